@@ -12,24 +12,37 @@ def get_includes():
 
 class Windows:
     """
-    An iterable list of sliding windows created from a :class:`libsequence.PolyTable`
+    A sequence of sliding windows created from a :class:`libsequence.PolyTable`.
+
+    Windows are created lazily: each is copied out of the table
+    as a :class:`libsequence.SimData` or :class:`libsequence.PolySites`
+    only when it is indexed or reached during iteration.
+    Use :attr:`ranges` to get the ranges of sites in each window,
+    and :func:`summary_statistics` to calculate statistics
+    of all windows without copying them.
+
+    .. versionchanged:: 0.2.4
+
+        Windows were previously all copied when the object was created.
     """
     def __init__(self, pt, window_size, step_len, starting_pos = 0.,  ending_pos = 1):
-        self.windows=[]
-        if isinstance(pt,_libsequence.SimData):
-            # from .windows_cpp import SimDataWindows
-            temp = SimDataWindows(pt,window_size,step_len,starting_pos,ending_pos)
-        else:
-            # from .windows_cpp import PolySitesWindows
-            temp = PolySitesWindows(pt,window_size,step_len,starting_pos,ending_pos)
-        for i in range(len(temp)):
-            self.windows.append(temp[i])
-        temp=None
+        self.windows = PolyTableWindows(pt, window_size, step_len,
+                                        starting_pos, ending_pos)
     def __iter__(self):
-        return iter(self.windows)
-    def __next__(self):
-        return next(self.windows)
+        for i in range(len(self.windows)):
+            yield self.windows[i]
     def __getitem__(self,i):
         return self.windows[i]
     def __len__(self):
         return len(self.windows)
+    @property
+    def ranges(self):
+        """
+        A list of :class:`libsequence.PolyTableWindow`, one per window.
+        """
+        return self.windows.ranges
+    def summary_statistics(self, stats=None, windows=None, nthreads=1):
+        """
+        See :func:`libsequence.PolyTableWindows.summary_statistics`.
+        """
+        return self.windows.summary_statistics(stats, windows, nthreads)
@@ -2,12 +2,11 @@
 from __future__ import print_function
 import argparse
 import libsequence
-import libsequence.polytable as pt
-import libsequence.summstats as sstats
 import libsequence.citations as citations
+import os
 import sqlite3
-import collections
-import pandas as pd
+import stat
+import sys
 
 
 def make_parser():
@@ -22,47 +21,111 @@ def make_parser():
 
     parser.add_argument("--garud", "-g", action='store_true',
                         help="Calculate H1, H12, etc.")
-    parser.add_argument("--outfile", "-o", type=str,
+    parser.add_argument("--outfile", "-o", type=str, required=True,
                         help="sqlite3 output file name")
+    parser.add_argument("--infile", "-i", type=str, default=None,
+                        help="Input file name.  Default is to read from standard input.")
+    parser.add_argument("--nthreads", "-t", type=int, default=1,
+                        help="Number of worker threads.  If 0, use all available cores.")
+    parser.add_argument("--batch-size", "-b", type=int, default=0,
+                        help="Number of replicates processed and written per transaction.  "
+                        "If 0, 16 per thread are used.")
     return parser
 
 
-ClassicStats = collections.namedtuple('ClassicStats', ['rep',
-                                                       'thetapi', 'thetaw', 'thetah', 'tajd', 'S', 'singletons', 'dsingletons'])
-GarudStatsT = collections.namedtuple(
-    'GarudStatsT', ['rep', 'H1', 'H12', 'H2H1'])
+def read_replicate_blocks(stream, chunk_size=1 << 24):
+    """
+    Read "ms"-format data from a binary stream in chunks of
+    chunk_size bytes, and yield blocks of bytes that each end
+    just before the start of a replicate, so that no replicate
+    is split between blocks.  The last block holds the rest of
+    the stream.
+    """
+    pending = bytearray()
+    while True:
+        chunk = stream.read(chunk_size)
+        if not chunk:
+            break
+        # Only the new data, and the two bytes before them, need to
+        # be searched for the start of a replicate.
+        search_from = max(len(pending) - 2, 0)
+        pending += chunk
+        end = pending.rfind(b"\n//", search_from)
+        if end != -1:
+            yield bytes(pending[:end + 1])
+            del pending[:end + 1]
+    if pending:
+        yield bytes(pending)
 
 
-def classic_stats(d,rep):
-    ad = sstats.PolySIM(d)
-    return ClassicStats(rep, ad.thetapi(),
-                        ad.thetaw(),
-                        ad.thetah(),
-                        ad.tajimasd(),
-                        ad.numpoly(),
-                        ad.numsingletons(),
-                        ad.numexternalmutations())
+def open_readers(args):
+    """
+    Yield MsFormatReader objects for the input.  Data on
+    standard input that are not a regular file, such as a
+    pipe from ms, are read in blocks so that they are never
+    held in memory or on disk as a whole.
+    """
+    if args.infile is not None:
+        yield libsequence.MsFormatReader(args.infile, args.nthreads,
+                                         args.batch_size)
+        return
+    fd = sys.stdin.fileno()
+    if stat.S_ISREG(os.fstat(fd).st_mode):
+        yield libsequence.MsFormatReader(fd, args.nthreads, args.batch_size)
+        return
+    stream = sys.stdin.buffer if hasattr(sys.stdin, 'buffer') else sys.stdin
+    for block in read_replicate_blocks(stream):
+        yield libsequence.MsFormatReader(block, args.nthreads,
+                                         args.batch_size)
+
+
+def iter_batches(readers, garud):
+    """
+    Yield the batches of statistics from each reader in turn.
+    """
+    for reader in readers:
+        while True:
+            batch = reader.next_statistics(garud)
+            if batch is None:
+                break
+            yield batch
+
+
+def write_statistics(readers, con, garud, verbose=False):
+    """
+    Write the statistics for all replicates of a sequence of
+    readers to the table "stats", committing once per batch of
+    replicates.  Replicates are numbered across all readers.
+    """
+    nrows = 0
+    insert = None
+    for batch in iter_batches(readers, garud):
+        batch['rep'] += nrows
+        if insert is None:
+            names = batch.dtype.names
+            con.execute("CREATE TABLE stats ({})".format(
+                ', '.join("{} {}".format(n, "INTEGER" if batch.dtype[n].kind == 'i' else "REAL")
+                          for n in names)))
+            insert = "INSERT INTO stats VALUES ({})".format(
+                ', '.join('?' * len(names)))
+        with con:
+            con.executemany(insert, batch.tolist())
+        nrows += len(batch)
+        if verbose is True:
+            print("{} replicates processed".format(nrows), file=sys.stderr)
+    return nrows
 
 
 def msstats_main(arg_list=None):
     parser = make_parser()
     args = parser.parse_args(arg_list)
 
-    d = pt.SimData()
-    classic_stats_list = []
-    garud_stats_list = []
-    rep = 0
-    while d.from_stdin() is True:
-        classic_stats_list.append(classic_stats(d,rep))
-        if args.garud is True:
-            gstats = sstats.garudStats(d)
-            garud_stats_list.append(GarudStatsT(
-                rep, gstats['H1'], gstats['H12'], gstats['H2H1']))
-        rep += 1
-    df = pd.DataFrame(classic_stats_list).set_index('rep')
-    if len(garud_stats_list) > 0:
-        gdf = pd.DataFrame(garud_stats_list).set_index('rep')
-        df = df.join(gdf)
+    readers = open_readers(args)
+    if args.verbose is True and args.infile is not None:
+        readers = list(readers)
+        print("{} replicates found".format(len(readers[0])), file=sys.stderr)
     con = sqlite3.connect(args.outfile)
-    df.to_sql('stats', con, index=False)
-    con.close()
+    try:
+        write_statistics(readers, con, args.garud, args.verbose)
+    finally:
+        con.close()
@@ -7,6 +7,9 @@ void init_fst(py::module & m);
 void init_VariantMatrix(py::module &);
 void init_summstats(py::module & );
 void init_windows(py::module & );
+void init_window_scan(py::module & );
+void init_PackedVariantMatrix(py::module & );
+void init_ms_reader(py::module & );
 
 PYBIND11_MODULE(_libsequence, m)
 {
@@ -15,4 +18,7 @@ PYBIND11_MODULE(_libsequence, m)
     init_VariantMatrix(m);
     init_summstats(m);
     init_windows(m);
+    init_window_scan(m);
+    init_PackedVariantMatrix(m);
+    init_ms_reader(m);
 }
@@ -0,0 +1,159 @@
+#ifndef PYLIBSEQ_ALLELE_COUNT_VIEWS_HPP
+#define PYLIBSEQ_ALLELE_COUNT_VIEWS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "summstats_kernels.hpp"
+
+// A view of a subset of the rows of an AlleleCountMatrix,
+// either a strided range of rows or an arbitrary list of
+// row indexes.  The view refers to the counts of the
+// matrix, which must outlive it.  Views of views refer to
+// the rows of the original matrix.
+class AlleleCountMatrixView
+{
+  private:
+    const std::int32_t *counts_;
+    std::ptrdiff_t start_, step_;
+    // Empty for strided views, including views of no rows
+    std::vector<std::size_t> indexes_;
+
+    std::size_t
+    matrix_row(const std::size_t i) const
+    {
+        if (is_strided())
+            {
+                return static_cast<std::size_t>(
+                    start_ + step_ * static_cast<std::ptrdiff_t>(i));
+            }
+        return indexes_[i];
+    }
+
+  public:
+    std::size_t ncol, nsam, nrow;
+
+    // Rows start, start + step, ... of the matrix
+    AlleleCountMatrixView(const std::int32_t *counts, const std::size_t ncol_,
+                          const std::size_t nsam_, const std::ptrdiff_t start,
+                          const std::ptrdiff_t step, const std::size_t nrow_)
+        : counts_(counts), start_(start), step_(step), indexes_(),
+          ncol(ncol_), nsam(nsam_), nrow(nrow_)
+    {
+    }
+
+    // Rows indexes[0], indexes[1], ... of the matrix
+    AlleleCountMatrixView(const std::int32_t *counts, const std::size_t ncol_,
+                          const std::size_t nsam_,
+                          std::vector<std::size_t> indexes)
+        : counts_(counts), start_(0), step_(1), indexes_(std::move(indexes)),
+          ncol(ncol_), nsam(nsam_), nrow(indexes_.size())
+    {
+    }
+
+    // Views are values: copies refer to the same rows.
+    AlleleCountMatrixView(const AlleleCountMatrixView &) = default;
+    AlleleCountMatrixView &operator=(const AlleleCountMatrixView &) = default;
+
+    bool
+    is_strided() const
+    {
+        return indexes_.empty();
+    }
+
+    const std::int32_t *
+    row(const std::size_t i) const
+    {
+        return counts_ + matrix_row(i) * ncol;
+    }
+
+    // Pointer to the first row and the distance
+    // between rows, for strided views.
+    std::pair<const std::int32_t *, std::ptrdiff_t>
+    strided_data() const
+    {
+        if (!is_strided())
+            {
+                throw std::logic_error("view is not strided");
+            }
+        return std::make_pair(counts_ + start_ * static_cast<std::ptrdiff_t>(ncol),
+                              step_ * static_cast<std::ptrdiff_t>(ncol));
+    }
+
+    // Rows start, start + step, ... of this view
+    AlleleCountMatrixView
+    subset(const std::ptrdiff_t start, const std::ptrdiff_t step,
+           const std::size_t n) const
+    {
+        if (is_strided())
+            {
+                return AlleleCountMatrixView(counts_, ncol, nsam,
+                                             start_ + step_ * start,
+                                             step_ * step, n);
+            }
+        std::vector<std::size_t> rows(n);
+        for (std::size_t i = 0; i < n; ++i)
+            {
+                rows[i] = indexes_[static_cast<std::size_t>(
+                    start + step * static_cast<std::ptrdiff_t>(i))];
+            }
+        return AlleleCountMatrixView(counts_, ncol, nsam, std::move(rows));
+    }
+
+    // Rows indexes[0], indexes[1], ... of this view
+    AlleleCountMatrixView
+    subset(const std::vector<std::size_t> &indexes) const
+    {
+        std::vector<std::size_t> rows(indexes.size());
+        for (std::size_t i = 0; i < indexes.size(); ++i)
+            {
+                if (indexes[i] >= nrow)
+                    {
+                        throw std::out_of_range("row index out of range");
+                    }
+                rows[i] = matrix_row(indexes[i]);
+            }
+        return AlleleCountMatrixView(counts_, ncol, nsam, std::move(rows));
+    }
+
+    // The counts of the rows, in order
+    std::vector<std::int32_t>
+    copy_counts() const
+    {
+        std::vector<std::int32_t> rv;
+        rv.reserve(nrow * ncol);
+        for (std::size_t i = 0; i < nrow; ++i)
+            {
+                rv.insert(rv.end(), row(i), row(i) + ncol);
+            }
+        return rv;
+    }
+};
+
+// As accumulate_sites, for the rows of a view.  Ancestral
+// states are indexed by row of the view.
+inline SiteSums
+accumulate_view(const AlleleCountMatrixView &v, const std::int8_t *refstates,
+                const std::size_t nrefstates, const HarmonicSums &h)
+{
+    SiteSums sums;
+    for (std::size_t i = 0; i < v.nrow; ++i)
+        {
+            accumulate_site(v.row(i), v.ncol,
+                            refstate_at(refstates, nrefstates, i), h, sums);
+        }
+    return sums;
+}
+
+inline double
+view_statistic(const AlleleCountMatrixView &v, const SummaryStatistic s,
+               const std::int8_t *refstates, const std::size_t nrefstates)
+{
+    const auto h = shared_harmonic_sums(v.nsam);
+    return summary_statistic_value(
+        s, accumulate_view(v, refstates, nrefstates, *h));
+}
+
+#endif
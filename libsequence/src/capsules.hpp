@@ -0,0 +1,925 @@
+#ifndef PYLIBSEQ_CAPSULES_HPP
+#define PYLIBSEQ_CAPSULES_HPP
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <Sequence/VariantMatrix.hpp>
+#include "mapped_file.hpp"
+
+// GenotypeCapsule and PositionCapsule implementations
+// shared by the various parts of the Python extension.
+
+namespace py = pybind11;
+
+// Capsules that own their data.  They never
+// touch the Python C API, so copies of a VariantMatrix
+// may be made with the GIL released.
+class OwnedGenotypeCapsule : public Sequence::GenotypeCapsule
+{
+  private:
+    std::vector<std::int8_t> buffer;
+    std::size_t nsites_, nsam_;
+
+  public:
+    OwnedGenotypeCapsule(const std::int8_t *input, std::size_t nsites,
+                         std::size_t nsam)
+        : buffer(input, input + nsites * nsam), nsites_(nsites), nsam_(nsam)
+    {
+    }
+
+    OwnedGenotypeCapsule(std::vector<std::int8_t> input, std::size_t nsites,
+                         std::size_t nsam)
+        : buffer(std::move(input)), nsites_(nsites), nsam_(nsam)
+    {
+        if (buffer.size() != nsites_ * nsam_)
+            {
+                throw std::invalid_argument("incorrect genotype buffer size");
+            }
+    }
+
+    std::size_t &
+    nsites()
+    {
+        return nsites_;
+    }
+
+    std::size_t &
+    nsam()
+    {
+        return nsam_;
+    }
+
+    std::size_t
+    nsites() const
+    {
+        return nsites_;
+    }
+
+    std::size_t
+    nsam() const
+    {
+        return nsam_;
+    }
+
+    std::int8_t &operator[](std::size_t i) { return buffer[i]; }
+
+    const std::int8_t &operator[](std::size_t i) const { return buffer[i]; }
+
+    std::int8_t *
+    data() final
+    {
+        return buffer.data();
+    }
+
+    const std::int8_t *
+    data() const final
+    {
+        return buffer.data();
+    }
+
+    const std::int8_t *
+    cdata() const final
+    {
+        return buffer.data();
+    }
+
+    std::unique_ptr<GenotypeCapsule>
+    clone() const final
+    {
+        return std::unique_ptr<GenotypeCapsule>(
+            new OwnedGenotypeCapsule(*this));
+    }
+
+    std::int8_t *
+    begin() final
+    {
+        return buffer.data();
+    }
+
+    const std::int8_t *
+    begin() const final
+    {
+        return buffer.data();
+    }
+
+    std::int8_t *
+    end() final
+    {
+        return buffer.data() + buffer.size();
+    }
+
+    const std::int8_t *
+    end() const final
+    {
+        return buffer.data() + buffer.size();
+    }
+
+    const std::int8_t *
+    cbegin() const final
+    {
+        return begin();
+    }
+
+    const std::int8_t *
+    cend() const final
+    {
+        return end();
+    }
+
+    bool
+    empty() const final
+    {
+        return !nsites();
+    }
+
+    std::size_t
+    size() const final
+    {
+        return buffer.size();
+    }
+
+    std::size_t
+    row_offset() const
+    {
+        return 0;
+    }
+
+    std::size_t
+    col_offset() const
+    {
+        return 0;
+    }
+
+    std::size_t
+    stride() const
+    {
+        return nsam();
+    }
+
+    std::int8_t &
+    operator()(std::size_t site, std::size_t sample) final
+    {
+        return buffer[nsam() * site + sample];
+    }
+
+    const std::int8_t &
+    operator()(std::size_t site, std::size_t sample) const final
+    {
+        return buffer[nsam() * site + sample];
+    }
+
+    bool
+    resizable() const final
+    {
+        return false;
+    }
+};
+
+class OwnedPositionCapsule : public Sequence::PositionCapsule
+{
+  private:
+    std::vector<double> buffer;
+
+  public:
+    OwnedPositionCapsule(const double *input, std::size_t nsites)
+        : buffer(input, input + nsites)
+    {
+    }
+
+    explicit OwnedPositionCapsule(std::vector<double> input)
+        : buffer(std::move(input))
+    {
+    }
+
+    double &operator[](std::size_t i) { return buffer[i]; }
+
+    const double &operator[](std::size_t i) const { return buffer[i]; }
+
+    double *
+    data() final
+    {
+        return buffer.data();
+    }
+
+    const double *
+    data() const final
+    {
+        return buffer.data();
+    }
+
+    const double *
+    cdata() const final
+    {
+        return buffer.data();
+    }
+
+    std::unique_ptr<PositionCapsule>
+    clone() const final
+    {
+        return std::unique_ptr<PositionCapsule>(
+            new OwnedPositionCapsule(*this));
+    }
+
+    double *
+    begin() final
+    {
+        return buffer.data();
+    }
+
+    const double *
+    begin() const final
+    {
+        return buffer.data();
+    }
+
+    const double *
+    cbegin() const final
+    {
+        return buffer.data();
+    }
+
+    double *
+    end() final
+    {
+        return buffer.data() + buffer.size();
+    }
+
+    const double *
+    end() const final
+    {
+        return buffer.data() + buffer.size();
+    }
+
+    const double *
+    cend() const final
+    {
+        return buffer.data() + buffer.size();
+    }
+
+    bool
+    empty() const final
+    {
+        return buffer.empty();
+    }
+
+    std::size_t
+    size() const final
+    {
+        return buffer.size();
+    }
+
+    std::size_t
+    nsites() const
+    {
+        return buffer.size();
+    }
+
+    bool
+    resizable() const final
+    {
+        return false;
+    }
+};
+
+class NumpyGenotypeCapsule : public Sequence::GenotypeCapsule
+{
+  private:
+    py::array_t<std::int8_t> buffer;
+    std::size_t nsites_, nsam_;
+
+  public:
+    explicit NumpyGenotypeCapsule(
+        py::array_t<std::int8_t, py::array::c_style | py::array::forcecast>
+            input)
+        : buffer(std::move(input)), nsites_(buffer.shape(0)),
+          nsam_(buffer.shape(1))
+    {
+    }
+
+    std::size_t &
+    nsites()
+    {
+        return nsites_;
+    }
+
+    std::size_t &
+    nsam()
+    {
+        return nsam_;
+    }
+
+    std::size_t
+    nsites() const
+    {
+        return nsites_;
+    }
+
+    std::size_t
+    nsam() const
+    {
+        return nsam_;
+    }
+
+    std::int8_t &operator[](std::size_t i) { return buffer.mutable_data()[i]; }
+
+    const std::int8_t &operator[](std::size_t i) const
+    {
+        return buffer.data()[i];
+    }
+
+    std::int8_t *
+    data() final
+    {
+        return buffer.mutable_data();
+    }
+
+    const std::int8_t *
+    data() const final
+    {
+        return buffer.data();
+    }
+
+    const std::int8_t *
+    cdata() const final
+    {
+        return buffer.data();
+    }
+
+    // Deep copy into owned storage.  Copying the
+    // py::array handle would touch its reference count,
+    // which is not safe once the GIL has been released.
+    std::unique_ptr<GenotypeCapsule>
+    clone() const final
+    {
+        return std::unique_ptr<GenotypeCapsule>(new OwnedGenotypeCapsule(
+            buffer.data(), nsites_, nsam_));
+    }
+
+    std::int8_t *
+    begin() final
+    {
+        return buffer.mutable_data();
+    }
+
+    const std::int8_t *
+    begin() const final
+    {
+        return buffer.data();
+    }
+
+    std::int8_t *
+    end() final
+    {
+        return buffer.mutable_data() + buffer.size();
+    }
+
+    const std::int8_t *
+    end() const final
+    {
+        return buffer.data() + buffer.size();
+    }
+
+    const std::int8_t *
+    cbegin() const final
+    {
+        return begin();
+    }
+
+    const std::int8_t *
+    cend() const final
+    {
+        return end();
+    }
+
+    bool
+    empty() const final
+    {
+        return !nsites();
+    }
+
+    std::size_t
+    size() const final
+    {
+        return buffer.size();
+    }
+
+    std::size_t
+    row_offset() const
+    {
+        return 0;
+    }
+
+    std::size_t
+    col_offset() const
+    {
+        return 0;
+    }
+
+    std::size_t
+    stride() const
+    {
+        return nsam();
+    }
+
+    std::int8_t &
+    operator()(std::size_t site, std::size_t sample) final
+    {
+        return buffer.mutable_data()[nsam() * site + sample];
+    }
+
+    const std::int8_t &
+    operator()(std::size_t site, std::size_t sample) const final
+    {
+        return buffer.data()[nsam() * site + sample];
+    }
+
+    bool
+    resizable() const final
+    {
+        return false;
+    }
+};
+
+class NumpyPositionCapsule : public Sequence::PositionCapsule
+{
+  private:
+    py::array_t<double> buffer;
+
+  public:
+    explicit NumpyPositionCapsule(py::array_t<double> input)
+        : buffer(std::move(input))
+    {
+        if (buffer.ndim() != 1)
+            {
+                throw std::invalid_argument(
+                    "positions must be a one-dimensional array");
+            }
+    }
+
+    double &operator[](std::size_t i) { return buffer.mutable_data()[i]; }
+
+    const double &operator[](std::size_t i) const { return buffer.data()[i]; }
+
+    double *
+    data() final
+    {
+        return buffer.mutable_data();
+    }
+
+    const double *
+    data() const final
+    {
+        return buffer.data();
+    }
+
+    const double *
+    cdata() const final
+    {
+        return buffer.data();
+    }
+
+    // See NumpyGenotypeCapsule::clone
+    std::unique_ptr<PositionCapsule>
+    clone() const final
+    {
+        return std::unique_ptr<PositionCapsule>(
+            new OwnedPositionCapsule(buffer.data(), buffer.size()));
+    }
+
+    double *
+    begin() final
+    {
+        return buffer.mutable_data();
+    }
+
+    const double *
+    begin() const final
+    {
+        return buffer.data();
+    }
+
+    const double *
+    cbegin() const final
+    {
+        return buffer.data();
+    }
+
+    double *
+    end() final
+    {
+        return buffer.mutable_data() + buffer.size();
+    }
+
+    const double *
+    end() const final
+    {
+        return buffer.data() + buffer.size();
+    }
+
+    const double *
+    cend() const final
+    {
+        return buffer.data() + buffer.size();
+    }
+
+    bool
+    empty() const final
+    {
+        return buffer.size() == 0;
+    }
+
+    std::size_t
+    size() const final
+    {
+        return buffer.size();
+    }
+
+    std::size_t
+    nsites() const
+    {
+        return buffer.size();
+    }
+
+    bool
+    resizable() const final
+    {
+        return false;
+    }
+};
+
+// Capsules whose data are part of a read-only memory-mapped
+// file, which is shared by the genotype and position capsules
+// of a VariantMatrix.  Pages are read on demand.  Mutable
+// access first copies the data into memory owned by the
+// capsule, so that the file is never modified, and read-only
+// use never commits memory for the whole file.
+class MappedGenotypeCapsule : public Sequence::GenotypeCapsule
+{
+  private:
+    std::shared_ptr<const MappedFile> file;
+    const std::int8_t *mapped;
+    std::vector<std::int8_t> owned;
+    bool is_copy;
+    std::size_t nsites_, nsam_;
+
+    const std::int8_t *
+    buffer() const
+    {
+        return is_copy ? owned.data() : mapped;
+    }
+
+    std::int8_t *
+    writable()
+    {
+        if (!is_copy)
+            {
+                owned.assign(mapped, mapped + size());
+                is_copy = true;
+            }
+        return owned.data();
+    }
+
+  public:
+    MappedGenotypeCapsule(std::shared_ptr<const MappedFile> file_,
+                          const std::size_t offset, std::size_t nsites,
+                          std::size_t nsam)
+        : file(std::move(file_)),
+          mapped(reinterpret_cast<const std::int8_t *>(file->data() + offset)),
+          owned(), is_copy(false), nsites_(nsites), nsam_(nsam)
+    {
+    }
+
+    std::size_t &
+    nsites()
+    {
+        return nsites_;
+    }
+
+    std::size_t &
+    nsam()
+    {
+        return nsam_;
+    }
+
+    std::size_t
+    nsites() const
+    {
+        return nsites_;
+    }
+
+    std::size_t
+    nsam() const
+    {
+        return nsam_;
+    }
+
+    std::int8_t &operator[](std::size_t i) { return writable()[i]; }
+
+    const std::int8_t &operator[](std::size_t i) const { return buffer()[i]; }
+
+    std::int8_t *
+    data() final
+    {
+        return writable();
+    }
+
+    const std::int8_t *
+    data() const final
+    {
+        return buffer();
+    }
+
+    const std::int8_t *
+    cdata() const final
+    {
+        return buffer();
+    }
+
+    // Copies own their data, as for NumpyGenotypeCapsule,
+    // so that changes to a copy are not seen by the original.
+    std::unique_ptr<GenotypeCapsule>
+    clone() const final
+    {
+        return std::unique_ptr<GenotypeCapsule>(
+            new OwnedGenotypeCapsule(buffer(), nsites_, nsam_));
+    }
+
+    std::int8_t *
+    begin() final
+    {
+        return writable();
+    }
+
+    const std::int8_t *
+    begin() const final
+    {
+        return buffer();
+    }
+
+    std::int8_t *
+    end() final
+    {
+        return writable() + size();
+    }
+
+    const std::int8_t *
+    end() const final
+    {
+        return buffer() + size();
+    }
+
+    const std::int8_t *
+    cbegin() const final
+    {
+        return begin();
+    }
+
+    const std::int8_t *
+    cend() const final
+    {
+        return end();
+    }
+
+    bool
+    empty() const final
+    {
+        return !nsites();
+    }
+
+    std::size_t
+    size() const final
+    {
+        return nsites_ * nsam_;
+    }
+
+    std::size_t
+    row_offset() const
+    {
+        return 0;
+    }
+
+    std::size_t
+    col_offset() const
+    {
+        return 0;
+    }
+
+    std::size_t
+    stride() const
+    {
+        return nsam();
+    }
+
+    std::int8_t &
+    operator()(std::size_t site, std::size_t sample) final
+    {
+        return writable()[nsam() * site + sample];
+    }
+
+    const std::int8_t &
+    operator()(std::size_t site, std::size_t sample) const final
+    {
+        return buffer()[nsam() * site + sample];
+    }
+
+    bool
+    resizable() const final
+    {
+        return false;
+    }
+};
+
+class MappedPositionCapsule : public Sequence::PositionCapsule
+{
+  private:
+    std::shared_ptr<const MappedFile> file;
+    const double *mapped;
+    std::vector<double> owned;
+    bool is_copy;
+    std::size_t nsites_;
+
+    const double *
+    buffer() const
+    {
+        return is_copy ? owned.data() : mapped;
+    }
+
+    double *
+    writable()
+    {
+        if (!is_copy)
+            {
+                owned.assign(mapped, mapped + nsites_);
+                is_copy = true;
+            }
+        return owned.data();
+    }
+
+  public:
+    MappedPositionCapsule(std::shared_ptr<const MappedFile> file_,
+                          const std::size_t offset, std::size_t nsites)
+        : file(std::move(file_)),
+          mapped(reinterpret_cast<const double *>(file->data() + offset)),
+          owned(), is_copy(false), nsites_(nsites)
+    {
+    }
+
+    double &operator[](std::size_t i) { return writable()[i]; }
+
+    const double &operator[](std::size_t i) const { return buffer()[i]; }
+
+    double *
+    data() final
+    {
+        return writable();
+    }
+
+    const double *
+    data() const final
+    {
+        return buffer();
+    }
+
+    const double *
+    cdata() const final
+    {
+        return buffer();
+    }
+
+    // See MappedGenotypeCapsule::clone
+    std::unique_ptr<PositionCapsule>
+    clone() const final
+    {
+        return std::unique_ptr<PositionCapsule>(
+            new OwnedPositionCapsule(buffer(), nsites_));
+    }
+
+    double *
+    begin() final
+    {
+        return writable();
+    }
+
+    const double *
+    begin() const final
+    {
+        return buffer();
+    }
+
+    const double *
+    cbegin() const final
+    {
+        return buffer();
+    }
+
+    double *
+    end() final
+    {
+        return writable() + nsites_;
+    }
+
+    const double *
+    end() const final
+    {
+        return buffer() + nsites_;
+    }
+
+    const double *
+    cend() const final
+    {
+        return buffer() + nsites_;
+    }
+
+    bool
+    empty() const final
+    {
+        return nsites_ == 0;
+    }
+
+    std::size_t
+    size() const final
+    {
+        return nsites_;
+    }
+
+    std::size_t
+    nsites() const
+    {
+        return nsites_;
+    }
+
+    bool
+    resizable() const final
+    {
+        return false;
+    }
+};
+
+// Files mapped by map_shared_file.  A matrix whose data lie
+// in one of these files may share them, because the data of
+// a mapping never change.
+namespace mapped_detail
+{
+    inline std::mutex &
+    shared_files_mutex()
+    {
+        static std::mutex rv;
+        return rv;
+    }
+
+    inline std::vector<std::weak_ptr<const MappedFile>> &
+    shared_files()
+    {
+        static std::vector<std::weak_ptr<const MappedFile>> rv;
+        return rv;
+    }
+} // namespace mapped_detail
+
+inline std::shared_ptr<const MappedFile>
+map_shared_file(const std::string &path)
+{
+    std::shared_ptr<const MappedFile> rv(
+        new MappedFile(path, MappedFile::Mode::random));
+    std::lock_guard<std::mutex> guard(mapped_detail::shared_files_mutex());
+    auto &files = mapped_detail::shared_files();
+    std::vector<std::weak_ptr<const MappedFile>> live;
+    for (auto &w : files)
+        {
+            if (!w.expired())
+                {
+                    live.push_back(std::move(w));
+                }
+        }
+    live.emplace_back(rv);
+    files.swap(live);
+    return rv;
+}
+
+// The file mapped by map_shared_file that contains the
+// size bytes starting at data, or nullptr.
+inline std::shared_ptr<const MappedFile>
+shared_file_containing(const void *data, const std::size_t size)
+{
+    const std::less<const char *> before;
+    const char *first = static_cast<const char *>(data);
+    std::lock_guard<std::mutex> guard(mapped_detail::shared_files_mutex());
+    for (auto &w : mapped_detail::shared_files())
+        {
+            auto file = w.lock();
+            if (file && file->size() >= size && !before(first, file->data())
+                && !before(file->data() + (file->size() - size), first))
+                {
+                    return file;
+                }
+        }
+    return nullptr;
+}
+
+#endif
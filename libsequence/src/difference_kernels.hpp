@@ -0,0 +1,205 @@
+#ifndef PYLIBSEQ_DIFFERENCE_KERNELS_HPP
+#define PYLIBSEQ_DIFFERENCE_KERNELS_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "packed_genotypes.hpp"
+#include "parallel.hpp"
+
+// Pairwise differences between samples, stored as the
+// condensed upper triangle of the distance matrix: pairs
+// (0, 1), (0, 2), ..., (0, n - 1), (1, 2), ..., which is the
+// layout of scipy.spatial.distance.pdist.  Sites where either
+// sample has missing data (negative states) do not count.
+//
+// The pairs are split into square tiles of samples, and the
+// tiles are processed in parallel.  When any_difference is
+// true, outputs are 0 or 1, and the comparison of a pair stops
+// at the first difference.
+
+inline std::size_t
+condensed_size(const std::size_t nsam)
+{
+    return nsam < 2 ? 0 : nsam * (nsam - 1) / 2;
+}
+
+// Requires i < j
+inline std::size_t
+condensed_index(const std::size_t nsam, const std::size_t i,
+                const std::size_t j)
+{
+    return nsam * i - i * (i + 1) / 2 + (j - i - 1);
+}
+
+struct SampleTile
+{
+    std::size_t ibegin, iend, jbegin, jend;
+};
+
+inline std::vector<SampleTile>
+upper_triangle_tiles(const std::size_t nsam, const std::size_t tile_size)
+{
+    std::vector<SampleTile> tiles;
+    for (std::size_t i = 0; i < nsam; i += tile_size)
+        {
+            for (std::size_t j = i; j < nsam; j += tile_size)
+                {
+                    tiles.push_back(SampleTile{
+                        i, std::min(nsam, i + tile_size), j,
+                        std::min(nsam, j + tile_size) });
+                }
+        }
+    return tiles;
+}
+
+// Apply f(i, j) to all pairs i < j in the tile
+template <typename F>
+inline void
+for_each_pair(const SampleTile &t, const F &f)
+{
+    for (std::size_t i = t.ibegin; i < t.iend; ++i)
+        {
+            for (std::size_t j = std::max(t.jbegin, i + 1); j < t.jend; ++j)
+                {
+                    f(i, j);
+                }
+        }
+}
+
+// Samples as rows of bits over sites.  Rows of two tiles
+// of 64 samples fit in L1 cache for up to ~16k sites.
+template <typename T>
+inline void
+packed_pairwise_differences(const PackedSamples &h, const bool any_difference,
+                            const unsigned nthreads, T *output)
+{
+    const auto tiles = upper_triangle_tiles(h.nsam, 64);
+    parallel_for(
+        tiles.size(), nthreads, 1,
+        [&](const std::size_t begin, const std::size_t end) {
+            for (std::size_t t = begin; t < end; ++t)
+                {
+                    for_each_pair(tiles[t], [&](const std::size_t i,
+                                                const std::size_t j) {
+                        const std::uint64_t *a = h.sample(i),
+                                            *b = h.sample(j);
+                        const std::uint64_t *ma = h.missing(i),
+                                            *mb = h.missing(j);
+                        std::int64_t n = 0;
+                        for (std::size_t w = 0; w < h.nwords; ++w)
+                            {
+                                std::uint64_t x = a[w] ^ b[w];
+                                if (ma)
+                                    {
+                                        x &= ~(ma[w] | mb[w]);
+                                    }
+                                if (any_difference && x)
+                                    {
+                                        n = 1;
+                                        break;
+                                    }
+                                n += popcount64(x);
+                            }
+                        output[condensed_index(h.nsam, i, j)]
+                            = static_cast<T>(n);
+                    });
+                }
+        });
+}
+
+// General int8 states.  Sites are processed in chunks
+// that are transposed so that each sample is a contiguous
+// run of states, and pairs within a tile are compared over
+// blocks of sites small enough to stay in L1 cache.
+template <typename T>
+inline void
+genotype_pairwise_differences(const std::int8_t *data,
+                              const std::size_t nsites,
+                              const std::size_t nsam,
+                              const bool any_difference,
+                              const unsigned nthreads, T *output)
+{
+    const std::size_t site_chunk = 4096, site_block = 256, tile_size = 64;
+    const auto tiles = upper_triangle_tiles(nsam, tile_size);
+    std::fill(output, output + condensed_size(nsam), T(0));
+    std::vector<std::int8_t> buffer(nsam * std::min(site_chunk, nsites));
+    for (std::size_t s0 = 0; s0 < nsites; s0 += site_chunk)
+        {
+            const std::size_t ls = std::min(site_chunk, nsites - s0);
+            parallel_for(nsam, nthreads, default_grain_size(nsam, nthreads, 64),
+                         [&](const std::size_t begin, const std::size_t end) {
+                             for (std::size_t s = 0; s < ls; ++s)
+                                 {
+                                     const std::int8_t *row
+                                         = data + (s0 + s) * nsam;
+                                     for (std::size_t j = begin; j < end; ++j)
+                                         {
+                                             buffer[j * ls + s] = row[j];
+                                         }
+                                 }
+                         });
+            auto compare_block = [&](const std::size_t i,
+                                     const std::size_t j,
+                                     const std::size_t k0,
+                                     const std::size_t k1) {
+                T &o = output[condensed_index(nsam, i, j)];
+                if (any_difference && o)
+                    {
+                        return;
+                    }
+                const std::int8_t *a = buffer.data() + i * ls;
+                const std::int8_t *b = buffer.data() + j * ls;
+                std::int32_t n = 0;
+                // a | b is negative if either state is missing.
+                for (std::size_t k = k0; k < k1; ++k)
+                    {
+                        n += (a[k] != b[k]) & ((a[k] | b[k]) >= 0);
+                    }
+                o = any_difference ? static_cast<T>(n > 0)
+                                   : static_cast<T>(o + n);
+            };
+            parallel_for(
+                tiles.size(), nthreads, 1,
+                [&](const std::size_t begin, const std::size_t end) {
+                    for (std::size_t t = begin; t < end; ++t)
+                        {
+                            for (std::size_t k0 = 0; k0 < ls;
+                                 k0 += site_block)
+                                {
+                                    const std::size_t k1
+                                        = std::min(ls, k0 + site_block);
+                                    for_each_pair(
+                                        tiles[t], [&](const std::size_t i,
+                                                      const std::size_t j) {
+                                            compare_block(i, j, k0, k1);
+                                        });
+                                }
+                        }
+                });
+        }
+}
+
+// Use the bit-packed kernel when all states are 0, 1, or
+// missing, and the general kernel otherwise.
+template <typename T>
+inline void
+pairwise_differences(const std::int8_t *data, const std::size_t nsites,
+                     const std::size_t nsam, const bool any_difference,
+                     const unsigned nthreads, T *output)
+{
+    PackedSites g(nsites, nsam);
+    if (pack_binary_genotypes(data, g))
+        {
+            packed_pairwise_differences(PackedSamples(g), any_difference,
+                                        nthreads, output);
+        }
+    else
+        {
+            genotype_pairwise_differences(data, nsites, nsam, any_difference,
+                                          nthreads, output);
+        }
+}
+
+#endif
@@ -0,0 +1,305 @@
+#ifndef PYLIBSEQ_DIVERGENCE_KERNELS_HPP
+#define PYLIBSEQ_DIVERGENCE_KERNELS_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include "genomic_windows.hpp"
+#include "parallel.hpp"
+
+// Diversity within, and divergence between, all pairs of
+// npop populations.  For each site, the counts of each
+// state in each population are held in an npop x ncol
+// matrix.  Sums over a set of sites are stored in a flat
+// array of divergence_nvalues(npop) doubles: the fields of
+// DivergencePopulationField for each population, followed
+// by the fields of DivergencePairField for each pair i < j,
+// in row-major order of pairs.
+
+enum DivergencePopulationField
+{
+    // Mean number of differences between samples
+    population_pi,
+    // Number of polymorphic sites
+    population_polymorphic,
+    npopulation_fields
+};
+
+enum DivergencePairField
+{
+    // Mean number of differences between populations
+    pair_dxy,
+    // Within- and between-population diversity at the
+    // sites where both populations have two or more samples,
+    // used for Hudson's Fst
+    pair_fst_within,
+    pair_fst_between,
+    // Polymorphic in both populations
+    pair_shared,
+    // Monomorphic in both populations, for different states
+    pair_fixed,
+    // Polymorphic in one population and monomorphic
+    // in the other
+    pair_private_first,
+    pair_private_second,
+    npair_fields
+};
+
+inline std::size_t
+divergence_npairs(const std::size_t npop)
+{
+    return npop < 2 ? 0 : npop * (npop - 1) / 2;
+}
+
+inline std::size_t
+divergence_nvalues(const std::size_t npop)
+{
+    return npopulation_fields * npop + npair_fields * divergence_npairs(npop);
+}
+
+// The counts of a site, and values per population
+// derived from them.
+struct DivergenceScratch
+{
+    std::vector<std::int32_t> counts, n, nstates, state;
+    std::vector<double> pi;
+
+    DivergenceScratch(const std::size_t npop, const std::size_t ncol)
+        : counts(npop * ncol), n(npop), nstates(npop), state(npop), pi(npop)
+    {
+    }
+};
+
+// Add the contribution of the site whose counts are in
+// s.counts to sums.
+inline void
+accumulate_divergence_site(const std::size_t npop, const std::size_t ncol,
+                           DivergenceScratch &s, double *sums)
+{
+    for (std::size_t i = 0; i < npop; ++i)
+        {
+            const std::int32_t *c = s.counts.data() + i * ncol;
+            std::int64_t n = 0, sumsq = 0;
+            std::int32_t nstates = 0, state = -1;
+            for (std::size_t k = 0; k < ncol; ++k)
+                {
+                    n += c[k];
+                    sumsq += static_cast<std::int64_t>(c[k]) * c[k];
+                    if (c[k] > 0)
+                        {
+                            ++nstates;
+                            state = static_cast<std::int32_t>(k);
+                        }
+                }
+            s.n[i] = static_cast<std::int32_t>(n);
+            s.nstates[i] = nstates;
+            s.state[i] = state;
+            s.pi[i] = n > 1 ? static_cast<double>(n * n - sumsq)
+                                  / static_cast<double>(n * (n - 1))
+                            : 0.;
+            sums[i * npopulation_fields + population_pi] += s.pi[i];
+            sums[i * npopulation_fields + population_polymorphic]
+                += nstates > 1;
+        }
+    double *pair = sums + npopulation_fields * npop;
+    for (std::size_t i = 0; i < npop; ++i)
+        {
+            const std::int32_t *ci = s.counts.data() + i * ncol;
+            for (std::size_t j = i + 1; j < npop; ++j, pair += npair_fields)
+                {
+                    if (s.n[i] > 0 && s.n[j] > 0)
+                        {
+                            const std::int32_t *cj = s.counts.data() + j * ncol;
+                            std::int64_t same = 0;
+                            for (std::size_t k = 0; k < ncol; ++k)
+                                {
+                                    same += static_cast<std::int64_t>(ci[k])
+                                            * cj[k];
+                                }
+                            const double dxy
+                                = 1.
+                                  - static_cast<double>(same)
+                                        / (static_cast<double>(s.n[i])
+                                           * static_cast<double>(s.n[j]));
+                            pair[pair_dxy] += dxy;
+                            if (s.n[i] > 1 && s.n[j] > 1)
+                                {
+                                    pair[pair_fst_within]
+                                        += (s.pi[i] + s.pi[j]) / 2.;
+                                    pair[pair_fst_between] += dxy;
+                                }
+                        }
+                    const bool poly_i = s.nstates[i] > 1,
+                               poly_j = s.nstates[j] > 1;
+                    const bool mono_i = s.nstates[i] == 1,
+                               mono_j = s.nstates[j] == 1;
+                    pair[pair_shared] += poly_i && poly_j;
+                    pair[pair_fixed]
+                        += mono_i && mono_j && s.state[i] != s.state[j];
+                    pair[pair_private_first] += poly_i && mono_j;
+                    pair[pair_private_second] += mono_i && poly_j;
+                }
+        }
+}
+
+// Sums over the sites [boundaries[k], boundaries[k + 1]),
+// for each k, as a row-major matrix with one row per
+// range.  fill_counts(site, counts) sets the npop x ncol
+// counts of a site, which are zero on entry.
+template <typename F>
+inline std::vector<double>
+divergence_range_sums(const std::vector<std::size_t> &boundaries,
+                      const std::size_t npop, const std::size_t ncol,
+                      const F &fill_counts, const unsigned nthreads)
+{
+    const std::size_t nranges = boundaries.empty() ? 0 : boundaries.size() - 1;
+    const std::size_t nvalues = divergence_nvalues(npop);
+    std::vector<double> sums(nranges * nvalues, 0.);
+    parallel_for(
+        nranges, nthreads, default_grain_size(nranges, nthreads, 1),
+        [&](const std::size_t begin, const std::size_t end) {
+            DivergenceScratch scratch(npop, ncol);
+            for (std::size_t r = begin; r < end; ++r)
+                {
+                    for (std::size_t site = boundaries[r];
+                         site < boundaries[r + 1]; ++site)
+                        {
+                            std::fill(scratch.counts.begin(),
+                                      scratch.counts.end(), 0);
+                            fill_counts(site, scratch.counts.data());
+                            accumulate_divergence_site(
+                                npop, ncol, scratch, sums.data() + r * nvalues);
+                        }
+                }
+        });
+    return sums;
+}
+
+// Sums over all nsites sites.  Blocks of sites are
+// processed in parallel.
+template <typename F>
+inline std::vector<double>
+divergence_sums(const std::size_t nsites, const std::size_t npop,
+                const std::size_t ncol, const F &fill_counts,
+                const unsigned nthreads)
+{
+    const std::size_t grain = default_grain_size(nsites, nthreads, 256);
+    std::vector<std::size_t> boundaries;
+    for (std::size_t b = 0; b < nsites; b += grain)
+        {
+            boundaries.push_back(b);
+        }
+    boundaries.push_back(nsites);
+    const auto blocks
+        = divergence_range_sums(boundaries, npop, ncol, fill_counts, nthreads);
+    const std::size_t nvalues = divergence_nvalues(npop);
+    std::vector<double> sums(nvalues, 0.);
+    for (std::size_t b = 0; b + 1 < boundaries.size(); ++b)
+        {
+            for (std::size_t v = 0; v < nvalues; ++v)
+                {
+                    sums[v] += blocks[b * nvalues + v];
+                }
+        }
+    return sums;
+}
+
+// Sums for each window, as a row-major matrix with one row
+// per window.  The site ranges of the windows are split at
+// every window edge, so that overlapping windows share
+// the sums of the ranges they have in common, and each
+// site is processed once.
+template <typename F>
+inline std::vector<double>
+windowed_divergence_sums(const std::vector<GenomicWindow> &windows,
+                         const std::size_t nsites, const std::size_t npop,
+                         const std::size_t ncol, const F &fill_counts,
+                         const unsigned nthreads)
+{
+    std::vector<std::size_t> boundaries{ 0, nsites };
+    for (const auto &w : windows)
+        {
+            boundaries.push_back(w.first);
+            boundaries.push_back(w.last);
+        }
+    std::sort(boundaries.begin(), boundaries.end());
+    boundaries.erase(std::unique(boundaries.begin(), boundaries.end()),
+                     boundaries.end());
+    const auto ranges
+        = divergence_range_sums(boundaries, npop, ncol, fill_counts, nthreads);
+    const std::size_t nvalues = divergence_nvalues(npop);
+    std::vector<double> sums(windows.size() * nvalues, 0.);
+    parallel_for(
+        windows.size(), nthreads,
+        default_grain_size(windows.size(), nthreads, 16),
+        [&](const std::size_t begin, const std::size_t end) {
+            for (std::size_t w = begin; w < end; ++w)
+                {
+                    double *output = sums.data() + w * nvalues;
+                    auto r = static_cast<std::size_t>(
+                        std::lower_bound(boundaries.begin(), boundaries.end(),
+                                         windows[w].first)
+                        - boundaries.begin());
+                    for (; boundaries[r] < windows[w].last; ++r)
+                        {
+                            const double *range = ranges.data() + r * nvalues;
+                            for (std::size_t v = 0; v < nvalues; ++v)
+                                {
+                                    output[v] += range[v];
+                                }
+                        }
+                }
+        });
+    return sums;
+}
+
+// Unpack the sums for a set of sites into per-population
+// pi and npop x npop row-major matrices.  The diagonals of
+// dxy and shared are the pi and number of polymorphic
+// sites of each population, and the diagonals of fst,
+// fixed, and private are zero.  private[i][j] counts the
+// sites that are polymorphic in i and monomorphic in j.
+// Fst is NaN if there is no divergence between two
+// populations.
+inline void
+unpack_divergence_sums(const double *sums, const std::size_t npop,
+                       double *pi, double *dxy, double *fst,
+                       std::int64_t *shared, std::int64_t *fixed,
+                       std::int64_t *priv)
+{
+    for (std::size_t i = 0; i < npop; ++i)
+        {
+            const double *p = sums + i * npopulation_fields;
+            const std::size_t ii = i * npop + i;
+            pi[i] = dxy[ii] = p[population_pi];
+            fst[ii] = 0.;
+            shared[ii] = static_cast<std::int64_t>(p[population_polymorphic]);
+            fixed[ii] = priv[ii] = 0;
+        }
+    const double *pair = sums + npopulation_fields * npop;
+    for (std::size_t i = 0; i < npop; ++i)
+        {
+            for (std::size_t j = i + 1; j < npop; ++j, pair += npair_fields)
+                {
+                    const std::size_t ij = i * npop + j, ji = j * npop + i;
+                    dxy[ij] = dxy[ji] = pair[pair_dxy];
+                    fst[ij] = fst[ji]
+                        = pair[pair_fst_between] > 0.
+                              ? 1. - pair[pair_fst_within]
+                                         / pair[pair_fst_between]
+                              : std::numeric_limits<double>::quiet_NaN();
+                    shared[ij] = shared[ji]
+                        = static_cast<std::int64_t>(pair[pair_shared]);
+                    fixed[ij] = fixed[ji]
+                        = static_cast<std::int64_t>(pair[pair_fixed]);
+                    priv[ij] = static_cast<std::int64_t>(
+                        pair[pair_private_first]);
+                    priv[ji] = static_cast<std::int64_t>(
+                        pair[pair_private_second]);
+                }
+        }
+}
+
+#endif
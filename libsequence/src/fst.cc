@@ -1,11 +1,228 @@
+#include <algorithm>
 #include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
 #include <pybind11/stl.h>
+#include <Sequence/AlleleCountMatrix.hpp>
 #include <Sequence/FST.hpp>
 #include <Sequence/PolyTable.hpp>
+#include <Sequence/VariantMatrix.hpp>
 #include <stdexcept>
+#include "divergence_kernels.hpp"
+#include "genomic_windows.hpp"
+#include "numpy_helpers.hpp"
+#include "state_counts.hpp"
 
 namespace py = pybind11;
 
+namespace
+{
+    // A list of array-like objects of sample indexes,
+    // one per population.
+    std::vector<std::vector<std::size_t>>
+    sample_sets_from_object(py::object o, const std::size_t nsam)
+    {
+        std::vector<std::vector<std::size_t>> rv;
+        for (auto item : o)
+            {
+                auto a = py::array_t<std::int64_t, py::array::c_style
+                                                       | py::array::forcecast>::
+                    ensure(py::reinterpret_borrow<py::object>(item));
+                if (!a || a.ndim() != 1)
+                    {
+                        throw std::invalid_argument(
+                            "each sample set must be a one-dimensional "
+                            "array of sample indexes");
+                    }
+                std::vector<std::size_t> samples;
+                for (std::size_t i = 0; i < static_cast<std::size_t>(a.size());
+                     ++i)
+                    {
+                        const std::int64_t x = a.data()[i];
+                        if (x < 0 || static_cast<std::size_t>(x) >= nsam)
+                            {
+                                throw std::out_of_range(
+                                    "sample index out of range");
+                            }
+                        samples.push_back(static_cast<std::size_t>(x));
+                    }
+                auto sorted = samples;
+                std::sort(sorted.begin(), sorted.end());
+                if (std::adjacent_find(sorted.begin(), sorted.end())
+                    != sorted.end())
+                    {
+                        throw std::invalid_argument(
+                            "sample sets may not contain duplicate indexes");
+                    }
+                rv.push_back(std::move(samples));
+            }
+        return rv;
+    }
+
+    // Fills the counts of each population at a site of
+    // a VariantMatrix.
+    struct SampleSetCounts
+    {
+        const std::int8_t *data;
+        std::size_t nsam, ncol;
+        const std::vector<std::vector<std::size_t>> &sets;
+
+        void
+        operator()(const std::size_t site, std::int32_t *counts) const
+        {
+            const std::int8_t *row = data + site * nsam;
+            for (std::size_t p = 0; p < sets.size(); ++p)
+                {
+                    std::int32_t *c = counts + p * ncol;
+                    for (auto j : sets[p])
+                        {
+                            if (row[j] >= 0)
+                                {
+                                    ++c[row[j]];
+                                }
+                        }
+                }
+        }
+    };
+
+    SampleSetCounts
+    sample_set_counts(const Sequence::VariantMatrix &vm,
+                      const std::vector<std::vector<std::size_t>> &sets,
+                      const unsigned nthreads)
+    {
+        const int m = max_state(vm.cdata(), vm.nsites() * vm.nsam(), nthreads);
+        return SampleSetCounts{ vm.cdata(), vm.nsam(),
+                                static_cast<std::size_t>(std::max(m, 0) + 1),
+                                sets };
+    }
+
+    // The results for nrecords sets of sites, as a dict of
+    // arrays whose first dimension has length nrecords.
+    // If windowed is false, that dimension is omitted.
+    py::dict
+    divergence_arrays(const std::vector<double> &sums,
+                      const std::size_t nrecords, const std::size_t npop,
+                      const bool windowed)
+    {
+        const std::size_t nvalues = divergence_nvalues(npop),
+                          nmatrix = npop * npop;
+        std::vector<double> pi(nrecords * npop), dxy(nrecords * nmatrix),
+            fst(nrecords * nmatrix);
+        std::vector<std::int64_t> shared(nrecords * nmatrix),
+            fixed(nrecords * nmatrix), priv(nrecords * nmatrix);
+        for (std::size_t r = 0; r < nrecords; ++r)
+            {
+                unpack_divergence_sums(
+                    sums.data() + r * nvalues, npop, pi.data() + r * npop,
+                    dxy.data() + r * nmatrix, fst.data() + r * nmatrix,
+                    shared.data() + r * nmatrix, fixed.data() + r * nmatrix,
+                    priv.data() + r * nmatrix);
+            }
+        std::vector<std::size_t> vshape{ npop }, mshape{ npop, npop };
+        if (windowed)
+            {
+                vshape.insert(vshape.begin(), nrecords);
+                mshape.insert(mshape.begin(), nrecords);
+            }
+        py::dict rv;
+        rv["pi"] = numpy_from_vector(std::move(pi), vshape);
+        rv["dxy"] = numpy_from_vector(std::move(dxy), mshape);
+        rv["fst"] = numpy_from_vector(std::move(fst), mshape);
+        rv["shared"] = numpy_from_vector(std::move(shared), mshape);
+        rv["fixed"] = numpy_from_vector(std::move(fixed), mshape);
+        rv["private"] = numpy_from_vector(std::move(priv), mshape);
+        return rv;
+    }
+
+    py::dict
+    variant_matrix_divergence(const Sequence::VariantMatrix &vm,
+                              py::object sample_sets, const unsigned nthreads)
+    {
+        const auto sets = sample_sets_from_object(sample_sets, vm.nsam());
+        std::vector<double> sums;
+        {
+            py::gil_scoped_release release;
+            const auto counts = sample_set_counts(vm, sets, nthreads);
+            sums = divergence_sums(vm.nsites(), sets.size(), counts.ncol,
+                                   counts, nthreads);
+        }
+        return divergence_arrays(sums, 1, sets.size(), false);
+    }
+
+    py::dict
+    windowed_variant_matrix_divergence(const Sequence::VariantMatrix &vm,
+                                       py::object sample_sets,
+                                       const double window_size,
+                                       const double step, const double start,
+                                       py::object stop,
+                                       const unsigned nthreads)
+    {
+        const auto sets = sample_sets_from_object(sample_sets, vm.nsam());
+        const double stop_value
+            = !stop.is_none() ? stop.cast<double>()
+                              : (vm.nsites() ? *(vm.pend() - 1) : start);
+        std::vector<GenomicWindow> windows;
+        std::vector<double> sums;
+        {
+            py::gil_scoped_release release;
+            windows = make_genomic_windows(vm.pbegin(), vm.nsites(),
+                                           window_size, step, start,
+                                           stop_value);
+            const auto counts = sample_set_counts(vm, sets, nthreads);
+            sums = windowed_divergence_sums(windows, vm.nsites(), sets.size(),
+                                            counts.ncol, counts, nthreads);
+        }
+        auto rv = divergence_arrays(sums, windows.size(), sets.size(), true);
+        std::vector<double> left, right;
+        for (const auto &w : windows)
+            {
+                left.push_back(w.left);
+                right.push_back(w.right);
+            }
+        rv["start"] = numpy_from_vector(std::move(left), { windows.size() });
+        rv["stop"] = numpy_from_vector(std::move(right), { windows.size() });
+        return rv;
+    }
+
+    // Each AlleleCountMatrix holds the counts of one
+    // population at the same sites.
+    py::dict
+    allele_count_matrix_divergence(py::list matrices, const unsigned nthreads)
+    {
+        std::vector<const Sequence::AlleleCountMatrix *> acms;
+        std::size_t ncol = 1;
+        for (auto item : matrices)
+            {
+                acms.push_back(&item.cast<const Sequence::AlleleCountMatrix &>());
+                ncol = std::max(ncol, acms.back()->ncol);
+                if (acms.back()->nrow != acms.front()->nrow)
+                    {
+                        throw std::invalid_argument(
+                            "all AlleleCountMatrix objects must have the "
+                            "same number of sites");
+                    }
+            }
+        const std::size_t nsites = acms.empty() ? 0 : acms.front()->nrow;
+        std::vector<double> sums;
+        {
+            py::gil_scoped_release release;
+            sums = divergence_sums(
+                nsites, acms.size(), ncol,
+                [&](const std::size_t site, std::int32_t *counts) {
+                    for (std::size_t p = 0; p < acms.size(); ++p)
+                        {
+                            const auto &c = acms[p]->counts;
+                            const std::size_t n = acms[p]->ncol;
+                            std::copy(c.begin() + site * n,
+                                      c.begin() + (site + 1) * n,
+                                      counts + p * ncol);
+                        }
+                },
+                nthreads);
+        }
+        return divergence_arrays(sums, 1, acms.size(), false);
+    }
+} // namespace
+
 void init_fst(py::module & m)
 {
     //py::object polytable
@@ -68,4 +285,81 @@ void init_fst(py::module & m)
         .def("shared", &Sequence::FST::shared)
         .def("fixed", &Sequence::FST::fixed)
         .def("priv", &Sequence::FST::Private);
+
+    m.def("divergence", &variant_matrix_divergence,
+          R"delim(
+          Diversity within, and divergence between, all pairs
+          of populations.
+
+          :param m: A :class:`libsequence.VariantMatrix`
+          :param sample_sets: A list of arrays of sample indexes, one per population.
+          :param nthreads: (1) Number of threads to use.  If 0, use all available cores.
+
+          :rtype: dict
+
+          The return value maps names to numpy arrays.  With
+          npop populations, these are:
+
+          * pi: shape (npop,), the mean number of differences between samples of each population
+          * dxy: shape (npop, npop), the mean number of differences between samples of two populations
+          * fst: shape (npop, npop), Hudson's Fst, :math:`1 - \pi_W/d_{xy}`
+          * shared: shape (npop, npop), the number of sites polymorphic in both populations
+          * fixed: shape (npop, npop), the number of sites monomorphic in both populations, for different states
+          * private: shape (npop, npop).  Element [i, j] is the number of sites polymorphic in i and monomorphic in j
+
+          pi and dxy are summed over sites, as for
+          :func:`libsequence.thetapi`, and missing data are
+          skipped.  Fst is a ratio of sums over the sites where
+          both populations have at least two samples with data,
+          where :math:`\pi_W` is the mean of the pi of the two
+          populations, and is NaN if :math:`d_{xy}` is zero.
+          The diagonal of dxy is pi, and that of shared is the
+          number of polymorphic sites in each population.  The
+          diagonals of fst, fixed, and private are zero.
+
+          The counts of all populations at a site are obtained
+          in a single pass over its genotypes, and blocks of
+          sites are processed in parallel.
+
+          .. versionadded:: 0.2.4
+          )delim",
+          py::arg("m"), py::arg("sample_sets"), py::arg("nthreads") = 1);
+
+    m.def("divergence", &allele_count_matrix_divergence,
+          R"delim(
+          As above, for a list of :class:`libsequence.AlleleCountMatrix`,
+          each holding the counts of one population at the same sites.
+          )delim",
+          py::arg("matrices"), py::arg("nthreads") = 1);
+
+    m.def("windowed_divergence", &windowed_variant_matrix_divergence,
+          R"delim(
+          Calculate :func:`libsequence.divergence` in sliding
+          windows along a VariantMatrix.
+
+          :param m: A :class:`libsequence.VariantMatrix`
+          :param sample_sets: A list of arrays of sample indexes, one per population.
+          :param window_size: The length of each window
+          :param step: The distance between the left edges of adjacent windows
+          :param start: (0.0) The left edge of the first window.
+          :param stop: (None) The largest possible left edge of a window.  If None, the last position in m is used.
+          :param nthreads: (1) Number of threads to use.  If 0, use all available cores.
+
+          :rtype: dict
+
+          The arrays of :func:`libsequence.divergence` gain a
+          first dimension of one element per window, and the
+          arrays start and stop hold the edges of the windows.
+          Windows are defined as for
+          :func:`libsequence.windowed_statistics`.
+
+          Sites are split into ranges at every window edge.  Each
+          range is processed once, in parallel, and the results
+          for a window are the sums over its ranges.
+
+          .. versionadded:: 0.2.4
+          )delim",
+          py::arg("m"), py::arg("sample_sets"), py::arg("window_size"),
+          py::arg("step"), py::arg("start") = 0.0, py::arg("stop") = nullptr,
+          py::arg("nthreads") = 1);
 }
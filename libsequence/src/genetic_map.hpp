@@ -0,0 +1,102 @@
+#ifndef PYLIBSEQ_GENETIC_MAP_HPP
+#define PYLIBSEQ_GENETIC_MAP_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+// A genetic map given as sorted physical positions and the
+// corresponding genetic positions.  Locations between map
+// points are linearly interpolated, and locations outside
+// of the map take the value of the nearest end, as for
+// numpy.interp.
+class GeneticMap
+{
+  private:
+    std::vector<double> physical, genetic;
+
+  public:
+    GeneticMap(const double *physical_, const double *genetic_,
+               const std::size_t n)
+        : physical(physical_, physical_ + n), genetic(genetic_, genetic_ + n)
+    {
+        if (n == 0)
+            {
+                throw std::invalid_argument("genetic map is empty");
+            }
+        for (std::size_t i = 1; i < n; ++i)
+            {
+                if (!(physical[i] > physical[i - 1]))
+                    {
+                        throw std::invalid_argument(
+                            "genetic map positions must be strictly "
+                            "increasing");
+                    }
+                if (genetic[i] < genetic[i - 1])
+                    {
+                        throw std::invalid_argument(
+                            "genetic map values must be non-decreasing");
+                    }
+            }
+    }
+
+    double
+    operator()(const double x) const
+    {
+        if (x <= physical.front())
+            {
+                return genetic.front();
+            }
+        if (x >= physical.back())
+            {
+                return genetic.back();
+            }
+        const std::size_t i = static_cast<std::size_t>(
+            std::upper_bound(physical.begin(), physical.end(), x)
+            - physical.begin());
+        const double f
+            = (x - physical[i - 1]) / (physical[i] - physical[i - 1]);
+        return genetic[i - 1] + f * (genetic[i] - genetic[i - 1]);
+    }
+
+    // The genetic locations of positions, in one pass
+    // through the map when positions are sorted.
+    std::vector<double>
+    interpolate(const double *positions, const std::size_t n) const
+    {
+        std::vector<double> rv(n);
+        std::size_t i = 0;
+        for (std::size_t k = 0; k < n; ++k)
+            {
+                const double x = positions[k];
+                if (i > 0 && physical[i - 1] > x)
+                    {
+                        rv[k] = (*this)(x);
+                        continue;
+                    }
+                while (i < physical.size() && physical[i] <= x)
+                    {
+                        ++i;
+                    }
+                if (i == 0)
+                    {
+                        rv[k] = genetic.front();
+                    }
+                else if (i == physical.size())
+                    {
+                        rv[k] = genetic.back();
+                    }
+                else
+                    {
+                        const double f = (x - physical[i - 1])
+                                         / (physical[i] - physical[i - 1]);
+                        rv[k] = genetic[i - 1]
+                                + f * (genetic[i] - genetic[i - 1]);
+                    }
+            }
+        return rv;
+    }
+};
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef PYLIBSEQ_GENOMIC_WINDOWS_HPP
+#define PYLIBSEQ_GENOMIC_WINDOWS_HPP
+
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+// Sliding windows over sorted mutation positions.
+// A window covers the half-open interval [left, right)
+// of positions, and the half-open range [first, last)
+// of site indexes.
+
+struct GenomicWindow
+{
+    double left, right;
+    std::size_t first, last;
+};
+
+inline void
+validate_sorted_positions(const double *positions, const std::size_t nsites)
+{
+    for (std::size_t i = 1; i < nsites; ++i)
+        {
+            if (positions[i] < positions[i - 1])
+                {
+                    throw std::invalid_argument(
+                        "positions must be sorted in ascending order");
+                }
+        }
+}
+
+inline double
+window_left_edge(const double start, const double step, const std::size_t k)
+{
+    return start + static_cast<double>(k) * step;
+}
+
+// Windows have left edges start, start + step, ...,
+// for all left edges <= stop.
+inline std::vector<GenomicWindow>
+make_genomic_windows(const double *positions, const std::size_t nsites,
+                     const double window_size, const double step,
+                     const double start, const double stop)
+{
+    if (!(window_size > 0.) || !std::isfinite(window_size))
+        {
+            throw std::invalid_argument("window size must be > 0");
+        }
+    if (!(step > 0.) || !std::isfinite(step))
+        {
+            throw std::invalid_argument("step size must be > 0");
+        }
+    if (!std::isfinite(start) || !std::isfinite(stop))
+        {
+            throw std::invalid_argument("start and stop must be finite");
+        }
+    validate_sorted_positions(positions, nsites);
+    std::vector<GenomicWindow> windows;
+    if (stop < start)
+        {
+            return windows;
+        }
+    // The quotient is rounded, so it is corrected to the
+    // last k whose left edge, computed exactly as below,
+    // is <= stop.
+    std::size_t nsteps = static_cast<std::size_t>(
+        std::floor((stop - start) / step));
+    while (window_left_edge(start, step, nsteps + 1) <= stop)
+        {
+            ++nsteps;
+        }
+    while (nsteps > 0 && window_left_edge(start, step, nsteps) > stop)
+        {
+            --nsteps;
+        }
+    const std::size_t nwindows = nsteps + 1;
+    windows.reserve(nwindows);
+    // Left and right edges only increase, so the site
+    // indexes are found in a single sweep.
+    std::size_t first = 0, last = 0;
+    for (std::size_t k = 0; k < nwindows; ++k)
+        {
+            const double left = window_left_edge(start, step, k);
+            const double right = left + window_size;
+            while (first < nsites && positions[first] < left)
+                {
+                    ++first;
+                }
+            if (last < first)
+                {
+                    last = first;
+                }
+            while (last < nsites && positions[last] < right)
+                {
+                    ++last;
+                }
+            windows.push_back(GenomicWindow{ left, right, first, last });
+        }
+    return windows;
+}
+
+#endif
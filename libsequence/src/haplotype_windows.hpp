@@ -0,0 +1,334 @@
+#ifndef PYLIBSEQ_HAPLOTYPE_WINDOWS_HPP
+#define PYLIBSEQ_HAPLOTYPE_WINDOWS_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <vector>
+#include "genomic_windows.hpp"
+#include "parallel.hpp"
+
+// Haplotype statistics in sliding windows of sites.
+//
+// Each sample carries an integer label such that two samples
+// have the same label if and only if their haplotypes over a
+// range of sites are identical.  Labels for a range grow by one
+// site at a time: the new label is the index of the pair (old
+// label, state) in order of first appearance.  This is exact,
+// and costs O(nsam) per site.
+//
+// Labels cannot be updated as sites leave a window, so windows
+// are handled as a queue made of two stacks.  An anchor site k
+// splits a window [a, b) into [a, k) and [k, b).  Labels for
+// [k, b) grow to the right as windows advance.  Labels for
+// [a, k) are built once, to the left from k, when the anchor is
+// set, and are kept only for the first sites a of the windows
+// that will use them.  The label of a sample in the window is
+// the pair of its labels for the two parts.  When the left edge
+// of a window passes the last kept first site, the anchor moves
+// to the right edge of that window.  Each site is thus added to
+// a set of labels at most twice, unless more first sites fall
+// before an anchor than can be kept.
+//
+// Labels are extended through a table of (old label, state)
+// pairs, sized by the number of old labels times the number of
+// states at a site, rather than by all 256 possible states.
+
+struct HaplotypeStatistics
+{
+    std::int64_t nsam, nhaps;
+    double diversity, H1, H12, H2H1;
+};
+
+// Statistics from the number of copies of each haplotype.
+// H1, H12, and H2/H1 are those of Garud et al. (2015),
+// calculated from haplotype frequencies, and the diversity
+// is that of Depaulis and Veuille (1998).  The counts are
+// sorted in place.
+inline HaplotypeStatistics
+haplotype_statistics_from_counts(std::vector<std::int64_t> &counts)
+{
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    HaplotypeStatistics rv{ 0, 0, nan, nan, nan, nan };
+    counts.erase(std::remove(counts.begin(), counts.end(), 0), counts.end());
+    std::sort(counts.begin(), counts.end(), std::greater<std::int64_t>());
+    for (auto c : counts)
+        {
+            rv.nsam += c;
+        }
+    rv.nhaps = static_cast<std::int64_t>(counts.size());
+    if (rv.nsam == 0)
+        {
+            return rv;
+        }
+    const double n = static_cast<double>(rv.nsam);
+    double H1 = 0.;
+    for (auto c : counts)
+        {
+            const double p = static_cast<double>(c) / n;
+            H1 += p * p;
+        }
+    const double p1 = static_cast<double>(counts[0]) / n;
+    const double p2
+        = counts.size() > 1 ? static_cast<double>(counts[1]) / n : 0.;
+    rv.H1 = H1;
+    rv.H12 = H1 + 2. * p1 * p2;
+    rv.H2H1 = (H1 - p1 * p1) / H1;
+    if (rv.nsam > 1)
+        {
+            rv.diversity = n / (n - 1.) * (1. - H1);
+        }
+    return rv;
+}
+
+// Extends haplotype labels by one site.
+class LabelRefiner
+{
+  private:
+    // Index of each state at the current site, by state + 128,
+    // in order of first appearance
+    std::vector<std::int32_t> state_index;
+    std::vector<std::int8_t> states;
+    // Indexed by old label * number of states + state index
+    std::vector<std::int32_t> table;
+    std::vector<std::size_t> touched;
+
+  public:
+    LabelRefiner() : state_index(256, -1), states(), table(), touched() {}
+
+    // Writes the labels of (labels[j], site[j]) to next,
+    // and returns the number of distinct labels.  The old
+    // labels must be < nlabels.
+    std::int32_t
+    refine(const std::int32_t *labels, const std::int32_t nlabels,
+           const std::int8_t *site, const std::size_t nsam,
+           std::int32_t *next)
+    {
+        std::int32_t nstates = 0;
+        for (std::size_t j = 0; j < nsam; ++j)
+            {
+                std::int32_t &index = state_index[site[j] + 128];
+                if (index < 0)
+                    {
+                        index = nstates++;
+                        states.push_back(site[j]);
+                    }
+            }
+        const std::size_t size = static_cast<std::size_t>(nlabels)
+                                 * static_cast<std::size_t>(nstates);
+        if (table.size() < size)
+            {
+                table.resize(size, -1);
+            }
+        std::int32_t nnext = 0;
+        for (std::size_t j = 0; j < nsam; ++j)
+            {
+                const std::size_t key
+                    = static_cast<std::size_t>(labels[j]) * nstates
+                      + static_cast<std::size_t>(
+                          state_index[site[j] + 128]);
+                if (table[key] < 0)
+                    {
+                        table[key] = nnext++;
+                        touched.push_back(key);
+                    }
+                next[j] = table[key];
+            }
+        for (auto key : touched)
+            {
+                table[key] = -1;
+            }
+        touched.clear();
+        for (auto state : states)
+            {
+                state_index[state + 128] = -1;
+            }
+        states.clear();
+        return nnext;
+    }
+};
+
+class HaplotypeWindowScanner
+{
+  private:
+    const std::int8_t *data;
+    std::size_t nsam;
+    LabelRefiner refiner;
+    // The anchor, and the right edge of the labels for [anchor, right)
+    std::size_t anchor, right;
+    std::int32_t nright;
+    std::vector<std::int32_t> right_labels, scratch;
+    // left_labels[i * nsam + j] labels [left_firsts[i], anchor),
+    // and left_index is the entry for the current window.
+    std::vector<std::size_t> left_firsts;
+    std::size_t left_index;
+    std::vector<std::int32_t> left_labels;
+    // Number of missing states of each sample in the current window
+    std::vector<std::int32_t> nmissing;
+    std::size_t window_first, window_last;
+    std::vector<std::int64_t> keys, counts;
+
+    void
+    update_missing(const std::size_t site, const std::int32_t delta)
+    {
+        const std::int8_t *s = data + site * nsam;
+        for (std::size_t j = 0; j < nsam; ++j)
+            {
+                if (s[j] < 0)
+                    {
+                        nmissing[j] += delta;
+                    }
+            }
+    }
+
+    // Sets the anchor to the last site of window, and labels
+    // the left parts of it and of the windows that follow.
+    // Labels are kept only for their first sites, for at
+    // most about 2^24 labels in all.
+    void
+    set_anchor(const GenomicWindow *window, const GenomicWindow *end)
+    {
+        const std::size_t max_firsts
+            = std::max<std::size_t>(1, (std::size_t(1) << 24) / nsam);
+        anchor = right = window->last;
+        nright = 1;
+        left_firsts.clear();
+        left_index = 0;
+        for (; window != end && window->first <= anchor
+               && left_firsts.size() < max_firsts;
+             ++window)
+            {
+                if (left_firsts.empty() || window->first != left_firsts.back())
+                    {
+                        left_firsts.push_back(window->first);
+                    }
+            }
+        left_labels.resize(left_firsts.size() * nsam);
+        // The labels grow to the left from the anchor, and
+        // right_labels and scratch hold them until they are
+        // saved at each first site.
+        std::fill(right_labels.begin(), right_labels.end(), 0);
+        std::int32_t nleft = 1;
+        std::size_t s = anchor;
+        for (std::size_t i = left_firsts.size(); i > 0; --i)
+            {
+                for (; s > left_firsts[i - 1]; --s)
+                    {
+                        nleft = refiner.refine(right_labels.data(), nleft,
+                                               data + (s - 1) * nsam, nsam,
+                                               scratch.data());
+                        right_labels.swap(scratch);
+                    }
+                std::copy(right_labels.begin(), right_labels.end(),
+                          left_labels.begin() + (i - 1) * nsam);
+            }
+        std::fill(right_labels.begin(), right_labels.end(), 0);
+    }
+
+  public:
+    HaplotypeWindowScanner(const std::int8_t *data_, const std::size_t nsam_)
+        : data(data_), nsam(nsam_), refiner(), anchor(0), right(0),
+          nright(1), right_labels(nsam_, 0), scratch(nsam_, 0),
+          left_firsts(), left_index(0), left_labels(), nmissing(nsam_, 0),
+          window_first(0), window_last(0), keys(), counts()
+    {
+    }
+
+    // The scanner refers to data, and is not copied.
+    HaplotypeWindowScanner(const HaplotypeWindowScanner &) = delete;
+    HaplotypeWindowScanner &operator=(const HaplotypeWindowScanner &) = delete;
+
+    // Statistics for *window.  Windows must be visited in
+    // order, with non-decreasing first and last sites, and
+    // [window, end) are the windows still to be visited.
+    HaplotypeStatistics
+    next(const GenomicWindow *window, const GenomicWindow *end)
+    {
+        const std::size_t first = window->first, last = window->last;
+        // Update the missing data counts
+        if (first >= window_last)
+            {
+                for (std::size_t s = window_first; s < window_last; ++s)
+                    {
+                        update_missing(s, -1);
+                    }
+                window_first = window_last = first;
+            }
+        for (; window_first < first; ++window_first)
+            {
+                update_missing(window_first, -1);
+            }
+        for (; window_last < last; ++window_last)
+            {
+                update_missing(window_last, 1);
+            }
+        while (left_index < left_firsts.size()
+               && left_firsts[left_index] < first)
+            {
+                ++left_index;
+            }
+        if (left_index == left_firsts.size()
+            || left_firsts[left_index] != first || last < anchor)
+            {
+                set_anchor(window, end);
+            }
+        for (; right < last; ++right)
+            {
+                nright = refiner.refine(right_labels.data(), nright,
+                                        data + right * nsam, nsam,
+                                        scratch.data());
+                right_labels.swap(scratch);
+            }
+        const std::int32_t *labels = left_labels.data() + left_index * nsam;
+        keys.clear();
+        for (std::size_t j = 0; j < nsam; ++j)
+            {
+                if (nmissing[j] == 0)
+                    {
+                        keys.push_back(static_cast<std::int64_t>(labels[j])
+                                           * nright
+                                       + right_labels[j]);
+                    }
+            }
+        std::sort(keys.begin(), keys.end());
+        counts.clear();
+        for (std::size_t i = 0; i < keys.size(); ++i)
+            {
+                if (i == 0 || keys[i] != keys[i - 1])
+                    {
+                        counts.push_back(0);
+                    }
+                ++counts.back();
+            }
+        return haplotype_statistics_from_counts(counts);
+    }
+};
+
+// Statistics for each window.  Windows are split into
+// contiguous blocks, one per thread, and each block is
+// scanned independently.
+inline std::vector<HaplotypeStatistics>
+windowed_haplotype_statistics(const std::int8_t *data,
+                              const std::size_t nsam,
+                              const std::vector<GenomicWindow> &windows,
+                              const unsigned nthreads)
+{
+    std::vector<HaplotypeStatistics> rv(windows.size());
+    const std::size_t nblocks = std::max<std::size_t>(
+        1, std::min<std::size_t>(resolve_nthreads(nthreads), windows.size()));
+    const std::size_t block_size = (windows.size() + nblocks - 1) / nblocks;
+    parallel_for(windows.size(), nthreads, block_size,
+                 [&](const std::size_t begin, const std::size_t end) {
+                     HaplotypeWindowScanner scanner(data, nsam);
+                     for (std::size_t w = begin; w < end; ++w)
+                         {
+                             rv[w] = scanner.next(windows.data() + w,
+                                                  windows.data() + end);
+                         }
+                 });
+    return rv;
+}
+
+#endif
@@ -0,0 +1,242 @@
+#ifndef PYLIBSEQ_LD_KERNELS_HPP
+#define PYLIBSEQ_LD_KERNELS_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "genomic_windows.hpp"
+#include "packed_genotypes.hpp"
+#include "parallel.hpp"
+
+// Linkage disequilibrium between biallelic sites.
+// Genotypes are re-encoded once as bit-packed rows, and
+// the counts needed for a pair of sites are popcounts.
+
+class BiallelicSites : public PackedSites
+{
+  public:
+    // The minor allele count of each site, or -1 if
+    // the site is not biallelic.
+    std::vector<std::int32_t> minor_count;
+
+    // The reference state of a site is the smaller of its
+    // two states, and bits are set for the larger one, so that
+    // 0/1 data are encoded as-is.  Negative values are missing
+    // data.
+    BiallelicSites(const std::int8_t *data, const std::size_t nsites_,
+                   const std::size_t nsam_)
+        : PackedSites(nsites_, nsam_), minor_count(nsites_, -1)
+    {
+        for (std::size_t i = 0; i < nsites; ++i)
+            {
+                const std::int8_t *site = data + i * nsam;
+                std::int8_t ref = -1, alt = -1;
+                bool biallelic = true;
+                for (std::size_t j = 0; j < nsam && biallelic; ++j)
+                    {
+                        const std::int8_t g = site[j];
+                        if (g < 0 || g == ref || g == alt)
+                            {
+                                continue;
+                            }
+                        if (ref < 0)
+                            {
+                                ref = g;
+                            }
+                        else if (alt < 0)
+                            {
+                                alt = std::max(g, ref);
+                                ref = std::min(g, ref);
+                            }
+                        else
+                            {
+                                biallelic = false;
+                            }
+                    }
+                std::int32_t n = 0, nalt = 0;
+                for (std::size_t j = 0; j < nsam; ++j)
+                    {
+                        const std::int8_t g = site[j];
+                        if (g < 0)
+                            {
+                                set_missing(i, j);
+                                continue;
+                            }
+                        if (g != ref)
+                            {
+                                set(i, j);
+                                ++nalt;
+                            }
+                        ++n;
+                    }
+                if (biallelic && alt >= 0)
+                    {
+                        minor_count[i] = std::min(nalt, n - nalt);
+                    }
+            }
+    }
+
+    bool
+    usable(const std::size_t i, const std::int32_t mincount) const
+    {
+        return minor_count[i] >= 0 && minor_count[i] >= mincount;
+    }
+};
+
+struct PairwiseLD
+{
+    double rsq, D, Dprime;
+};
+
+// LD between sites i and j, using the samples that are
+// not missing at either site.  All values are zero if
+// either site is monomorphic within those samples.
+inline PairwiseLD
+pairwise_ld(const PackedSites &sites, const std::size_t i,
+            const std::size_t j)
+{
+    const std::uint64_t *di = sites.site(i), *dj = sites.site(j);
+    const std::uint64_t *mi = sites.missing(i), *mj = sites.missing(j);
+    std::int64_t nmissing = 0, a = 0, b = 0, ab = 0;
+    for (std::size_t w = 0; w < sites.nwords; ++w)
+        {
+            ab += popcount64(di[w] & dj[w]);
+            if (mi)
+                {
+                    nmissing += popcount64(mi[w] | mj[w]);
+                    a += popcount64(di[w] & ~mj[w]);
+                    b += popcount64(dj[w] & ~mi[w]);
+                }
+            else
+                {
+                    a += popcount64(di[w]);
+                    b += popcount64(dj[w]);
+                }
+        }
+    const std::int64_t n = static_cast<std::int64_t>(sites.nsam) - nmissing;
+    PairwiseLD rv{ 0., 0., 0. };
+    if (n == 0)
+        {
+            return rv;
+        }
+    const double p = static_cast<double>(a) / n,
+                 q = static_cast<double>(b) / n;
+    const double denom = p * (1. - p) * q * (1. - q);
+    if (!(denom > 0.))
+        {
+            return rv;
+        }
+    rv.D = static_cast<double>(ab) / n - p * q;
+    rv.rsq = rv.D * rv.D / denom;
+    const double dmax = rv.D < 0. ? std::min(p * q, (1. - p) * (1. - q))
+                                  : std::min(p * (1. - q), (1. - p) * q);
+    rv.Dprime = dmax > 0. ? rv.D / dmax : 0.;
+    return rv;
+}
+
+// The pairs (selected[a], selected[b]), a < b, of sites
+// less than maxd apart.  The positions of the selected
+// sites must be sorted.
+class LDPairIndex
+{
+  public:
+    // offsets[a] is the index of the first pair whose first
+    // site is selected[a], and ends[a] is one past the last
+    // b paired with a.
+    std::vector<std::size_t> offsets, ends;
+
+    LDPairIndex(const double *positions,
+                const std::vector<std::size_t> &selected, const double maxd,
+                const unsigned nthreads)
+        : offsets(selected.size() + 1, 0), ends(selected.size(), 0)
+    {
+        const std::size_t n = selected.size();
+        parallel_for(n, nthreads, default_grain_size(n, nthreads, 256),
+                     [&](const std::size_t begin, const std::size_t end) {
+                         for (std::size_t a = begin; a < end; ++a)
+                             {
+                                 const double x = positions[selected[a]];
+                                 std::size_t b = a + 1;
+                                 while (b < n
+                                        && positions[selected[b]] - x < maxd)
+                                     {
+                                         ++b;
+                                     }
+                                 ends[a] = b;
+                             }
+                     });
+        for (std::size_t a = 0; a < n; ++a)
+            {
+                offsets[a + 1] = offsets[a] + (ends[a] - a - 1);
+            }
+    }
+
+    std::size_t
+    npairs() const
+    {
+        return offsets.back();
+    }
+};
+
+// LD for all pairs of an LDPairIndex, as row-major records
+// of (position i, position j, rsq, D, Dprime).  Rows of pairs
+// are processed in parallel, and each is written to its own
+// part of the output.  positions has one element per site,
+// and must be sorted.
+inline std::vector<double>
+ld_records(const PackedSites &sites, const double *positions,
+           const std::vector<std::size_t> &selected, const double maxd,
+           const unsigned nthreads)
+{
+    validate_sorted_positions(positions, sites.nsites);
+    const LDPairIndex index(positions, selected, maxd, nthreads);
+    std::vector<double> values(5 * index.npairs());
+    const std::size_t n = selected.size();
+    parallel_for(n, nthreads, default_grain_size(n, nthreads, 16),
+                 [&](const std::size_t begin, const std::size_t end) {
+                     for (std::size_t a = begin; a < end; ++a)
+                         {
+                             double *out = values.data() + 5 * index.offsets[a];
+                             const std::size_t i = selected[a];
+                             for (std::size_t b = a + 1; b < index.ends[a];
+                                  ++b, out += 5)
+                                 {
+                                     const std::size_t j = selected[b];
+                                     const auto ld = pairwise_ld(sites, i, j);
+                                     out[0] = positions[i];
+                                     out[1] = positions[j];
+                                     out[2] = ld.rsq;
+                                     out[3] = ld.D;
+                                     out[4] = ld.Dprime;
+                                 }
+                         }
+                 });
+    return values;
+}
+
+// A symmetric selected.size() x selected.size() matrix of one
+// LD statistic.  Diagonal elements are 1 for rsq and Dprime,
+// and D is the variance of the site.
+inline void
+ld_matrix(const PackedSites &sites, const std::vector<std::size_t> &selected,
+          double PairwiseLD::*stat, const unsigned nthreads, double *output)
+{
+    const std::size_t n = selected.size();
+    parallel_for(n, nthreads, default_grain_size(n, nthreads, 16),
+                 [&](const std::size_t begin, const std::size_t end) {
+                     for (std::size_t a = begin; a < end; ++a)
+                         {
+                             for (std::size_t b = a; b < n; ++b)
+                                 {
+                                     const double x
+                                         = pairwise_ld(sites, selected[a],
+                                                       selected[b]).*stat;
+                                     output[a * n + b] = x;
+                                     output[b * n + a] = x;
+                                 }
+                         }
+                 });
+}
+
+#endif
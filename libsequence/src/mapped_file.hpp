@@ -0,0 +1,123 @@
+#ifndef PYLIBSEQ_MAPPED_FILE_HPP
+#define PYLIBSEQ_MAPPED_FILE_HPP
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A read-only memory map of an entire file.  Read-only
+// private mappings are not counted against the system's
+// commit limit, so files larger than RAM plus swap may be
+// mapped.
+class MappedFile
+{
+  public:
+    enum class Mode
+    {
+        // Read-only, read from start to end
+        sequential,
+        // Read-only, read in any order.  Pages are shared
+        // with other processes mapping the same file.
+        random
+    };
+
+  private:
+    void *address;
+    std::size_t length;
+
+    void
+    map(const int fd, const Mode mode)
+    {
+        struct stat info;
+        if (fstat(fd, &info) != 0)
+            {
+                throw std::runtime_error(std::string("fstat failed: ")
+                                         + std::strerror(errno));
+            }
+        if (!S_ISREG(info.st_mode))
+            {
+                throw std::invalid_argument(
+                    "only regular files can be memory-mapped");
+            }
+        length = static_cast<std::size_t>(info.st_size);
+        if (length == 0)
+            {
+                return;
+            }
+        address = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (address == MAP_FAILED)
+            {
+                address = nullptr;
+                throw std::runtime_error(std::string("mmap failed: ")
+                                         + std::strerror(errno));
+            }
+#ifdef MADV_SEQUENTIAL
+        if (mode == Mode::sequential)
+            {
+                madvise(address, length, MADV_SEQUENTIAL);
+            }
+#endif
+    }
+
+  public:
+    explicit MappedFile(const std::string &path,
+                        const Mode mode = Mode::sequential)
+        : address(nullptr), length(0)
+    {
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            {
+                throw std::runtime_error("could not open " + path + ": "
+                                         + std::strerror(errno));
+            }
+        try
+            {
+                map(fd, mode);
+            }
+        catch (...)
+            {
+                close(fd);
+                throw;
+            }
+        // The mapping remains valid after the file is closed.
+        close(fd);
+    }
+
+    // The file descriptor is not closed.
+    explicit MappedFile(const int fd, const Mode mode = Mode::sequential)
+        : address(nullptr), length(0)
+    {
+        map(fd, mode);
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    ~MappedFile()
+    {
+        if (address)
+            {
+                munmap(address, length);
+            }
+    }
+
+    const char *
+    data() const
+    {
+        return static_cast<const char *>(address);
+    }
+
+    std::size_t
+    size() const
+    {
+        return length;
+    }
+};
+
+#endif
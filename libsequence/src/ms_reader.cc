@@ -0,0 +1,305 @@
+#include <deque>
+#include <memory>
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <pybind11/stl.h>
+#include <Sequence/VariantMatrix.hpp>
+#include "capsules.hpp"
+#include "msformat_reader.hpp"
+#include "msstats_kernels.hpp"
+#include "numpy_helpers.hpp"
+#include "parallel.hpp"
+
+namespace py = pybind11;
+
+namespace
+{
+    // Iterates over the replicates in ms-format data.
+    // Replicates are parsed in parallel, a batch at a time,
+    // so that memory use is bounded by the batch size.
+    class MsFormatReader
+    {
+      private:
+        // Either a memory-mapped file or a Python object
+        // supporting the buffer protocol owns the data.  The
+        // buffer is held for the lifetime of the reader, which
+        // prevents objects such as bytearray from being resized.
+        std::unique_ptr<MappedFile> file;
+        py::buffer source;
+        std::unique_ptr<py::buffer_info> view;
+        const char *data;
+        std::size_t size;
+        std::vector<std::size_t> offsets;
+        std::deque<MsReplicate> batch;
+        std::size_t next_replicate, batch_size;
+        unsigned nthreads;
+        // Set while a batch is parsed without the GIL.
+        bool busy;
+
+        void
+        parse_batch()
+        {
+            const std::size_t first = next_replicate;
+            const std::size_t n
+                = std::min(batch_size, offsets.size() - first);
+            std::vector<MsReplicate> parsed(n);
+            parallel_for(n, nthreads, 1,
+                         [&](const std::size_t begin, const std::size_t end) {
+                             for (std::size_t i = begin; i < end; ++i)
+                                 {
+                                     const std::size_t r = first + i;
+                                     const std::size_t stop
+                                         = r + 1 < offsets.size()
+                                               ? offsets[r + 1]
+                                               : size;
+                                     parsed[i] = parse_ms_replicate(
+                                         data + offsets[r], data + stop);
+                                 }
+                         });
+            for (auto &p : parsed)
+                {
+                    batch.push_back(std::move(p));
+                }
+        }
+
+        void
+        find_replicates()
+        {
+            py::gil_scoped_release release;
+            offsets = find_ms_replicates(data, size, nthreads);
+        }
+
+      public:
+        MsFormatReader(py::object input, const unsigned nthreads_,
+                       const std::size_t batch_size_)
+            : file(nullptr), source(), view(nullptr), data(nullptr), size(0), offsets(),
+              batch(), next_replicate(0),
+              batch_size(batch_size_ ? batch_size_
+                                     : 16 * resolve_nthreads(nthreads_)),
+              nthreads(nthreads_), busy(false)
+        {
+            if (py::isinstance<py::int_>(input))
+                {
+                    file.reset(new MappedFile(input.cast<int>()));
+                    data = file->data();
+                    size = file->size();
+                }
+            else if (py::isinstance<py::buffer>(input)
+                     && !py::isinstance<py::str>(input))
+                {
+                    source = input.cast<py::buffer>();
+                    view.reset(new py::buffer_info(source.request()));
+                    if (view->ndim != 1 || view->itemsize != 1
+                        || view->strides[0] != 1)
+                        {
+                            throw std::invalid_argument(
+                                "buffer must be one-dimensional and "
+                                "contiguous bytes");
+                        }
+                    data = static_cast<const char *>(view->ptr);
+                    size = static_cast<std::size_t>(view->size);
+                }
+            else
+                {
+                    // str or os.PathLike
+                    auto path = py::module::import("os")
+                                    .attr("fspath")(input)
+                                    .cast<std::string>();
+                    file.reset(new MappedFile(path));
+                    data = file->data();
+                    size = file->size();
+                }
+            find_replicates();
+        }
+
+        std::size_t
+        nreplicates() const
+        {
+            return offsets.size();
+        }
+
+        Sequence::VariantMatrix
+        next()
+        {
+            if (busy)
+                {
+                    throw std::runtime_error(
+                        "reader is in use by another thread");
+                }
+            if (batch.empty())
+                {
+                    if (next_replicate >= offsets.size())
+                        {
+                            throw py::stop_iteration();
+                        }
+                    busy = true;
+                    try
+                        {
+                            py::gil_scoped_release release;
+                            parse_batch();
+                        }
+                    catch (...)
+                        {
+                            busy = false;
+                            throw;
+                        }
+                    busy = false;
+                }
+            MsReplicate r(std::move(batch.front()));
+            batch.pop_front();
+            ++next_replicate;
+            const std::size_t nsites = r.nsites, nsam = r.nsam;
+            auto genotypes
+                = numpy_from_vector(std::move(r.genotypes), { nsites, nsam });
+            auto positions
+                = numpy_from_vector(std::move(r.positions), { nsites });
+            std::unique_ptr<Sequence::GenotypeCapsule> g(
+                new NumpyGenotypeCapsule(std::move(genotypes)));
+            std::unique_ptr<Sequence::PositionCapsule> p(
+                new NumpyPositionCapsule(std::move(positions)));
+            return Sequence::VariantMatrix(std::move(g), std::move(p),
+                                           r.max_allele);
+        }
+
+        // The statistics for the next batch of replicates, or
+        // None when all replicates have been read.  Each
+        // replicate is parsed and summarized by one thread,
+        // and its genotypes are discarded immediately.
+        py::object
+        next_statistics(const bool garud)
+        {
+            if (busy)
+                {
+                    throw std::runtime_error(
+                        "reader is in use by another thread");
+                }
+            const std::size_t first = next_replicate;
+            const std::size_t n
+                = std::min(batch_size, offsets.size() - first);
+            if (n == 0)
+                {
+                    return py::none();
+                }
+            std::vector<MsStatistics> stats(n);
+            busy = true;
+            try
+                {
+                    py::gil_scoped_release release;
+                    parallel_for(
+                        n, nthreads, 1,
+                        [&](const std::size_t begin, const std::size_t end) {
+                            for (std::size_t i = begin; i < end; ++i)
+                                {
+                                    // Replicates already parsed by
+                                    // __next__ are not parsed again.
+                                    if (i < batch.size())
+                                        {
+                                            stats[i] = ms_statistics(batch[i],
+                                                                     garud);
+                                            continue;
+                                        }
+                                    const std::size_t r = first + i;
+                                    const std::size_t stop
+                                        = r + 1 < offsets.size()
+                                              ? offsets[r + 1]
+                                              : size;
+                                    stats[i] = ms_statistics(
+                                        parse_ms_replicate(data + offsets[r],
+                                                           data + stop),
+                                        garud);
+                                }
+                        });
+                }
+            catch (...)
+                {
+                    busy = false;
+                    throw;
+                }
+            busy = false;
+            batch.erase(batch.begin(),
+                        batch.begin() + std::min(n, batch.size()));
+            next_replicate += n;
+            auto names = ms_statistic_names(garud);
+            names.insert(names.begin(), "rep");
+            std::vector<bool> is_integer(names.size(), false);
+            for (std::size_t i = 0; i < names.size(); ++i)
+                {
+                    is_integer[i] = names[i] == "rep" || names[i] == "S"
+                                    || names[i] == "singletons"
+                                    || names[i] == "dsingletons";
+                }
+            std::vector<double> values;
+            values.reserve(n * names.size());
+            for (std::size_t i = 0; i < n; ++i)
+                {
+                    values.push_back(static_cast<double>(first + i));
+                    append_ms_statistics(stats[i], garud, values);
+                }
+            return make_structured_array(names, is_integer, values, n);
+        }
+    };
+} // namespace
+
+void
+init_ms_reader(py::module &m)
+{
+    py::class_<MsFormatReader>(m, "MsFormatReader",
+                               R"delim(
+        Iterate over the replicates in "ms"-format data,
+        such as the output of ms or msprime.
+
+        :param source: A file name, an open file descriptor, or a bytes-like object.
+        :param nthreads: (1) Number of threads to use for parsing.  If 0, use all available cores.
+        :param batch_size: (0) Number of replicates to parse at a time.  If 0, 16 per thread are used.
+
+        Iteration yields one :class:`libsequence.VariantMatrix`
+        per replicate, whose data and positions are stored in numpy
+        arrays.
+
+        Files are memory-mapped, and the start of every replicate
+        is found when the reader is created.  Replicates are then
+        parsed in batches, using several threads, so that memory
+        use is proportional to the batch size rather than to the
+        size of the input.  File descriptors must refer to regular
+        files, so standard input may only be used when redirected
+        from a file.
+
+        The number of replicates is given by len().
+
+        .. versionadded:: 0.2.4
+
+        >>> import libsequence
+        >>> ms = b"ms 2 1 -s 2\n1 2 3\n\n//\nsegsites: 2\npositions: 0.1 0.5\n01\n10\n"
+        >>> for vm in libsequence.MsFormatReader(ms):
+        ...     print(vm.nsites, vm.nsam)
+        2 2
+        )delim")
+        .def(py::init<py::object, unsigned, std::size_t>(), py::arg("source"),
+             py::arg("nthreads") = 1, py::arg("batch_size") = 0)
+        .def("__len__", &MsFormatReader::nreplicates)
+        .def("__iter__",
+             [](MsFormatReader &self) -> MsFormatReader & { return self; })
+        .def("__next__", &MsFormatReader::next)
+        .def("next_statistics", &MsFormatReader::next_statistics,
+             R"delim(
+             Calculate the statistics reported by msstats for the
+             next batch of replicates.
+
+             :param garud: (False) Also calculate H1, H12, and H2/H1.
+
+             :rtype: numpy.ndarray or None
+
+             The return value is a structured array with one record
+             per replicate and fields rep, thetapi, thetaw, thetah,
+             tajd, S, singletons, and dsingletons, followed by H1, H12,
+             and H2H1 if garud is True.  The ancestral state is 0.
+             Replicates are processed in parallel and their genotypes
+             are not kept, so memory use is bounded by the batch size.
+             None is returned once all replicates have been read.
+
+             The H statistics are those of Garud et al. (2015),
+             calculated from haplotype frequencies.  Haplotypes
+             with missing data are excluded.
+             )delim",
+             py::arg("garud") = false);
+}
@@ -0,0 +1,214 @@
+#ifndef PYLIBSEQ_MSFORMAT_READER_HPP
+#define PYLIBSEQ_MSFORMAT_READER_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "mapped_file.hpp"
+#include "parallel.hpp"
+
+// Parsing of "ms"-format output, as written by ms, msprime,
+// and related simulators, from an in-memory buffer.  The
+// buffer is usually a memory-mapped file.  Replicates start
+// with a line beginning with "//", and the boundaries of all
+// replicates are found before any are parsed, so that
+// replicates may then be parsed independently.
+
+struct MsReplicate
+{
+    std::size_t nsites, nsam;
+    std::int8_t max_allele;
+    std::vector<double> positions;
+    // Row-major nsites x nsam
+    std::vector<std::int8_t> genotypes;
+};
+
+// The offsets of all lines beginning with "//".  Chunks
+// of the buffer are searched in parallel.
+inline std::vector<std::size_t>
+find_ms_replicates(const char *data, const std::size_t size,
+                   const unsigned nthreads)
+{
+    const std::size_t nchunks
+        = size < (1u << 20) ? 1 : std::size_t(4) * resolve_nthreads(nthreads);
+    const std::size_t chunk_size = (size + nchunks - 1) / nchunks;
+    std::vector<std::vector<std::size_t>> found(nchunks);
+    parallel_for(nchunks, nthreads, 1,
+                 [&](const std::size_t begin, const std::size_t end) {
+                     for (std::size_t c = begin; c < end; ++c)
+                         {
+                             // Offsets of line starts in [first, last)
+                             const std::size_t first = c * chunk_size;
+                             const std::size_t last
+                                 = std::min(size, first + chunk_size);
+                             std::size_t p = first;
+                             if (p > 0 && data[p - 1] != '\n')
+                                 {
+                                     const void *nl = std::memchr(
+                                         data + p, '\n', last - p);
+                                     p = nl ? static_cast<const char *>(nl)
+                                                  - data + 1
+                                            : last;
+                                 }
+                             while (p < last)
+                                 {
+                                     if (p + 1 < size && data[p] == '/'
+                                         && data[p + 1] == '/')
+                                         {
+                                             found[c].push_back(p);
+                                         }
+                                     const void *nl = std::memchr(
+                                         data + p, '\n', size - p);
+                                     if (!nl)
+                                         {
+                                             break;
+                                         }
+                                     p = static_cast<const char *>(nl) - data
+                                         + 1;
+                                 }
+                         }
+                 });
+    std::vector<std::size_t> offsets;
+    for (auto &f : found)
+        {
+            offsets.insert(offsets.end(), f.begin(), f.end());
+        }
+    return offsets;
+}
+
+namespace msformat_detail
+{
+    // The line starting at p, excluding any trailing
+    // newline and carriage return, and the start of the
+    // next line.
+    inline const char *
+    next_line(const char *p, const char *end, const char *&line_end)
+    {
+        const void *nl = std::memchr(p, '\n', end - p);
+        const char *next = nl ? static_cast<const char *>(nl) + 1 : end;
+        line_end = nl ? static_cast<const char *>(nl) : end;
+        if (line_end > p && line_end[-1] == '\r')
+            {
+                --line_end;
+            }
+        return next;
+    }
+
+    inline bool
+    starts_with(const char *p, const char *line_end, const char *prefix)
+    {
+        const std::size_t n = std::strlen(prefix);
+        return static_cast<std::size_t>(line_end - p) >= n
+               && std::memcmp(p, prefix, n) == 0;
+    }
+} // namespace msformat_detail
+
+// Parse the replicate in [begin, end), where begin
+// points to the "//" line.
+inline MsReplicate
+parse_ms_replicate(const char *begin, const char *end)
+{
+    using namespace msformat_detail;
+    MsReplicate rv{ 0, 0, 0, {}, {} };
+    const char *line_end = nullptr;
+    // Skip the "//" line and any trees, to the segsites line
+    const char *p = next_line(begin, end, line_end);
+    for (;;)
+        {
+            if (p >= end)
+                {
+                    throw std::invalid_argument(
+                        "ms replicate has no segsites line");
+                }
+            const char *next = next_line(p, end, line_end);
+            if (starts_with(p, line_end, "segsites:"))
+                {
+                    const std::string s(p + 9, line_end);
+                    char *parsed_end = nullptr;
+                    const long nsites = std::strtol(s.c_str(), &parsed_end, 10);
+                    if (parsed_end == s.c_str() || nsites < 0)
+                        {
+                            throw std::invalid_argument(
+                                "invalid segsites line");
+                        }
+                    rv.nsites = static_cast<std::size_t>(nsites);
+                    p = next;
+                    break;
+                }
+            p = next;
+        }
+    if (rv.nsites == 0)
+        {
+            return rv;
+        }
+    const char *next = next_line(p, end, line_end);
+    if (!starts_with(p, line_end, "positions:"))
+        {
+            throw std::invalid_argument("ms replicate has no positions line");
+        }
+    {
+        // strtod needs a terminated string
+        const std::string s(p + 10, line_end);
+        const char *q = s.c_str();
+        rv.positions.reserve(rv.nsites);
+        for (std::size_t i = 0; i < rv.nsites; ++i)
+            {
+                char *parsed_end = nullptr;
+                const double x = std::strtod(q, &parsed_end);
+                if (parsed_end == q)
+                    {
+                        throw std::invalid_argument(
+                            "fewer positions than segregating sites");
+                    }
+                rv.positions.push_back(x);
+                q = parsed_end;
+            }
+    }
+    p = next;
+    // Haplotypes are the non-empty lines before the end
+    // of the replicate.
+    std::vector<const char *> haplotypes;
+    while (p < end)
+        {
+            next = next_line(p, end, line_end);
+            if (line_end > p)
+                {
+                    if (static_cast<std::size_t>(line_end - p) != rv.nsites)
+                        {
+                            throw std::invalid_argument(
+                                "haplotype length does not equal the number "
+                                "of segregating sites");
+                        }
+                    haplotypes.push_back(p);
+                }
+            p = next;
+        }
+    rv.nsam = haplotypes.size();
+    rv.genotypes.resize(rv.nsites * rv.nsam);
+    std::int8_t max_allele = 0;
+    for (std::size_t j = 0; j < rv.nsam; ++j)
+        {
+            const char *h = haplotypes[j];
+            for (std::size_t i = 0; i < rv.nsites; ++i)
+                {
+                    const int x = h[i] - '0';
+                    if (x < 0 || x > 9)
+                        {
+                            throw std::invalid_argument(
+                                "invalid character in haplotype");
+                        }
+                    rv.genotypes[i * rv.nsam + j] = static_cast<std::int8_t>(x);
+                    max_allele = std::max(max_allele,
+                                          static_cast<std::int8_t>(x));
+                }
+        }
+    rv.max_allele = max_allele;
+    return rv;
+}
+
+#endif
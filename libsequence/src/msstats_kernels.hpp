@@ -0,0 +1,181 @@
+#ifndef PYLIBSEQ_MSSTATS_KERNELS_HPP
+#define PYLIBSEQ_MSSTATS_KERNELS_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+#include "haplotype_windows.hpp"
+#include "msformat_reader.hpp"
+#include "packed_genotypes.hpp"
+#include "summstats_kernels.hpp"
+
+// The statistics reported by msstats for one replicate of
+// "ms"-format data, where state 0 is ancestral.  Each
+// replicate is processed by a single thread, so that many
+// replicates may be processed at once.
+
+struct MsStatistics
+{
+    double thetapi, thetaw, thetah, tajd;
+    std::int64_t S, singletons, dsingletons;
+    double H1, H12, H2H1;
+};
+
+inline const std::vector<std::string> &
+ms_statistic_names(const bool garud)
+{
+    static const std::vector<std::string> classic{
+        "thetapi", "thetaw", "thetah", "tajd", "S", "singletons", "dsingletons"
+    };
+    static const std::vector<std::string> all{
+        "thetapi", "thetaw",      "thetah", "tajd", "S",   "singletons",
+        "dsingletons", "H1", "H12", "H2H1"
+    };
+    return garud ? all : classic;
+}
+
+// Haplotype labels for data that are not all 0/1.
+// Haplotypes with missing data are labelled -1.
+inline std::vector<std::int32_t>
+genotype_label_haplotypes(const std::int8_t *data, const std::size_t nsites,
+                          const std::size_t nsam)
+{
+    std::vector<std::string> haplotypes(nsam, std::string(nsites, '\0'));
+    std::vector<bool> missing(nsam, false);
+    for (std::size_t i = 0; i < nsites; ++i)
+        {
+            const std::int8_t *row = data + i * nsam;
+            for (std::size_t j = 0; j < nsam; ++j)
+                {
+                    haplotypes[j][i] = static_cast<char>(row[j]);
+                    if (row[j] < 0)
+                        {
+                            missing[j] = true;
+                        }
+                }
+        }
+    std::vector<std::int32_t> labels(nsam, -1);
+    std::map<std::string, std::int32_t> seen;
+    for (std::size_t j = 0; j < nsam; ++j)
+        {
+            if (!missing[j])
+                {
+                    const auto next = static_cast<std::int32_t>(seen.size());
+                    labels[j] = seen.insert(std::make_pair(haplotypes[j], next))
+                                    .first->second;
+                }
+        }
+    return labels;
+}
+
+// Haplotypes labelled -1 are not counted.
+inline HaplotypeStatistics
+haplotype_statistics_from_labels(const std::vector<std::int32_t> &labels)
+{
+    std::vector<std::int64_t> counts;
+    for (auto l : labels)
+        {
+            if (l >= 0)
+                {
+                    if (static_cast<std::size_t>(l) >= counts.size())
+                        {
+                            counts.resize(l + 1, 0);
+                        }
+                    ++counts[l];
+                }
+        }
+    return haplotype_statistics_from_counts(counts);
+}
+
+// Haplotype labels of row-major nsites x nsam genotypes,
+// using packed bits when all states are 0, 1, or missing.
+inline std::vector<std::int32_t>
+label_genotype_haplotypes(const std::int8_t *data, const std::size_t nsites,
+                          const std::size_t nsam)
+{
+    PackedSites g(nsites, nsam);
+    return pack_binary_genotypes(data, g)
+               ? packed_label_haplotypes(g)
+               : genotype_label_haplotypes(data, nsites, nsam);
+}
+
+inline MsStatistics
+ms_statistics(const MsReplicate &r, const bool garud)
+{
+    MsStatistics s{ 0., 0., 0., 0., 0, 0, 0, 0., 0., 0. };
+    const auto tables = shared_harmonic_sums(r.nsam);
+    const HarmonicSums &h = *tables;
+    SiteSums sums;
+    std::vector<std::int32_t> scratch(128, 0);
+    for (std::size_t i = 0; i < r.nsites; ++i)
+        {
+            const std::int8_t *site = r.genotypes.data() + i * r.nsam;
+            int maxstate = -1;
+            for (std::size_t j = 0; j < r.nsam; ++j)
+                {
+                    if (site[j] >= 0)
+                        {
+                            ++scratch[site[j]];
+                            maxstate = std::max(maxstate, int(site[j]));
+                        }
+                }
+            const std::size_t ncol = static_cast<std::size_t>(maxstate + 1);
+            const std::int64_t nvariable = sums.nvariable_sites;
+            accumulate_site(scratch.data(), ncol, 0, h, sums);
+            if (sums.nvariable_sites > nvariable)
+                {
+                    bool singleton = false, derived_singleton = false;
+                    for (std::size_t k = 0; k < ncol; ++k)
+                        {
+                            if (scratch[k] == 1)
+                                {
+                                    singleton = true;
+                                    derived_singleton |= (k != 0);
+                                }
+                        }
+                    s.singletons += singleton;
+                    s.dsingletons += derived_singleton;
+                }
+            std::fill(scratch.begin(), scratch.begin() + ncol, 0);
+        }
+    s.thetapi = sums.thetapi;
+    s.thetaw = sums.thetaw;
+    s.thetah = sums.thetah;
+    s.S = sums.nvariable_sites;
+    s.tajd = tajd_from_sums(sums);
+    if (garud)
+        {
+            const auto h = haplotype_statistics_from_labels(
+                label_genotype_haplotypes(r.genotypes.data(), r.nsites,
+                                          r.nsam));
+            s.H1 = h.H1;
+            s.H12 = h.H12;
+            s.H2H1 = h.H2H1;
+        }
+    return s;
+}
+
+// Append the values of s, in the order of ms_statistic_names
+inline void
+append_ms_statistics(const MsStatistics &s, const bool garud,
+                     std::vector<double> &values)
+{
+    values.push_back(s.thetapi);
+    values.push_back(s.thetaw);
+    values.push_back(s.thetah);
+    values.push_back(s.tajd);
+    values.push_back(static_cast<double>(s.S));
+    values.push_back(static_cast<double>(s.singletons));
+    values.push_back(static_cast<double>(s.dsingletons));
+    if (garud)
+        {
+            values.push_back(s.H1);
+            values.push_back(s.H12);
+            values.push_back(s.H2H1);
+        }
+}
+
+#endif
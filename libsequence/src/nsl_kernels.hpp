@@ -0,0 +1,383 @@
+#ifndef PYLIBSEQ_NSL_KERNELS_HPP
+#define PYLIBSEQ_NSL_KERNELS_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+#include "packed_genotypes.hpp"
+#include "parallel.hpp"
+
+// nSL and iHS (Ferrer-Admetlla et al. 2014) for every core
+// site in one sweep over pairs of samples.
+//
+// For a core site c and a pair of samples with the same
+// state at c, the shared haplotype extends from the closest
+// site to the left of c at which the pair differs, l, to the
+// closest such site to the right, r.  Pairs for which either
+// end is not found are not counted.  The pair contributes
+// r - l - 1 sites to nSL and the distance from position l to
+// position r to iHS, and the statistics are the log ratio
+// of the mean contributions of pairs carrying the reference
+// state to that of pairs carrying another state.
+//
+// All cores between two consecutive differences of a pair
+// share the same l and r, so rather than extending the
+// haplotypes around each core, the differences of each pair
+// are enumerated once, and the contribution to the interval
+// of cores between them is added to difference arrays.
+// The cost is O(D + P * nsites / w + nsam * nsites), where D
+// is the total number of differences over the P pairs, and
+// w is 64 for bit-packed data and 8 otherwise.  The word
+// scan only finds the differences; each is then handled
+// individually, so D dominates for diverse samples.
+// Pairs are processed in parallel by rows of the upper
+// triangle, and each thread accumulates into its own sums.
+
+struct nSLScanResult
+{
+    double nsl, ihs;
+    std::int32_t core_count;
+};
+
+namespace nsl_detail
+{
+    // Samples as contiguous rows of int8 states over sites,
+    // for data that cannot be bit-packed.
+    class GenotypeSamples
+    {
+      private:
+        std::vector<std::int8_t> rows;
+
+      public:
+        std::size_t nsites, nsam;
+
+        GenotypeSamples(const std::int8_t *data, const std::size_t nsites_,
+                        const std::size_t nsam_)
+            : rows(nsites_ * nsam_), nsites(nsites_), nsam(nsam_)
+        {
+            for (std::size_t i = 0; i < nsites; ++i)
+                {
+                    for (std::size_t j = 0; j < nsam; ++j)
+                        {
+                            rows[j * nsites + i] = data[i * nsam + j];
+                        }
+                }
+        }
+
+        std::int8_t
+        state(const std::size_t i, const std::size_t site) const
+        {
+            return rows[i * nsites + site];
+        }
+
+        // Apply f(site) to each site at which samples i
+        // and j differ, in increasing order.
+        template <typename F>
+        void
+        for_each_difference(const std::size_t i, const std::size_t j,
+                            const F &f) const
+        {
+            const std::int8_t *a = rows.data() + i * nsites;
+            const std::int8_t *b = rows.data() + j * nsites;
+            std::size_t k = 0;
+            for (; k + 8 <= nsites; k += 8)
+                {
+                    std::uint64_t x, y;
+                    std::memcpy(&x, a + k, 8);
+                    std::memcpy(&y, b + k, 8);
+                    if (x != y)
+                        {
+                            for (std::size_t s = k; s < k + 8; ++s)
+                                {
+                                    if (a[s] != b[s])
+                                        {
+                                            f(s);
+                                        }
+                                }
+                        }
+                }
+            for (; k < nsites; ++k)
+                {
+                    if (a[k] != b[k])
+                        {
+                            f(k);
+                        }
+                }
+        }
+    };
+
+    // Bit-packed samples, for data whose states are 0, 1, or
+    // missing.  Missing data differ from any other state, and
+    // two missing values do not differ, as for GenotypeSamples.
+    class BinarySamples
+    {
+      private:
+        PackedSamples h;
+
+      public:
+        explicit BinarySamples(const PackedSites &g) : h(g) {}
+
+        std::int8_t
+        state(const std::size_t i, const std::size_t site) const
+        {
+            const std::size_t w = i * h.nwords + site / 64;
+            const std::uint64_t bit = std::uint64_t(1) << (site % 64);
+            if (!h.missing_bits.empty() && (h.missing_bits[w] & bit))
+                {
+                    return -1;
+                }
+            return (h.bits[w] & bit) ? 1 : 0;
+        }
+
+        template <typename F>
+        void
+        for_each_difference(const std::size_t i, const std::size_t j,
+                            const F &f) const
+        {
+            const std::uint64_t *a = h.sample(i), *b = h.sample(j);
+            const std::uint64_t *ma = h.missing(i), *mb = h.missing(j);
+            for (std::size_t w = 0; w < h.nwords; ++w)
+                {
+                    std::uint64_t x = a[w] ^ b[w];
+                    if (ma)
+                        {
+                            x |= ma[w] ^ mb[w];
+                        }
+                    for (; x; x &= x - 1)
+                        {
+                            f(64 * w + count_trailing_zeros64(x));
+                        }
+                }
+        }
+    };
+
+    // Running sums for the cores of one sample, i, over the
+    // pairs (i, j), stored as difference arrays.
+    struct PairSums
+    {
+        std::vector<std::int64_t> length, npairs;
+        std::vector<double> distance;
+
+        explicit PairSums(const std::size_t nsites)
+            : length(nsites + 1, 0), npairs(nsites + 1, 0),
+              distance(nsites + 1, 0.)
+        {
+        }
+
+        // Add sign times the contribution of a pair,
+        // l sites and distance d, to cores [first, last)
+        void
+        add(const std::size_t first, const std::size_t last,
+            const std::int64_t l, const double d, const std::int64_t sign)
+        {
+            length[first] += sign * l;
+            length[last] -= sign * l;
+            npairs[first] += sign;
+            npairs[last] -= sign;
+            distance[first] += static_cast<double>(sign) * d;
+            distance[last] -= static_cast<double>(sign) * d;
+        }
+    };
+
+    // Sums by core for pairs carrying the reference state
+    // (group 0) and any other state (group 1).
+    struct CoreSums
+    {
+        std::vector<std::int64_t> length[2], npairs[2];
+        std::vector<double> distance[2];
+
+        explicit CoreSums(const std::size_t nsites)
+        {
+            for (int g = 0; g < 2; ++g)
+                {
+                    length[g].assign(nsites, 0);
+                    npairs[g].assign(nsites, 0);
+                    distance[g].assign(nsites, 0.);
+                }
+        }
+
+        CoreSums &
+        operator+=(const CoreSums &rhs)
+        {
+            for (int g = 0; g < 2; ++g)
+                {
+                    for (std::size_t c = 0; c < length[g].size(); ++c)
+                        {
+                            length[g][c] += rhs.length[g][c];
+                            npairs[g][c] += rhs.npairs[g][c];
+                            distance[g][c] += rhs.distance[g][c];
+                        }
+                }
+            return *this;
+        }
+    };
+
+    // Add the pairs (i, j), j > i, to sums.  Only
+    // differences at sites where breaks[site] is true end
+    // a shared haplotype.  breaks may be empty, meaning that
+    // all sites may end a haplotype.
+    template <typename Samples>
+    inline void
+    add_sample_pairs(const Samples &samples, const std::size_t nsites,
+                     const std::size_t nsam,
+                     const std::size_t i, const std::int8_t refstate,
+                     const double *positions, const std::vector<bool> &breaks,
+                     PairSums &pairs, std::vector<std::size_t> &pending,
+                     CoreSums &sums)
+    {
+        std::fill(pairs.length.begin(), pairs.length.end(), 0);
+        std::fill(pairs.npairs.begin(), pairs.npairs.end(), 0);
+        std::fill(pairs.distance.begin(), pairs.distance.end(), 0.);
+        for (std::size_t j = i + 1; j < nsam; ++j)
+            {
+                // Differences that do not end the haplotype are
+                // cores at which the pair does not share a state.
+                bool have_left = false;
+                std::size_t left = 0;
+                pending.clear();
+                samples.for_each_difference(i, j, [&](const std::size_t d) {
+                    if (!breaks.empty() && !breaks[d])
+                        {
+                            if (have_left)
+                                {
+                                    pending.push_back(d);
+                                }
+                            return;
+                        }
+                    if (have_left && d > left + 1)
+                        {
+                            const auto l = static_cast<std::int64_t>(
+                                d - left - 1);
+                            const double dist = positions[d] - positions[left];
+                            pairs.add(left + 1, d, l, dist, 1);
+                            for (auto p : pending)
+                                {
+                                    pairs.add(p, p + 1, l, dist, -1);
+                                }
+                        }
+                    pending.clear();
+                    have_left = true;
+                    left = d;
+                });
+            }
+        std::int64_t length = 0, npairs = 0;
+        double distance = 0.;
+        for (std::size_t c = 0; c < nsites; ++c)
+            {
+                length += pairs.length[c];
+                npairs += pairs.npairs[c];
+                distance += pairs.distance[c];
+                const std::int8_t state = samples.state(i, c);
+                if (state < 0 || npairs == 0)
+                    {
+                        continue;
+                    }
+                const int g = state == refstate ? 0 : 1;
+                sums.length[g][c] += length;
+                sums.npairs[g][c] += npairs;
+                sums.distance[g][c] += distance;
+            }
+    }
+
+    template <typename Samples>
+    inline CoreSums
+    scan_pairs(const Samples &samples, const std::size_t nsites, const std::size_t nsam,
+               const std::int8_t refstate, const double *positions,
+               const std::vector<bool> &breaks, const unsigned nthreads)
+    {
+        // One set of sums per thread.  Rows of the upper
+        // triangle are dealt out in turn, which balances the
+        // number of pairs per thread.
+        const std::size_t nchunks = std::max<std::size_t>(
+            1, std::min<std::size_t>(resolve_nthreads(nthreads), nsam));
+        std::vector<CoreSums> partial(nchunks, CoreSums(0));
+        parallel_for(
+            nchunks, nthreads, 1,
+            [&](const std::size_t begin, const std::size_t end) {
+                for (std::size_t chunk = begin; chunk < end; ++chunk)
+                    {
+                        CoreSums sums(nsites);
+                        PairSums pairs(nsites);
+                        std::vector<std::size_t> pending;
+                        for (std::size_t i = chunk; i < nsam; i += nchunks)
+                            {
+                                add_sample_pairs(samples, nsites, nsam, i, refstate, positions,
+                                                 breaks, pairs, pending, sums);
+                            }
+                        partial[chunk] = std::move(sums);
+                    }
+            });
+        CoreSums rv(std::move(partial[0]));
+        for (std::size_t chunk = 1; chunk < nchunks; ++chunk)
+            {
+                rv += partial[chunk];
+            }
+        return rv;
+    }
+} // namespace nsl_detail
+
+// nSL and iHS for all sites of row-major nsites x nsam
+// data.  Positions may be physical or genetic.  If x is
+// non-negative, only sites where the number of non-missing,
+// non-reference states is at most x end a shared haplotype.
+inline std::vector<nSLScanResult>
+nsl_scan(const std::int8_t *data, const std::size_t nsites,
+         const std::size_t nsam, const std::int8_t refstate,
+         const double *positions, const int x, const unsigned nthreads)
+{
+    using namespace nsl_detail;
+    std::vector<nSLScanResult> rv(nsites);
+    std::vector<bool> breaks;
+    if (x >= 0)
+        {
+            breaks.resize(nsites);
+        }
+    for (std::size_t c = 0; c < nsites; ++c)
+        {
+            std::int32_t n = 0;
+            const std::int8_t *site = data + c * nsam;
+            for (std::size_t j = 0; j < nsam; ++j)
+                {
+                    n += (site[j] >= 0 && site[j] != refstate);
+                }
+            rv[c].core_count = n;
+            if (x >= 0)
+                {
+                    breaks[c] = n <= x;
+                }
+        }
+    if (nsites == 0)
+        {
+            return rv;
+        }
+    PackedSites g(nsites, nsam);
+    const CoreSums sums
+        = pack_binary_genotypes(data, g)
+              ? scan_pairs(BinarySamples(g), nsites, nsam, refstate,
+                           positions, breaks, nthreads)
+              : scan_pairs(GenotypeSamples(data, nsites, nsam), nsites, nsam,
+                           refstate, positions, breaks, nthreads);
+    // Means of zero pairs are NaN
+    auto mean = [](const double sum, const std::int64_t n) {
+        return n > 0 ? sum / static_cast<double>(n)
+                     : std::numeric_limits<double>::quiet_NaN();
+    };
+    for (std::size_t c = 0; c < nsites; ++c)
+        {
+            rv[c].nsl
+                = std::log(mean(static_cast<double>(sums.length[0][c]),
+                                sums.npairs[0][c]))
+                  - std::log(mean(static_cast<double>(sums.length[1][c]),
+                                  sums.npairs[1][c]));
+            rv[c].ihs = std::log(mean(sums.distance[0][c], sums.npairs[0][c]))
+                        - std::log(mean(sums.distance[1][c],
+                                        sums.npairs[1][c]));
+        }
+    return rv;
+}
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef PYLIBSEQ_NUMPY_HELPERS_HPP
+#define PYLIBSEQ_NUMPY_HELPERS_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+
+namespace py = pybind11;
+
+using AncestralStates
+    = py::array_t<std::int8_t, py::array::c_style | py::array::forcecast>;
+
+// Build a numpy structured array from a row-major buffer
+// of nrecords x names.size() values.  Fields flagged as
+// integers are stored as int64, and the rest as float64.
+inline py::array
+make_structured_array(const std::vector<std::string> &names,
+                      const std::vector<bool> &is_integer,
+                      const std::vector<double> &values,
+                      const std::size_t nrecords)
+{
+    if (values.size() != nrecords * names.size())
+        {
+            throw std::invalid_argument("incorrect number of values");
+        }
+    py::list fields;
+    for (std::size_t i = 0; i < names.size(); ++i)
+        {
+            fields.append(py::make_tuple(names[i], is_integer[i] ? "i8" : "f8"));
+        }
+    std::vector<std::size_t> shape{ nrecords };
+    py::array rv(py::dtype::from_args(fields), shape);
+    auto p = static_cast<char *>(rv.mutable_data());
+    auto v = values.begin();
+    for (std::size_t r = 0; r < nrecords; ++r)
+        {
+            for (std::size_t i = 0; i < names.size(); ++i, ++v, p += 8)
+                {
+                    if (is_integer[i])
+                        {
+                            auto x = static_cast<std::int64_t>(*v);
+                            std::memcpy(p, &x, 8);
+                        }
+                    else
+                        {
+                            std::memcpy(p, &*v, 8);
+                        }
+                }
+        }
+    return rv;
+}
+
+// Convert None, a single value, or an array-like object
+// into ancestral states whose data may be read with the
+// GIL released. The size of the return value is 0 for
+// None, 1 for a single value, and nsites otherwise.
+inline AncestralStates
+ancestral_states_from_object(py::object o, const std::size_t nsites)
+{
+    if (o.is_none())
+        {
+            return AncestralStates(std::vector<std::size_t>{ 0 });
+        }
+    auto rv = AncestralStates::ensure(o);
+    if (!rv)
+        {
+            throw std::invalid_argument("invalid ancestral states");
+        }
+    if (rv.size() != 1 && static_cast<std::size_t>(rv.size()) != nsites)
+        {
+            throw std::invalid_argument(
+                "number of ancestral states must be one or equal to the "
+                "number of sites");
+        }
+    return rv;
+}
+
+// Convert None or an array-like object of site indexes
+// into a vector.  None means all sites.  Indexes must be
+// in range and strictly increasing.
+inline std::vector<std::size_t>
+site_indexes_from_object(py::object o, const std::size_t nsites)
+{
+    std::vector<std::size_t> rv;
+    if (o.is_none())
+        {
+            rv.resize(nsites);
+            for (std::size_t i = 0; i < nsites; ++i)
+                {
+                    rv[i] = i;
+                }
+            return rv;
+        }
+    auto a = py::array_t<std::int64_t,
+                         py::array::c_style | py::array::forcecast>::ensure(o);
+    if (!a || a.ndim() != 1)
+        {
+            throw std::invalid_argument(
+                "site indexes must be a one-dimensional array");
+        }
+    const auto n = static_cast<std::size_t>(a.size());
+    rv.reserve(n);
+    for (std::size_t i = 0; i < n; ++i)
+        {
+            const std::int64_t x = a.data()[i];
+            if (x < 0 || static_cast<std::size_t>(x) >= nsites)
+                {
+                    throw std::out_of_range("site index out of range");
+                }
+            if (!rv.empty() && static_cast<std::size_t>(x) <= rv.back())
+                {
+                    throw std::invalid_argument(
+                        "site indexes must be strictly increasing");
+                }
+            rv.push_back(static_cast<std::size_t>(x));
+        }
+    return rv;
+}
+
+// A numpy array taking ownership of the contents of v.
+// No data are copied.
+template <typename T>
+inline py::array_t<T>
+numpy_from_vector(std::vector<T> &&v, const std::vector<std::size_t> &shape)
+{
+    auto owner = new std::vector<T>(std::move(v));
+    py::capsule base(owner, [](void *p) {
+        delete reinterpret_cast<std::vector<T> *>(p);
+    });
+    return py::array_t<T>(shape, owner->data(), base);
+}
+
+#endif
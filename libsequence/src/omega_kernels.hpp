@@ -0,0 +1,210 @@
+#ifndef PYLIBSEQ_OMEGA_KERNELS_HPP
+#define PYLIBSEQ_OMEGA_KERNELS_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+#include "ld_kernels.hpp"
+#include "parallel.hpp"
+
+// The omega statistic of Kim and Nielsen (2004) over windows
+// of consecutive sites.  For a window of n sites split into
+// the first l sites and the remaining n - l sites,
+//
+// omega = [(sum L + sum R) / (C(l, 2) + C(n - l, 2))]
+//         / [sum LR / (l (n - l))],
+//
+// where sum L and sum R are the sums of r^2 over pairs of sites
+// on the same side of the split and sum LR is the sum over pairs
+// spanning it.  All three sums are differences of a cumulative
+// 2-D table of r^2, so each split costs O(1).
+
+struct OmegaMaxWindow
+{
+    std::size_t first, last;
+    double omega_max, position;
+};
+
+// r^2 for all pairs of sites at most width - 1 sites apart,
+// within a range [begin, end) of sites.  Pairs involving
+// sites that are not usable at mincount have r^2 = 0.
+class RsqBand
+{
+  private:
+    std::size_t begin, end, width;
+    std::vector<double> band;
+
+  public:
+    RsqBand() : begin(0), end(0), width(0), band() {}
+
+    void
+    assign(const BiallelicSites &sites, const std::size_t begin_,
+           const std::size_t end_, const std::size_t width_,
+           const std::int32_t mincount)
+    {
+        begin = begin_;
+        end = end_;
+        width = width_;
+        band.assign((end - begin) * width, 0.);
+        for (std::size_t x = begin; x < end; ++x)
+            {
+                if (!sites.usable(x, mincount))
+                    {
+                        continue;
+                    }
+                double *row = band.data() + (x - begin) * width;
+                const std::size_t ymax = std::min(end, x + width);
+                for (std::size_t y = x + 1; y < ymax; ++y)
+                    {
+                        if (sites.usable(y, mincount))
+                            {
+                                row[y - x - 1] = pairwise_ld(sites, x, y).rsq;
+                            }
+                    }
+            }
+    }
+
+    // Requires begin <= x < y < end and y - x < width.
+    double
+    operator()(const std::size_t x, const std::size_t y) const
+    {
+        return band[(x - begin) * width + (y - x - 1)];
+    }
+};
+
+// Element (i, j) is the sum of r^2 over pairs x < y
+// of local sites with x < i and y < j.
+class CumulativeRsq
+{
+  private:
+    std::size_t n;
+    std::vector<double> table;
+
+  public:
+    CumulativeRsq() : n(0), table() {}
+
+    void
+    assign(const RsqBand &band, const std::size_t first,
+           const std::size_t last)
+    {
+        n = last - first;
+        table.assign((n + 1) * (n + 1), 0.);
+        for (std::size_t i = 0; i < n; ++i)
+            {
+                const double *previous = table.data() + i * (n + 1);
+                double *current = table.data() + (i + 1) * (n + 1);
+                double row_sum = 0.;
+                for (std::size_t j = 0; j <= n; ++j)
+                    {
+                        if (j > i + 1)
+                            {
+                                row_sum += band(first + i, first + j - 1);
+                            }
+                        current[j] = previous[j] + row_sum;
+                    }
+            }
+    }
+
+    double
+    operator()(const std::size_t i, const std::size_t j) const
+    {
+        return table[i * (n + 1) + j];
+    }
+};
+
+// Maximize omega over the splits of the window [first, last).
+// As in omega_max for SimData, the last site to the left of
+// the split must not be the first site of the window and must
+// have a minor allele count of at least mincount.  The position
+// of that site is reported.
+inline OmegaMaxWindow
+omega_max_window(const CumulativeRsq &c, const BiallelicSites &sites,
+                 const double *positions, const std::size_t first,
+                 const std::size_t last, const std::int32_t mincount)
+{
+    const std::size_t n = last - first;
+    OmegaMaxWindow rv{ first, last, std::numeric_limits<double>::quiet_NaN(),
+                       std::numeric_limits<double>::quiet_NaN() };
+    if (n < 3)
+        {
+            return rv;
+        }
+    const double total = c(n, n);
+    double best = -std::numeric_limits<double>::infinity();
+    for (std::size_t l = 2; l < n; ++l)
+        {
+            if (!sites.usable(first + l - 1, mincount))
+                {
+                    continue;
+                }
+            const double left = c(l, l);
+            const double cross = c(l, n) - left;
+            const double right = total - c(l, n);
+            const double dl = static_cast<double>(l),
+                         dr = static_cast<double>(n - l);
+            const double numerator = (left + right)
+                                     / (dl * (dl - 1.) / 2. + dr * (dr - 1.) / 2.);
+            const double denominator = cross / (dl * dr);
+            const double omega = numerator / denominator;
+            if (std::isfinite(omega) && omega > best)
+                {
+                    best = omega;
+                    rv.omega_max = omega;
+                    rv.position = positions[first + l - 1];
+                }
+        }
+    return rv;
+}
+
+// Windows of at most window_snps consecutive sites, with
+// first sites 0, step, 2*step, ..., until a window contains
+// the last site.
+inline std::vector<OmegaMaxWindow>
+omega_max_scan(const BiallelicSites &sites, const double *positions,
+               const std::size_t window_snps, const std::size_t step,
+               const std::int32_t mincount, const unsigned nthreads)
+{
+    if (window_snps == 0 || step == 0)
+        {
+            throw std::invalid_argument(
+                "window size and step must be positive");
+        }
+    std::vector<OmegaMaxWindow> windows;
+    for (std::size_t first = 0; first < sites.nsites; first += step)
+        {
+            const std::size_t last = std::min(sites.nsites, first + window_snps);
+            windows.push_back(OmegaMaxWindow{ first, last, 0., 0. });
+            if (last == sites.nsites)
+                {
+                    break;
+                }
+        }
+    // Windows in a chunk share one band of r^2 values, so that
+    // each pair of sites is visited once per chunk.  The chunk
+    // size is limited to keep the band at a few window lengths.
+    const std::size_t max_grain
+        = std::max<std::size_t>(1, 3 * window_snps / step);
+    const std::size_t grain = std::min(
+        max_grain, default_grain_size(windows.size(), nthreads, 1));
+    parallel_for(windows.size(), nthreads, grain,
+                 [&](const std::size_t begin, const std::size_t end) {
+                     RsqBand band;
+                     band.assign(sites, windows[begin].first,
+                                 windows[end - 1].last, window_snps,
+                                 mincount);
+                     CumulativeRsq c;
+                     for (std::size_t w = begin; w < end; ++w)
+                         {
+                             c.assign(band, windows[w].first, windows[w].last);
+                             windows[w] = omega_max_window(
+                                 c, sites, positions, windows[w].first,
+                                 windows[w].last, mincount);
+                         }
+                 });
+    return windows;
+}
+
+#endif
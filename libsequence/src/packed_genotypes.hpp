@@ -0,0 +1,339 @@
+#ifndef PYLIBSEQ_PACKED_GENOTYPES_HPP
+#define PYLIBSEQ_PACKED_GENOTYPES_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <stdexcept>
+#include <vector>
+
+// Bit-packed genotypes.  Each site is a row of 64-bit words
+// with one bit per sample.  A separate set of rows flags
+// missing data, and is empty when no data are missing.
+// Bits for missing data, and bits past the last sample
+// in a row, are always zero.
+
+inline int
+popcount64(const std::uint64_t x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcountll(x);
+#else
+    std::uint64_t v = x - ((x >> 1) & 0x5555555555555555ULL);
+    v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+    v = (v + (v >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return static_cast<int>((v * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+inline int
+count_trailing_zeros64(const std::uint64_t x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(x);
+#else
+    return popcount64((x & (~x + 1)) - 1);
+#endif
+}
+
+inline std::size_t
+words_for_bits(const std::size_t nbits)
+{
+    return (nbits + 63) / 64;
+}
+
+// Mask of the valid bits in the last word of a row.
+inline std::uint64_t
+last_word_mask(const std::size_t nbits)
+{
+    const std::size_t r = nbits % 64;
+    return r ? (std::uint64_t(1) << r) - 1 : ~std::uint64_t(0);
+}
+
+class PackedSites
+{
+  protected:
+    std::vector<std::uint64_t> bits, missing_bits;
+
+  public:
+    std::size_t nsites, nsam, nwords;
+
+    PackedSites(const std::size_t nsites_, const std::size_t nsam_)
+        : bits(nsites_ * words_for_bits(nsam_), 0), missing_bits(),
+          nsites(nsites_), nsam(nsam_), nwords(words_for_bits(nsam_))
+    {
+    }
+
+    void
+    set(const std::size_t site, const std::size_t sample)
+    {
+        bits[site * nwords + sample / 64] |= std::uint64_t(1)
+                                             << (sample % 64);
+    }
+
+    void
+    set_missing(const std::size_t site, const std::size_t sample)
+    {
+        if (missing_bits.empty())
+            {
+                missing_bits.resize(bits.size(), 0);
+            }
+        missing_bits[site * nwords + sample / 64] |= std::uint64_t(1)
+                                                     << (sample % 64);
+    }
+
+    bool
+    get(const std::size_t site, const std::size_t sample) const
+    {
+        return (bits[site * nwords + sample / 64] >> (sample % 64)) & 1;
+    }
+
+    bool
+    has_missing_data() const
+    {
+        return !missing_bits.empty();
+    }
+
+    bool
+    is_missing(const std::size_t site, const std::size_t sample) const
+    {
+        return has_missing_data()
+               && ((missing_bits[site * nwords + sample / 64] >> (sample % 64))
+                   & 1);
+    }
+
+    const std::uint64_t *
+    site(const std::size_t i) const
+    {
+        return bits.data() + i * nwords;
+    }
+
+    // nullptr if there are no missing data.
+    const std::uint64_t *
+    missing(const std::size_t i) const
+    {
+        return missing_bits.empty() ? nullptr
+                                    : missing_bits.data() + i * nwords;
+    }
+
+    std::size_t
+    nbytes() const
+    {
+        return sizeof(std::uint64_t) * (bits.size() + missing_bits.size());
+    }
+};
+
+// Fill g from row-major nsites x nsam genotypes, setting bits
+// for state 1 and flagging negative states as missing.
+// Returns false as soon as a state > 1 is found.
+inline bool
+pack_binary_genotypes(const std::int8_t *data, PackedSites &g)
+{
+    for (std::size_t i = 0; i < g.nsites; ++i)
+        {
+            const std::int8_t *row = data + i * g.nsam;
+            for (std::size_t j = 0; j < g.nsam; ++j)
+                {
+                    if (row[j] == 1)
+                        {
+                            g.set(i, j);
+                        }
+                    else if (row[j] < 0)
+                        {
+                            g.set_missing(i, j);
+                        }
+                    else if (row[j] != 0)
+                        {
+                            return false;
+                        }
+                }
+        }
+    return true;
+}
+
+// Genotypes where every non-missing state is 0 or 1.
+// Negative states are missing data.
+class PackedGenotypes : public PackedSites
+{
+  public:
+    std::vector<double> positions;
+
+    PackedGenotypes(const std::int8_t *data, const double *positions_,
+                    const std::size_t nsites_, const std::size_t nsam_)
+        : PackedSites(nsites_, nsam_),
+          positions(positions_, positions_ + nsites_)
+    {
+        if (!pack_binary_genotypes(data, *this))
+            {
+                throw std::invalid_argument(
+                    "packed genotypes require states of 0 or 1, or missing "
+                    "data");
+            }
+    }
+
+    void
+    unpack(std::int8_t *output, const std::int8_t missing_state) const
+    {
+        for (std::size_t i = 0; i < nsites; ++i)
+            {
+                for (std::size_t j = 0; j < nsam; ++j)
+                    {
+                        output[i * nsam + j]
+                            = is_missing(i, j) ? missing_state
+                                               : static_cast<std::int8_t>(
+                                                   get(i, j));
+                    }
+            }
+    }
+};
+
+// Row-major nsites x 2 matrix of the numbers of 0 and 1 states.
+inline std::vector<std::int32_t>
+packed_allele_counts(const PackedSites &g)
+{
+    std::vector<std::int32_t> counts(2 * g.nsites, 0);
+    for (std::size_t i = 0; i < g.nsites; ++i)
+        {
+            const std::uint64_t *s = g.site(i);
+            const std::uint64_t *m = g.missing(i);
+            std::int32_t n1 = 0, nmissing = 0;
+            for (std::size_t w = 0; w < g.nwords; ++w)
+                {
+                    n1 += popcount64(s[w]);
+                    nmissing += m ? popcount64(m[w]) : 0;
+                }
+            counts[2 * i] = static_cast<std::int32_t>(g.nsam) - n1 - nmissing;
+            counts[2 * i + 1] = n1;
+        }
+    return counts;
+}
+
+// The transpose of a PackedSites: one row of bits over
+// sites per sample.  Used by the kernels comparing samples.
+struct PackedSamples
+{
+    std::size_t nsam, nwords;
+    std::vector<std::uint64_t> bits, missing_bits;
+
+    explicit PackedSamples(const PackedSites &g)
+        : nsam(g.nsam), nwords(words_for_bits(g.nsites)),
+          bits(g.nsam * words_for_bits(g.nsites), 0), missing_bits()
+    {
+        if (g.has_missing_data())
+            {
+                missing_bits.resize(bits.size(), 0);
+            }
+        for (std::size_t i = 0; i < g.nsites; ++i)
+            {
+                const std::uint64_t site_bit = std::uint64_t(1) << (i % 64);
+                const std::size_t w = i / 64;
+                const std::uint64_t *s = g.site(i);
+                const std::uint64_t *m = g.missing(i);
+                for (std::size_t k = 0; k < g.nwords; ++k)
+                    {
+                        for (std::uint64_t x = s[k]; x; x &= x - 1)
+                            {
+                                const std::size_t j
+                                    = 64 * k + count_trailing_zeros64(x);
+                                bits[j * nwords + w] |= site_bit;
+                            }
+                        for (std::uint64_t x = m ? m[k] : 0; x; x &= x - 1)
+                            {
+                                const std::size_t j
+                                    = 64 * k + count_trailing_zeros64(x);
+                                missing_bits[j * nwords + w] |= site_bit;
+                            }
+                    }
+            }
+    }
+
+    const std::uint64_t *
+    sample(const std::size_t j) const
+    {
+        return bits.data() + j * nwords;
+    }
+
+    const std::uint64_t *
+    missing(const std::size_t j) const
+    {
+        return missing_bits.empty() ? nullptr
+                                    : missing_bits.data() + j * nwords;
+    }
+};
+
+// Haplotypes are labelled 0, 1, ... in order of first
+// appearance.  Haplotypes with missing data are labelled -1.
+inline std::vector<std::int32_t>
+packed_label_haplotypes(const PackedSites &g)
+{
+    const PackedSamples h(g);
+    std::vector<std::int32_t> labels(g.nsam, -1);
+    std::map<std::vector<std::uint64_t>, std::int32_t> seen;
+    for (std::size_t j = 0; j < g.nsam; ++j)
+        {
+            const std::uint64_t *m = h.missing(j);
+            if (m && std::any_of(m, m + h.nwords,
+                                 [](const std::uint64_t x) { return x != 0; }))
+                {
+                    continue;
+                }
+            std::vector<std::uint64_t> key(h.sample(j),
+                                           h.sample(j) + h.nwords);
+            const auto next = static_cast<std::int32_t>(seen.size());
+            labels[j] = seen.insert(std::make_pair(std::move(key), next))
+                            .first->second;
+        }
+    return labels;
+}
+
+// Whether sites i and j have all four gametes among
+// the samples not missing at either site.
+inline bool
+packed_four_gametes(const PackedSites &g, const std::size_t i,
+                    const std::size_t j)
+{
+    const std::uint64_t *a = g.site(i), *b = g.site(j);
+    const std::uint64_t *ma = g.missing(i), *mb = g.missing(j);
+    std::uint64_t g00 = 0, g01 = 0, g10 = 0, g11 = 0;
+    for (std::size_t w = 0; w < g.nwords; ++w)
+        {
+            std::uint64_t valid
+                = w + 1 == g.nwords ? last_word_mask(g.nsam) : ~std::uint64_t(0);
+            if (ma)
+                {
+                    valid &= ~(ma[w] | mb[w]);
+                }
+            g00 |= ~a[w] & ~b[w] & valid;
+            g01 |= ~a[w] & b[w] & valid;
+            g10 |= a[w] & ~b[w] & valid;
+            g11 |= a[w] & b[w] & valid;
+        }
+    return g00 && g01 && g10 && g11;
+}
+
+// Hudson and Kaplan's (1985) Rmin: the largest number of
+// non-overlapping intervals between pairs of sites failing
+// the four-gamete test.  Intervals are taken greedily in order
+// of their right ends, which is optimal.
+inline std::int32_t
+packed_rmin(const PackedSites &g)
+{
+    std::int32_t rmin = 0;
+    std::size_t left = 0;
+    for (std::size_t j = 1; j < g.nsites; ++j)
+        {
+            for (std::size_t i = j; i > left; --i)
+                {
+                    if (packed_four_gametes(g, i - 1, j))
+                        {
+                            ++rmin;
+                            left = j;
+                            break;
+                        }
+                }
+        }
+    return rmin;
+}
+
+#endif
@@ -0,0 +1,246 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <pybind11/stl.h>
+#include <Sequence/AlleleCountMatrix.hpp>
+#include <Sequence/VariantMatrix.hpp>
+#include "capsules.hpp"
+#include "difference_kernels.hpp"
+#include "ld_kernels.hpp"
+#include "numpy_helpers.hpp"
+#include "packed_genotypes.hpp"
+
+namespace py = pybind11;
+
+void
+init_PackedVariantMatrix(py::module &m)
+{
+    py::class_<PackedGenotypes>(m, "PackedVariantMatrix",
+                                R"delim(
+        Bit-packed genotypes for sites where all states are 0 or 1.
+
+        Each genotype takes one bit.  Missing data, represented by
+        negative values, are stored as a separate bit mask, which is
+        only allocated if data are missing.  Compared to a
+        :class:`libsequence.VariantMatrix`, memory use is 8 times
+        lower without missing data, and 4 times lower with them.
+
+        The following functions accept a PackedVariantMatrix
+        and use bitwise operations and population counts over
+        64 samples (or sites) at a time:
+
+        * :func:`libsequence.difference_matrix`
+        * :func:`libsequence.is_different_matrix`
+        * :func:`libsequence.label_haplotypes`
+        * :func:`libsequence.rmin`
+        * :func:`libsequence.ld`
+
+        .. versionadded:: 0.2.4
+
+        >>> import libsequence
+        >>> import numpy as np
+        >>> d = np.array([0, 1, 1, 0, -1, 1], dtype=np.int8).reshape((2, 3))
+        >>> p = libsequence.PackedVariantMatrix(d, np.array([0.1, 0.2]))
+        >>> ac = p.count_alleles()
+        )delim")
+        .def(py::init([](const Sequence::VariantMatrix &vm) {
+                 return PackedGenotypes(vm.cdata(), vm.pbegin(), vm.nsites(),
+                                        vm.nsam());
+             }),
+             "Construct from a :class:`libsequence.VariantMatrix`",
+             py::arg("vm"), py::call_guard<py::gil_scoped_release>())
+        .def(py::init(
+                 [](py::array_t<std::int8_t,
+                                py::array::c_style | py::array::forcecast>
+                        data,
+                    py::array_t<double, py::array::c_style
+                                            | py::array::forcecast>
+                        positions) {
+                     if (data.ndim() != 2)
+                         {
+                             throw std::invalid_argument(
+                                 "data must be a 2d array");
+                         }
+                     if (positions.ndim() != 1
+                         || positions.shape(0) != data.shape(0))
+                         {
+                             throw std::invalid_argument(
+                                 "number of positions must equal the number "
+                                 "of rows in data");
+                         }
+                     py::gil_scoped_release release;
+                     return PackedGenotypes(data.data(), positions.data(),
+                                            data.shape(0), data.shape(1));
+                 }),
+             R"delim(
+             Construct from numpy arrays
+
+             :param data: 2d array with one row per site
+             :param positions: 1d array of positions
+             )delim",
+             py::arg("data"), py::arg("positions"))
+        .def_readonly("nsites", &PackedGenotypes::nsites, "Number of sites")
+        .def_readonly("nsam", &PackedGenotypes::nsam, "Number of samples")
+        .def_property_readonly(
+            "positions",
+            [](py::object self) {
+                const auto &g = self.cast<const PackedGenotypes &>();
+                auto rv = py::array_t<double>({ g.nsites }, { sizeof(double) },
+                                              g.positions.data(), self);
+                rv.attr("flags").attr("writeable") = false;
+                return rv;
+            },
+            "Read-only numpy array of positions")
+        .def_property_readonly("nbytes", &PackedGenotypes::nbytes,
+                               "Size of the packed genotypes, in bytes")
+        .def_property_readonly("has_missing_data",
+                               &PackedGenotypes::has_missing_data)
+        .def(
+            "count_alleles",
+            [](const PackedGenotypes &self) {
+                return Sequence::AlleleCountMatrix(packed_allele_counts(self),
+                                                   2, self.nsites, self.nsam);
+            },
+            "Return a :class:`libsequence.AlleleCountMatrix`",
+            py::call_guard<py::gil_scoped_release>())
+        .def(
+            "to_VariantMatrix",
+            [](const PackedGenotypes &self) {
+                std::vector<std::int8_t> data(self.nsites * self.nsam);
+                self.unpack(data.data(), Sequence::VariantMatrix::mask);
+                std::unique_ptr<Sequence::GenotypeCapsule> g(
+                    new OwnedGenotypeCapsule(std::move(data), self.nsites,
+                                             self.nsam));
+                std::unique_ptr<Sequence::PositionCapsule> p(
+                    new OwnedPositionCapsule(self.positions));
+                return Sequence::VariantMatrix(std::move(g), std::move(p), 1);
+            },
+            R"delim(
+            Return a :class:`libsequence.VariantMatrix`.
+
+            Missing data are assigned :attr:`libsequence.VariantMatrix.mask`.
+            )delim",
+            py::call_guard<py::gil_scoped_release>());
+
+    m.def(
+        "difference_matrix",
+        [](const PackedGenotypes &g, const unsigned nthreads) {
+            py::array_t<std::int32_t> rv(condensed_size(g.nsam));
+            auto output = rv.mutable_data();
+            py::gil_scoped_release release;
+            packed_pairwise_differences(PackedSamples(g), false, nthreads,
+                                        output);
+            return rv;
+        },
+        R"delim(
+            Return the number of differences between all
+            pairs of samples in a PackedVariantMatrix.
+            Sites with missing data in either sample are
+            not counted.
+
+            :param m: A :class:`libsequence.PackedVariantMatrix`
+            :param nthreads: (1) Number of threads to use.  If 0, use all available cores.
+
+            :rtype: numpy.ndarray
+
+            The layout is the same as for the VariantMatrix version.
+            )delim",
+        py::arg("m"), py::arg("nthreads") = 1);
+
+    m.def(
+        "is_different_matrix",
+        [](const PackedGenotypes &g, const unsigned nthreads) {
+            py::array_t<bool> rv(condensed_size(g.nsam));
+            auto output = rv.mutable_data();
+            py::gil_scoped_release release;
+            packed_pairwise_differences(PackedSamples(g), true, nthreads,
+                                        output);
+            return rv;
+        },
+        R"delim(
+            Return whether or not pairs of samples
+            in a PackedVariantMatrix differ.
+
+            :param m: A :class:`libsequence.PackedVariantMatrix`
+            :param nthreads: (1) Number of threads to use.  If 0, use all available cores.
+
+            :rtype: numpy.ndarray
+            )delim",
+        py::arg("m"), py::arg("nthreads") = 1);
+
+    m.def(
+        "label_haplotypes",
+        [](const PackedGenotypes &g) { return packed_label_haplotypes(g); },
+        R"delim(
+            Label the haplotypes in a PackedVariantMatrix.
+
+            :param m: A :class:`libsequence.PackedVariantMatrix`
+
+            Labels are assigned in order of first appearance,
+            starting from zero.  Haplotypes with missing data
+            are labelled -1.
+            )delim",
+        py::arg("m"), py::call_guard<py::gil_scoped_release>());
+
+    m.def(
+        "rmin",
+        [](const PackedGenotypes &g) { return packed_rmin(g); },
+        R"delim(
+            Hudson and Kaplan's estimate of the minimum number
+            of recombination events.
+
+            :param m: A :class:`libsequence.PackedVariantMatrix`
+
+            For each pair of sites, the four-gamete test uses
+            the samples with no missing data at either site.
+            )delim",
+        py::arg("m"), py::call_guard<py::gil_scoped_release>());
+
+    m.def(
+        "ld",
+        [](const PackedGenotypes &g, const std::int32_t mincount,
+           const double maxd, py::object sites, const unsigned nthreads) {
+            auto selected = site_indexes_from_object(sites, g.nsites);
+            std::vector<double> values;
+            {
+                py::gil_scoped_release release;
+                auto counts = packed_allele_counts(g);
+                selected.erase(
+                    std::remove_if(selected.begin(), selected.end(),
+                                   [&counts, mincount](const std::size_t i) {
+                                       const std::int32_t c = std::min(
+                                           counts[2 * i], counts[2 * i + 1]);
+                                       return !(c > 0 && c >= mincount);
+                                   }),
+                    selected.end());
+                values = ld_records(g, g.positions.data(), selected, maxd,
+                                    nthreads);
+            }
+            return make_structured_array(
+                { "i", "j", "rsq", "D", "Dprime" },
+                { false, false, false, false, false }, values,
+                values.size() / 5);
+        },
+        R"delim(
+        Return pairwise LD statistics.
+
+        :param m: A :class:`libsequence.PackedVariantMatrix`
+        :param mincount: (1) Do not include sites with minor allele count < mincount.
+        :param maxd: (inf) Do not include site pairs separated by >= maxd.
+        :param sites: (None) Sorted indexes of the sites to include.  If None, all sites are used.
+        :param nthreads: (1) Number of threads to use.  If 0, use all available cores.
+
+        :rtype: numpy.ndarray
+
+        The return value is a structured array with fields i, j,
+        rsq, D, and Dprime, where i and j are the positions of the
+        two sites.  For each pair of sites, only samples without
+        missing data at either site are used.  D is calculated for
+        state 1 at both sites.
+        )delim",
+        py::arg("m"), py::arg("mincount") = 1,
+        py::arg("maxd") = std::numeric_limits<double>::infinity(),
+        py::arg("sites") = nullptr, py::arg("nthreads") = 1);
+}
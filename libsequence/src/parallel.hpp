@@ -0,0 +1,104 @@
+#ifndef PYLIBSEQ_PARALLEL_HPP
+#define PYLIBSEQ_PARALLEL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Minimal thread-based parallelism for the C++ engines.
+// None of these functions touch the Python C API, and
+// they are intended to be called with the GIL released.
+
+// The number of threads to use.  A value of zero means
+// to use all available hardware threads.
+inline unsigned
+resolve_nthreads(const unsigned nthreads)
+{
+    if (nthreads > 0)
+        {
+            return nthreads;
+        }
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Apply f(begin, end) to chunks of [0, n) of at most
+// grain_size elements.  Chunks are handed out dynamically,
+// so that threads are balanced when the cost per element
+// varies.  The first exception thrown by f is rethrown
+// in the calling thread once all workers have finished.
+template <typename F>
+inline void
+parallel_for(const std::size_t n, const unsigned nthreads,
+             const std::size_t grain_size, const F &f)
+{
+    if (n == 0)
+        {
+            return;
+        }
+    const std::size_t grain = std::max<std::size_t>(grain_size, 1);
+    const std::size_t nchunks = (n + grain - 1) / grain;
+    const std::size_t nworkers
+        = std::min<std::size_t>(resolve_nthreads(nthreads), nchunks);
+    if (nworkers < 2)
+        {
+            f(std::size_t(0), n);
+            return;
+        }
+    std::atomic<std::size_t> next(0);
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto worker = [&]() {
+        for (;;)
+            {
+                const std::size_t begin = next.fetch_add(grain);
+                if (begin >= n)
+                    {
+                        return;
+                    }
+                try
+                    {
+                        f(begin, std::min(n, begin + grain));
+                    }
+                catch (...)
+                    {
+                        std::lock_guard<std::mutex> lock(error_mutex);
+                        if (!error)
+                            {
+                                error = std::current_exception();
+                            }
+                        next = n;
+                        return;
+                    }
+            }
+    };
+    std::vector<std::thread> threads;
+    for (std::size_t i = 1; i < nworkers; ++i)
+        {
+            threads.emplace_back(worker);
+        }
+    worker();
+    for (auto &t : threads)
+        {
+            t.join();
+        }
+    if (error)
+        {
+            std::rethrow_exception(error);
+        }
+}
+
+// Split [0, n) into a number of chunks suitable for
+// nthreads threads, each of at least min_grain_size elements.
+inline std::size_t
+default_grain_size(const std::size_t n, const unsigned nthreads,
+                   const std::size_t min_grain_size)
+{
+    const std::size_t nchunks = 8 * resolve_nthreads(nthreads);
+    return std::max(min_grain_size, (n + nchunks - 1) / nchunks);
+}
+
+#endif
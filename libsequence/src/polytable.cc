@@ -17,6 +17,7 @@
 // along with pylibseq.  If not, see <http://www.gnu.org/licenses/>.
 //
 
+#include <array>
 #include <iostream>
 #include <pybind11/pybind11.h>
 #include <pybind11/functional.h>
@@ -28,9 +29,44 @@
 #include <Sequence/polySiteVector.hpp>
 #include <Sequence/PolyTableFunctions.hpp>
 #include <Sequence/stateCounter.hpp>
+#include <Sequence/VariantMatrix.hpp>
+#include "polytable_conversion.hpp"
+#include "state_counts.hpp"
 
 namespace py = pybind11;
 
+namespace
+{
+    // States 0 and 1 become '0' and '1', and missing data
+    // become 'N'.
+    Sequence::SimData
+    simdata_from_variant_matrix(const Sequence::VariantMatrix &vm,
+                                const unsigned nthreads)
+    {
+        py::gil_scoped_release release;
+        const std::size_t nsites = vm.nsites(), nsam = vm.nsam();
+        if (max_state(vm.cdata(), nsites * nsam, nthreads) > 1)
+            {
+                throw std::invalid_argument(
+                    "SimData can only hold states 0 and 1");
+            }
+        std::array<char, 256> symbols;
+        symbols.fill('N');
+        symbols[0] = '0';
+        symbols[1] = '1';
+        std::vector<std::string> data(nsam, std::string(nsites, 'N'));
+        std::vector<char *> haplotypes(nsam);
+        for (std::size_t j = 0; j < nsam; ++j)
+            {
+                haplotypes[j] = &data[j][0];
+            }
+        genotypes_to_haplotypes(vm.cdata(), nsites, nsam, symbols, nthreads,
+                                haplotypes);
+        return Sequence::SimData(std::vector<double>(vm.pbegin(), vm.pend()),
+                                 std::move(data));
+    }
+} // namespace
+
 void init_PolyTable(py::module & m)
 {
     py::class_<Sequence::PolyTable>(m, "PolyTable",
@@ -122,6 +158,22 @@ void init_PolyTable(py::module & m)
              },
              "Create an instance of this type by reading data from stdin.  "
              "Useful for reading input from msprime or ms.")
+        .def_static("from_variant_matrix", &simdata_from_variant_matrix,
+                    py::arg("vm"), py::arg("nthreads") = 1,
+                    R"delim(
+            Create a SimData from a :class:`libsequence.VariantMatrix`.
+
+            :param vm: A :class:`libsequence.VariantMatrix` whose states are 0, 1, or missing.
+            :param nthreads: (1) Number of threads to use.  If 0, use all available cores.
+
+            Missing data are written as N.  The sites of vm are
+            transposed into haplotypes in square tiles that fit in
+            cache, and blocks of haplotypes are converted in parallel.
+            This is the inverse of
+            :func:`libsequence.VariantMatrix.from_polytable`.
+
+            .. versionadded:: 0.2.4
+            )delim")
         .def("__init__",
              [](Sequence::SimData& d, const Sequence::polySiteVector& p) {
                  new (&d) Sequence::SimData(p.cbegin(), p.cend());
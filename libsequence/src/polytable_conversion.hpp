@@ -0,0 +1,111 @@
+#ifndef PYLIBSEQ_POLYTABLE_CONVERSION_HPP
+#define PYLIBSEQ_POLYTABLE_CONVERSION_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "parallel.hpp"
+
+// Conversion between polymorphism tables, which store one
+// string of characters per haplotype, and row-major
+// nsites x nsam genotype data.  Both directions are
+// transposes, done in square tiles so that reads and
+// writes stay in cache.
+
+constexpr std::size_t polytable_tile_size = 64;
+
+// 0 and 1 are states 0 and 1, and A, C, G, and T (in
+// either case) are states 0 to 3.  All other characters,
+// including N and gaps, are missing data.
+inline std::array<std::int8_t, 256>
+polytable_state_table()
+{
+    std::array<std::int8_t, 256> table;
+    table.fill(-1);
+    table['0'] = 0;
+    table['1'] = 1;
+    const char bases[] = "ACGT";
+    for (std::int8_t i = 0; i < 4; ++i)
+        {
+            table[static_cast<unsigned char>(bases[i])] = i;
+            table[static_cast<unsigned char>(bases[i] + ('a' - 'A'))] = i;
+        }
+    return table;
+}
+
+// Set output[i * nsam + j] to the state of character i of
+// haplotypes[j], which must have at least nsites characters.
+inline void
+haplotypes_to_genotypes(const std::vector<const char *> &haplotypes,
+                        const std::size_t nsites,
+                        const std::array<std::int8_t, 256> &table,
+                        const unsigned nthreads, std::int8_t *output)
+{
+    const std::size_t nsam = haplotypes.size(), T = polytable_tile_size;
+    const std::size_t ntiles = (nsites + T - 1) / T;
+    parallel_for(
+        ntiles, nthreads, default_grain_size(ntiles, nthreads, 1),
+        [&](const std::size_t begin, const std::size_t end) {
+            for (std::size_t s0 = begin * T; s0 < std::min(nsites, end * T);
+                 s0 += T)
+                {
+                    const std::size_t s1 = std::min(nsites, s0 + T);
+                    for (std::size_t j0 = 0; j0 < nsam; j0 += T)
+                        {
+                            const std::size_t j1 = std::min(nsam, j0 + T);
+                            for (std::size_t j = j0; j < j1; ++j)
+                                {
+                                    const char *h = haplotypes[j];
+                                    for (std::size_t i = s0; i < s1; ++i)
+                                        {
+                                            output[i * nsam + j]
+                                                = table[static_cast<
+                                                    unsigned char>(h[i])];
+                                        }
+                                }
+                        }
+                }
+        });
+}
+
+// The inverse of haplotypes_to_genotypes.  Character i of
+// haplotypes[j] is set to symbols[data[i * nsam + j]],
+// where states are cast to unsigned char, so that
+// negative states index the upper half of symbols.
+inline void
+genotypes_to_haplotypes(const std::int8_t *data, const std::size_t nsites,
+                        const std::size_t nsam,
+                        const std::array<char, 256> &symbols,
+                        const unsigned nthreads,
+                        const std::vector<char *> &haplotypes)
+{
+    const std::size_t T = polytable_tile_size;
+    const std::size_t ntiles = (nsam + T - 1) / T;
+    parallel_for(
+        ntiles, nthreads, default_grain_size(ntiles, nthreads, 1),
+        [&](const std::size_t begin, const std::size_t end) {
+            for (std::size_t j0 = begin * T; j0 < std::min(nsam, end * T);
+                 j0 += T)
+                {
+                    const std::size_t j1 = std::min(nsam, j0 + T);
+                    for (std::size_t s0 = 0; s0 < nsites; s0 += T)
+                        {
+                            const std::size_t s1 = std::min(nsites, s0 + T);
+                            for (std::size_t i = s0; i < s1; ++i)
+                                {
+                                    const std::int8_t *site = data + i * nsam;
+                                    for (std::size_t j = j0; j < j1; ++j)
+                                        {
+                                            haplotypes[j][i] = symbols
+                                                [static_cast<unsigned char>(
+                                                    site[j])];
+                                        }
+                                }
+                        }
+                }
+        });
+}
+
+#endif
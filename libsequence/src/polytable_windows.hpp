@@ -0,0 +1,117 @@
+#ifndef PYLIBSEQ_POLYTABLE_WINDOWS_HPP
+#define PYLIBSEQ_POLYTABLE_WINDOWS_HPP
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+#include "genomic_windows.hpp"
+#include "parallel.hpp"
+#include "polytable_conversion.hpp"
+#include "summstats_kernels.hpp"
+
+// Sliding windows over the sites of a polymorphism table,
+// described by ranges of site indexes so that no data are
+// copied until a window is used.
+
+// The windows of libsequence's PolyTableSlice.  There are
+// floor((stop - start) / step) windows, with left edges
+// start, start + step, ..., and a window includes the
+// sites whose positions are >= left and <= right.
+inline std::vector<GenomicWindow>
+make_polytable_windows(const double *positions, const std::size_t nsites,
+                       const double window_size, const double step,
+                       const double start, const double stop)
+{
+    if (!(window_size > 0.))
+        {
+            throw std::runtime_error("window size must be > 0");
+        }
+    if (!(step > 0.))
+        {
+            throw std::runtime_error("step size must be > 0");
+        }
+    validate_sorted_positions(positions, nsites);
+    std::vector<GenomicWindow> windows;
+    const double n = std::floor((stop - start) / step);
+    if (!(n > 0.))
+        {
+            return windows;
+        }
+    const std::size_t nwindows = static_cast<std::size_t>(n);
+    windows.reserve(nwindows);
+    std::size_t first = 0, last = 0;
+    for (std::size_t k = 0; k < nwindows; ++k)
+        {
+            const double left = start + static_cast<double>(k) * step;
+            const double right = left + window_size;
+            while (first < nsites && positions[first] < left)
+                {
+                    ++first;
+                }
+            last = std::max(last, first);
+            while (last < nsites && positions[last] <= right)
+                {
+                    ++last;
+                }
+            windows.push_back(GenomicWindow{ left, right, first, last });
+        }
+    return windows;
+}
+
+// Element i of the return value is the sum of the
+// contributions of sites [0, i) of the haplotypes, whose
+// characters are mapped to states by table.  Blocks of
+// sites are counted in parallel, reading each haplotype
+// once per block.
+inline std::vector<SiteSums>
+polytable_prefix_sums(const std::vector<const char *> &haplotypes,
+                      const std::size_t nsites,
+                      const std::array<std::int8_t, 256> &table,
+                      const int refstate, const HarmonicSums &h,
+                      const unsigned nthreads)
+{
+    constexpr std::size_t T = polytable_tile_size, ncol = 4;
+    const std::size_t nblocks = (nsites + T - 1) / T;
+    std::vector<SiteSums> prefix(nsites + 1);
+    parallel_for(
+        nblocks, nthreads, default_grain_size(nblocks, nthreads, 16),
+        [&](const std::size_t begin, const std::size_t end) {
+            std::array<std::int32_t, T * ncol> counts;
+            for (std::size_t b = begin; b < end; ++b)
+                {
+                    const std::size_t s0 = b * T,
+                                      s1 = std::min(nsites, s0 + T);
+                    counts.fill(0);
+                    for (auto hap : haplotypes)
+                        {
+                            for (std::size_t i = s0; i < s1; ++i)
+                                {
+                                    const std::int8_t s = table
+                                        [static_cast<unsigned char>(hap[i])];
+                                    if (s >= 0)
+                                        {
+                                            ++counts[(i - s0) * ncol
+                                                     + static_cast<
+                                                         std::size_t>(s)];
+                                        }
+                                }
+                        }
+                    for (std::size_t i = s0; i < s1; ++i)
+                        {
+                            accumulate_site(counts.data() + (i - s0) * ncol,
+                                            ncol, refstate, h, prefix[i + 1]);
+                        }
+                }
+        });
+    for (std::size_t i = 1; i < prefix.size(); ++i)
+        {
+            prefix[i] += prefix[i - 1];
+        }
+    return prefix;
+}
+
+#endif
@@ -0,0 +1,234 @@
+#ifndef PYLIBSEQ_REPLICATE_KERNELS_HPP
+#define PYLIBSEQ_REPLICATE_KERNELS_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "msstats_kernels.hpp"
+#include "parallel.hpp"
+#include "summstats_kernels.hpp"
+
+// Statistics of many independent replicates, such as
+// simulations for ABC, in one call.  Each replicate is
+// processed by a single thread, and the results are
+// written to one row of a row-major nreplicates x nstats
+// matrix.
+
+enum class HaplotypeStatistic
+{
+    number_of_haplotypes,
+    haplotype_diversity,
+    H1,
+    H12,
+    H2H1
+};
+
+inline const std::vector<std::pair<std::string, HaplotypeStatistic>> &
+haplotype_statistic_names()
+{
+    static const std::vector<std::pair<std::string, HaplotypeStatistic>>
+        names{ { "number_of_haplotypes",
+                 HaplotypeStatistic::number_of_haplotypes },
+               { "haplotype_diversity",
+                 HaplotypeStatistic::haplotype_diversity },
+               { "H1", HaplotypeStatistic::H1 },
+               { "H12", HaplotypeStatistic::H12 },
+               { "H2H1", HaplotypeStatistic::H2H1 } };
+    return names;
+}
+
+// One column of the output: a summary statistic, or a
+// statistic of haplotypes if is_haplotype is true.
+struct ReplicateStatistic
+{
+    bool is_haplotype;
+    SummaryStatistic summary;
+    HaplotypeStatistic haplotype;
+};
+
+// As summary_statistics_from_names, with the addition
+// of the names of haplotype statistics.
+inline std::vector<ReplicateStatistic>
+replicate_statistics_from_names(const std::vector<std::string> &names,
+                                const bool have_ancestral_states)
+{
+    std::vector<ReplicateStatistic> rv;
+    if (names.empty())
+        {
+            for (auto s : summary_statistics_from_names(
+                     names, have_ancestral_states))
+                {
+                    rv.push_back(ReplicateStatistic{
+                        false, s, HaplotypeStatistic::H1 });
+                }
+            return rv;
+        }
+    for (auto &name : names)
+        {
+            bool found = false;
+            for (auto &h : haplotype_statistic_names())
+                {
+                    if (h.first == name)
+                        {
+                            rv.push_back(ReplicateStatistic{
+                                true, SummaryStatistic::thetapi, h.second });
+                            found = true;
+                        }
+                }
+            if (!found)
+                {
+                    rv.push_back(ReplicateStatistic{
+                        false,
+                        summary_statistics_from_names(
+                            { name }, have_ancestral_states)[0],
+                        HaplotypeStatistic::H1 });
+                }
+        }
+    return rv;
+}
+
+inline bool
+needs_haplotypes(const std::vector<ReplicateStatistic> &stats)
+{
+    for (auto &s : stats)
+        {
+            if (s.is_haplotype)
+                {
+                    return true;
+                }
+        }
+    return false;
+}
+
+inline double
+haplotype_statistic_value(const HaplotypeStatistic s,
+                          const HaplotypeStatistics &h)
+{
+    switch (s)
+        {
+        case HaplotypeStatistic::number_of_haplotypes:
+            return static_cast<double>(h.nhaps);
+        case HaplotypeStatistic::haplotype_diversity:
+            return h.diversity;
+        case HaplotypeStatistic::H1:
+            return h.H1;
+        case HaplotypeStatistic::H12:
+            return h.H12;
+        case HaplotypeStatistic::H2H1:
+            return h.H2H1;
+        }
+    throw std::invalid_argument("unknown haplotype statistic");
+}
+
+// Row-major nsites x nsam genotypes of one replicate
+struct GenotypeReplicate
+{
+    const std::int8_t *data;
+    std::size_t nsites, nsam;
+};
+
+// The counts of an AlleleCountMatrix of one replicate
+struct CountReplicate
+{
+    const std::int32_t *counts;
+    std::size_t nrow, ncol, nsam;
+};
+
+inline void
+replicate_statistic_values(const std::vector<ReplicateStatistic> &stats,
+                           const SiteSums &sums,
+                           const HaplotypeStatistics *haplotypes,
+                           double *output)
+{
+    for (std::size_t i = 0; i < stats.size(); ++i)
+        {
+            output[i] = stats[i].is_haplotype
+                            ? haplotype_statistic_value(stats[i].haplotype,
+                                                        *haplotypes)
+                            : summary_statistic_value(stats[i].summary, sums);
+        }
+}
+
+// Tables for the largest sample size of any replicate
+template <typename Replicate>
+inline std::shared_ptr<const HarmonicSums>
+replicate_harmonic_sums(const std::vector<Replicate> &reps)
+{
+    std::size_t nmax = 0;
+    for (auto &rep : reps)
+        {
+            nmax = std::max(nmax, rep.nsam);
+        }
+    return shared_harmonic_sums(nmax);
+}
+
+// A negative refstate means that ancestral states are unknown.
+inline void
+genotype_replicate_statistics(const std::vector<GenotypeReplicate> &reps,
+                              const std::vector<ReplicateStatistic> &stats,
+                              const int refstate, const unsigned nthreads,
+                              double *output)
+{
+    const bool haplotypes = needs_haplotypes(stats);
+    const auto tables = replicate_harmonic_sums(reps);
+    const HarmonicSums &h = *tables;
+    parallel_for(
+        reps.size(), nthreads, default_grain_size(reps.size(), nthreads, 1),
+        [&](const std::size_t begin, const std::size_t end) {
+            std::array<std::int32_t, 128> scratch;
+            scratch.fill(0);
+            for (std::size_t r = begin; r < end; ++r)
+                {
+                    const auto &rep = reps[r];
+                    SiteSums sums;
+                    for (std::size_t i = 0; i < rep.nsites; ++i)
+                        {
+                            accumulate_genotypes(rep.data + i * rep.nsam,
+                                                 rep.nsam, refstate, h,
+                                                 scratch.data(), sums);
+                        }
+                    HaplotypeStatistics hs{ 0, 0, 0., 0., 0., 0. };
+                    if (haplotypes)
+                        {
+                            hs = haplotype_statistics_from_labels(
+                                label_genotype_haplotypes(rep.data, rep.nsites,
+                                                          rep.nsam));
+                        }
+                    replicate_statistic_values(stats, sums, &hs,
+                                               output + r * stats.size());
+                }
+        });
+}
+
+// Haplotype statistics cannot be calculated from counts.
+inline void
+count_replicate_statistics(const std::vector<CountReplicate> &reps,
+                           const std::vector<SummaryStatistic> &stats,
+                           const int refstate, const unsigned nthreads,
+                           double *output)
+{
+    const std::int8_t ref = static_cast<std::int8_t>(refstate);
+    const auto tables = replicate_harmonic_sums(reps);
+    const HarmonicSums &h = *tables;
+    parallel_for(
+        reps.size(), nthreads, default_grain_size(reps.size(), nthreads, 1),
+        [&](const std::size_t begin, const std::size_t end) {
+            for (std::size_t r = begin; r < end; ++r)
+                {
+                    const auto &rep = reps[r];
+                    const auto sums = accumulate_sites(
+                        rep.counts, rep.ncol, 0, rep.nrow, &ref,
+                        refstate >= 0 ? 1 : 0, h);
+                    summary_statistic_values(stats, sums,
+                                             output + r * stats.size());
+                }
+        });
+}
+
+#endif
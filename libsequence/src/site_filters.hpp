@@ -0,0 +1,151 @@
+#ifndef PYLIBSEQ_SITE_FILTERS_HPP
+#define PYLIBSEQ_SITE_FILTERS_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+#include "parallel.hpp"
+
+// Filtering of the sites and samples of row-major
+// nsites x nsam genotype data, where negative states
+// are missing.  Filters produce a mask of the sites to
+// keep, and masks or lists of indexes are applied by
+// copying the selected rows and columns.
+
+// A site is kept if it passes all criteria.  The minor
+// allele frequency is that of the second most common
+// state among non-missing states, and is 0 for sites
+// with no data.  Positions are compared inclusively,
+// as for VariantMatrix.window.
+struct SiteFilter
+{
+    double min_maf, max_maf, max_missing, start, stop;
+    bool biallelic;
+
+    SiteFilter()
+        : min_maf(0.), max_maf(1.), max_missing(1.),
+          start(-std::numeric_limits<double>::infinity()),
+          stop(std::numeric_limits<double>::infinity()), biallelic(false)
+    {
+    }
+};
+
+inline bool
+keep_site(const std::int8_t *site, const std::size_t nsam,
+          const double position, const SiteFilter &filter,
+          std::array<std::int32_t, 128> &scratch)
+{
+    if (position < filter.start || position > filter.stop)
+        {
+            return false;
+        }
+    std::int32_t n = 0;
+    int maxstate = -1;
+    for (std::size_t j = 0; j < nsam; ++j)
+        {
+            if (site[j] >= 0)
+                {
+                    ++scratch[site[j]];
+                    ++n;
+                    maxstate = std::max(maxstate, int(site[j]));
+                }
+        }
+    std::int32_t first = 0, second = 0, nstates = 0;
+    for (int k = 0; k <= maxstate; ++k)
+        {
+            const std::int32_t c = scratch[k];
+            nstates += (c > 0);
+            if (c > first)
+                {
+                    second = first;
+                    first = c;
+                }
+            else if (c > second)
+                {
+                    second = c;
+                }
+            scratch[k] = 0;
+        }
+    const double maf
+        = n > 0 ? static_cast<double>(second) / static_cast<double>(n) : 0.;
+    const double missing
+        = nsam > 0 ? static_cast<double>(nsam - static_cast<std::size_t>(n))
+                         / static_cast<double>(nsam)
+                   : 0.;
+    return maf >= filter.min_maf && maf <= filter.max_maf
+           && missing <= filter.max_missing
+           && !(filter.biallelic && nstates > 2);
+}
+
+// Sets keep[i] to whether site i passes the filter.
+inline void
+site_filter_mask(const std::int8_t *data, const double *positions,
+                 const std::size_t nsites, const std::size_t nsam,
+                 const SiteFilter &filter, const unsigned nthreads,
+                 bool *keep)
+{
+    parallel_for(nsites, nthreads,
+                 default_grain_size(nsites, nthreads, 1024),
+                 [&](const std::size_t begin, const std::size_t end) {
+                     std::array<std::int32_t, 128> scratch;
+                     scratch.fill(0);
+                     for (std::size_t i = begin; i < end; ++i)
+                         {
+                             keep[i] = keep_site(data + i * nsam, nsam,
+                                                 positions[i], filter,
+                                                 scratch);
+                         }
+                 });
+}
+
+// Whether indexes are i, i + 1, ..., so that the
+// selected rows are contiguous in memory.
+inline bool
+is_contiguous(const std::vector<std::size_t> &indexes)
+{
+    for (std::size_t i = 1; i < indexes.size(); ++i)
+        {
+            if (indexes[i] != indexes[i - 1] + 1)
+                {
+                    return false;
+                }
+        }
+    return true;
+}
+
+// Copy the given sites and samples of data, which has
+// nsam columns, into output, which must have room for
+// sites.size() x samples.size() values.
+inline void
+gather_genotypes(const std::int8_t *data, const std::size_t nsam,
+                 const std::vector<std::size_t> &sites,
+                 const std::vector<std::size_t> &samples,
+                 const unsigned nthreads, std::int8_t *output)
+{
+    const std::size_t ncol = samples.size();
+    const bool all_samples = ncol == nsam && is_contiguous(samples);
+    parallel_for(sites.size(), nthreads,
+                 default_grain_size(sites.size(), nthreads, 1024),
+                 [&](const std::size_t begin, const std::size_t end) {
+                     for (std::size_t i = begin; i < end; ++i)
+                         {
+                             const std::int8_t *row = data + sites[i] * nsam;
+                             std::int8_t *out = output + i * ncol;
+                             if (all_samples)
+                                 {
+                                     std::memcpy(out, row, nsam);
+                                     continue;
+                                 }
+                             for (std::size_t j = 0; j < ncol; ++j)
+                                 {
+                                     out[j] = row[samples[j]];
+                                 }
+                         }
+                 });
+}
+
+#endif
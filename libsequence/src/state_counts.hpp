@@ -0,0 +1,62 @@
+#ifndef PYLIBSEQ_STATE_COUNTS_HPP
+#define PYLIBSEQ_STATE_COUNTS_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "parallel.hpp"
+
+// Counts of the non-missing states at each site of
+// row-major nsites x nsam genotype data, as one
+// nsites x ncol matrix.
+
+// The largest non-negative state, or -1 if there are none.
+inline int
+max_state(const std::int8_t *data, const std::size_t n,
+          const unsigned nthreads)
+{
+    std::vector<int> partial(resolve_nthreads(nthreads) * 8, -1);
+    const std::size_t grain = std::max<std::size_t>(
+        1 << 16, (n + partial.size() - 1) / partial.size());
+    parallel_for(n, nthreads, grain,
+                 [&](const std::size_t begin, const std::size_t end) {
+                     std::int8_t m = -1;
+                     for (std::size_t i = begin; i < end; ++i)
+                         {
+                             m = std::max(m, data[i]);
+                         }
+                     partial[begin / grain] = m;
+                 });
+    return *std::max_element(partial.begin(), partial.end());
+}
+
+// Blocks of sites are counted in parallel.  States
+// greater than or equal to ncol are not counted.
+inline void
+count_states(const std::int8_t *data, const std::size_t nsites,
+             const std::size_t nsam, const std::size_t ncol,
+             const unsigned nthreads, std::int32_t *counts)
+{
+    parallel_for(nsites, nthreads,
+                 default_grain_size(nsites, nthreads, 1024),
+                 [&](const std::size_t begin, const std::size_t end) {
+                     std::fill(counts + begin * ncol, counts + end * ncol, 0);
+                     for (std::size_t i = begin; i < end; ++i)
+                         {
+                             const std::int8_t *site = data + i * nsam;
+                             std::int32_t *c = counts + i * ncol;
+                             for (std::size_t j = 0; j < nsam; ++j)
+                                 {
+                                     const std::size_t s
+                                         = static_cast<std::size_t>(site[j]);
+                                     if (site[j] >= 0 && s < ncol)
+                                         {
+                                             ++c[s];
+                                         }
+                                 }
+                         }
+                 });
+}
+
+#endif
@@ -2,7 +2,9 @@
 #include <pybind11/numpy.h>
 #include <pybind11/stl.h>
 #include <pybind11/stl_bind.h>
+#include <memory>
 #include <numeric>
+#include <unordered_map>
 #include <Sequence/VariantMatrix.hpp>
 #include <Sequence/AlleleCountMatrix.hpp>
 #include <Sequence/summstats.hpp>
@@ -19,6 +21,15 @@
 #include <Sequence/SummStatsDeprecated/lHaf.hpp>
 #include <Sequence/Recombination.hpp>
 #include <Sequence/stateCounter.hpp>
+#include "allele_count_views.hpp"
+#include "difference_kernels.hpp"
+#include "genetic_map.hpp"
+#include "nsl_kernels.hpp"
+#include "numpy_helpers.hpp"
+#include "omega_kernels.hpp"
+#include "polytable_conversion.hpp"
+#include "replicate_kernels.hpp"
+#include "summstats_kernels.hpp"
 
 namespace py = pybind11;
 
@@ -26,6 +37,325 @@ PYBIND11_MAKE_OPAQUE(std::vector<Sequence::nSLiHS>);
 
 std::pair<double, double> omega_max(const Sequence::SimData& data);
 
+namespace
+{
+    // A genetic map from a pair of array-like objects:
+    // sorted physical positions and their genetic positions.
+    std::unique_ptr<GeneticMap>
+    genetic_map_from_object(py::object gmap)
+    {
+        using Array = py::array_t<double, py::array::c_style
+                                              | py::array::forcecast>;
+        auto t = gmap.cast<py::tuple>();
+        if (t.size() != 2)
+            {
+                throw std::invalid_argument(
+                    "genetic map must be a pair of arrays");
+            }
+        auto physical = Array::ensure(t[0]);
+        auto genetic = Array::ensure(t[1]);
+        if (!physical || !genetic || physical.ndim() != 1
+            || genetic.ndim() != 1 || physical.size() != genetic.size())
+            {
+                throw std::invalid_argument(
+                    "genetic map must be two 1d arrays of equal length");
+            }
+        return std::unique_ptr<GeneticMap>(new GeneticMap(
+            physical.data(), genetic.data(),
+            static_cast<std::size_t>(physical.size())));
+    }
+
+    // Positions on the genetic map, or the positions
+    // themselves if there is no map.
+    std::vector<double>
+    map_positions(const GeneticMap* gmap, const double* positions,
+                  const std::size_t n)
+    {
+        if (gmap == nullptr)
+            {
+                return std::vector<double>(positions, positions + n);
+            }
+        return gmap->interpolate(positions, n);
+    }
+
+    std::vector<Sequence::nSLiHS>
+    nsl_results(const std::vector<nSLScanResult>& scan)
+    {
+        std::vector<Sequence::nSLiHS> rv;
+        rv.reserve(scan.size());
+        for (auto& s : scan)
+            {
+                rv.push_back(Sequence::nSLiHS{
+                    s.nsl, s.ihs,
+                    static_cast<decltype(Sequence::nSLiHS::core_count)>(
+                        s.core_count) });
+            }
+        return rv;
+    }
+
+    SiteSums
+    site_sums(const Sequence::AlleleCountMatrix& ac,
+              const AncestralStates& refstates, const HarmonicSums& h)
+    {
+        return accumulate_sites(ac.counts.data(), ac.ncol, 0, ac.nrow,
+                                refstates.data(),
+                                static_cast<std::size_t>(refstates.size()), h);
+    }
+
+    SiteSums
+    site_sums(const AlleleCountMatrixView& ac,
+              const AncestralStates& refstates, const HarmonicSums& h)
+    {
+        return accumulate_view(ac, refstates.data(),
+                               static_cast<std::size_t>(refstates.size()), h);
+    }
+
+    // The single-record array returned by summary_statistics
+    template <typename Matrix>
+    py::array
+    summary_statistics_record(const Matrix& ac, py::object stats,
+                              py::object ancestral_states)
+    {
+        auto refstates
+            = ancestral_states_from_object(ancestral_states, ac.nrow);
+        auto statlist = summary_statistics_from_names(
+            stats.is_none() ? std::vector<std::string>()
+                            : stats.cast<std::vector<std::string>>(),
+            refstates.size() > 0);
+        std::vector<double> values(statlist.size());
+        {
+            py::gil_scoped_release release;
+            const auto h = shared_harmonic_sums(ac.nsam);
+            auto sums = site_sums(ac, refstates, *h);
+            summary_statistic_values(statlist, sums, values.data());
+        }
+        std::vector<std::string> names;
+        std::vector<bool> is_integer;
+        for (auto s : statlist)
+            {
+                names.push_back(summary_statistic_name(s));
+                is_integer.push_back(summary_statistic_is_integer(s));
+            }
+        return make_structured_array(names, is_integer, values, 1);
+    }
+
+    // -1 for None, meaning that ancestral states are unknown
+    int
+    ancestral_state_from_object(py::object o)
+    {
+        if (o.is_none())
+            {
+                return -1;
+            }
+        const auto state = o.cast<std::int8_t>();
+        if (state < 0)
+            {
+                throw std::invalid_argument(
+                    "ancestral state must be non-negative");
+            }
+        return state;
+    }
+
+    std::vector<ReplicateStatistic>
+    replicate_statistics_from_object(py::object stats, const int refstate)
+    {
+        return replicate_statistics_from_names(
+            stats.is_none() ? std::vector<std::string>()
+                            : stats.cast<std::vector<std::string>>(),
+            refstate >= 0);
+    }
+
+    py::array
+    genotype_replicate_array(const std::vector<GenotypeReplicate>& reps,
+                             const std::vector<ReplicateStatistic>& statlist,
+                             const int refstate, const unsigned nthreads)
+    {
+        std::vector<double> values(reps.size() * statlist.size());
+        {
+            py::gil_scoped_release release;
+            genotype_replicate_statistics(reps, statlist, refstate, nthreads,
+                                          values.data());
+        }
+        return numpy_from_vector(std::move(values),
+                                 { reps.size(), statlist.size() });
+    }
+
+    // replicates is a sequence of VariantMatrix or of
+    // AlleleCountMatrix objects.
+    py::array
+    replicate_statistics(py::sequence replicates, py::object stats,
+                         py::object ancestral_state, const unsigned nthreads)
+    {
+        const int refstate = ancestral_state_from_object(ancestral_state);
+        const auto statlist
+            = replicate_statistics_from_object(stats, refstate);
+        const std::size_t nreps = replicates.size();
+        if (nreps > 0 && py::isinstance<Sequence::AlleleCountMatrix>(
+                             replicates[0]))
+            {
+                std::vector<SummaryStatistic> summaries;
+                for (auto& s : statlist)
+                    {
+                        if (s.is_haplotype)
+                            {
+                                throw std::invalid_argument(
+                                    "haplotype statistics require "
+                                    "VariantMatrix replicates");
+                            }
+                        summaries.push_back(s.summary);
+                    }
+                std::vector<CountReplicate> reps;
+                for (std::size_t i = 0; i < nreps; ++i)
+                    {
+                        if (!py::isinstance<Sequence::AlleleCountMatrix>(
+                                replicates[i]))
+                            {
+                                throw py::type_error(
+                                    "all replicates must have the same type");
+                            }
+                        const auto& ac
+                            = replicates[i]
+                                  .cast<const Sequence::AlleleCountMatrix&>();
+                        reps.push_back(CountReplicate{
+                            ac.counts.data(), ac.nrow, ac.ncol, ac.nsam });
+                    }
+                std::vector<double> values(nreps * summaries.size());
+                {
+                    py::gil_scoped_release release;
+                    count_replicate_statistics(reps, summaries, refstate,
+                                               nthreads, values.data());
+                }
+                return numpy_from_vector(std::move(values),
+                                         { nreps, summaries.size() });
+            }
+        std::vector<GenotypeReplicate> reps;
+        for (std::size_t i = 0; i < nreps; ++i)
+            {
+                if (!py::isinstance<Sequence::VariantMatrix>(replicates[i]))
+                    {
+                        throw py::type_error(
+                            "replicates must be VariantMatrix or "
+                            "AlleleCountMatrix objects of the same type");
+                    }
+                const auto& vm
+                    = replicates[i].cast<const Sequence::VariantMatrix&>();
+                reps.push_back(
+                    GenotypeReplicate{ vm.cdata(), vm.nsites(), vm.nsam() });
+            }
+        return genotype_replicate_array(reps, statlist, refstate, nthreads);
+    }
+
+    // Replicate r is elements [offsets[r], offsets[r + 1]) of
+    // genotypes, as a row-major matrix with nsam[r] columns.
+    py::array
+    packed_replicate_statistics(
+        py::array_t<std::int8_t, py::array::c_style | py::array::forcecast>
+            genotypes,
+        py::array_t<std::int64_t, py::array::c_style | py::array::forcecast>
+            offsets,
+        py::array_t<std::int64_t, py::array::c_style | py::array::forcecast>
+            nsam,
+        py::object stats, py::object ancestral_state, const unsigned nthreads)
+    {
+        const int refstate = ancestral_state_from_object(ancestral_state);
+        const auto statlist
+            = replicate_statistics_from_object(stats, refstate);
+        if (offsets.ndim() != 1 || offsets.size() < 1)
+            {
+                throw std::invalid_argument(
+                    "offsets must be a one-dimensional array with at least "
+                    "one element");
+            }
+        const std::size_t nreps = static_cast<std::size_t>(offsets.size()) - 1;
+        if (nsam.size() != 1 && static_cast<std::size_t>(nsam.size()) != nreps)
+            {
+                throw std::invalid_argument(
+                    "nsam must be a single value or one value per replicate");
+            }
+        const std::int64_t* o = offsets.data();
+        const auto ngenotypes = static_cast<std::int64_t>(genotypes.size());
+        std::vector<GenotypeReplicate> reps;
+        for (std::size_t r = 0; r < nreps; ++r)
+            {
+                const std::int64_t n = nsam.data()[nsam.size() == 1 ? 0 : r];
+                if (o[r] < 0 || o[r + 1] < o[r] || o[r + 1] > ngenotypes)
+                    {
+                        throw std::invalid_argument(
+                            "offsets must be increasing and within the "
+                            "genotypes");
+                    }
+                if (n < 1 || (o[r + 1] - o[r]) % n != 0)
+                    {
+                        throw std::invalid_argument(
+                            "the size of each replicate must be a multiple "
+                            "of its sample size");
+                    }
+                reps.push_back(GenotypeReplicate{
+                    genotypes.data() + o[r],
+                    static_cast<std::size_t>((o[r + 1] - o[r]) / n),
+                    static_cast<std::size_t>(n) });
+            }
+        return genotype_replicate_array(reps, statlist, refstate, nthreads);
+    }
+
+    // Bind the statistic s of a view to name, for
+    // statistics that do not need ancestral states.
+    void
+    def_view_statistic(py::module& m, const char* name,
+                       const SummaryStatistic s)
+    {
+        if (summary_statistic_is_integer(s))
+            {
+                m.def(
+                    name,
+                    [s](const AlleleCountMatrixView& v) {
+                        return static_cast<std::int64_t>(
+                            view_statistic(v, s, nullptr, 0));
+                    },
+                    py::arg("ac"), py::call_guard<py::gil_scoped_release>());
+            }
+        else
+            {
+                m.def(
+                    name,
+                    [s](const AlleleCountMatrixView& v) {
+                        return view_statistic(v, s, nullptr, 0);
+                    },
+                    py::arg("ac"), py::call_guard<py::gil_scoped_release>());
+            }
+    }
+
+    // As def_view_statistic, for statistics that need one
+    // ancestral state, or one for each row of the view.
+    void
+    def_view_statistic_with_ancestral_states(py::module& m, const char* name,
+                                             const SummaryStatistic s)
+    {
+        m.def(
+            name,
+            [s](const AlleleCountMatrixView& v, const std::int8_t refstate) {
+                return view_statistic(v, s, &refstate, 1);
+            },
+            py::arg("ac"), py::arg("ancestral_state"),
+            py::call_guard<py::gil_scoped_release>());
+        m.def(
+            name,
+            [s](const AlleleCountMatrixView& v,
+                const std::vector<std::int8_t>& refstates) {
+                if (refstates.size() != v.nrow)
+                    {
+                        throw std::invalid_argument(
+                            "number of ancestral states must equal the "
+                            "number of rows");
+                    }
+                return view_statistic(v, s, refstates.data(),
+                                      refstates.size());
+            },
+            py::arg("ac"), py::arg("ancestral_states"),
+            py::call_guard<py::gil_scoped_release>());
+    }
+} // namespace
+
 void
 init_summstats(py::module& m)
 {
@@ -36,13 +366,13 @@ init_summstats(py::module& m)
           R"delim(
             Mean number of pairwise differences.
             
-            :param ac: A :class:`libsequence.AlleleCountMatrix`
+            :param ac: A :class:`libsequence.AlleleCountMatrix` or :class:`libsequence.AlleleCountMatrixView`
             
             .. note::
 
                 Implemented as sum of site heterozygosity.
             )delim",
-          py::arg("ac"));
+          py::arg("ac"), py::call_guard<py::gil_scoped_release>());
 
     m.def("thetaw", &Sequence::thetaw,
           R"delim(
@@ -53,24 +383,33 @@ init_summstats(py::module& m)
             .. note::
 
                 Calculated from the total number of mutations.
-            )delim",py::arg("ac"));
-    m.def("nvariable_sites", &Sequence::nvariable_sites);
-    m.def("nbiallelic_sites", &Sequence::nbiallelic_sites);
-    m.def("total_number_of_mutations", &Sequence::total_number_of_mutations);
+            )delim",py::arg("ac"), py::call_guard<py::gil_scoped_release>());
+    m.def("nvariable_sites", &Sequence::nvariable_sites, py::call_guard<py::gil_scoped_release>());
+    m.def("nbiallelic_sites", &Sequence::nbiallelic_sites, py::call_guard<py::gil_scoped_release>());
+    m.def("total_number_of_mutations", &Sequence::total_number_of_mutations,
+          py::call_guard<py::gil_scoped_release>());
     m.def("tajd", &Sequence::tajd,
           R"delim(
             Tajima's D.
 
             :param m: A :class:`libsequence.AlleleCountMatrix`
+
+            .. note::
+
+                The normalizing constants are those of the sample
+                size of the matrix.  For data with missing values,
+                :func:`libsequence.summary_statistics` and the
+                overload for :class:`libsequence.AlleleCountMatrixView`
+                use the sample size of each site instead.
             )delim",
-          py::arg("ac"));
+          py::arg("ac"), py::call_guard<py::gil_scoped_release>());
 
     m.def(
         "hprime",
         [](const Sequence::AlleleCountMatrix& m, const std::int8_t refstate) {
             return Sequence::hprime(m, refstate);
         },
-        py::arg("ac"), py::arg("ancestral_state"));
+        py::arg("ac"), py::arg("ancestral_state"), py::call_guard<py::gil_scoped_release>());
 
     m.def(
         "hprime",
@@ -78,14 +417,14 @@ init_summstats(py::module& m)
            const std::vector<std::int8_t>& refstates) {
             return Sequence::hprime(m, refstates);
         },
-        py::arg("ac"), py::arg("ancestral_state"));
+        py::arg("ac"), py::arg("ancestral_state"), py::call_guard<py::gil_scoped_release>());
 
     m.def(
         "faywuh",
         [](const Sequence::AlleleCountMatrix& m, const std::int8_t refstate) {
             return Sequence::faywuh(m, refstate);
         },
-        py::arg("ac"), py::arg("ancestral_state"));
+        py::arg("ac"), py::arg("ancestral_state"), py::call_guard<py::gil_scoped_release>());
 
     m.def(
         "faywuh",
@@ -93,28 +432,88 @@ init_summstats(py::module& m)
            const std::vector<std::int8_t>& refstates) {
             return Sequence::faywuh(m, refstates);
         },
-        py::arg("ac"), py::arg("ancestral_states"));
+        py::arg("ac"), py::arg("ancestral_states"), py::call_guard<py::gil_scoped_release>());
 
-    m.def("is_different_matrix", &Sequence::difference_matrix,
-          R"delim(
+    // Overloads for views of rows of an AlleleCountMatrix
+    def_view_statistic(m, "thetapi", SummaryStatistic::thetapi);
+    def_view_statistic(m, "thetaw", SummaryStatistic::thetaw);
+    def_view_statistic(m, "nvariable_sites", SummaryStatistic::nvariable_sites);
+    def_view_statistic(m, "nbiallelic_sites", SummaryStatistic::nbiallelic_sites);
+    def_view_statistic(m, "total_number_of_mutations",
+                       SummaryStatistic::total_number_of_mutations);
+    def_view_statistic(m, "tajd", SummaryStatistic::tajd);
+    def_view_statistic_with_ancestral_states(m, "hprime",
+                                             SummaryStatistic::hprime);
+    def_view_statistic_with_ancestral_states(m, "faywuh",
+                                             SummaryStatistic::faywuh);
+
+    m.def(
+        "is_different_matrix",
+        [](const Sequence::VariantMatrix& m, const unsigned nthreads) {
+            py::array_t<bool> rv(condensed_size(m.nsam()));
+            auto output = rv.mutable_data();
+            py::gil_scoped_release release;
+            pairwise_differences(m.cdata(), m.nsites(), m.nsam(), true,
+                                 nthreads, output);
+            return rv;
+        },
+        R"delim(
             Return whether or not pairs of 
             samples in a VariantMatrix differ
 
             :param m: A :class:`libsequence.VariantMatrix`
+            :param nthreads: (1) Number of threads to use.  If 0, use all available cores.
+
+            :rtype: numpy.ndarray
+
+            The layout is the same as for :func:`libsequence.difference_matrix`.
+            The comparison of each pair of samples stops at the first
+            difference.
+
+            .. versionchanged:: 0.2.4
+
+                Returns a boolean numpy array.  Previously, this function
+                returned the number of differences.  Added nthreads.
             )delim",
-          py::arg("m"));
+        py::arg("m"), py::arg("nthreads") = 1);
 
-    m.def("difference_matrix", &Sequence::difference_matrix,
-          R"delim(
+    m.def(
+        "difference_matrix",
+        [](const Sequence::VariantMatrix& m, const unsigned nthreads) {
+            py::array_t<std::int32_t> rv(condensed_size(m.nsam()));
+            auto output = rv.mutable_data();
+            py::gil_scoped_release release;
+            pairwise_differences(m.cdata(), m.nsites(), m.nsam(), false,
+                                 nthreads, output);
+            return rv;
+        },
+        R"delim(
             Return the nummber of differences between all
             samples in a VariantMatrix
 
             :param m: A :class:`libsequence.VariantMatrix`
+            :param nthreads: (1) Number of threads to use.  If 0, use all available cores.
+
+            :rtype: numpy.ndarray
+
+            The return value is the condensed upper triangle of the
+            matrix of differences, for pairs (0, 1), (0, 2), ..., (1, 2), ...
+            This is the layout returned by scipy.spatial.distance.pdist,
+            so that scipy.spatial.distance.squareform gives the full matrix.
+            Sites where either sample has missing data are not counted.
+
+            Pairs of samples are processed in cache-sized tiles.  If all
+            states are 0, 1, or missing, genotypes are first packed into
+            bits and compared 64 sites at a time.
+
+            .. versionchanged:: 0.2.4
+
+                Returns a numpy array.  Added nthreads.
             )delim",
-          py::arg("m"));
-    m.def("label_haplotypes", &Sequence::label_haplotypes);
-    m.def("number_of_haplotypes", &Sequence::number_of_haplotypes);
-    m.def("haplotype_diversity", &Sequence::haplotype_diversity);
+        py::arg("m"), py::arg("nthreads") = 1);
+    m.def("label_haplotypes", &Sequence::label_haplotypes, py::call_guard<py::gil_scoped_release>());
+    m.def("number_of_haplotypes", &Sequence::number_of_haplotypes, py::call_guard<py::gil_scoped_release>());
+    m.def("haplotype_diversity", &Sequence::haplotype_diversity, py::call_guard<py::gil_scoped_release>());
     m.def("rmin", &Sequence::rmin,
           R"delim(
             Hudson and Kaplan's estimate of the minimum number
@@ -126,7 +525,8 @@ init_summstats(py::module& m)
 
                 Sites with more than two allelic states to not 
                 contribute to the analysis.
-            )delim");
+            )delim",
+          py::call_guard<py::gil_scoped_release>());
 
     PYBIND11_NUMPY_DTYPE(Sequence::nSLiHS, nsl, ihs, core_count);
 
@@ -142,16 +542,101 @@ init_summstats(py::module& m)
 
     m.def(
         "nsl",
-        [](const Sequence::VariantMatrix& m, const std::int8_t refstate) {
-            return Sequence::nsl(m, refstate);
+        [](const Sequence::VariantMatrix& m, const std::int8_t refstate,
+           py::object gmap) -> std::vector<Sequence::nSLiHS> {
+            if (gmap.is_none())
+                {
+                    py::gil_scoped_release release;
+                    return Sequence::nsl(m, refstate);
+                }
+            auto map = genetic_map_from_object(gmap);
+            py::gil_scoped_release release;
+            const auto positions
+                = map->interpolate(m.pbegin(), m.nsites());
+            return nsl_results(nsl_scan(m.cdata(), m.nsites(), m.nsam(),
+                                        refstate, positions.data(), -1, 1));
         },
-        py::arg("m"), py::arg("refstate"));
+        py::arg("m"), py::arg("refstate"), py::arg("gmap") = nullptr,
+        R"delim(
+        Calculate :math:`nS_L` and iHS :cite:`Ferrer-Admetlla2014-wa`
+        for every site of a VariantMatrix.
+
+        :param m: A :class:`libsequence.VariantMatrix`
+        :param refstate: Value of the reference state
+        :param gmap: (None) A genetic map, as a pair of arrays (physical positions, genetic positions).
+
+        :rtype: :class:`libsequence.VecnSLResults`
+
+        If gmap is not None, iHS uses genetic rather than
+        physical distances.  The map positions must be strictly
+        increasing, and the genetic location of each site is
+        interpolated linearly.  Sites outside of the map take the
+        value of the nearest end of the map.  This calculation is
+        done with :func:`libsequence.nsl_scan`.
+
+        .. versionchanged:: 0.2.4
+
+            Added gmap.
+        )delim");
 
     m.def(
         "nslx",
         [](const Sequence::VariantMatrix& m, const std::int8_t refstate,
            const int x) { return Sequence::nslx(m, refstate, x); },
-        py::arg("m"), py::arg("refstate"), py::arg("x"));
+        py::arg("m"), py::arg("refstate"), py::arg("x"), py::call_guard<py::gil_scoped_release>());
+
+    m.def(
+        "nsl_scan",
+        [](const Sequence::VariantMatrix& m, const std::int8_t refstate,
+           py::object x, py::object gmap, const unsigned nthreads) {
+            const int xval = x.is_none() ? -1 : x.cast<int>();
+            if (xval < -1)
+                {
+                    throw std::invalid_argument("x must be non-negative");
+                }
+            auto map = gmap.is_none() ? nullptr : genetic_map_from_object(gmap);
+            py::gil_scoped_release release;
+            const auto positions
+                = map_positions(map.get(), m.pbegin(), m.nsites());
+            return nsl_results(nsl_scan(m.cdata(), m.nsites(), m.nsam(),
+                                        refstate, positions.data(), xval,
+                                        nthreads));
+        },
+        py::arg("m"), py::arg("refstate"), py::arg("x") = nullptr,
+        py::arg("gmap") = nullptr, py::arg("nthreads") = 1,
+        R"delim(
+        Calculate :math:`nS_L` and iHS :cite:`Ferrer-Admetlla2014-wa`
+        for every site of a VariantMatrix in a single sweep.
+
+        :param m: A :class:`libsequence.VariantMatrix`
+        :param refstate: Value of the reference state
+        :param x: (None) If not None, only mutations with non-reference count :math:`\leq x` break up haplotype homozygosity, as for :func:`libsequence.nslx`.
+        :param gmap: (None) A genetic map, as a pair of arrays (physical positions, genetic positions).  See :func:`libsequence.nsl`.
+        :param nthreads: (1) Number of threads to use.  If 0, use all available cores.
+
+        :rtype: :class:`libsequence.VecnSLResults`
+
+        Rather than extending haplotypes around each core site,
+        the sites at which each pair of samples differ are found
+        once, and every core site between two consecutive
+        differences receives that pair's contribution.  The cost is
+        proportional to the total number of differences over all
+        pairs of samples, rather than to the lengths of shared
+        haplotypes times the number of cores.  Finding the
+        differences of a pair scans its sites 64 at a time when all
+        states are 0, 1, or missing, and 8 at a time otherwise, but
+        each difference found is then handled on its own.  Pairs of
+        samples are divided among threads.
+
+        For a pair of samples sharing the state at the core, the
+        shared haplotype is bounded by the nearest differences on
+        either side, and contributes the number of sites between
+        them to :math:`nS_L` and the distance between them to iHS.
+        Pairs for which either bound is not found do not contribute.
+        Missing data differ from any non-missing state.
+
+        .. versionadded:: 0.2.4
+        )delim");
 
     //m.def("nsl",
     //      [](const Sequence::VariantMatrix& m, const std::size_t core,
@@ -174,8 +659,9 @@ init_summstats(py::module& m)
         .def_readonly("H1", &Sequence::GarudStats::H1, "Value of H1")
         .def_readonly("H12", &Sequence::GarudStats::H12, "Value of H2")
         .def_readonly("H2H1", &Sequence::GarudStats::H2H1, "Value of H2/H1");
-    m.def("garud_statistics", &Sequence::garud_statistics);
-    m.def("two_locus_haplotype_counts", &Sequence::two_locus_haplotype_counts);
+    m.def("garud_statistics", &Sequence::garud_statistics, py::call_guard<py::gil_scoped_release>());
+    m.def("two_locus_haplotype_counts", &Sequence::two_locus_haplotype_counts,
+          py::call_guard<py::gil_scoped_release>());
 
     py::class_<Sequence::AlleleCounts>(m, "AlleleCounts")
         .def_readonly("nstates", &Sequence::AlleleCounts::nstates,
@@ -183,21 +669,147 @@ init_summstats(py::module& m)
         .def_readonly("nmissing", &Sequence::AlleleCounts::nmissing,
                       "Number of samples with missing states");
 
-    m.def("allele_counts", [](const Sequence::AlleleCountMatrix& m) {
-        return Sequence::allele_counts(m);
-    });
+    m.def(
+        "allele_counts",
+        [](const Sequence::AlleleCountMatrix& m) {
+            return Sequence::allele_counts(m);
+        },
+        py::call_guard<py::gil_scoped_release>());
 
     m.def(
         "non_reference_allele_counts",
         [](const Sequence::AlleleCountMatrix& m, const std::int8_t refstate) {
             return Sequence::non_reference_allele_counts(m, refstate);
-        });
+        },
+        py::call_guard<py::gil_scoped_release>());
 
     m.def("non_reference_allele_counts",
           [](const Sequence::AlleleCountMatrix& m,
              const std::vector<std::int8_t>& refstates) {
               return Sequence::non_reference_allele_counts(m, refstates);
-          });
+          },
+          py::call_guard<py::gil_scoped_release>());
+
+    m.def(
+        "summary_statistics",
+        [](const Sequence::AlleleCountMatrix& ac, py::object stats,
+           py::object ancestral_states) {
+            return summary_statistics_record(ac, stats, ancestral_states);
+        },
+        R"delim(
+            Calculate several summary statistics in a single
+            pass through the data.
+
+            :param ac: A :class:`libsequence.AlleleCountMatrix` or :class:`libsequence.AlleleCountMatrixView`
+            :param stats: (None) A list of statistic names.
+            :param ancestral_states: (None) The ancestral state, or a list of ancestral states for each site.
+
+            :rtype: numpy.ndarray
+
+            The return value is a structured array with a single record
+            whose fields are the requested statistics. The valid names
+            are thetapi, thetaw, tajd, thetah, thetal, faywuh,
+            hprime, nvariable_sites, nbiallelic_sites, and
+            total_number_of_mutations. If stats is None, all
+            statistics are returned, omitting those requiring ancestral
+            states if ancestral_states is None.
+
+            .. note::
+
+                The per-site sample size is the number of non-missing
+                states.  Tajima's D and H' are corrected for missing data by
+                summing :math:`\theta_W` and the constants of their
+                variances over sites, each at its own sample size.
+                Without missing data, they are the usual statistics.
+                The functions :func:`libsequence.thetaw`,
+                :func:`libsequence.tajd` and :func:`libsequence.hprime`
+                of an :class:`libsequence.AlleleCountMatrix` are those
+                of libsequence, which use the sample size of the matrix.
+
+            .. versionadded:: 0.2.4
+
+            >>> import msprime
+            >>> import libsequence
+            >>> ts = msprime.simulate(10, mutation_rate=10, random_seed=42)
+            >>> ac = libsequence.VariantMatrix.from_TreeSequence(ts).count_alleles()
+            >>> s = libsequence.summary_statistics(ac, ["thetapi", "tajd"])
+            >>> s = libsequence.summary_statistics(ac, ancestral_states=0)
+            )delim",
+        py::arg("ac"), py::arg("stats") = nullptr,
+        py::arg("ancestral_states") = nullptr);
+
+    m.def(
+        "summary_statistics",
+        [](const AlleleCountMatrixView& ac, py::object stats,
+           py::object ancestral_states) {
+            return summary_statistics_record(ac, stats, ancestral_states);
+        },
+        py::arg("ac"), py::arg("stats") = nullptr,
+        py::arg("ancestral_states") = nullptr);
+
+    m.def("replicate_statistics", &replicate_statistics,
+          R"delim(
+            Calculate statistics for many replicates in one call.
+
+            :param replicates: A list of :class:`libsequence.VariantMatrix`, or a list of :class:`libsequence.AlleleCountMatrix`.
+            :param stats: (None) A list of statistic names.
+            :param ancestral_state: (None) The ancestral state of all sites.
+            :param nthreads: (1) Number of threads to use.  If 0, use all available cores.
+
+            :rtype: numpy.ndarray
+
+            The return value is a 2d array with one row per replicate
+            and one column per statistic, in the order of stats.
+            The names of statistics, and the default set of
+            statistics, are the same as for
+            :func:`libsequence.summary_statistics`.  For
+            :class:`libsequence.VariantMatrix` replicates, the
+            haplotype statistics number_of_haplotypes,
+            haplotype_diversity, H1, H12, and H2H1 are also
+            available, where haplotypes with missing data are
+            ignored.
+
+            Each replicate is processed by one thread, without
+            holding the GIL, so that many small replicates are
+            processed efficiently.
+
+            .. versionadded:: 0.2.4
+
+            >>> import msprime
+            >>> import libsequence
+            >>> reps = [libsequence.VariantMatrix.from_TreeSequence(ts)
+            ...         for ts in msprime.simulate(10, mutation_rate=10,
+            ...                                    random_seed=42, num_replicates=20)]
+            >>> s = libsequence.replicate_statistics(reps, ["thetapi", "tajd", "H12"], nthreads=2)
+            )delim",
+          py::arg("replicates"), py::arg("stats") = nullptr,
+          py::arg("ancestral_state") = nullptr, py::arg("nthreads") = 1);
+
+    m.def("packed_replicate_statistics", &packed_replicate_statistics,
+          R"delim(
+            As :func:`libsequence.replicate_statistics`, for
+            replicates whose genotypes are concatenated into
+            one array.
+
+            :param genotypes: The genotypes of all replicates, as a 1d array of 8-bit integers.
+            :param offsets: An array of length nreplicates + 1.  Replicate i is genotypes[offsets[i]:offsets[i + 1]].
+            :param nsam: The sample size of all replicates, or an array of the sample size of each replicate.
+            :param stats: (None) A list of statistic names.
+            :param ancestral_state: (None) The ancestral state of all sites.
+            :param nthreads: (1) Number of threads to use.  If 0, use all available cores.
+
+            :rtype: numpy.ndarray
+
+            The genotypes of each replicate are a row-major
+            nsites x nsam matrix, as in
+            :attr:`libsequence.VariantMatrix.data`.  No
+            VariantMatrix objects are created.
+
+            .. versionadded:: 0.2.4
+            )delim",
+          py::arg("genotypes"), py::arg("offsets"), py::arg("nsam"),
+          py::arg("stats") = nullptr, py::arg("ancestral_state") = nullptr,
+          py::arg("nthreads") = 1);
 
     //py::object polytable
     //    = (py::object)py::module::import("libsequence.polytable")
@@ -291,8 +903,8 @@ init_summstats(py::module& m)
 
     m.def(
         "nSLiHS",
-        [](const Sequence::SimData& d, py::object core_snps, py::object gmap) {
-            std::vector<std::tuple<double, double, std::uint32_t>> rv;
+        [](const Sequence::SimData& d, py::object core_snps, py::object gmap,
+           const unsigned nthreads) {
             std::vector<std::size_t> cores;
             if (!core_snps.is_none())
                 {
@@ -303,35 +915,103 @@ init_summstats(py::module& m)
                     cores.resize(d.numsites());
                     std::iota(cores.begin(), cores.end(), 0);
                 }
-            std::unordered_map<double, double> gm;
-            if (!gmap.is_none())
+            for (auto c : cores)
+                {
+                    if (c >= d.numsites())
+                        {
+                            throw std::out_of_range(
+                                "core SNP index out of range");
+                        }
+                }
+            const std::size_t nsites = d.numsites(), nsam = d.size();
+            // Locations of all sites, on the genetic map if given
+            std::vector<double> positions = d.GetPositions();
+            if (py::isinstance<py::dict>(gmap))
                 {
-                    gm = gmap.cast<std::unordered_map<double, double>>();
+                    const auto gm
+                        = gmap.cast<std::unordered_map<double, double>>();
+                    for (auto& x : positions)
+                        {
+                            const auto i = gm.find(x);
+                            if (i == gm.end())
+                                {
+                                    throw std::invalid_argument(
+                                        "genetic map has no entry for a "
+                                        "site position");
+                                }
+                            x = i->second;
+                        }
                 }
-            for (auto c : cores)
+            else if (!gmap.is_none())
                 {
-                    auto nsl = Sequence::nSL(c, d, gm);
-                    auto dc = static_cast<std::uint32_t>(
-                        std::count((d.sbegin() + c)->second.begin(),
-                                   (d.sbegin() + c)->second.end(), '1'));
-                    rv.push_back(std::make_tuple(nsl.first, nsl.second, dc));
+                    positions = genetic_map_from_object(gmap)->interpolate(
+                        positions.data(), nsites);
                 }
-            return rv;
+            std::vector<const char*> haplotypes(nsam);
+            for (std::size_t j = 0; j < nsam; ++j)
+                {
+                    if (d[j].size() != nsites)
+                        {
+                            throw std::invalid_argument(
+                                "all haplotypes must have one character "
+                                "per site");
+                        }
+                    haplotypes[j] = d[j].c_str();
+                }
+            // nsl, ihs, and core_count for each core
+            std::vector<double> values(3 * cores.size());
+            {
+                py::gil_scoped_release release;
+                std::vector<std::int8_t> genotypes(nsites * nsam);
+                haplotypes_to_genotypes(haplotypes, nsites,
+                                        polytable_state_table(), nthreads,
+                                        genotypes.data());
+                const auto scan
+                    = nsl_scan(genotypes.data(), nsites, nsam, 0,
+                               positions.data(), -1, nthreads);
+                for (std::size_t k = 0; k < cores.size(); ++k)
+                    {
+                        const auto& r = scan[cores[k]];
+                        values[3 * k] = r.nsl;
+                        values[3 * k + 1] = r.ihs;
+                        values[3 * k + 2] = static_cast<double>(r.core_count);
+                    }
+            }
+            return make_structured_array({ "nsl", "ihs", "core_count" },
+                                         { false, false, true }, values,
+                                         cores.size());
         },
         R"delim(
 		"Raw"/unstandardized :math:`nS_L` and iHS from Ferrer-Admetlla et al. doi:10.1093/molbev/msu077.
 
 		:param pt: A :class:`libsequence.polytable.PolyTable`
         :param core_snps: (None) Indexes of SNPs to analyze as "core" SNPs.
-		:param gmap: (None) A dictionary relating each position in pt to its location on a genetic map.
-		:return: A list of (nSL,iHS) tuples
-		:rtype: list
+		:param gmap: (None) A genetic map: either a pair of arrays (physical positions, genetic positions), or a dictionary relating each position in pt to its location on a genetic map.
+        :param nthreads: (1) Number of threads to use.  If 0, use all available cores.
+		:return: A structured array with fields nsl, ihs, and core_count, with one record per core SNP.
+		:rtype: numpy.ndarray
     
 		.. note:: Only :class:`libsequence.polytable.SimData` types currently supported
 
+        When gmap is a pair of arrays, the map positions must be
+        strictly increasing, and the genetic location of each site is
+        interpolated linearly, as for :func:`libsequence.nsl`.
+        The table is converted to genotypes, with 0 as the
+        ancestral state, and the statistics are calculated for all
+        sites at once by :func:`libsequence.nsl_scan`.  core_count
+        is the number of derived states at the core SNP.
+
+        .. versionchanged:: 0.2.4
+
+            Returns a structured array rather than a list of tuples.
+            gmap may be a pair of arrays.  Added nthreads.  A
+            dictionary gmap must have an entry for the position of
+            every site, not only the core SNPs, or ValueError is
+            raised.  Earlier versions passed the dictionary to
+            libsequence without checking it.
 		)delim",
         py::arg("d"), py::arg("core_snps") = nullptr,
-        py::arg("gmap") = nullptr);
+        py::arg("gmap") = nullptr, py::arg("nthreads") = 1);
 
     m.def("lhaf", &Sequence::lHaf,
           R"delim(
@@ -344,21 +1024,26 @@ init_summstats(py::module& m)
 		:rtype: list
 
 		.. note:: Only :class:`libsequence.polytable.SimData` types currently supported.
-		)delim");
+		)delim",
+          py::call_guard<py::gil_scoped_release>());
 
     m.def(
         "ld",
         [](const Sequence::PolyTable& p, const bool have_outgroup,
            const unsigned outgroup, const unsigned mincount,
            const double maxd) {
-            auto temp = Sequence::Recombination::Disequilibrium(
-                &p, have_outgroup, outgroup, mincount, maxd);
-            // Before filling a py::list, let's get rid of skipped objects
-            temp.erase(std::remove_if(temp.begin(), temp.end(),
-                                      [](const Sequence::PairwiseLDstats& s) {
-                                          return s.skipped;
-                                      }),
-                       temp.end());
+            auto temp = [&]() {
+                py::gil_scoped_release release;
+                auto rv = Sequence::Recombination::Disequilibrium(
+                    &p, have_outgroup, outgroup, mincount, maxd);
+                // Before filling a py::list, let's get rid of skipped objects
+                rv.erase(std::remove_if(rv.begin(), rv.end(),
+                                        [](const Sequence::PairwiseLDstats& s) {
+                                            return s.skipped;
+                                        }),
+                         rv.end());
+                return rv;
+            }();
             py::list rv;
             for (auto&& ld : temp)
                 {
@@ -387,10 +1072,135 @@ init_summstats(py::module& m)
         py::arg("outgroup") = 0, py::arg("mincount") = 1,
         py::arg("maxd") = std::numeric_limits<double>::max());
 
+    m.def(
+        "ld",
+        [](const Sequence::VariantMatrix& vm, const std::int32_t mincount,
+           const double maxd, py::object sites, const unsigned nthreads) {
+            auto selected = site_indexes_from_object(sites, vm.nsites());
+            std::vector<double> values;
+            {
+                py::gil_scoped_release release;
+                BiallelicSites b(vm.cdata(), vm.nsites(), vm.nsam());
+                selected.erase(std::remove_if(selected.begin(),
+                                              selected.end(),
+                                              [&b, mincount](std::size_t i) {
+                                                  return !b.usable(
+                                                      i, std::max(mincount,
+                                                                  1));
+                                              }),
+                               selected.end());
+                values = ld_records(b, vm.pbegin(), selected, maxd, nthreads);
+            }
+            return make_structured_array(
+                { "i", "j", "rsq", "D", "Dprime" },
+                { false, false, false, false, false }, values,
+                values.size() / 5);
+        },
+        R"delim(
+        Return pairwise LD statistics.
+
+        :param m: A :class:`libsequence.VariantMatrix`
+        :param mincount: (1) Do not include sites with minor allele count < mincount.
+        :param maxd: (inf) Do not include site pairs separated by >= maxd.
+        :param sites: (None) Sorted indexes of the sites to include.  If None, all sites are used.
+        :param nthreads: (1) Number of threads to use.  If 0, use all available cores.
+
+        :rtype: numpy.ndarray
+
+        The return value is a structured array with fields i, j,
+        rsq, D, and Dprime, where i and j are the positions of the
+        two sites.  Only biallelic sites are included.  For each
+        pair of sites, only samples without missing data at either
+        site are used.  D is calculated for the larger of the two
+        states at each site.  Positions must be sorted.
+
+        Genotypes are packed into bits once, and the haplotype
+        counts for a pair of sites are calculated 64 samples
+        at a time.
+
+        .. versionadded:: 0.2.4
+
+        >>> import msprime
+        >>> import libsequence
+        >>> ts = msprime.simulate(10, mutation_rate=10, random_seed=42)
+        >>> vm = libsequence.VariantMatrix.from_TreeSequence(ts)
+        >>> ld = libsequence.ld(vm, mincount=2, maxd=0.1)
+        >>> rsq = ld['rsq']
+        )delim",
+        py::arg("m"), py::arg("mincount") = 1,
+        py::arg("maxd") = std::numeric_limits<double>::infinity(),
+        py::arg("sites") = nullptr, py::arg("nthreads") = 1);
+
+    m.def(
+        "ld_matrix",
+        [](const Sequence::VariantMatrix& vm, const std::string& stat,
+           py::object sites, const unsigned nthreads) {
+            double PairwiseLD::*member = nullptr;
+            if (stat == "rsq")
+                {
+                    member = &PairwiseLD::rsq;
+                }
+            else if (stat == "D")
+                {
+                    member = &PairwiseLD::D;
+                }
+            else if (stat == "Dprime")
+                {
+                    member = &PairwiseLD::Dprime;
+                }
+            else
+                {
+                    throw std::invalid_argument("unknown LD statistic: "
+                                                + stat);
+                }
+            auto selected = site_indexes_from_object(sites, vm.nsites());
+            const std::size_t n = selected.size();
+            py::array_t<double> rv(std::vector<std::size_t>{ n, n });
+            auto output = rv.mutable_data();
+            py::gil_scoped_release release;
+            BiallelicSites b(vm.cdata(), vm.nsites(), vm.nsam());
+            ld_matrix(b, selected, member, nthreads, output);
+            for (std::size_t a = 0; a < n; ++a)
+                {
+                    if (!b.usable(selected[a], 1))
+                        {
+                            for (std::size_t c = 0; c < n; ++c)
+                                {
+                                    output[a * n + c] = output[c * n + a]
+                                        = std::numeric_limits<
+                                            double>::quiet_NaN();
+                                }
+                        }
+                }
+            return rv;
+        },
+        R"delim(
+        Return a matrix of pairwise LD.
+
+        :param m: A :class:`libsequence.VariantMatrix`
+        :param stat: ("rsq") One of rsq, D, or Dprime.
+        :param sites: (None) Sorted indexes of the sites to include.  If None, all sites are used.
+        :param nthreads: (1) Number of threads to use.  If 0, use all available cores.
+
+        :rtype: numpy.ndarray
+
+        The return value is a symmetric 2d array with one row
+        and column per site.  Rows and columns of sites that
+        are not biallelic are NaN.  See :func:`libsequence.ld`
+        for how the statistics are calculated.
+
+        .. versionadded:: 0.2.4
+        )delim",
+        py::arg("m"), py::arg("stat") = "rsq", py::arg("sites") = nullptr,
+        py::arg("nthreads") = 1);
+
     m.def(
         "garudStats",
         [](const Sequence::SimData& d) {
-            auto g = Sequence::H1H12(d);
+            auto g = [&d]() {
+                py::gil_scoped_release release;
+                return Sequence::H1H12(d);
+            }();
             py::dict rv;
             rv[py::str("H1")] = py::float_(g.H1);
             rv[py::str("H12")] = py::float_(g.H12);
@@ -404,7 +1214,7 @@ init_summstats(py::module& m)
 		)delim",
         py::arg("d"));
 
-    m.def("omega_max", &omega_max, py::arg("data"),
+    m.def("omega_max", &omega_max, py::arg("data"), py::call_guard<py::gil_scoped_release>(),
           R"delim(
 		Returns the omega max statistic of 
 		Kim and Nielsen (2004) Genetics 167:1513
@@ -415,4 +1225,117 @@ init_summstats(py::module& m)
 
 		:rtype: tuple
 		)delim");
+
+    m.def(
+        "omega_max",
+        [](const Sequence::VariantMatrix &vm, const std::int32_t mincount) {
+            if (vm.nsites() == 0)
+                {
+                    return std::make_pair(
+                        std::numeric_limits<double>::quiet_NaN(),
+                        std::numeric_limits<double>::quiet_NaN());
+                }
+            BiallelicSites sites(vm.cdata(), vm.nsites(), vm.nsam());
+            auto w = omega_max_scan(sites, vm.pbegin(), vm.nsites(), 1,
+                                    mincount, 1);
+            return std::make_pair(w[0].omega_max, w[0].position);
+        },
+        py::arg("vm"), py::arg("mincount") = 2,
+        py::call_guard<py::gil_scoped_release>(),
+        R"delim(
+        Returns the omega max statistic of
+        Kim and Nielsen (2004) Genetics 167:1513
+
+        :param vm: A :class:`libsequence.VariantMatrix`
+        :param mincount: (2) Minimum minor allele count for a site to be included in LD calculations.
+
+        :return: Omega max statistic and corresponding position.
+
+        :rtype: tuple
+
+        See :func:`libsequence.omega_max_scan` for details.
+
+        .. versionadded:: 0.2.4
+        )delim");
+
+    m.def(
+        "omega_max_scan",
+        [](const Sequence::VariantMatrix &vm, const std::size_t window_snps,
+           const std::size_t step, const std::int32_t mincount,
+           const unsigned nthreads) {
+            std::vector<double> values;
+            {
+                py::gil_scoped_release release;
+                BiallelicSites sites(vm.cdata(), vm.nsites(), vm.nsam());
+                auto windows = omega_max_scan(sites, vm.pbegin(), window_snps,
+                                              step, mincount, nthreads);
+                values.reserve(5 * windows.size());
+                for (auto &w : windows)
+                    {
+                        values.push_back(vm.pbegin()[w.first]);
+                        values.push_back(vm.pbegin()[w.last - 1]);
+                        values.push_back(
+                            static_cast<double>(w.last - w.first));
+                        values.push_back(w.omega_max);
+                        values.push_back(w.position);
+                    }
+            }
+            return make_structured_array(
+                { "start", "stop", "nsites", "omega_max", "position" },
+                { false, false, true, false, false }, values,
+                values.size() / 5);
+        },
+        py::arg("vm"), py::arg("window_snps"), py::arg("step"),
+        py::arg("mincount") = 2, py::arg("nthreads") = 1,
+        R"delim(
+        The omega max statistic of Kim and Nielsen (2004) Genetics 167:1513
+        in sliding windows of consecutive sites.
+
+        :param vm: A :class:`libsequence.VariantMatrix`
+        :param window_snps: The maximum number of sites in a window
+        :param step: The number of sites between the first sites of adjacent windows
+        :param mincount: (2) Minimum minor allele count for a site to be included in LD calculations.
+        :param nthreads: (1) Number of threads to use.  If 0, use all available cores.
+
+        :rtype: numpy.ndarray
+
+        The return value is a structured array with one record per window.
+        The fields are the positions of the first and last sites in the
+        window, the number of sites, omega max, and the position at which
+        omega is maximized.  Windows start at sites 0, step, 2*step, etc.,
+        until a window includes the last site.
+
+        For each split of a window into the first l and remaining n - l sites,
+        omega is the mean :math:`r^2` between pairs of sites on the same side of the
+        split divided by the mean :math:`r^2` between pairs spanning the split.
+        Omega max is the maximum over splits for which the last site to the
+        left of the split is not the first site in the window and has a minor
+        allele count of at least mincount.  The reported position is that of
+        this site.
+
+        Only biallelic sites with a minor allele count of at least mincount
+        contribute to :math:`r^2`, and other pairs have :math:`r^2 = 0`.
+        Samples with missing data at either site are excluded from the
+        calculation of :math:`r^2` for that pair.
+        Omega max is nan for windows with fewer than three sites.
+
+        Each pair of sites within window_snps of each other is visited about once,
+        and the sums needed for each split are obtained in constant time from
+        a cumulative table of :math:`r^2`, so that the cost per window is
+        proportional to the square of window_snps.
+
+        .. note::
+
+            The numerator sums over pairs within each side of the split, whereas
+            :func:`libsequence.omega_max` for :class:`libsequence.SimData` includes
+            pairs spanning the split in the numerator.
+
+        .. versionadded:: 0.2.4
+
+        >>> import msprime
+        >>> import libsequence
+        >>> ts = msprime.simulate(20, mutation_rate=50, recombination_rate=10, random_seed=42)
+        >>> vm = libsequence.VariantMatrix.from_TreeSequence(ts)
+        >>> w = libsequence.omega_max_scan(vm, 100, 25)
+        )delim");
 }
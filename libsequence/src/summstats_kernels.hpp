@@ -0,0 +1,468 @@
+#ifndef PYLIBSEQ_SUMMSTATS_KERNELS_HPP
+#define PYLIBSEQ_SUMMSTATS_KERNELS_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Single-pass calculation of the "classic" summary
+// statistics from the raw data of an AlleleCountMatrix.
+// Each site is visited once, and its contributions to
+// all statistics are accumulated into a SiteSums.
+// Because SiteSums are additive, they also serve as
+// the prefix sums for windowed calculations.
+//
+// The sample size of a site is its number of non-missing
+// states.  Statistics normalized by functions of the
+// sample size accumulate those functions per site, so
+// that missing data are corrected for in the same pass.
+
+enum class SummaryStatistic
+{
+    thetapi,
+    thetaw,
+    tajd,
+    thetah,
+    thetal,
+    faywuh,
+    hprime,
+    nvariable_sites,
+    nbiallelic_sites,
+    total_number_of_mutations
+};
+
+inline const std::vector<std::pair<std::string, SummaryStatistic>> &
+summary_statistic_names()
+{
+    static const std::vector<std::pair<std::string, SummaryStatistic>> names{
+        { "thetapi", SummaryStatistic::thetapi },
+        { "thetaw", SummaryStatistic::thetaw },
+        { "tajd", SummaryStatistic::tajd },
+        { "thetah", SummaryStatistic::thetah },
+        { "thetal", SummaryStatistic::thetal },
+        { "faywuh", SummaryStatistic::faywuh },
+        { "hprime", SummaryStatistic::hprime },
+        { "nvariable_sites", SummaryStatistic::nvariable_sites },
+        { "nbiallelic_sites", SummaryStatistic::nbiallelic_sites },
+        { "total_number_of_mutations",
+          SummaryStatistic::total_number_of_mutations }
+    };
+    return names;
+}
+
+inline SummaryStatistic
+summary_statistic_from_name(const std::string &name)
+{
+    for (auto &n : summary_statistic_names())
+        {
+            if (n.first == name)
+                {
+                    return n.second;
+                }
+        }
+    throw std::invalid_argument("unknown summary statistic: " + name);
+}
+
+inline const std::string &
+summary_statistic_name(const SummaryStatistic s)
+{
+    for (auto &n : summary_statistic_names())
+        {
+            if (n.second == s)
+                {
+                    return n.first;
+                }
+        }
+    throw std::invalid_argument("unknown summary statistic");
+}
+
+inline bool
+summary_statistic_is_integer(const SummaryStatistic s)
+{
+    return s == SummaryStatistic::nvariable_sites
+           || s == SummaryStatistic::nbiallelic_sites
+           || s == SummaryStatistic::total_number_of_mutations;
+}
+
+inline bool
+summary_statistic_needs_ancestral_state(const SummaryStatistic s)
+{
+    return s == SummaryStatistic::thetah || s == SummaryStatistic::thetal
+           || s == SummaryStatistic::faywuh || s == SummaryStatistic::hprime;
+}
+
+// An empty list of names means all statistics, or all
+// those not requiring ancestral states if none are known.
+inline std::vector<SummaryStatistic>
+summary_statistics_from_names(const std::vector<std::string> &names,
+                              const bool have_ancestral_states)
+{
+    std::vector<SummaryStatistic> rv;
+    if (names.empty())
+        {
+            for (auto &n : summary_statistic_names())
+                {
+                    if (have_ancestral_states
+                        || !summary_statistic_needs_ancestral_state(n.second))
+                        {
+                            rv.push_back(n.second);
+                        }
+                }
+            return rv;
+        }
+    for (auto &n : names)
+        {
+            rv.push_back(summary_statistic_from_name(n));
+            if (!have_ancestral_states
+                && summary_statistic_needs_ancestral_state(rv.back()))
+                {
+                    throw std::invalid_argument(
+                        n + " requires ancestral states");
+                }
+        }
+    return rv;
+}
+
+// Tables of a1(n) = sum_{i=1}^{n-1} 1/i
+// and a2(n) = sum_{i=1}^{n-1} 1/i^2
+// for all n <= nmax + 1, and of the constants of the
+// variances of Tajima's D and of H' for all n <= nmax.
+// The variance constants are per mutation, so that
+// var(D) = S * tajd_e1(n) + S * (S - 1) * tajd_e2(n),
+// and similarly for H'.
+class HarmonicSums
+{
+  private:
+    std::vector<double> a1_, a2_, tajd_e1_, tajd_e2_, hprime_c1_,
+        hprime_c2_;
+
+  public:
+    explicit HarmonicSums(const std::size_t nmax)
+        : a1_(nmax + 2, 0.0), a2_(nmax + 2, 0.0), tajd_e1_(nmax + 1, 0.0),
+          tajd_e2_(nmax + 1, 0.0), hprime_c1_(nmax + 1, 0.0),
+          hprime_c2_(nmax + 1, 0.0)
+    {
+        for (std::size_t i = 2; i < a1_.size(); ++i)
+            {
+                double d = static_cast<double>(i - 1);
+                a1_[i] = a1_[i - 1] + 1. / d;
+                a2_[i] = a2_[i - 1] + 1. / (d * d);
+            }
+        for (std::size_t i = 2; i < tajd_e1_.size(); ++i)
+            {
+                const double n = static_cast<double>(i);
+                const double a1 = a1_[i], a2 = a2_[i];
+                const double b1 = (n + 1.) / (3. * (n - 1.));
+                const double b2
+                    = 2. * (n * n + n + 3.) / (9. * n * (n - 1.));
+                const double c1 = b1 - 1. / a1;
+                const double c2 = b2 - (n + 2.) / (a1 * n) + a2 / (a1 * a1);
+                tajd_e1_[i] = c1 / a1;
+                tajd_e2_[i] = c2 / (a1 * a1 + a2);
+                // Zeng et al. (2006), with theta = S / a1 and
+                // theta^2 = S * (S - 1) / (a1^2 + a2)
+                hprime_c1_[i] = (n - 2.) / (6. * (n - 1.)) / a1;
+                hprime_c2_[i] = (18. * n * n * (3. * n + 2.) * a2_[i + 1]
+                                 - (88. * n * n * n + 9. * n * n - 13. * n
+                                    + 6.))
+                                / (9. * n * (n - 1.) * (n - 1.))
+                                / (a1 * a1 + a2);
+            }
+    }
+
+    double
+    a1(const std::size_t n) const
+    {
+        return a1_[n];
+    }
+
+    double
+    a2(const std::size_t n) const
+    {
+        return a2_[n];
+    }
+
+    double
+    tajd_e1(const std::size_t n) const
+    {
+        return tajd_e1_[n];
+    }
+
+    double
+    tajd_e2(const std::size_t n) const
+    {
+        return tajd_e2_[n];
+    }
+
+    double
+    hprime_c1(const std::size_t n) const
+    {
+        return hprime_c1_[n];
+    }
+
+    double
+    hprime_c2(const std::size_t n) const
+    {
+        return hprime_c2_[n];
+    }
+
+    std::size_t
+    nmax() const
+    {
+        return a1_.size() - 2;
+    }
+};
+
+// Tables for sample sizes of at least nmax, shared by
+// all callers and threads.  The tables grow when a larger
+// sample size is requested, and are otherwise built once
+// per process.  Values do not depend on the size of the
+// tables.
+inline std::shared_ptr<const HarmonicSums>
+shared_harmonic_sums(const std::size_t nmax)
+{
+    static std::mutex mutex;
+    static std::shared_ptr<const HarmonicSums> tables;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!tables || tables->nmax() < nmax)
+        {
+            tables = std::make_shared<const HarmonicSums>(
+                std::max(nmax, tables ? 2 * tables->nmax() : nmax));
+        }
+    return tables;
+}
+
+struct SiteSums
+{
+    double thetapi, thetaw, thetah, thetal;
+    // Sums over mutations of the variance constants of
+    // HarmonicSums at the sample size of each site
+    double tajd_e1, tajd_e2, hprime_c1, hprime_c2;
+    std::int64_t nvariable_sites, nbiallelic_sites, total_number_of_mutations;
+
+    SiteSums()
+        : thetapi(0.), thetaw(0.), thetah(0.), thetal(0.), tajd_e1(0.),
+          tajd_e2(0.), hprime_c1(0.), hprime_c2(0.), nvariable_sites(0),
+          nbiallelic_sites(0), total_number_of_mutations(0)
+    {
+    }
+
+    SiteSums &
+    operator+=(const SiteSums &rhs)
+    {
+        thetapi += rhs.thetapi;
+        thetaw += rhs.thetaw;
+        thetah += rhs.thetah;
+        thetal += rhs.thetal;
+        tajd_e1 += rhs.tajd_e1;
+        tajd_e2 += rhs.tajd_e2;
+        hprime_c1 += rhs.hprime_c1;
+        hprime_c2 += rhs.hprime_c2;
+        nvariable_sites += rhs.nvariable_sites;
+        nbiallelic_sites += rhs.nbiallelic_sites;
+        total_number_of_mutations += rhs.total_number_of_mutations;
+        return *this;
+    }
+
+    SiteSums &
+    operator-=(const SiteSums &rhs)
+    {
+        thetapi -= rhs.thetapi;
+        thetaw -= rhs.thetaw;
+        thetah -= rhs.thetah;
+        thetal -= rhs.thetal;
+        tajd_e1 -= rhs.tajd_e1;
+        tajd_e2 -= rhs.tajd_e2;
+        hprime_c1 -= rhs.hprime_c1;
+        hprime_c2 -= rhs.hprime_c2;
+        nvariable_sites -= rhs.nvariable_sites;
+        nbiallelic_sites -= rhs.nbiallelic_sites;
+        total_number_of_mutations -= rhs.total_number_of_mutations;
+        return *this;
+    }
+};
+
+inline SiteSums
+operator-(SiteSums lhs, const SiteSums &rhs)
+{
+    lhs -= rhs;
+    return lhs;
+}
+
+// Add the contribution of one row of an AlleleCountMatrix.
+// The sample size at a site is the number of non-missing
+// states.  A negative refstate means that the ancestral
+// state is unknown.
+inline void
+accumulate_site(const std::int32_t *row, const std::size_t ncol,
+                const int refstate, const HarmonicSums &h, SiteSums &sums)
+{
+    std::int64_t n = 0, nstates = 0;
+    double homozygosity = 0.;
+    for (std::size_t j = 0; j < ncol; ++j)
+        {
+            const std::int64_t c = row[j];
+            n += c;
+            nstates += (c > 0);
+            homozygosity += static_cast<double>(c * (c - 1));
+        }
+    if (nstates < 2)
+        {
+            return;
+        }
+    const double dn = static_cast<double>(n),
+                 mutations = static_cast<double>(nstates - 1);
+    const std::size_t un = static_cast<std::size_t>(n);
+    sums.thetapi += 1. - homozygosity / (dn * (dn - 1.));
+    sums.thetaw += mutations / h.a1(un);
+    sums.tajd_e1 += mutations * h.tajd_e1(un);
+    sums.tajd_e2 += mutations * h.tajd_e2(un);
+    sums.hprime_c1 += mutations * h.hprime_c1(un);
+    sums.hprime_c2 += mutations * h.hprime_c2(un);
+    ++sums.nvariable_sites;
+    sums.nbiallelic_sites += (nstates == 2);
+    sums.total_number_of_mutations += nstates - 1;
+    if (refstate >= 0)
+        {
+            const std::int64_t derived
+                = n
+                  - (static_cast<std::size_t>(refstate) < ncol ? row[refstate]
+                                                                : 0);
+            if (derived > 0 && derived < n)
+                {
+                    const double dd = static_cast<double>(derived);
+                    sums.thetah += 2. * dd * dd / (dn * (dn - 1.));
+                    sums.thetal += dd / (dn - 1.);
+                }
+        }
+}
+
+// Add the contribution of one site of a VariantMatrix.
+// Negative values are missing data.  The scratch buffer
+// must have room for 128 counts, and be zeroed on entry.
+// It is zeroed again on exit.
+inline void
+accumulate_genotypes(const std::int8_t *site, const std::size_t nsam,
+                     const int refstate, const HarmonicSums &h,
+                     std::int32_t *scratch, SiteSums &sums)
+{
+    int maxstate = -1;
+    for (std::size_t j = 0; j < nsam; ++j)
+        {
+            const int g = site[j];
+            if (g >= 0)
+                {
+                    ++scratch[g];
+                    maxstate = g > maxstate ? g : maxstate;
+                }
+        }
+    const std::size_t ncol = static_cast<std::size_t>(maxstate + 1);
+    accumulate_site(scratch, ncol, refstate, h, sums);
+    std::fill(scratch, scratch + ncol, 0);
+}
+
+// nrefstates may be 0 (ancestral states unknown),
+// 1 (same value for all sites), or the number of sites.
+inline int
+refstate_at(const std::int8_t *refstates, const std::size_t nrefstates,
+            const std::size_t site)
+{
+    if (nrefstates == 0)
+        {
+            return -1;
+        }
+    return refstates[nrefstates == 1 ? 0 : site];
+}
+
+inline SiteSums
+accumulate_sites(const std::int32_t *counts, const std::size_t ncol,
+                 const std::size_t first_row, const std::size_t last_row,
+                 const std::int8_t *refstates, const std::size_t nrefstates,
+                 const HarmonicSums &h)
+{
+    SiteSums sums;
+    for (std::size_t i = first_row; i < last_row; ++i)
+        {
+            accumulate_site(counts + i * ncol, ncol,
+                            refstate_at(refstates, nrefstates, i), h, sums);
+        }
+    return sums;
+}
+
+// Tajima's D, with theta_W and the variance summed over
+// sites at their own sample sizes.  Without missing data,
+// this is the usual statistic.
+inline double
+tajd_from_sums(const SiteSums &sums)
+{
+    const double S = static_cast<double>(sums.total_number_of_mutations);
+    if (S == 0.)
+        {
+            return std::numeric_limits<double>::quiet_NaN();
+        }
+    return (sums.thetapi - sums.thetaw)
+           / std::sqrt(sums.tajd_e1 + (S - 1.) * sums.tajd_e2);
+}
+
+// Zeng et al. (2006) normalization of Fay and Wu's H,
+// corrected for missing data as for tajd_from_sums
+inline double
+hprime_from_sums(const SiteSums &sums)
+{
+    const double S = static_cast<double>(sums.total_number_of_mutations);
+    if (S == 0.)
+        {
+            return std::numeric_limits<double>::quiet_NaN();
+        }
+    return (sums.thetapi - sums.thetal)
+           / std::sqrt(sums.hprime_c1 + (S - 1.) * sums.hprime_c2);
+}
+
+inline double
+summary_statistic_value(const SummaryStatistic s, const SiteSums &sums)
+{
+    switch (s)
+        {
+        case SummaryStatistic::thetapi:
+            return sums.thetapi;
+        case SummaryStatistic::thetaw:
+            return sums.thetaw;
+        case SummaryStatistic::tajd:
+            return tajd_from_sums(sums);
+        case SummaryStatistic::thetah:
+            return sums.thetah;
+        case SummaryStatistic::thetal:
+            return sums.thetal;
+        case SummaryStatistic::faywuh:
+            return sums.thetapi - sums.thetah;
+        case SummaryStatistic::hprime:
+            return hprime_from_sums(sums);
+        case SummaryStatistic::nvariable_sites:
+            return static_cast<double>(sums.nvariable_sites);
+        case SummaryStatistic::nbiallelic_sites:
+            return static_cast<double>(sums.nbiallelic_sites);
+        case SummaryStatistic::total_number_of_mutations:
+            return static_cast<double>(sums.total_number_of_mutations);
+        }
+    throw std::invalid_argument("unknown summary statistic");
+}
+
+inline void
+summary_statistic_values(const std::vector<SummaryStatistic> &stats,
+                         const SiteSums &sums, double *output)
+{
+    for (std::size_t i = 0; i < stats.size(); ++i)
+        {
+            output[i] = summary_statistic_value(stats[i], sums);
+        }
+}
+
+#endif
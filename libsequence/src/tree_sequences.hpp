@@ -0,0 +1,576 @@
+#ifndef PYLIBSEQ_TREE_SEQUENCES_HPP
+#define PYLIBSEQ_TREE_SEQUENCES_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "parallel.hpp"
+
+// Engines working directly on the table columns of a tskit
+// tree sequence.  Trees are traversed left to right by
+// inserting and removing edges, and the data at each site
+// are obtained from the current tree.  Independent traversals
+// may start anywhere along the genome, allowing the sites to
+// be split into chunks processed by different threads.
+
+// Raw views of the table columns.  Offsets are those of
+// the ragged ancestral_state/derived_state columns.
+struct TreeSequenceTables
+{
+    std::size_t num_nodes, num_edges, num_sites, num_mutations;
+    const double *edge_left;
+    const double *edge_right;
+    const std::int32_t *edge_parent;
+    const std::int32_t *edge_child;
+    const double *site_position;
+    const std::int8_t *ancestral_state;
+    const std::uint64_t *ancestral_state_offset;
+    const std::int32_t *mutation_site;
+    const std::int32_t *mutation_node;
+    const std::int32_t *mutation_parent;
+    const std::int8_t *derived_state;
+    const std::uint64_t *derived_state_offset;
+};
+
+// Edge indexes sorted by left and by right coordinate,
+// and the index of the first mutation at each site.
+// These are calculated once and shared by all traversals.
+struct TreeSequenceIndexes
+{
+    std::vector<std::size_t> insertion, removal, first_mutation;
+
+    explicit TreeSequenceIndexes(const TreeSequenceTables &tables)
+        : insertion(tables.num_edges), removal(tables.num_edges),
+          first_mutation(tables.num_sites + 1, tables.num_mutations)
+    {
+        std::iota(insertion.begin(), insertion.end(), 0);
+        std::iota(removal.begin(), removal.end(), 0);
+        std::sort(insertion.begin(), insertion.end(),
+                  [&tables](const std::size_t a, const std::size_t b) {
+                      return tables.edge_left[a] < tables.edge_left[b];
+                  });
+        std::sort(removal.begin(), removal.end(),
+                  [&tables](const std::size_t a, const std::size_t b) {
+                      return tables.edge_right[a] < tables.edge_right[b];
+                  });
+        for (std::size_t m = tables.num_mutations; m > 0; --m)
+            {
+                const std::int32_t s = tables.mutation_site[m - 1];
+                if (s < 0 || static_cast<std::size_t>(s) >= tables.num_sites)
+                    {
+                        throw std::invalid_argument(
+                            "mutation site out of range");
+                    }
+                if (tables.mutation_node[m - 1] < 0
+                    || static_cast<std::size_t>(tables.mutation_node[m - 1])
+                           >= tables.num_nodes)
+                    {
+                        throw std::invalid_argument(
+                            "mutation node out of range");
+                    }
+                if (m < tables.num_mutations && tables.mutation_site[m] < s)
+                    {
+                        throw std::invalid_argument(
+                            "mutations must be sorted by site");
+                    }
+                first_mutation[s] = m - 1;
+            }
+        for (std::size_t i = tables.num_sites; i > 0; --i)
+            {
+                first_mutation[i - 1]
+                    = std::min(first_mutation[i - 1], first_mutation[i]);
+            }
+    }
+};
+
+inline void
+validate_samples(const TreeSequenceTables &tables,
+                 const std::vector<std::int32_t> &samples)
+{
+    std::vector<bool> seen(tables.num_nodes, false);
+    for (auto s : samples)
+        {
+            if (s < 0 || static_cast<std::size_t>(s) >= tables.num_nodes)
+                {
+                    throw std::invalid_argument("sample out of range");
+                }
+            if (seen[s])
+                {
+                    throw std::invalid_argument("duplicate sample");
+                }
+            seen[s] = true;
+        }
+}
+
+// Left-to-right traversal of trees.  Derived classes
+// implement insert_edge(parent, child) and
+// remove_edge(parent, child) to maintain their own
+// per-node state, and call start() once constructed.
+template <typename Derived> class TreeSweep
+{
+  private:
+    const TreeSequenceIndexes &indexes;
+    std::size_t next_insertion, next_removal;
+
+    Derived &
+    derived()
+    {
+        return static_cast<Derived &>(*this);
+    }
+
+  protected:
+    const TreeSequenceTables &tables;
+
+    TreeSweep(const TreeSequenceTables &t, const TreeSequenceIndexes &i)
+        : indexes(i), next_insertion(0), next_removal(0), tables(t)
+    {
+    }
+
+    // Build the tree covering position x from scratch.
+    void
+    start(const double x)
+    {
+        const auto &insertion = indexes.insertion;
+        const auto &removal = indexes.removal;
+        for (; next_insertion < insertion.size()
+               && tables.edge_left[insertion[next_insertion]] <= x;
+             ++next_insertion)
+            {
+                const std::size_t e = insertion[next_insertion];
+                if (tables.edge_right[e] > x)
+                    {
+                        derived().insert_edge(tables.edge_parent[e],
+                                              tables.edge_child[e]);
+                    }
+            }
+        next_removal = static_cast<std::size_t>(
+            std::upper_bound(removal.begin(), removal.end(), x,
+                             [this](const double value, const std::size_t e) {
+                                 return value < tables.edge_right[e];
+                             })
+            - removal.begin());
+    }
+
+  public:
+    // Move to the tree covering position x >= the
+    // current position.
+    void
+    advance(const double x)
+    {
+        const auto &insertion = indexes.insertion;
+        const auto &removal = indexes.removal;
+        const double inf = std::numeric_limits<double>::infinity();
+        for (;;)
+            {
+                const double r = next_removal < removal.size()
+                                     ? tables.edge_right[removal[next_removal]]
+                                     : inf;
+                const double l
+                    = next_insertion < insertion.size()
+                          ? tables.edge_left[insertion[next_insertion]]
+                          : inf;
+                const double t = std::min(r, l);
+                if (t > x)
+                    {
+                        return;
+                    }
+                for (; next_removal < removal.size()
+                       && tables.edge_right[removal[next_removal]] == t;
+                     ++next_removal)
+                    {
+                        const std::size_t e = removal[next_removal];
+                        derived().remove_edge(tables.edge_parent[e],
+                                              tables.edge_child[e]);
+                    }
+                for (; next_insertion < insertion.size()
+                       && tables.edge_left[insertion[next_insertion]] == t;
+                     ++next_insertion)
+                    {
+                        const std::size_t e = insertion[next_insertion];
+                        derived().insert_edge(tables.edge_parent[e],
+                                              tables.edge_child[e]);
+                    }
+            }
+    }
+};
+
+// The number of samples below each node.
+class SampleCountingTree : public TreeSweep<SampleCountingTree>
+{
+  private:
+    std::vector<std::int32_t> parent, below, nchildren;
+    std::vector<char> is_sample;
+    std::int32_t nisolated;
+
+    int
+    isolated(const std::int32_t u) const
+    {
+        return is_sample[u] && parent[u] == -1 && nchildren[u] == 0;
+    }
+
+  public:
+    SampleCountingTree(const TreeSequenceTables &t,
+                       const TreeSequenceIndexes &i,
+                       const std::vector<std::int32_t> &samples,
+                       const double x)
+        : TreeSweep<SampleCountingTree>(t, i), parent(t.num_nodes, -1),
+          below(t.num_nodes, 0), nchildren(t.num_nodes, 0),
+          is_sample(t.num_nodes, 0),
+          nisolated(static_cast<std::int32_t>(samples.size()))
+    {
+        for (auto s : samples)
+            {
+                below[s] += 1;
+                is_sample[s] = 1;
+            }
+        start(x);
+    }
+
+    void
+    insert_edge(std::int32_t p, const std::int32_t c)
+    {
+        nisolated -= isolated(p) + isolated(c);
+        const std::int32_t n = below[c];
+        parent[c] = p;
+        ++nchildren[p];
+        nisolated += isolated(p) + isolated(c);
+        for (; p != -1; p = parent[p])
+            {
+                below[p] += n;
+            }
+    }
+
+    void
+    remove_edge(std::int32_t p, const std::int32_t c)
+    {
+        nisolated -= isolated(p) + isolated(c);
+        const std::int32_t n = below[c];
+        --nchildren[p];
+        parent[c] = -1;
+        nisolated += isolated(p) + isolated(c);
+        for (; p != -1; p = parent[p])
+            {
+                below[p] -= n;
+            }
+    }
+
+    std::int32_t
+    num_samples_below(const std::int32_t u) const
+    {
+        return below[u];
+    }
+
+    // Samples with no parent and no children, which
+    // are missing data unless they carry a mutation.
+    std::int32_t
+    num_isolated_samples() const
+    {
+        return nisolated;
+    }
+
+    bool
+    is_isolated_sample(const std::int32_t u) const
+    {
+        return isolated(u) != 0;
+    }
+};
+
+// Parent, child, and sibling links, allowing the
+// samples below a node to be visited.
+class GenotypeDecodingTree : public TreeSweep<GenotypeDecodingTree>
+{
+  private:
+    std::vector<std::int32_t> parent, left_child, right_child, left_sib,
+        right_sib, sample_index, stack;
+
+  public:
+    GenotypeDecodingTree(const TreeSequenceTables &t,
+                         const TreeSequenceIndexes &i,
+                         const std::vector<std::int32_t> &samples,
+                         const double x)
+        : TreeSweep<GenotypeDecodingTree>(t, i), parent(t.num_nodes, -1),
+          left_child(t.num_nodes, -1), right_child(t.num_nodes, -1),
+          left_sib(t.num_nodes, -1), right_sib(t.num_nodes, -1),
+          sample_index(t.num_nodes, -1), stack()
+    {
+        for (std::size_t j = 0; j < samples.size(); ++j)
+            {
+                sample_index[samples[j]] = static_cast<std::int32_t>(j);
+            }
+        start(x);
+    }
+
+    void
+    insert_edge(const std::int32_t p, const std::int32_t c)
+    {
+        const std::int32_t u = right_child[p];
+        parent[c] = p;
+        if (u == -1)
+            {
+                left_child[p] = c;
+            }
+        else
+            {
+                right_sib[u] = c;
+            }
+        left_sib[c] = u;
+        right_sib[c] = -1;
+        right_child[p] = c;
+    }
+
+    void
+    remove_edge(const std::int32_t p, const std::int32_t c)
+    {
+        const std::int32_t lsib = left_sib[c], rsib = right_sib[c];
+        if (lsib == -1)
+            {
+                left_child[p] = rsib;
+            }
+        else
+            {
+                right_sib[lsib] = rsib;
+            }
+        if (rsib == -1)
+            {
+                right_child[p] = lsib;
+            }
+        else
+            {
+                left_sib[rsib] = lsib;
+            }
+        parent[c] = left_sib[c] = right_sib[c] = -1;
+    }
+
+    bool
+    is_isolated(const std::int32_t u) const
+    {
+        return parent[u] == -1 && left_child[u] == -1;
+    }
+
+    // Assign state to all samples below node u.
+    void
+    set_state_below(const std::int32_t u, const std::int8_t state,
+                    std::int8_t *row)
+    {
+        stack.clear();
+        stack.push_back(u);
+        while (!stack.empty())
+            {
+                const std::int32_t v = stack.back();
+                stack.pop_back();
+                if (sample_index[v] != -1)
+                    {
+                        row[sample_index[v]] = state;
+                    }
+                for (std::int32_t c = left_child[v]; c != -1; c = right_sib[c])
+                    {
+                        stack.push_back(c);
+                    }
+            }
+    }
+};
+
+// Numbers the allelic states at a site as in tskit: 0 is
+// the ancestral state, and derived states are numbered in
+// order of first appearance.  Each mutation's parent must be
+// an earlier mutation at the same site.
+class SiteAlleles
+{
+  private:
+    std::vector<std::pair<const std::int8_t *, std::size_t>> alleles;
+    std::vector<std::size_t> allele_index;
+    std::size_t first_mutation;
+
+  public:
+    SiteAlleles() : alleles(), allele_index(), first_mutation(0) {}
+
+    void
+    reset(const TreeSequenceTables &tables, const std::size_t site,
+          const std::size_t first, const std::size_t last)
+    {
+        alleles.clear();
+        alleles.emplace_back(
+            tables.ancestral_state + tables.ancestral_state_offset[site],
+            static_cast<std::size_t>(tables.ancestral_state_offset[site + 1]
+                                     - tables.ancestral_state_offset[site]));
+        allele_index.resize(last - first);
+        first_mutation = first;
+        for (std::size_t m = first; m < last; ++m)
+            {
+                const std::int32_t p = tables.mutation_parent[m];
+                if (p != -1
+                    && (static_cast<std::size_t>(p) < first
+                        || static_cast<std::size_t>(p) >= m))
+                    {
+                        throw std::invalid_argument("invalid mutation parent");
+                    }
+                std::pair<const std::int8_t *, std::size_t> state(
+                    tables.derived_state + tables.derived_state_offset[m],
+                    static_cast<std::size_t>(tables.derived_state_offset[m + 1]
+                                             - tables.derived_state_offset[m]));
+                std::size_t a = 0;
+                for (; a < alleles.size(); ++a)
+                    {
+                        if (alleles[a].second == state.second
+                            && std::memcmp(alleles[a].first, state.first,
+                                           state.second)
+                                   == 0)
+                            {
+                                break;
+                            }
+                    }
+                if (a == alleles.size())
+                    {
+                        alleles.push_back(state);
+                    }
+                allele_index[m - first] = a;
+            }
+    }
+
+    std::size_t
+    nalleles() const
+    {
+        return alleles.size();
+    }
+
+    // Allelic state of mutation m
+    std::size_t
+    derived(const std::size_t m) const
+    {
+        return allele_index[m - first_mutation];
+    }
+
+    // Allelic state of the parent of mutation m
+    std::size_t
+    parental(const TreeSequenceTables &tables, const std::size_t m) const
+    {
+        const std::int32_t p = tables.mutation_parent[m];
+        return p == -1 ? 0 : derived(static_cast<std::size_t>(p));
+    }
+};
+
+inline std::vector<std::int32_t>
+allele_counts_from_tables(const TreeSequenceTables &tables,
+                          const std::vector<std::int32_t> &samples,
+                          const std::size_t ncol, const unsigned nthreads)
+{
+    validate_samples(tables, samples);
+    const TreeSequenceIndexes indexes(tables);
+    const auto nsamples = static_cast<std::int32_t>(samples.size());
+    std::vector<std::int32_t> counts(tables.num_sites * ncol, 0);
+    // Each chunk starts by building its first tree from
+    // scratch, so we want about one chunk per thread.
+    const std::size_t nworkers = resolve_nthreads(nthreads);
+    parallel_for(
+        tables.num_sites, nthreads,
+        (tables.num_sites + nworkers - 1) / nworkers,
+        [&](const std::size_t begin, const std::size_t end) {
+            SampleCountingTree tree(tables, indexes, samples,
+                                    tables.site_position[begin]);
+            SiteAlleles alleles;
+            for (std::size_t site = begin; site < end; ++site)
+                {
+                    tree.advance(tables.site_position[site]);
+                    const std::size_t first = indexes.first_mutation[site],
+                                      last = indexes.first_mutation[site + 1];
+                    alleles.reset(tables, site, first, last);
+                    if (alleles.nalleles() > ncol)
+                        {
+                            throw std::invalid_argument(
+                                "incorrect max_allele_value");
+                        }
+                    std::int32_t *row = counts.data() + site * ncol;
+                    // Isolated samples are missing, as in
+                    // GenotypeDecoder.
+                    row[0] = nsamples - tree.num_isolated_samples();
+                    // A mutation moves the samples below it from the
+                    // state of its parent mutation (or the ancestral
+                    // state) to its derived state.  A first mutation
+                    // on an isolated sample gives it a state.
+                    for (std::size_t m = first; m < last; ++m)
+                        {
+                            const std::int32_t u = tables.mutation_node[m];
+                            const std::int32_t n = tree.num_samples_below(u);
+                            row[alleles.derived(m)] += n;
+                            if (!(tables.mutation_parent[m] == -1
+                                  && tree.is_isolated_sample(u)))
+                                {
+                                    row[alleles.parental(tables, m)] -= n;
+                                }
+                        }
+                }
+        });
+    return counts;
+}
+
+// Decodes the genotypes of consecutive ranges of sites.
+// Successive calls to decode must be for increasing sites,
+// and the tree is carried over from one call to the next.
+class GenotypeDecoder
+{
+  private:
+    const TreeSequenceTables &tables;
+    const TreeSequenceIndexes &indexes;
+    GenotypeDecodingTree tree;
+    SiteAlleles alleles;
+    std::vector<std::int32_t> samples;
+
+  public:
+    GenotypeDecoder(const TreeSequenceTables &t, const TreeSequenceIndexes &i,
+                    const std::vector<std::int32_t> &samples_, const double x)
+        : tables(t), indexes(i), tree(t, i, samples_, x), alleles(),
+          samples(samples_)
+    {
+    }
+
+    // Write sites [first_site, last_site) as a row-major
+    // matrix of sites x samples.  As in tskit, samples that
+    // are isolated in a tree are assigned missing_state unless
+    // they carry a mutation.  Returns the largest allelic
+    // state seen.
+    std::int8_t
+    decode(const std::size_t first_site, const std::size_t last_site,
+           const std::int8_t missing_state, std::int8_t *output)
+    {
+        std::int8_t max_state = 0;
+        for (std::size_t site = first_site; site < last_site; ++site)
+            {
+                tree.advance(tables.site_position[site]);
+                const std::size_t first = indexes.first_mutation[site],
+                                  last = indexes.first_mutation[site + 1];
+                alleles.reset(tables, site, first, last);
+                if (alleles.nalleles()
+                    > static_cast<std::size_t>(
+                          std::numeric_limits<std::int8_t>::max()))
+                    {
+                        throw std::invalid_argument(
+                            "too many alleles for 8-bit genotypes");
+                    }
+                std::int8_t *row
+                    = output + (site - first_site) * samples.size();
+                for (std::size_t j = 0; j < samples.size(); ++j)
+                    {
+                        row[j] = tree.is_isolated(samples[j]) ? missing_state
+                                                              : 0;
+                    }
+                // Parent mutations precede their children,
+                // so later mutations overwrite earlier ones.
+                for (std::size_t m = first; m < last; ++m)
+                    {
+                        const auto state
+                            = static_cast<std::int8_t>(alleles.derived(m));
+                        tree.set_state_below(tables.mutation_node[m], state,
+                                             row);
+                        max_state = std::max(max_state, state);
+                    }
+            }
+        return max_state;
+    }
+};
+
+#endif
@@ -5,303 +5,656 @@
 #include <pybind11/stl.h>
 #include <pybind11/stl_bind.h>
 #include <Sequence/AlleleCountMatrix.hpp>
+#include <Sequence/PolyTable.hpp>
 #include <Sequence/VariantMatrix.hpp>
 #include <Sequence/VariantMatrixViews.hpp>
 #include <Sequence/variant_matrix/filtering.hpp>
 #include <Sequence/variant_matrix/windows.hpp>
 #include <Sequence/variant_matrix/msformat.hpp>
 #include <Sequence/StateCounts.hpp>
+#include "allele_count_views.hpp"
+#include "capsules.hpp"
+#include "numpy_helpers.hpp"
+#include "polytable_conversion.hpp"
+#include "site_filters.hpp"
+#include "state_counts.hpp"
+#include "tree_sequences.hpp"
+#include "variant_matrix_file.hpp"
 
 namespace py = pybind11;
 
-class NumpyGenotypeCapsule : public Sequence::GenotypeCapsule
+class MockVM
 {
   private:
-    py::array_t<std::int8_t> buffer;
-    std::size_t nsites_, nsam_;
+    std::unique_ptr<Sequence::GenotypeCapsule> g;
+    std::unique_ptr<Sequence::PositionCapsule> p;
 
   public:
-    explicit NumpyGenotypeCapsule(
-        py::array_t<std::int8_t, py::array::c_style | py::array::forcecast>
-            input)
-        : buffer(std::move(input)), nsites_(buffer.shape(0)),
-          nsam_(buffer.shape(1))
-    {
-    }
-
-    std::size_t &
-    nsites()
-    {
-        return nsites_;
-    }
-
-    std::size_t &
-    nsam()
-    {
-        return nsam_;
-    }
-
-    std::size_t
-    nsites() const
-    {
-        return nsites_;
-    }
-
-    std::size_t
-    nsam() const
-    {
-        return nsam_;
-    }
-
-    std::int8_t &operator[](std::size_t i) { return buffer.mutable_data()[i]; }
-
-    const std::int8_t &operator[](std::size_t i) const
-    {
-        return buffer.data()[i];
-    }
-
-    std::int8_t *
-    data() final
+    MockVM(std::unique_ptr<Sequence::GenotypeCapsule> g_,
+           std::unique_ptr<Sequence::PositionCapsule> p_)
+        : g(std::move(g_)), p(std::move(p_))
     {
-        return buffer.mutable_data();
     }
+};
 
-    const std::int8_t *
-    data() const final
+// Holds the table columns of a tskit tree sequence
+// as contiguous numpy arrays, so that they may be
+// used with the GIL released.
+class TreeSequenceColumns
+{
+  private:
+    using int32_array
+        = py::array_t<std::int32_t, py::array::c_style | py::array::forcecast>;
+    using int8_array
+        = py::array_t<std::int8_t, py::array::c_style | py::array::forcecast>;
+    using offset_array
+        = py::array_t<std::uint64_t,
+                      py::array::c_style | py::array::forcecast>;
+    using double_array
+        = py::array_t<double, py::array::c_style | py::array::forcecast>;
+
+    std::size_t num_nodes;
+    double_array edge_left, edge_right;
+    int32_array edge_parent, edge_child;
+    double_array position;
+    int8_array ancestral_state;
+    offset_array ancestral_state_offset;
+    int32_array mutation_site, mutation_node, mutation_parent;
+    int8_array derived_state;
+    offset_array derived_state_offset;
+
+    // edges, sites, and mutations are tables of one
+    // TableCollection, which tskit copies each time that
+    // the tables attribute of a tree sequence is read.
+    TreeSequenceColumns(const std::size_t nodes, py::object edges,
+                        py::object sites, py::object mutations)
+        : num_nodes(nodes), edge_left(edges.attr("left")),
+          edge_right(edges.attr("right")),
+          edge_parent(edges.attr("parent")),
+          edge_child(edges.attr("child")),
+          position(sites.attr("position")),
+          ancestral_state(sites.attr("ancestral_state")),
+          ancestral_state_offset(sites.attr("ancestral_state_offset")),
+          mutation_site(mutations.attr("site")),
+          mutation_node(mutations.attr("node")),
+          mutation_parent(mutations.attr("parent")),
+          derived_state(mutations.attr("derived_state")),
+          derived_state_offset(mutations.attr("derived_state_offset"))
     {
-        return buffer.data();
     }
 
-    const std::int8_t *
-    cdata() const final
+    TreeSequenceColumns(const std::size_t nodes, py::object tables)
+        : TreeSequenceColumns(nodes, tables.attr("edges"),
+                              tables.attr("sites"), tables.attr("mutations"))
     {
-        return buffer.data();
     }
 
-    std::unique_ptr<GenotypeCapsule>
-    clone() const final
+  public:
+    explicit TreeSequenceColumns(py::object ts)
+        : TreeSequenceColumns(ts.attr("num_nodes").cast<std::size_t>(),
+                              ts.attr("tables"))
     {
-        return std::unique_ptr<GenotypeCapsule>(
-            new NumpyGenotypeCapsule(this->buffer));
     }
 
-    std::int8_t *
-    begin() final
+    TreeSequenceTables
+    tables() const
     {
-        return buffer.mutable_data();
+        return TreeSequenceTables{
+            num_nodes,
+            static_cast<std::size_t>(edge_left.size()),
+            static_cast<std::size_t>(position.size()),
+            static_cast<std::size_t>(mutation_site.size()),
+            edge_left.data(),
+            edge_right.data(),
+            edge_parent.data(),
+            edge_child.data(),
+            position.data(),
+            ancestral_state.data(),
+            ancestral_state_offset.data(),
+            mutation_site.data(),
+            mutation_node.data(),
+            mutation_parent.data(),
+            derived_state.data(),
+            derived_state_offset.data()
+        };
     }
 
-    const std::int8_t *
-    begin() const final
+    // If samples is None, all sample nodes of ts are used.
+    static std::vector<std::int32_t>
+    sample_nodes(py::object ts, py::object samples)
     {
-        return buffer.data();
+        return samples.is_none()
+                   ? ts.attr("samples")().cast<std::vector<std::int32_t>>()
+                   : samples.cast<std::vector<std::int32_t>>();
     }
+};
 
-    std::int8_t *
-    end() final
-    {
-        return buffer.mutable_data() + buffer.size();
-    }
+// Iterator over consecutive VariantMatrix objects decoded
+// from a tree sequence.  Chunks contain either a fixed number
+// of sites or the sites in consecutive genomic intervals.
+// The current tree is kept between chunks, so that the
+// whole iteration is a single left-to-right traversal.
+class TreeSequenceChunks
+{
+  private:
+    TreeSequenceColumns columns;
+    // Held by pointer, as the decoder refers to it and
+    // instances are moved when returned to Python.
+    std::unique_ptr<TreeSequenceTables> tables;
+    std::vector<std::int32_t> samples;
+    std::unique_ptr<TreeSequenceIndexes> indexes;
+    std::unique_ptr<GenotypeDecoder> decoder;
+    std::size_t chunk_sites, next_site, next_interval;
+    double interval_length, sequence_length;
+    // Set while a chunk is decoded without the GIL.
+    bool busy;
 
-    const std::int8_t *
-    end() const final
+  public:
+    TreeSequenceChunks(py::object ts, py::object samples_,
+                       const std::size_t nsites, const double interval)
+        : columns(ts), tables(new TreeSequenceTables(columns.tables())),
+          samples(TreeSequenceColumns::sample_nodes(ts, samples_)),
+          indexes(nullptr), decoder(nullptr), chunk_sites(nsites),
+          next_site(0), next_interval(0), interval_length(interval),
+          sequence_length(ts.attr("sequence_length").cast<double>()),
+          busy(false)
     {
-        return buffer.data() + buffer.size();
+        if (chunk_sites == 0 && !(interval_length > 0.))
+            {
+                throw std::invalid_argument(
+                    "chunk size must be a positive number of sites or a "
+                    "positive interval length");
+            }
+        validate_samples(*tables, samples);
+        py::gil_scoped_release release;
+        indexes.reset(new TreeSequenceIndexes(*tables));
+        decoder.reset(new GenotypeDecoder(*tables, *indexes, samples, 0.0));
     }
 
-    const std::int8_t *
-    cbegin() const final
+    Sequence::VariantMatrix
+    next()
     {
-        return begin();
+        if (busy)
+            {
+                throw std::runtime_error(
+                    "iterator is in use by another thread");
+            }
+        std::size_t last_site = next_site;
+        if (chunk_sites > 0)
+            {
+                if (next_site >= tables->num_sites)
+                    {
+                        throw py::stop_iteration();
+                    }
+                last_site
+                    = std::min(tables->num_sites, next_site + chunk_sites);
+            }
+        else
+            {
+                if (static_cast<double>(next_interval) * interval_length
+                    >= sequence_length)
+                    {
+                        throw py::stop_iteration();
+                    }
+                ++next_interval;
+                const double right
+                    = static_cast<double>(next_interval) * interval_length;
+                while (last_site < tables->num_sites
+                       && tables->site_position[last_site] < right)
+                    {
+                        ++last_site;
+                    }
+            }
+        const std::size_t nsites = last_site - next_site;
+        std::unique_ptr<Sequence::GenotypeCapsule> g;
+        std::unique_ptr<Sequence::PositionCapsule> p;
+        std::int8_t max_allele = 0;
+        busy = true;
+        try
+            {
+                py::gil_scoped_release release;
+                std::vector<std::int8_t> genotypes(nsites * samples.size());
+                max_allele = decoder->decode(next_site, last_site,
+                                             Sequence::VariantMatrix::mask,
+                                             genotypes.data());
+                g.reset(new OwnedGenotypeCapsule(std::move(genotypes), nsites,
+                                                 samples.size()));
+                p.reset(new OwnedPositionCapsule(
+                    tables->site_position + next_site, nsites));
+            }
+        catch (...)
+            {
+                busy = false;
+                throw;
+            }
+        busy = false;
+        next_site = last_site;
+        return Sequence::VariantMatrix(std::move(g), std::move(p), max_allele);
     }
+};
 
-    const std::int8_t *
-    cend() const final
-    {
-        return end();
-    }
+Sequence::VariantMatrix
+mslike_from_numpy(
+    py::array_t<std::int8_t, py::array::c_style | py::array::forcecast>
+        genotypes,
+    py::array_t<double> positions)
+{
+    std::unique_ptr<Sequence::GenotypeCapsule> pp(
+        new NumpyGenotypeCapsule(std::move(genotypes)));
+    std::unique_ptr<Sequence::PositionCapsule> gp(
+        new NumpyPositionCapsule(std::move(positions)));
+    return Sequence::VariantMatrix(std::move(pp), std::move(gp), 1);
+}
 
-    bool
-    empty() const final
+namespace
+{
+    AlleleCountMatrixView
+    view_of(const Sequence::AlleleCountMatrix &am)
     {
-        return !nsites();
+        return AlleleCountMatrixView(am.counts.data(), am.ncol, am.nsam, 0, 1,
+                                     am.nrow);
     }
 
-    std::size_t
-    size() const final
+    AlleleCountMatrixView
+    slice_view(const AlleleCountMatrixView &v, py::slice slice)
     {
-        return buffer.size();
+        std::size_t start, stop, step, slicelength;
+        if (!slice.compute(v.nrow, &start, &stop, &step, &slicelength))
+            throw py::error_already_set();
+        // Negative steps wrap around in step, and back in the cast.
+        return v.subset(static_cast<std::ptrdiff_t>(start),
+                        static_cast<std::ptrdiff_t>(step), slicelength);
     }
 
-    std::size_t
-    row_offset() const
+    AlleleCountMatrixView
+    index_view(const AlleleCountMatrixView &v, py::array_t<std::size_t> x)
     {
-        return 0;
+        auto r = x.unchecked<1>();
+        std::vector<std::size_t> indexes(r.shape(0));
+        for (std::size_t i = 0; i < indexes.size(); ++i)
+            {
+                indexes[i] = r(i);
+            }
+        return v.subset(indexes);
     }
 
-    std::size_t
-    col_offset() const
+    // Strided views share the memory of the matrix,
+    // which is kept alive by self.  Other views are copied.
+    py::array
+    view_array(py::object self)
     {
-        return 0;
+        const auto &v = self.cast<const AlleleCountMatrixView &>();
+        if (!v.is_strided())
+            {
+                return numpy_from_vector(v.copy_counts(),
+                                         { v.nrow, v.ncol });
+            }
+        auto data = v.strided_data();
+        const auto size = static_cast<std::ptrdiff_t>(sizeof(std::int32_t));
+        py::array_t<std::int32_t> rv(
+            std::vector<std::ptrdiff_t>{
+                static_cast<std::ptrdiff_t>(v.nrow),
+                static_cast<std::ptrdiff_t>(v.ncol) },
+            std::vector<std::ptrdiff_t>{ data.second * size, size },
+            data.first, self);
+        rv.attr("flags").attr("writeable") = false;
+        return rv;
     }
 
-    std::size_t
-    stride() const
+    // The pickled state of a VariantMatrix is a pair of
+    // read-only arrays referring to its data.  numpy pickles
+    // them as raw bytes or, with protocol 5, as out-of-band
+    // buffers.
+    py::tuple
+    variant_matrix_state(py::object self)
     {
-        return nsam();
+        const auto &m = self.cast<const Sequence::VariantMatrix &>();
+        py::array_t<std::int8_t> genotypes(
+            std::vector<std::size_t>{ m.nsites(), m.nsam() }, m.cdata(),
+            self);
+        py::array_t<double> positions(std::vector<std::size_t>{ m.nsites() },
+                                      m.pbegin(), self);
+        genotypes.attr("flags").attr("writeable") = false;
+        positions.attr("flags").attr("writeable") = false;
+        return py::make_tuple(std::move(genotypes), std::move(positions));
     }
 
-    std::int8_t &
-    operator()(std::size_t site, std::size_t sample) final
+    // Writeable arrays are used without copying.  Read-only
+    // ones, such as arrays unpickled from read-only buffers
+    // or the arrays of variant_matrix_state when the buffers
+    // of protocol 5 are passed within a process, are copied.
+    Sequence::VariantMatrix
+    variant_matrix_from_state(py::tuple t)
     {
-        return buffer.mutable_data()[nsam() * site + sample];
+        if (t.size() != 2)
+            {
+                throw std::runtime_error("invalid object state");
+            }
+        if (py::isinstance<py::list>(t[0]))
+            {
+                // Written by versions before 0.2.4
+                auto d = t[0].cast<std::vector<std::int8_t>>();
+                auto p = t[1].cast<std::vector<double>>();
+                return Sequence::VariantMatrix(std::move(d), std::move(p));
+            }
+        auto g = py::array_t<std::int8_t, py::array::c_style
+                                              | py::array::forcecast>::
+            ensure(t[0]);
+        auto p = py::array_t<double, py::array::c_style
+                                         | py::array::forcecast>::ensure(t[1]);
+        if (!g || !p || g.ndim() != 2 || p.ndim() != 1
+            || g.shape(0) != p.shape(0))
+            {
+                throw std::runtime_error("invalid object state");
+            }
+        std::unique_ptr<Sequence::GenotypeCapsule> gp;
+        std::unique_ptr<Sequence::PositionCapsule> pp;
+        if (g.writeable() && p.writeable())
+            {
+                gp.reset(new NumpyGenotypeCapsule(std::move(g)));
+                pp.reset(new NumpyPositionCapsule(std::move(p)));
+            }
+        else
+            {
+                gp.reset(new OwnedGenotypeCapsule(
+                    g.data(), static_cast<std::size_t>(g.shape(0)),
+                    static_cast<std::size_t>(g.shape(1))));
+                pp.reset(new OwnedPositionCapsule(
+                    p.data(), static_cast<std::size_t>(p.shape(0))));
+            }
+        return Sequence::VariantMatrix(std::move(gp), std::move(pp), -1);
     }
 
-    const std::int8_t &
-    operator()(std::size_t site, std::size_t sample) const final
+    // As for VariantMatrix.  The counts are always copied,
+    // because an AlleleCountMatrix owns them.
+    py::tuple
+    allele_count_matrix_state(py::object self)
     {
-        return buffer.data()[nsam() * site + sample];
+        using value_type = Sequence::AlleleCountMatrix::value_type;
+        const auto &c = self.cast<const Sequence::AlleleCountMatrix &>();
+        py::array_t<value_type> counts(
+            std::vector<std::size_t>{ c.nrow, c.ncol }, c.counts.data(),
+            self);
+        return py::make_tuple(std::move(counts), c.nsam);
     }
 
-    bool
-    resizable() const final
+    Sequence::AlleleCountMatrix
+    allele_count_matrix_from_state(py::tuple t)
     {
-        return false;
+        using value_type = Sequence::AlleleCountMatrix::value_type;
+        if (t.size() != 2)
+            {
+                throw std::runtime_error("invalid object state");
+            }
+        auto a = py::array_t<value_type, py::array::c_style
+                                             | py::array::forcecast>::
+            ensure(t[0]);
+        if (!a || a.ndim() != 2)
+            {
+                throw std::runtime_error("invalid object state");
+            }
+        const auto nrow = static_cast<std::size_t>(a.shape(0));
+        const auto ncol = static_cast<std::size_t>(a.shape(1));
+        std::vector<value_type> counts(a.data(), a.data() + nrow * ncol);
+        return Sequence::AlleleCountMatrix(std::move(counts), ncol, nrow,
+                                           t[1].cast<std::size_t>());
     }
-};
 
-class NumpyPositionCapsule : public Sequence::PositionCapsule
-{
-  private:
-    py::array_t<double> buffer;
-
-  public:
-    explicit NumpyPositionCapsule(py::array_t<double> input)
-        : buffer(std::move(input))
+    // None, a boolean mask of length n, or strictly
+    // increasing indexes, as a sorted list of indexes.
+    std::vector<std::size_t>
+    selection_indexes(py::object o, const std::size_t n)
     {
-        if (buffer.ndim() != 1)
+        if (o.is_none())
+            {
+                return site_indexes_from_object(o, n);
+            }
+        py::object a = py::module::import("numpy").attr("asarray")(o);
+        if (!py::isinstance<py::array_t<bool>>(a))
+            {
+                return site_indexes_from_object(a, n);
+            }
+        auto mask = a.cast<py::array_t<bool, py::array::c_style
+                                                 | py::array::forcecast>>();
+        if (mask.ndim() != 1 || static_cast<std::size_t>(mask.size()) != n)
             {
                 throw std::invalid_argument(
-                    "positions must be a one-dimensional array");
+                    "boolean mask has the wrong length");
             }
+        std::vector<std::size_t> rv;
+        for (std::size_t i = 0; i < n; ++i)
+            {
+                if (mask.data()[i])
+                    {
+                        rv.push_back(i);
+                    }
+            }
+        return rv;
     }
 
-    double &operator[](std::size_t i) { return buffer.mutable_data()[i]; }
-
-    const double &operator[](std::size_t i) const { return buffer.data()[i]; }
-
-    double *
-    data() final
-    {
-        return buffer.mutable_data();
-    }
-
-    const double *
-    data() const final
-    {
-        return buffer.data();
-    }
-
-    const double *
-    cdata() const final
-    {
-        return buffer.data();
-    }
-
-    std::unique_ptr<PositionCapsule>
-    clone() const final
-    {
-        return std::unique_ptr<PositionCapsule>(
-            new NumpyPositionCapsule(*this));
-    }
-
-    double *
-    begin() final
-    {
-        return buffer.mutable_data();
-    }
-
-    const double *
-    begin() const final
+    // The selected rows and columns of self.  When all columns
+    // of a contiguous block of rows of a matrix read from a file
+    // are selected, the genotypes of the result refer to the
+    // file, as for variant_matrix_from_file.  Otherwise, the
+    // data are copied.  The result never refers to memory
+    // owned by self, so that neither sees changes to the other.
+    Sequence::VariantMatrix
+    select_variant_matrix(py::object self, py::object sites,
+                          py::object samples, const unsigned nthreads)
     {
-        return buffer.data();
+        const auto &m = self.cast<const Sequence::VariantMatrix &>();
+        const auto rows = selection_indexes(sites, m.nsites());
+        const auto cols = selection_indexes(samples, m.nsam());
+        if (!rows.empty() && cols.size() == m.nsam() && is_contiguous(rows))
+            {
+                const std::int8_t *first = m.cdata() + rows[0] * m.nsam();
+                auto file = shared_file_containing(first,
+                                                   rows.size() * m.nsam());
+                if (file)
+                    {
+                        const auto offset = static_cast<std::size_t>(
+                            reinterpret_cast<const char *>(first)
+                            - file->data());
+                        std::unique_ptr<Sequence::GenotypeCapsule> gp(
+                            new MappedGenotypeCapsule(std::move(file), offset,
+                                                      rows.size(), m.nsam()));
+                        std::unique_ptr<Sequence::PositionCapsule> pp(
+                            new OwnedPositionCapsule(m.pbegin() + rows[0],
+                                                     rows.size()));
+                        return Sequence::VariantMatrix(std::move(gp),
+                                                       std::move(pp), -1);
+                    }
+            }
+        py::gil_scoped_release release;
+        std::vector<std::int8_t> genotypes(rows.size() * cols.size());
+        gather_genotypes(m.cdata(), m.nsam(), rows, cols, nthreads,
+                         genotypes.data());
+        std::vector<double> positions(rows.size());
+        for (std::size_t i = 0; i < rows.size(); ++i)
+            {
+                positions[i] = m.pbegin()[rows[i]];
+            }
+        std::unique_ptr<Sequence::GenotypeCapsule> gp(new OwnedGenotypeCapsule(
+            std::move(genotypes), rows.size(), cols.size()));
+        std::unique_ptr<Sequence::PositionCapsule> pp(
+            new OwnedPositionCapsule(std::move(positions)));
+        return Sequence::VariantMatrix(std::move(gp), std::move(pp), -1);
     }
 
-    const double *
-    cbegin() const final
+    // The first element of a row or column view and the
+    // distance between elements, found from its iterators.
+    template <typename View>
+    std::pair<const std::int8_t *, std::ptrdiff_t>
+    view_layout(const View &v)
     {
-        return buffer.data();
+        if (v.size() == 0)
+            {
+                return std::make_pair(nullptr, std::ptrdiff_t(1));
+            }
+        auto i = v.begin();
+        const std::int8_t *first = &*i;
+        if (v.size() == 1)
+            {
+                return std::make_pair(first, std::ptrdiff_t(1));
+            }
+        ++i;
+        return std::make_pair(first, &*i - first);
     }
 
-    double *
-    end() final
+    // A read-only numpy array sharing the data of a view,
+    // which is kept alive by the array.
+    template <typename View>
+    py::array
+    view_numpy(py::object self)
     {
-        return buffer.mutable_data() + buffer.size();
+        const auto &v = self.cast<const View &>();
+        const auto layout = view_layout(v);
+        py::array_t<std::int8_t> rv(
+            std::vector<std::ptrdiff_t>{
+                static_cast<std::ptrdiff_t>(v.size()) },
+            std::vector<std::ptrdiff_t>{ layout.second }, layout.first, self);
+        rv.attr("flags").attr("writeable") = false;
+        return rv;
     }
 
-    const double *
-    end() const final
+    // The buffer of a view, which is read-only for the
+    // views of const data.
+    template <typename View, bool readonly>
+    py::buffer_info
+    view_buffer(const View &v)
     {
-        return buffer.data() + buffer.size();
+        const auto layout = view_layout(v);
+        return py::buffer_info(
+            const_cast<std::int8_t *>(layout.first), sizeof(std::int8_t),
+            py::format_descriptor<std::int8_t>::format(), 1, { v.size() },
+            { layout.second }, readonly);
     }
 
-    const double *
-    cend() const final
+    // Indexes in any order, each less than n.
+    std::vector<std::size_t>
+    indexes_from_array(py::array_t<std::int64_t, py::array::c_style
+                                                     | py::array::forcecast>
+                           a,
+                       const std::size_t n)
     {
-        return buffer.data() + buffer.size();
+        if (a.ndim() != 1)
+            {
+                throw std::invalid_argument(
+                    "indexes must be a one-dimensional array");
+            }
+        std::vector<std::size_t> rv(static_cast<std::size_t>(a.size()));
+        for (std::size_t i = 0; i < rv.size(); ++i)
+            {
+                const std::int64_t x = a.data()[i];
+                if (x < 0 || static_cast<std::size_t>(x) >= n)
+                    {
+                        throw std::out_of_range("index out of range");
+                    }
+                rv[i] = static_cast<std::size_t>(x);
+            }
+        return rv;
     }
 
-    bool
-    empty() const final
+    // Read-only numpy view of a slice of sites or samples,
+    // whose base is self.
+    py::array
+    genotype_slice(py::object self, py::slice slice, const bool sites)
     {
-        return buffer.size() == 0;
+        const auto &m = self.cast<const Sequence::VariantMatrix &>();
+        std::size_t start, stop, step, slicelength;
+        if (!slice.compute(sites ? m.nsites() : m.nsam(), &start, &stop,
+                           &step, &slicelength))
+            throw py::error_already_set();
+        const auto rowstride = static_cast<std::ptrdiff_t>(m.nsam());
+        const auto offset = static_cast<std::ptrdiff_t>(start)
+                            * (sites ? rowstride : 1);
+        const auto n = static_cast<std::ptrdiff_t>(slicelength);
+        const auto stride = static_cast<std::ptrdiff_t>(step);
+        py::array_t<std::int8_t> rv(
+            sites ? std::vector<std::ptrdiff_t>{ n, rowstride }
+                  : std::vector<std::ptrdiff_t>{
+                      static_cast<std::ptrdiff_t>(m.nsites()), n },
+            sites ? std::vector<std::ptrdiff_t>{ stride * rowstride, 1 }
+                  : std::vector<std::ptrdiff_t>{ rowstride, stride },
+            m.cdata() + offset, self);
+        rv.attr("flags").attr("writeable") = false;
+        return rv;
     }
 
-    std::size_t
-    size() const final
+    // Copy of a set of sites or samples
+    py::array
+    genotype_subset(const Sequence::VariantMatrix &m,
+                    py::array_t<std::int64_t, py::array::c_style
+                                                  | py::array::forcecast>
+                        indexes,
+                    const bool sites, const unsigned nthreads)
     {
-        return buffer.size();
+        auto selected
+            = indexes_from_array(indexes, sites ? m.nsites() : m.nsam());
+        std::vector<std::size_t> all(sites ? m.nsam() : m.nsites());
+        for (std::size_t i = 0; i < all.size(); ++i)
+            {
+                all[i] = i;
+            }
+        const auto &rows = sites ? selected : all;
+        const auto &cols = sites ? all : selected;
+        py::array_t<std::int8_t> rv(
+            std::vector<std::size_t>{ rows.size(), cols.size() });
+        auto output = rv.mutable_data();
+        py::gil_scoped_release release;
+        gather_genotypes(m.cdata(), m.nsam(), rows, cols, nthreads, output);
+        return rv;
     }
 
-    std::size_t
-    nsites() const
+    std::string
+    path_from_object(py::object path)
     {
-        return buffer.size();
+        return py::module::import("os").attr("fspath")(path).cast<std::string>();
     }
 
-    bool
-    resizable() const final
+    // Only the header is read here.  The data are paged
+    // in from the file when first accessed.
+    Sequence::VariantMatrix
+    variant_matrix_from_file(const std::string &path)
     {
-        return false;
+        auto file = map_shared_file(path);
+        const auto h = read_variant_matrix_file_header(file->data(),
+                                                       file->size());
+        std::unique_ptr<Sequence::GenotypeCapsule> g(new MappedGenotypeCapsule(
+            file, h.genotypes_offset, h.nsites, h.nsam));
+        std::unique_ptr<Sequence::PositionCapsule> p(
+            new MappedPositionCapsule(file, h.positions_offset, h.nsites));
+        return Sequence::VariantMatrix(std::move(g), std::move(p),
+                                       h.max_allele);
     }
-};
 
-class MockVM
-{
-  private:
-    std::unique_ptr<Sequence::GenotypeCapsule> g;
-    std::unique_ptr<Sequence::PositionCapsule> p;
-
-  public:
-    MockVM(std::unique_ptr<Sequence::GenotypeCapsule> g_,
-           std::unique_ptr<Sequence::PositionCapsule> p_)
-        : g(std::move(g_)), p(std::move(p_))
+    Sequence::VariantMatrix
+    variant_matrix_from_polytable(const Sequence::PolyTable &pt,
+                                  const unsigned nthreads)
     {
+        const std::size_t nsites = pt.numsites(), nsam = pt.size();
+        std::vector<const char *> haplotypes(nsam);
+        for (std::size_t j = 0; j < nsam; ++j)
+            {
+                if (pt[j].size() != nsites)
+                    {
+                        throw std::invalid_argument(
+                            "all haplotypes must have one character per "
+                            "site");
+                    }
+                haplotypes[j] = pt[j].c_str();
+            }
+        py::gil_scoped_release release;
+        std::vector<std::int8_t> genotypes(nsites * nsam);
+        haplotypes_to_genotypes(haplotypes, nsites, polytable_state_table(),
+                                nthreads, genotypes.data());
+        std::unique_ptr<Sequence::GenotypeCapsule> g(new OwnedGenotypeCapsule(
+            std::move(genotypes), nsites, nsam));
+        std::unique_ptr<Sequence::PositionCapsule> p(
+            new OwnedPositionCapsule(pt.GetPositions()));
+        return Sequence::VariantMatrix(std::move(g), std::move(p), -1);
     }
-};
-
-Sequence::VariantMatrix
-mslike_from_numpy(
-    py::array_t<std::int8_t, py::array::c_style | py::array::forcecast>
-        genotypes,
-    py::array_t<double> positions)
-{
-    std::unique_ptr<Sequence::GenotypeCapsule> pp(
-        new NumpyGenotypeCapsule(std::move(genotypes)));
-    std::unique_ptr<Sequence::PositionCapsule> gp(
-        new NumpyPositionCapsule(std::move(positions)));
-    return Sequence::VariantMatrix(std::move(pp), std::move(gp), 1);
-}
+} // namespace
 
 void
 init_VariantMatrix(py::module &m)
@@ -312,7 +665,8 @@ init_VariantMatrix(py::module &m)
         "protocol.")
         .def(py::init<const Sequence::VariantMatrix &>(),
              "Construct from a "
-             ":class:`libsequence.variant_matrix.VariantMatrix`")
+             ":class:`libsequence.variant_matrix.VariantMatrix`",
+             py::call_guard<py::gil_scoped_release>())
         .def(py::init([](std::vector<std::int32_t> &data,
                          std::size_t max_allele, std::size_t nsites,
                          std::size_t nsam) {
@@ -321,47 +675,59 @@ init_VariantMatrix(py::module &m)
         }))
         .def_static(
             "from_tskit",
-            [](py::object ts, std::int8_t max_allele_value) {
-                std::size_t nsamples
-                    = ts.attr("num_samples").cast<std::size_t>();
-                std::size_t nsites = ts.attr("num_sites").cast<std::size_t>();
-                std::vector<std::int32_t> temp(nsites * (max_allele_value + 1),
-                                               0);
-                std::size_t current_site = 0;
-                py::array_t<std::uint8_t, py::array::c_style> a;
-                py::iterator variants = ts.attr("variants")();
-                while (variants != py::iterator::sentinel())
+            [](py::object ts, std::int8_t max_allele_value, py::object samples,
+               const unsigned nthreads) {
+                if (max_allele_value < 0)
                     {
-                        a = (*variants).attr("genotypes").cast<decltype(a)>();
-                        // Disable bounds checking
-                        auto r = a.unchecked<1>();
-                        for (std::size_t i = 0; i < nsamples; ++i)
-                            {
-                                if (r[i] > max_allele_value)
-                                    {
-                                        throw std::invalid_argument(
-                                            "incorrect max_allele_value");
-                                    }
-                                ++temp[current_site + r[i]];
-                            }
-                        current_site += (max_allele_value + 1);
-                        ++variants;
+                        throw std::invalid_argument(
+                            "max_allele_value must be non-negative");
                     }
-                return Sequence::AlleleCountMatrix(
-                    std::move(temp), max_allele_value + 1, nsites, nsamples);
+                TreeSequenceColumns columns(ts);
+                auto sample_nodes
+                    = TreeSequenceColumns::sample_nodes(ts, samples);
+                const TreeSequenceTables t = columns.tables();
+                const std::size_t ncol
+                    = static_cast<std::size_t>(max_allele_value) + 1;
+                py::gil_scoped_release release;
+                auto counts = allele_counts_from_tables(t, sample_nodes, ncol,
+                                                        nthreads);
+                return Sequence::AlleleCountMatrix(std::move(counts), ncol,
+                                                   t.num_sites,
+                                                   sample_nodes.size());
             },
             R"delim(
              Construct AlleleCountMatrix from a tree sequence object from tskit
              
              :param ts: A tree sequence
              :type ts: tskit.TreeSequence
-             :type chunksize: int
              :param max_allele_value: Maximum numeric value for a mutation
              :type max_allele_value: int8
+             :param samples: (None) The sample nodes to count.  If None, all samples are used.
+             :type samples: list
+             :param nthreads: (1) Number of threads to use.  If 0, use all available cores.
+             :type nthreads: int
              :rtype: :class:`libsequence.AlleleCountMatrix`
 
+             Counts are obtained by traversing the trees, using
+             the edge, site, and mutation tables.  The genome is
+             divided into one chunk of sites per thread.  Allelic
+             states are numbered as in tskit, with 0 representing
+             the ancestral state.
+
+             .. note::
+
+                As in tskit, samples that are isolated in a tree, and
+                carry no mutations at a site, are missing data, and
+                are not counted.  The counts of a site may therefore
+                sum to less than the number of samples.
+
              .. versionadded:: 0.2.3
 
+             .. versionchanged:: 0.2.4
+
+                Counts are calculated from the tables in C++.
+                Added samples and nthreads.
+
              >>> import msprime
              >>> import libsequence
              >>> import numpy as np
@@ -371,7 +737,8 @@ init_VariantMatrix(py::module &m)
              >>> vmac = libsequence.AlleleCountMatrix(vm)
              >>> assert np.array_equal(np.array(ac), np.array(vmac))
             )delim",
-            py::arg("ts"), py::arg("max_allele_value") = 1)
+            py::arg("ts"), py::arg("max_allele_value") = 1,
+            py::arg("samples") = nullptr, py::arg("nthreads") = 1)
         .def_readonly("counts", &Sequence::AlleleCountMatrix::counts,
                       "Flattened view of the raw data.")
         .def_readonly("nrow", &Sequence::AlleleCountMatrix::nrow,
@@ -394,6 +761,7 @@ init_VariantMatrix(py::module &m)
                  if (!slice.compute(am.counts.size(), &start, &stop, &step,
                                     &slicelength))
                      throw py::error_already_set();
+                 py::gil_scoped_release release;
                  std::vector<int> c;
                  int nrow = 0;
                  for (size_t i = 0; i < slicelength; ++i, ++nrow)
@@ -409,6 +777,7 @@ init_VariantMatrix(py::module &m)
              [](const Sequence::AlleleCountMatrix &am,
                 py::array_t<std::size_t> x) {
                  auto r = x.unchecked<1>();
+                 py::gil_scoped_release release;
                  std::vector<int> c;
                  int nrow = 0;
                  for (std::size_t i = 0; i < r.shape(0); ++i, ++nrow)
@@ -440,17 +809,124 @@ init_VariantMatrix(py::module &m)
                         /* Strides (in bytes) for each index */
                     });
             })
-        .def("_merge", [](const Sequence::AlleleCountMatrix &self,
-                          const Sequence::AlleleCountMatrix &acm) {
-            if (self.nsam != acm.nsam || self.ncol != acm.ncol)
-                {
-                    throw std::invalid_argument("dimension mismatch");
-                }
-            auto counts = self.counts;
-            counts.insert(end(counts), begin(acm.counts), end(acm.counts));
-            return Sequence::AlleleCountMatrix(
-                std::move(counts), self.ncol, self.nrow + acm.nrow, self.nsam);
-        });
+        .def(
+            "_merge",
+            [](const Sequence::AlleleCountMatrix &self,
+               const Sequence::AlleleCountMatrix &acm) {
+                if (self.nsam != acm.nsam || self.ncol != acm.ncol)
+                    {
+                        throw std::invalid_argument("dimension mismatch");
+                    }
+                std::vector<Sequence::AlleleCountMatrix::value_type> counts;
+                counts.reserve(self.counts.size() + acm.counts.size());
+                counts.insert(end(counts), begin(self.counts),
+                              end(self.counts));
+                counts.insert(end(counts), begin(acm.counts),
+                              end(acm.counts));
+                return Sequence::AlleleCountMatrix(std::move(counts),
+                                                   self.ncol,
+                                                   self.nrow + acm.nrow,
+                                                   self.nsam);
+            },
+            py::call_guard<py::gil_scoped_release>())
+        .def(py::pickle(&allele_count_matrix_state,
+                        &allele_count_matrix_from_state))
+        .def(
+            "view",
+            [](const Sequence::AlleleCountMatrix &am) { return view_of(am); },
+            py::keep_alive<0, 1>(),
+            R"delim(
+            Return a :class:`libsequence.AlleleCountMatrixView` of all rows.
+
+            .. versionadded:: 0.2.4
+            )delim")
+        .def(
+            "view",
+            [](const Sequence::AlleleCountMatrix &am, py::slice slice) {
+                return slice_view(view_of(am), slice);
+            },
+            py::keep_alive<0, 1>(), py::arg("rows"),
+            R"delim(
+            Return a :class:`libsequence.AlleleCountMatrixView` of a slice
+            or an array of indexes of rows.  Unlike indexing, no data are
+            copied.
+
+            :param rows: A slice, or a list of row indexes.
+
+            .. versionadded:: 0.2.4
+
+            >>> import msprime
+            >>> import libsequence
+            >>> ts = msprime.simulate(10, mutation_rate=10, random_seed=42)
+            >>> ac = libsequence.VariantMatrix.from_TreeSequence(ts).count_alleles()
+            >>> v = ac.view(slice(0, ac.nrow, 2))
+            >>> pi = libsequence.thetapi(v)
+            >>> v = ac.view([0, 3, 5])
+            )delim")
+        .def(
+            "view",
+            [](const Sequence::AlleleCountMatrix &am,
+               py::array_t<std::size_t> x) {
+                return index_view(view_of(am), x);
+            },
+            py::keep_alive<0, 1>(), py::arg("rows"));
+
+    py::class_<AlleleCountMatrixView>(m, "AlleleCountMatrixView",
+                                      R"delim(
+        A view of some of the rows of a
+        :class:`libsequence.AlleleCountMatrix`, obtained from
+        :func:`libsequence.AlleleCountMatrix.view`.  Views refer to
+        the data of the matrix, which is kept alive as long as the
+        view exists.  They are accepted by :func:`libsequence.thetapi`,
+        :func:`libsequence.thetaw`, :func:`libsequence.tajd`,
+        :func:`libsequence.faywuh`, :func:`libsequence.hprime`,
+        :func:`libsequence.nvariable_sites`,
+        :func:`libsequence.nbiallelic_sites`,
+        :func:`libsequence.total_number_of_mutations`, and
+        :func:`libsequence.summary_statistics`.
+
+        Views of slices are converted to numpy arrays without
+        copying.  The arrays are read-only.
+
+        .. versionadded:: 0.2.4
+        )delim")
+        .def_readonly("nrow", &AlleleCountMatrixView::nrow,
+                      "Number of rows (sites) in the view.")
+        .def_readonly("ncol", &AlleleCountMatrixView::ncol,
+                      "Number of columns (allelic states) in the view.")
+        .def_readonly("nsam", &AlleleCountMatrixView::nsam,
+                      "Sample size of the original VariantMatrix.")
+        .def_property_readonly("is_strided", &AlleleCountMatrixView::is_strided,
+                               "True if the rows are evenly spaced in the "
+                               "matrix, so that the view may be converted "
+                               "to an array without copying.")
+        .def(
+            "row",
+            [](const AlleleCountMatrixView &v, const std::size_t i) {
+                if (i >= v.nrow)
+                    {
+                        throw std::out_of_range("row index out of range");
+                    }
+                return py::make_iterator(v.row(i), v.row(i) + v.ncol);
+            },
+            py::keep_alive<0, 1>(), py::arg("i"),
+            "Return an iterator over the i-th site.")
+        .def("__getitem__", &slice_view, py::keep_alive<0, 1>())
+        .def("__getitem__", &index_view, py::keep_alive<0, 1>())
+        .def("__len__",
+             [](const AlleleCountMatrixView &self) { return self.nrow; })
+        .def("__array__",
+             [](py::object self, py::args, py::kwargs) {
+                 return view_array(self);
+             })
+        .def(
+            "copy",
+            [](const AlleleCountMatrixView &v) {
+                return Sequence::AlleleCountMatrix(v.copy_counts(), v.ncol,
+                                                   v.nrow, v.nsam);
+            },
+            py::call_guard<py::gil_scoped_release>(),
+            "Return the rows as a new :class:`libsequence.AlleleCountMatrix`.");
 
     py::class_<Sequence::VariantMatrix>(m, "VariantMatrix",
                                         //py::buffer_protocol(),
@@ -526,6 +1002,195 @@ init_VariantMatrix(py::module &m)
             the output from msprime are cast from 8-bit unsigned
             integers to 8-bit signed integers.
             )delim")
+        .def_static(
+            "from_TreeSequence_chunks",
+            [](py::object ts, py::object nsites, py::object interval_length,
+               py::object samples) {
+                if (!nsites.is_none() && !interval_length.is_none())
+                    {
+                        throw std::invalid_argument(
+                            "nsites and interval_length cannot both be set");
+                    }
+                std::size_t chunk_sites = 0;
+                double interval = 0.0;
+                if (!interval_length.is_none())
+                    {
+                        interval = interval_length.cast<double>();
+                    }
+                else if (!nsites.is_none())
+                    {
+                        chunk_sites = nsites.cast<std::size_t>();
+                    }
+                else
+                    {
+                        chunk_sites = 10000;
+                    }
+                return TreeSequenceChunks(std::move(ts), std::move(samples),
+                                          chunk_sites, interval);
+            },
+            py::arg("ts"), py::arg("nsites") = nullptr,
+            py::arg("interval_length") = nullptr,
+            py::arg("samples") = nullptr,
+            R"delim(
+            Iterate over a tree sequence, generating one
+            VariantMatrix per chunk of the genome.
+
+            :param ts: A tree sequence
+            :type ts: tskit.TreeSequence
+            :param nsites: (None) The number of sites per chunk.
+            :type nsites: int
+            :param interval_length: (None) The genomic length of each chunk.
+            :type interval_length: float
+            :param samples: (None) The sample nodes to decode.  If None, all samples are used.
+            :type samples: list
+            :rtype: :class:`libsequence.TreeSequenceChunks`
+
+            At most one of nsites and interval_length may be given.
+            If neither is given, chunks contain 10,000 sites.
+            When chunking by site count, the last chunk may contain
+            fewer sites.  When chunking by interval, chunk i contains
+            the sites in [i*interval_length, (i+1)*interval_length),
+            for all intervals starting before the sequence length, and
+            may therefore be empty.
+
+            Genotypes are decoded in C++ directly from the edge,
+            site, and mutation tables, so that only one chunk at a
+            time is held in memory.  The trees are traversed once,
+            from left to right, over the course of the iteration.
+            Allelic states are numbered as in tskit, with 0
+            representing the ancestral state.  Samples that are
+            isolated in a tree, and carry no mutations at a site,
+            are assigned :attr:`libsequence.VariantMatrix.mask`.
+
+            .. versionadded:: 0.2.4
+
+            >>> import msprime
+            >>> import libsequence
+            >>> ts = msprime.simulate(10, mutation_rate=100, random_seed=42)
+            >>> for vm in libsequence.VariantMatrix.from_TreeSequence_chunks(ts, nsites=50):
+            ...     ac = vm.count_alleles()
+            )delim")
+        .def_static(
+            "from_file",
+            [](py::object path) {
+                const auto p = path_from_object(std::move(path));
+                py::gil_scoped_release release;
+                return variant_matrix_from_file(p);
+            },
+            py::arg("path"),
+            R"delim(
+            Open a file written by :func:`libsequence.VariantMatrix.to_file`.
+
+            :param path: The file name
+            :type path: str or os.PathLike
+            :rtype: :class:`libsequence.VariantMatrix`
+
+            The file is memory-mapped rather than read, so that opening
+            it takes constant time, and pages of data are read from disk
+            when they are first used.  Processes opening the same file
+            share its pages in the operating system's page cache.  The
+            mapping is read-only, so files larger than the available
+            memory may be opened.  Functions that modify the returned
+            object, such as :func:`libsequence.filter_sites`, first copy
+            its data into memory, and never write to the file.
+
+            .. versionadded:: 0.2.4
+
+            >>> import msprime
+            >>> import libsequence
+            >>> import tempfile
+            >>> ts = msprime.simulate(10, mutation_rate=10, random_seed=42)
+            >>> vm = libsequence.VariantMatrix.from_TreeSequence(ts)
+            >>> with tempfile.NamedTemporaryFile() as f:
+            ...     vm.to_file(f.name)
+            ...     m = libsequence.VariantMatrix.from_file(f.name)
+            ...     ac = m.count_alleles()
+            )delim")
+        .def_static("from_polytable", &variant_matrix_from_polytable,
+                    py::arg("pt"), py::arg("nthreads") = 1,
+                    R"delim(
+            Create a VariantMatrix from a polymorphism table.
+
+            :param pt: A :class:`libsequence.SimData` or :class:`libsequence.PolySites`
+            :param nthreads: (1) Number of threads to use.  If 0, use all available cores.
+            :rtype: :class:`libsequence.VariantMatrix`
+
+            Characters are mapped to states with a lookup table.
+            0 and 1 are states 0 and 1, and A, C, G, and T, in
+            either case, are states 0, 1, 2, and 3.  All other
+            characters, including N and gaps, are missing data.
+
+            The haplotypes of the table are transposed into sites
+            in square tiles that fit in cache, and blocks of sites
+            are converted in parallel.
+
+            .. versionadded:: 0.2.4
+
+            >>> import libsequence
+            >>> d = libsequence.SimData([(0.1, "0011"), (0.2, "1100")])
+            >>> vm = libsequence.VariantMatrix.from_polytable(d)
+            )delim")
+        .def("select", &select_variant_matrix, py::arg("sites") = nullptr,
+             py::arg("samples") = nullptr, py::arg("nthreads") = 1,
+             R"delim(
+            Return a VariantMatrix with a subset of sites and samples.
+
+            :param sites: (None) A boolean mask of the sites to keep, or their indexes.
+            :param samples: (None) A boolean mask of the samples to keep, or their indexes.
+            :param nthreads: (1) Number of threads to use.  If 0, use all available cores.
+            :type nthreads: int
+            :rtype: :class:`libsequence.VariantMatrix`
+
+            None means all sites or all samples.  Indexes must be
+            strictly increasing.
+
+            The selected data are copied using nthreads threads,
+            except when this object was opened with
+            :func:`libsequence.VariantMatrix.from_file`, all samples
+            are kept, and the sites are a contiguous block, as is the
+            case for a mask made by :func:`libsequence.site_mask` with
+            only a position range.  Then the genotypes of the result
+            are read from the file, and only the positions are
+            copied.  Either
+            way, changes to the result or to this object are not seen
+            by the other.
+
+            .. versionadded:: 0.2.4
+
+            >>> import libsequence
+            >>> import numpy as np
+            >>> m = libsequence.VariantMatrix(np.array([[0, 1, 1], [0, 0, 1]], dtype=np.int8), [0.1, 0.2])
+            >>> mask = libsequence.site_mask(m, min_maf=0.3)
+            >>> m2 = m.select(sites=mask, samples=[0, 2])
+            )delim")
+        .def(
+            "to_file",
+            [](const Sequence::VariantMatrix &self, py::object path) {
+                const auto p = path_from_object(std::move(path));
+                py::gil_scoped_release release;
+                write_variant_matrix_file(p, self.cdata(), self.pbegin(),
+                                          self.nsites(), self.nsam());
+            },
+            py::arg("path"),
+            R"delim(
+            Write the data to a binary file that may be opened with
+            :func:`libsequence.VariantMatrix.from_file`.
+
+            :param path: The file name
+            :type path: str or os.PathLike
+
+            The file contains a fixed-size header, the positions
+            as 64-bit floats, and the genotypes as a row-major
+            matrix of 8-bit integers.  Numbers are stored in the byte
+            order of the machine writing the file.
+
+            The data are written to a new file in the same directory,
+            which then replaces path.  Thus, a matrix opened from path
+            with :func:`libsequence.VariantMatrix.from_file` keeps its
+            data, and may itself be written to path.
+
+            .. versionadded:: 0.2.4
+            )delim")
         .def_property_readonly(
             "data",
             [](const Sequence::VariantMatrix &self) {
@@ -557,10 +1222,12 @@ init_VariantMatrix(py::module &m)
             "Number of samples")
         .def_readonly_static("mask", &Sequence::VariantMatrix::mask,
                              "Reserved missing data state")
-        .def("count_alleles",
-             [](const Sequence::VariantMatrix &m) {
-                 return Sequence::AlleleCountMatrix(m);
-             })
+        .def(
+            "count_alleles",
+            [](const Sequence::VariantMatrix &m) {
+                return Sequence::AlleleCountMatrix(m);
+            },
+            py::call_guard<py::gil_scoped_release>())
         .def(
             "site",
             [](const Sequence::VariantMatrix &m, const std::size_t i) {
@@ -573,7 +1240,7 @@ init_VariantMatrix(py::module &m)
              :type i: int
              :rtype: :class:`libsequence.variant_matrix.ConstRowView`
              )delim",
-            py::arg("i"))
+            py::arg("i"), py::keep_alive<0, 1>())
         .def(
             "sample",
             [](const Sequence::VariantMatrix &m, const std::size_t i) {
@@ -586,7 +1253,67 @@ init_VariantMatrix(py::module &m)
              :type i: int
              :rtype: :class:`libsequence.variantmatrix.ConstColView`
              )delim",
-            py::arg("i"))
+            py::arg("i"), py::keep_alive<0, 1>())
+        .def(
+            "sites",
+            [](py::object self, py::slice s) {
+                return genotype_slice(std::move(self), s, true);
+            },
+            py::arg("sites"),
+            R"delim(
+             Return the data for a set of sites as a 2d numpy array.
+
+             :param sites: A slice, or an array of site indexes
+             :param nthreads: (1) Number of threads used to copy indexed sites.
+             :rtype: numpy.ndarray
+
+             For a slice, the array is a read-only view of the data that
+             keeps this object alive.  For an array of indexes, which
+             may be in any order, the sites are copied.
+
+             .. versionadded:: 0.2.4
+             )delim")
+        .def(
+            "sites",
+            [](const Sequence::VariantMatrix &m,
+               py::array_t<std::int64_t,
+                           py::array::c_style | py::array::forcecast>
+                   indexes,
+               const unsigned nthreads) {
+                return genotype_subset(m, std::move(indexes), true, nthreads);
+            },
+            py::arg("sites"), py::arg("nthreads") = 1)
+        .def(
+            "samples",
+            [](py::object self, py::slice s) {
+                return genotype_slice(std::move(self), s, false);
+            },
+            py::arg("samples"),
+            R"delim(
+             Return the data for a set of samples as a 2d numpy array
+             with one row per site.
+
+             :param samples: A slice, or an array of sample indexes
+             :param nthreads: (1) Number of threads used to copy indexed samples.
+             :rtype: numpy.ndarray
+
+             For a slice, the array is a read-only, strided view of the
+             data that keeps this object alive.  For an array of indexes,
+             which may be in any order, the samples are copied.
+
+             .. versionadded:: 0.2.4
+             )delim")
+        .def(
+            "samples",
+            [](const Sequence::VariantMatrix &m,
+               py::array_t<std::int64_t,
+                           py::array::c_style | py::array::forcecast>
+                   indexes,
+               const unsigned nthreads) {
+                return genotype_subset(m, std::move(indexes), false,
+                                       nthreads);
+            },
+            py::arg("samples"), py::arg("nthreads") = 1)
         //.def_buffer([](Sequence::VariantMatrix &m) -> py::buffer_info {
         //    return py::buffer_info(
         //        m.data(),            /* Pointer to buffer */
@@ -605,37 +1332,27 @@ init_VariantMatrix(py::module &m)
                const double end) {
                 return Sequence::make_window(m, beg, end);
             },
-            py::arg("beg"), py::arg("end"))
+            py::arg("beg"), py::arg("end"), py::call_guard<py::gil_scoped_release>())
         .def(
             "slice",
             [](const Sequence::VariantMatrix &m, const double beg,
                const double end, const std::size_t i, const std::size_t j) {
                 return Sequence::make_slice(m, beg, end, i, j);
             },
-            py::arg("beg"), py::arg("end"), py::arg("i"), py::arg("j"))
-        .def(py::pickle(
-            [](const Sequence::VariantMatrix &m) {
-                std::vector<std::int8_t> temp(
-                    m.data(), m.data() + m.nsites() * m.nsam());
-                std::vector<double> ptemp(m.pbegin(), m.pend());
-                return py::make_tuple(std::move(temp), std::move(ptemp));
-            },
-            [](py::tuple t) {
-                if (t.size() != 2)
-                    {
-                        throw std::runtime_error("invalid object state");
-                    }
-                auto d = t[0].cast<std::vector<std::int8_t>>();
-                auto p = t[1].cast<std::vector<double>>();
-                return Sequence::VariantMatrix(std::move(d), std::move(p));
-            }));
+            py::arg("beg"), py::arg("end"), py::arg("i"), py::arg("j"),
+            py::call_guard<py::gil_scoped_release>())
+        .def(py::pickle(&variant_matrix_state, &variant_matrix_from_state));
 
-    py::class_<Sequence::ConstColView>(m, "ConstColView",
+    py::class_<Sequence::ConstColView>(m, "ConstColView", py::buffer_protocol(),
                                        R"delim(
             Immutable view of a VariantMatrix column.
 
             See :ref:`variantmatrix`.
             )delim")
+        .def("numpy", &view_numpy<Sequence::ConstColView>,
+             "Return a read-only numpy array sharing the data of this "
+             "view.\n\n.. versionadded:: 0.2.4")
+        .def_buffer(&view_buffer<Sequence::ConstColView, true>)
         .def("__len__",
              [](const Sequence::ConstColView &c) { return c.size(); })
         .def(
@@ -656,12 +1373,16 @@ init_VariantMatrix(py::module &m)
             },
             "Return contents as a list.");
 
-    py::class_<Sequence::ColView>(m, "ColView",
+    py::class_<Sequence::ColView>(m, "ColView", py::buffer_protocol(),
                                   R"delim(
         View of a VariantMatrix column.
 
         See :ref:`variantmatrix`
         )delim")
+        .def("numpy", &view_numpy<Sequence::ColView>,
+             "Return a read-only numpy array sharing the data of this "
+             "view.\n\n.. versionadded:: 0.2.4")
+        .def_buffer(&view_buffer<Sequence::ColView, false>)
         .def("__len__", [](const Sequence::ColView &c) { return c.size(); })
         .def(
             "__iter__",
@@ -681,12 +1402,16 @@ init_VariantMatrix(py::module &m)
             },
             "Return contents as a list.");
 
-    py::class_<Sequence::ConstRowView>(m, "ConstRowView",
+    py::class_<Sequence::ConstRowView>(m, "ConstRowView", py::buffer_protocol(),
                                        R"delim(
         Immutable view of a sample.
 
         See :ref:`variantmatrix`.
         )delim")
+        .def("numpy", &view_numpy<Sequence::ConstRowView>,
+             "Return a read-only numpy array sharing the data of this "
+             "view.\n\n.. versionadded:: 0.2.4")
+        .def_buffer(&view_buffer<Sequence::ConstRowView, true>)
         .def("__len__",
              [](const Sequence::ConstRowView &r) { return r.size(); })
         .def(
@@ -707,12 +1432,16 @@ init_VariantMatrix(py::module &m)
             },
             "Return contents as a list.");
 
-    py::class_<Sequence::RowView>(m, "RowView",
+    py::class_<Sequence::RowView>(m, "RowView", py::buffer_protocol(),
                                   R"delim(
         View of a sample in a VariantMatrix.
 
         See :ref:`variantmatrix`.
         )delim")
+        .def("numpy", &view_numpy<Sequence::RowView>,
+             "Return a read-only numpy array sharing the data of this "
+             "view.\n\n.. versionadded:: 0.2.4")
+        .def_buffer(&view_buffer<Sequence::RowView, false>)
         .def("__len__", [](const Sequence::RowView &r) { return r.size(); })
         .def(
             "__iter__",
@@ -781,19 +1510,22 @@ init_VariantMatrix(py::module &m)
         [](const Sequence::VariantMatrix &m, py::object refstates) {
             if (refstates.is_none())
                 {
+                    py::gil_scoped_release release;
                     return Sequence::process_variable_sites(m);
                 }
             try
                 {
                     py::int_ rs(refstates);
-                    return Sequence::process_variable_sites(
-                        m, rs.cast<std::int8_t>());
+                    auto refstate = rs.cast<std::int8_t>();
+                    py::gil_scoped_release release;
+                    return Sequence::process_variable_sites(m, refstate);
                 }
             catch (...)
                 {
                 }
-            return Sequence::process_variable_sites(
-                m, refstates.cast<std::vector<std::int8_t>>());
+            auto refstates_vector = refstates.cast<std::vector<std::int8_t>>();
+            py::gil_scoped_release release;
+            return Sequence::process_variable_sites(m, refstates_vector);
         },
         py::arg("m"), py::arg("refstates") = nullptr,
         R"delim(
@@ -806,7 +1538,64 @@ init_VariantMatrix(py::module &m)
           :return: list of :class:`libsequence.variant_matrix.StateCounts`
           :type: list
 
-          See :ref:`variantmatrix` for examples.
+          See :ref:`variantmatrix` for examples.  For large data,
+          :func:`libsequence.state_count_matrix` is faster.
+          )delim");
+
+    m.def(
+        "state_count_matrix",
+        [](const Sequence::VariantMatrix &m, py::object refstates,
+           const unsigned nthreads) {
+            auto rs = ancestral_states_from_object(refstates, m.nsites());
+            const std::size_t nrs = static_cast<std::size_t>(rs.size());
+            std::size_t ncol = 0;
+            {
+                py::gil_scoped_release release;
+                ncol = static_cast<std::size_t>(
+                    max_state(m.cdata(), m.nsites() * m.nsam(), nthreads) + 1);
+            }
+            py::array_t<std::int32_t> counts(
+                std::vector<std::size_t>{ m.nsites(), ncol });
+            py::array_t<std::int8_t> ref(m.nsites());
+            auto c = counts.mutable_data();
+            auto r = ref.mutable_data();
+            py::gil_scoped_release release;
+            count_states(m.cdata(), m.nsites(), m.nsam(), ncol, nthreads, c);
+            for (std::size_t i = 0; i < m.nsites(); ++i)
+                {
+                    r[i] = nrs == 0 ? Sequence::VariantMatrix::mask
+                                    : rs.data()[nrs == 1 ? 0 : i];
+                }
+            return py::make_tuple(std::move(counts), std::move(ref));
+        },
+        py::arg("m"), py::arg("refstates") = nullptr, py::arg("nthreads") = 1,
+        R"delim(
+          Obtain state counts for all sites as numpy arrays
+
+          :param m: data
+          :type m: :class:`libsequence.VariantMatrix`
+          :param refstates: (None) The reference state, or an array of reference states for each site.
+          :param nthreads: (1) Number of threads to use.  If 0, use all available cores.
+          :type nthreads: int
+          :return: The counts and the reference states
+          :rtype: tuple
+
+          This is an alternative to :func:`libsequence.process_variable_sites`
+          that avoids creating one object per site.  The counts are an
+          array of shape (m.nsites, k), where k is one more than the largest
+          state in m.  Row i contains the number of samples with each state
+          at site i, so that the row sums are the sample sizes excluding
+          missing data.  The reference states are an int8 array with
+          one value per site, which is
+          :attr:`libsequence.VariantMatrix.mask` when refstates is None.
+          Blocks of sites are counted in parallel.
+
+          .. versionadded:: 0.2.4
+
+          >>> import libsequence
+          >>> import numpy as np
+          >>> m = libsequence.VariantMatrix(np.array([[0, 1, 1], [0, 2, -1]], dtype=np.int8), [0.1, 0.2])
+          >>> counts, refstates = libsequence.state_count_matrix(m, refstates=np.array([0, 1]))
           )delim");
 
     //m.def("process_variable_sites",
@@ -850,6 +1639,12 @@ init_VariantMatrix(py::module &m)
                 created from a numpy array, its internal state
                 is changed to be based on C++ vectors, meaning
                 that a copy happened internally.
+
+            .. note::
+
+                The function is called once per row or column.  For
+                large data, :func:`libsequence.site_mask` and
+                :func:`libsequence.VariantMatrix.select` are much faster.
             )delim",
         py::arg("m"), py::arg("f"));
 
@@ -888,9 +1683,70 @@ init_VariantMatrix(py::module &m)
                 created from a numpy array, its internal state
                 is changed to be based on C++ vectors, meaning
                 that a copy happened internally.
+
+            .. note::
+
+                The function is called once per row or column.  For
+                large data, :func:`libsequence.site_mask` and
+                :func:`libsequence.VariantMatrix.select` are much faster.
             )delim",
         py::arg("m"), py::arg("f"));
 
+    m.def(
+        "site_mask",
+        [](const Sequence::VariantMatrix &m, const double min_maf,
+           const double max_maf, const double max_missing,
+           const bool biallelic, py::object start, py::object stop,
+           const unsigned nthreads) {
+            SiteFilter filter;
+            filter.min_maf = min_maf;
+            filter.max_maf = max_maf;
+            filter.max_missing = max_missing;
+            filter.biallelic = biallelic;
+            if (!start.is_none())
+                {
+                    filter.start = start.cast<double>();
+                }
+            if (!stop.is_none())
+                {
+                    filter.stop = stop.cast<double>();
+                }
+            py::array_t<bool> rv(m.nsites());
+            auto keep = rv.mutable_data();
+            py::gil_scoped_release release;
+            site_filter_mask(m.cdata(), m.pbegin(), m.nsites(), m.nsam(),
+                             filter, nthreads, keep);
+            return rv;
+        },
+        py::arg("m"), py::arg("min_maf") = 0.0, py::arg("max_maf") = 1.0,
+        py::arg("max_missing") = 1.0, py::arg("biallelic") = false,
+        py::arg("start") = nullptr, py::arg("stop") = nullptr,
+        py::arg("nthreads") = 1,
+        R"delim(
+        Return a boolean mask of the sites passing built-in filters.
+
+        :param m: A variant matrix
+        :type m: :class:`libsequence.VariantMatrix`
+        :param min_maf: (0.0) Minimum minor allele frequency.
+        :param max_maf: (1.0) Maximum minor allele frequency.
+        :param max_missing: (1.0) Maximum fraction of samples with missing data.
+        :param biallelic: (False) If True, remove sites with more than two states.
+        :param start: (None) Minimum position.
+        :param stop: (None) Maximum position.
+        :param nthreads: (1) Number of threads to use.  If 0, use all available cores.
+        :rtype: numpy.ndarray
+
+        An element of the mask is True if the site passes all
+        filters.  The minor allele frequency of a site is that of its
+        second most common state, among samples without missing data.
+        Positions are compared inclusively, as for
+        :func:`libsequence.VariantMatrix.window`.  Masks may be
+        combined with numpy and applied with
+        :func:`libsequence.VariantMatrix.select`.
+
+        .. versionadded:: 0.2.4
+        )delim");
+
     // Various I/O for VariantMatrix in "ms" format
     m.def("ms_from_stdin", []() -> py::object {
         if (std::cin.eof())
@@ -914,4 +1770,14 @@ init_VariantMatrix(py::module &m)
                 new NumpyPositionCapsule(pos));
             return MockVM(std::move(dp), std::move(pp));
         }));
+
+    py::class_<TreeSequenceChunks>(
+        m, "TreeSequenceChunks",
+        "Iterator over chunks of a tree sequence.  See "
+        ":func:`libsequence.VariantMatrix.from_TreeSequence_chunks`.")
+        .def("__iter__",
+             [](TreeSequenceChunks &self) -> TreeSequenceChunks & {
+                 return self;
+             })
+        .def("__next__", &TreeSequenceChunks::next);
 }
@@ -0,0 +1,203 @@
+#ifndef PYLIBSEQ_VARIANT_MATRIX_FILE_HPP
+#define PYLIBSEQ_VARIANT_MATRIX_FILE_HPP
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+
+// A binary file format for a VariantMatrix that may be
+// memory-mapped, so that opening a file costs O(1) and
+// pages are read on demand.  All integers are in the byte
+// order of the machine that wrote the file, which is
+// checked when the file is opened.
+//
+// Offset  Type        Content
+// 0       char[8]     "LSEQVMF\0"
+// 8       uint32      0x01020304, the byte order mark
+// 12      uint32      format version (1)
+// 16      uint64      number of sites
+// 24      uint64      number of samples
+// 32      uint64      offset of the positions
+// 40      uint64      offset of the genotypes
+// 48      int8        maximum allelic state
+// 49-63               zero
+//
+// The positions are nsites doubles, starting at byte 64.
+// The genotypes are row-major nsites x nsam int8 values,
+// starting at the next multiple of the page alignment.
+
+struct VariantMatrixFileHeader
+{
+    std::uint64_t nsites, nsam, positions_offset, genotypes_offset;
+    std::int8_t max_allele;
+};
+
+namespace vmfile_detail
+{
+    constexpr char magic[8] = { 'L', 'S', 'E', 'Q', 'V', 'M', 'F', '\0' };
+    constexpr std::uint32_t byte_order_mark = 0x01020304;
+    constexpr std::uint32_t version = 1;
+    constexpr std::size_t header_size = 64;
+    constexpr std::uint64_t alignment = 4096;
+
+    template <typename T>
+    inline T
+    read_field(const char *data, const std::size_t offset)
+    {
+        T rv;
+        std::memcpy(&rv, data + offset, sizeof(T));
+        return rv;
+    }
+
+    template <typename T>
+    inline void
+    write_field(char *data, const std::size_t offset, const T value)
+    {
+        std::memcpy(data + offset, &value, sizeof(T));
+    }
+
+    // Create a new file in the directory of path, with the
+    // permissions that fopen would give it, and return a
+    // stream for it and its name.
+    inline std::FILE *
+    create_temporary_file(const std::string &path, std::string &name)
+    {
+        static std::atomic<unsigned> counter(0);
+        for (;;)
+            {
+                name = path + ".tmp" + std::to_string(getpid()) + "."
+                       + std::to_string(counter++);
+                const int fd
+                    = open(name.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666);
+                if (fd >= 0)
+                    {
+                        std::FILE *f = fdopen(fd, "wb");
+                        if (f == nullptr)
+                            {
+                                const int error = errno;
+                                close(fd);
+                                std::remove(name.c_str());
+                                errno = error;
+                            }
+                        return f;
+                    }
+                if (errno != EEXIST)
+                    {
+                        return nullptr;
+                    }
+            }
+    }
+} // namespace vmfile_detail
+
+inline VariantMatrixFileHeader
+variant_matrix_file_layout(const std::size_t nsites, const std::size_t nsam,
+                           const std::int8_t max_allele)
+{
+    using namespace vmfile_detail;
+    const std::uint64_t positions_end
+        = header_size + sizeof(double) * static_cast<std::uint64_t>(nsites);
+    const std::uint64_t genotypes_offset
+        = (positions_end + alignment - 1) / alignment * alignment;
+    return VariantMatrixFileHeader{ nsites, nsam, header_size,
+                                    genotypes_offset, max_allele };
+}
+
+// Validate the header of a file of size bytes, including
+// that the data blocks lie within the file.
+inline VariantMatrixFileHeader
+read_variant_matrix_file_header(const char *data, const std::size_t size)
+{
+    using namespace vmfile_detail;
+    if (size < header_size || std::memcmp(data, magic, sizeof(magic)) != 0)
+        {
+            throw std::invalid_argument("not a VariantMatrix file");
+        }
+    if (read_field<std::uint32_t>(data, 8) != byte_order_mark)
+        {
+            throw std::invalid_argument(
+                "VariantMatrix file was written with a different byte "
+                "order");
+        }
+    if (read_field<std::uint32_t>(data, 12) != version)
+        {
+            throw std::invalid_argument(
+                "unsupported VariantMatrix file version");
+        }
+    VariantMatrixFileHeader h;
+    h.nsites = read_field<std::uint64_t>(data, 16);
+    h.nsam = read_field<std::uint64_t>(data, 24);
+    h.positions_offset = read_field<std::uint64_t>(data, 32);
+    h.genotypes_offset = read_field<std::uint64_t>(data, 40);
+    h.max_allele = read_field<std::int8_t>(data, 48);
+    const std::uint64_t max = std::numeric_limits<std::uint64_t>::max();
+    if (h.positions_offset % sizeof(double) != 0
+        || h.positions_offset > size
+        || h.nsites > (size - h.positions_offset) / sizeof(double)
+        || h.genotypes_offset > size
+        || (h.nsam > 0 && h.nsites > max / h.nsam)
+        || h.nsites * h.nsam > size - h.genotypes_offset)
+        {
+            throw std::invalid_argument("VariantMatrix file is truncated");
+        }
+    return h;
+}
+
+// Write a file, replacing any existing file at path.  The
+// data are written to a new file that is then renamed to
+// path, so that a file mapped by a VariantMatrix, which may
+// be the source of the data, is never truncated.
+inline void
+write_variant_matrix_file(const std::string &path,
+                          const std::int8_t *genotypes,
+                          const double *positions, const std::size_t nsites,
+                          const std::size_t nsam)
+{
+    using namespace vmfile_detail;
+    std::int8_t max_allele = -1;
+    for (std::size_t i = 0; i < nsites * nsam; ++i)
+        {
+            max_allele = genotypes[i] > max_allele ? genotypes[i] : max_allele;
+        }
+    const auto h = variant_matrix_file_layout(nsites, nsam, max_allele);
+    char header[header_size] = {};
+    std::memcpy(header, magic, sizeof(magic));
+    write_field(header, 8, byte_order_mark);
+    write_field(header, 12, version);
+    write_field(header, 16, h.nsites);
+    write_field(header, 24, h.nsam);
+    write_field(header, 32, h.positions_offset);
+    write_field(header, 40, h.genotypes_offset);
+    write_field(header, 48, h.max_allele);
+    std::string tmpname;
+    std::FILE *f = create_temporary_file(path, tmpname);
+    if (f == nullptr)
+        {
+            throw std::runtime_error("could not open " + path
+                                     + " for writing: "
+                                     + std::strerror(errno));
+        }
+    const std::size_t padding = static_cast<std::size_t>(
+        h.genotypes_offset - h.positions_offset - sizeof(double) * nsites);
+    const char zeros[alignment] = {};
+    const bool ok
+        = std::fwrite(header, 1, header_size, f) == header_size
+          && std::fwrite(positions, sizeof(double), nsites, f) == nsites
+          && std::fwrite(zeros, 1, padding, f) == padding
+          && std::fwrite(genotypes, 1, nsites * nsam, f) == nsites * nsam;
+    if (std::fclose(f) != 0 || !ok
+        || std::rename(tmpname.c_str(), path.c_str()) != 0)
+        {
+            std::remove(tmpname.c_str());
+            throw std::runtime_error("error writing " + path);
+        }
+}
+
+#endif
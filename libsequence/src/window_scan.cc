@@ -0,0 +1,239 @@
+#include <array>
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <pybind11/stl.h>
+#include <Sequence/VariantMatrix.hpp>
+#include "genomic_windows.hpp"
+#include "haplotype_windows.hpp"
+#include "numpy_helpers.hpp"
+#include "parallel.hpp"
+#include "summstats_kernels.hpp"
+
+namespace py = pybind11;
+
+namespace
+{
+    // Element i of the return value is the sum of the
+    // contributions of sites [0, i).
+    std::vector<SiteSums>
+    site_prefix_sums(const Sequence::VariantMatrix &vm,
+                     const std::int8_t *refstates,
+                     const std::size_t nrefstates, const HarmonicSums &h,
+                     const unsigned nthreads)
+    {
+        const std::size_t nsites = vm.nsites(), nsam = vm.nsam();
+        const std::int8_t *data = vm.cdata();
+        std::vector<SiteSums> prefix(nsites + 1);
+        parallel_for(
+            nsites, nthreads, default_grain_size(nsites, nthreads, 1024),
+            [&](const std::size_t begin, const std::size_t end) {
+                std::array<std::int32_t, 128> scratch;
+                scratch.fill(0);
+                for (std::size_t i = begin; i < end; ++i)
+                    {
+                        accumulate_genotypes(
+                            data + i * nsam, nsam,
+                            refstate_at(refstates, nrefstates, i), h,
+                            scratch.data(), prefix[i + 1]);
+                    }
+            });
+        for (std::size_t i = 1; i < prefix.size(); ++i)
+            {
+                prefix[i] += prefix[i - 1];
+            }
+        return prefix;
+    }
+
+    double
+    default_stop(const Sequence::VariantMatrix &vm, const double start,
+                 py::object stop)
+    {
+        if (!stop.is_none())
+            {
+                return stop.cast<double>();
+            }
+        return vm.nsites() ? *(vm.pend() - 1) : start;
+    }
+} // namespace
+
+void
+init_window_scan(py::module &m)
+{
+    m.def(
+        "windowed_statistics",
+        [](const Sequence::VariantMatrix &vm, const double window_size,
+           const double step, py::object stats, py::object ancestral_states,
+           const double start, py::object stop, const unsigned nthreads) {
+            auto refstates
+                = ancestral_states_from_object(ancestral_states, vm.nsites());
+            auto statlist = summary_statistics_from_names(
+                stats.is_none() ? std::vector<std::string>()
+                                : stats.cast<std::vector<std::string>>(),
+                refstates.size() > 0);
+            const double stop_value = default_stop(vm, start, stop);
+
+            const std::size_t nfields = statlist.size() + 2;
+            std::vector<double> values;
+            std::size_t nwindows = 0;
+            {
+                py::gil_scoped_release release;
+                auto windows = make_genomic_windows(
+                    vm.pbegin(), vm.nsites(), window_size, step, start,
+                    stop_value);
+                nwindows = windows.size();
+                const auto h = shared_harmonic_sums(vm.nsam());
+                auto prefix = site_prefix_sums(
+                    vm, refstates.data(),
+                    static_cast<std::size_t>(refstates.size()), *h, nthreads);
+                values.resize(nwindows * nfields);
+                parallel_for(
+                    nwindows, nthreads,
+                    default_grain_size(nwindows, nthreads, 256),
+                    [&](const std::size_t begin, const std::size_t end) {
+                        for (std::size_t w = begin; w < end; ++w)
+                            {
+                                double *output = values.data() + w * nfields;
+                                output[0] = windows[w].left;
+                                output[1] = windows[w].right;
+                                summary_statistic_values(
+                                    statlist,
+                                    prefix[windows[w].last]
+                                        - prefix[windows[w].first],
+                                    output + 2);
+                            }
+                    });
+            }
+            std::vector<std::string> names{ "start", "stop" };
+            std::vector<bool> is_integer{ false, false };
+            for (auto s : statlist)
+                {
+                    names.push_back(summary_statistic_name(s));
+                    is_integer.push_back(summary_statistic_is_integer(s));
+                }
+            return make_structured_array(names, is_integer, values,
+                                         nwindows);
+        },
+        R"delim(
+            Calculate summary statistics in sliding windows along
+            a VariantMatrix.
+
+            :param vm: A :class:`libsequence.VariantMatrix`
+            :param window_size: The length of each window
+            :param step: The distance between the left edges of adjacent windows
+            :param stats: (None) A list of statistic names.
+            :param ancestral_states: (None) The ancestral state, or a list of ancestral states for each site.
+            :param start: (0.0) The left edge of the first window.
+            :param stop: (None) The largest possible left edge of a window.  If None, the last position in vm is used.
+            :param nthreads: (1) Number of threads to use.  If 0, use all available cores.
+
+            :rtype: numpy.ndarray
+
+            The return value is a structured array with one record per window.
+            The fields are start, stop, and the requested statistics.
+            The names of statistics, and the default set of statistics,
+            are the same as for :func:`libsequence.summary_statistics`.
+
+            A window includes the sites whose positions are >= start
+            and < stop.
+
+            The left edge of window k is start + k * step, in floating
+            point, and windows are made for every left edge <= stop.
+            Decimal fractions are not exact in binary, so that 19 * 0.05
+            is slightly greater than 0.95.  To include a left edge that
+            is a decimal multiple of step, pass a slightly larger stop.
+
+            Each site is processed once, and the statistics for each
+            window are obtained as differences of cumulative sums over
+            sites. Thus, the run time is nearly independent of the window
+            size and step.
+
+            .. versionadded:: 0.2.4
+
+            >>> import msprime
+            >>> import libsequence
+            >>> ts = msprime.simulate(10, mutation_rate=10, random_seed=42)
+            >>> vm = libsequence.VariantMatrix.from_TreeSequence(ts)
+            >>> w = libsequence.windowed_statistics(vm, 0.1, 0.05, ["thetapi", "tajd"])
+            )delim",
+        py::arg("vm"), py::arg("window_size"), py::arg("step"),
+        py::arg("stats") = nullptr, py::arg("ancestral_states") = nullptr,
+        py::arg("start") = 0.0, py::arg("stop") = nullptr,
+        py::arg("nthreads") = 1);
+
+    m.def(
+        "windowed_haplotype_statistics",
+        [](const Sequence::VariantMatrix &vm, const double window_size,
+           const double step, const double start, py::object stop,
+           const unsigned nthreads) {
+            const double stop_value = default_stop(vm, start, stop);
+            std::vector<double> values;
+            std::size_t nwindows = 0;
+            {
+                py::gil_scoped_release release;
+                auto windows = make_genomic_windows(
+                    vm.pbegin(), vm.nsites(), window_size, step, start,
+                    stop_value);
+                nwindows = windows.size();
+                auto stats = windowed_haplotype_statistics(
+                    vm.cdata(), vm.nsam(), windows, nthreads);
+                values.reserve(8 * nwindows);
+                for (std::size_t w = 0; w < nwindows; ++w)
+                    {
+                        values.push_back(windows[w].left);
+                        values.push_back(windows[w].right);
+                        values.push_back(static_cast<double>(stats[w].nsam));
+                        values.push_back(static_cast<double>(stats[w].nhaps));
+                        values.push_back(stats[w].diversity);
+                        values.push_back(stats[w].H1);
+                        values.push_back(stats[w].H12);
+                        values.push_back(stats[w].H2H1);
+                    }
+            }
+            return make_structured_array(
+                { "start", "stop", "nsam", "nhaps", "diversity", "H1", "H12",
+                  "H2H1" },
+                { false, false, true, true, false, false, false, false },
+                values, nwindows);
+        },
+        R"delim(
+            Calculate haplotype statistics in sliding windows along
+            a VariantMatrix.
+
+            :param vm: A :class:`libsequence.VariantMatrix`
+            :param window_size: The length of each window
+            :param step: The distance between the left edges of adjacent windows
+            :param start: (0.0) The left edge of the first window.
+            :param stop: (None) The largest possible left edge of a window.  If None, the last position in vm is used.
+            :param nthreads: (1) Number of threads to use.  If 0, use all available cores.
+
+            :rtype: numpy.ndarray
+
+            The return value is a structured array with one record per
+            window, with fields start, stop, nsam, nhaps, diversity, H1,
+            H12, and H2H1.  Windows are defined as for
+            :func:`libsequence.windowed_statistics`.
+
+            Samples with missing data in a window are excluded from that
+            window, and nsam is the number of remaining samples.  nhaps
+            is the number of distinct haplotypes, and diversity is the
+            haplotype diversity of :cite:`Depaulis1998-ol`.  H1, H12, and
+            H2H1 are the statistics of :cite:`Garud2015-ob`, calculated
+            from haplotype frequencies.
+
+            Haplotypes are identified by exact integer labels that are
+            extended one site at a time as windows advance, rather than
+            recomputed for each window.  Thus, the run time is nearly
+            independent of the window size and step.
+
+            .. versionadded:: 0.2.4
+
+            >>> import msprime
+            >>> import libsequence
+            >>> ts = msprime.simulate(10, mutation_rate=10, random_seed=42)
+            >>> vm = libsequence.VariantMatrix.from_TreeSequence(ts)
+            >>> w = libsequence.windowed_haplotype_statistics(vm, 0.1, 0.05)
+            )delim",
+        py::arg("vm"), py::arg("window_size"), py::arg("step"),
+        py::arg("start") = 0.0, py::arg("stop") = nullptr,
+        py::arg("nthreads") = 1);
+}
@@ -1,10 +1,174 @@
+#include <mutex>
+#include <string>
 #include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <pybind11/stl.h>
 #include <Sequence/SimData.hpp>
 #include <Sequence/PolySites.hpp>
 #include <Sequence/PolyTableSlice.hpp>
+#include "numpy_helpers.hpp"
+#include "polytable_windows.hpp"
 
 namespace py = pybind11;
 
+namespace
+{
+    // Sliding windows over a PolyTable, which is kept alive
+    // by this object.  Windows are copied out of the table
+    // only when requested.
+    class PolyTableWindows
+    {
+      private:
+        py::object table_;
+        std::vector<double> positions_;
+        bool is_simdata_;
+        std::mutex prefix_mutex_;
+        std::vector<SiteSums> prefix_;
+
+        // The table, checked for changes to its number of
+        // sites since the windows were made.
+        const Sequence::PolyTable &
+        table() const
+        {
+            const auto &pt = table_.cast<const Sequence::PolyTable &>();
+            if (pt.numsites() != positions_.size())
+                {
+                    throw std::runtime_error(
+                        "PolyTable was modified after creating windows");
+                }
+            return pt;
+        }
+
+      public:
+        std::vector<GenomicWindow> windows;
+
+        PolyTableWindows(py::object pt, const double window_size,
+                         const double step_len, const double starting_pos,
+                         const double ending_pos)
+            : table_(pt),
+              positions_(pt.cast<const Sequence::PolyTable &>().GetPositions()),
+              is_simdata_(py::isinstance<Sequence::SimData>(pt)),
+              prefix_mutex_(), prefix_(),
+              windows(make_polytable_windows(positions_.data(),
+                                             positions_.size(), window_size,
+                                             step_len, starting_pos,
+                                             ending_pos))
+        {
+        }
+
+        const GenomicWindow &
+        at(std::ptrdiff_t i) const
+        {
+            if (i < 0)
+                {
+                    i += static_cast<std::ptrdiff_t>(windows.size());
+                }
+            if (i < 0 || static_cast<std::size_t>(i) >= windows.size())
+                {
+                    throw py::index_error("window index out of range");
+                }
+            return windows[static_cast<std::size_t>(i)];
+        }
+
+        // A SimData or PolySites, matching the type of
+        // the table, containing the sites of window i.
+        py::object
+        materialize(const std::ptrdiff_t i) const
+        {
+            const auto &w = at(i);
+            const auto &pt = table();
+            if (w.first == w.last)
+                {
+                    return is_simdata_ ? py::cast(Sequence::SimData())
+                                       : py::cast(Sequence::PolySites());
+                }
+            std::vector<double> pos(positions_.begin() + w.first,
+                                    positions_.begin() + w.last);
+            std::vector<std::string> data;
+            data.reserve(pt.size());
+            for (std::size_t j = 0; j < pt.size(); ++j)
+                {
+                    data.push_back(pt[j].substr(w.first, w.last - w.first));
+                }
+            if (is_simdata_)
+                {
+                    return py::cast(
+                        Sequence::SimData(std::move(pos), std::move(data)));
+                }
+            return py::cast(
+                Sequence::PolySites(std::move(pos), std::move(data)));
+        }
+
+        // Cumulative sums over the sites of the table, made
+        // once and shared by all windows.  0 is the ancestral
+        // state of SimData, and ancestral states are unknown
+        // for PolySites.
+        const std::vector<SiteSums> &
+        prefix_sums(const unsigned nthreads)
+        {
+            const auto &pt = table();
+            std::vector<const char *> haplotypes;
+            for (std::size_t j = 0; j < pt.size(); ++j)
+                {
+                    if (pt[j].size() != positions_.size())
+                        {
+                            throw std::invalid_argument(
+                                "all haplotypes must have one character "
+                                "per site");
+                        }
+                    haplotypes.push_back(pt[j].c_str());
+                }
+            py::gil_scoped_release release;
+            std::lock_guard<std::mutex> lock(prefix_mutex_);
+            if (prefix_.empty())
+                {
+                    prefix_ = polytable_prefix_sums(
+                        haplotypes, positions_.size(),
+                        polytable_state_table(), is_simdata_ ? 0 : -1,
+                        *shared_harmonic_sums(haplotypes.size()), nthreads);
+                }
+            return prefix_;
+        }
+
+        py::array
+        summary_statistics(py::object stats, py::object indexes,
+                           const unsigned nthreads)
+        {
+            auto statlist = summary_statistics_from_names(
+                stats.is_none() ? std::vector<std::string>()
+                                : stats.cast<std::vector<std::string>>(),
+                is_simdata_);
+            const auto selected
+                = site_indexes_from_object(indexes, windows.size());
+            const std::size_t nfields = statlist.size() + 2;
+            const auto &prefix = prefix_sums(nthreads);
+            std::vector<double> values(selected.size() * nfields);
+            {
+                py::gil_scoped_release release;
+                for (std::size_t k = 0; k < selected.size(); ++k)
+                    {
+                        const auto &w = windows[selected[k]];
+                        double *output = values.data() + k * nfields;
+                        output[0] = w.left;
+                        output[1] = w.right;
+                        summary_statistic_values(
+                            statlist, prefix[w.last] - prefix[w.first],
+                            output + 2);
+                    }
+            }
+            std::vector<std::string> names{ "start", "stop" };
+            std::vector<bool> is_integer{ false, false };
+            for (auto s : statlist)
+                {
+                    names.push_back(summary_statistic_name(s));
+                    is_integer.push_back(summary_statistic_is_integer(s));
+                }
+            return make_structured_array(names, is_integer, values,
+                                         selected.size());
+        }
+    };
+} // namespace
+
 void init_windows(py::module & m)
 {
     using SimDataWindows = Sequence::PolyTableSlice<Sequence::SimData>;
@@ -25,4 +189,76 @@ void init_windows(py::module & m)
 
     MAKE_WINDOWS_BACKEND(SimDataWindows, "SimDataWindows")
     MAKE_WINDOWS_BACKEND(PolySitesWindows, "PolySitesWindows")
+
+    py::class_<GenomicWindow>(m, "PolyTableWindow",
+                              "The range of sites of one window of a "
+                              ":class:`libsequence.PolyTableWindows`.")
+        .def_readonly("left", &GenomicWindow::left,
+                      "Left edge of the window")
+        .def_readonly("right", &GenomicWindow::right,
+                      "Right edge of the window, which is included")
+        .def_readonly("first", &GenomicWindow::first,
+                      "Index of the first site in the window")
+        .def_readonly("last", &GenomicWindow::last,
+                      "One past the index of the last site in the window")
+        .def_property_readonly(
+            "nsites", [](const GenomicWindow &w) { return w.last - w.first; })
+        .def("__repr__", [](const GenomicWindow &w) {
+            return "PolyTableWindow(left=" + std::to_string(w.left)
+                   + ", right=" + std::to_string(w.right)
+                   + ", first=" + std::to_string(w.first)
+                   + ", last=" + std::to_string(w.last) + ")";
+        });
+
+    py::class_<PolyTableWindows>(m, "PolyTableWindows",
+                                 R"delim(
+        Sliding windows over a :class:`libsequence.PolyTable`.
+
+        Windows are stored as ranges of site indexes into the
+        table, which is kept alive by this object and should not
+        be modified while it is in use.  The data of a window are
+        copied only when it is indexed.  The windows are
+        the same as those of :class:`libsequence.Windows`.
+
+        .. versionadded:: 0.2.4
+        )delim")
+        .def(py::init<py::object, double, double, double, double>(),
+             py::arg("pt"), py::arg("window_size"), py::arg("step_len"),
+             py::arg("starting_pos") = 0., py::arg("ending_pos") = 1.)
+        .def("__len__",
+             [](const PolyTableWindows &w) { return w.windows.size(); })
+        .def("__getitem__", &PolyTableWindows::materialize,
+             "Return window i as a :class:`libsequence.SimData` or "
+             ":class:`libsequence.PolySites`, matching the type of "
+             "the table.")
+        .def("range", &PolyTableWindows::at, py::arg("i"),
+             "Return the :class:`libsequence.PolyTableWindow` describing "
+             "window i.")
+        .def_property_readonly(
+            "ranges",
+            [](const PolyTableWindows &w) { return w.windows; },
+            "A list of :class:`libsequence.PolyTableWindow`, one per window.")
+        .def("summary_statistics", &PolyTableWindows::summary_statistics,
+             py::arg("stats") = nullptr, py::arg("windows") = nullptr,
+             py::arg("nthreads") = 1,
+             R"delim(
+             Calculate summary statistics of windows without copying them.
+
+             :param stats: (None) A list of statistic names.
+             :param windows: (None) Indexes of the windows to use, in increasing order.  If None, use all windows.
+             :param nthreads: (1) Number of threads to use.  If 0, use all available cores.
+
+             :rtype: numpy.ndarray
+
+             The return value is a structured array with one record
+             per window, as for :func:`libsequence.windowed_statistics`.
+             For :class:`libsequence.SimData`, 0 is the ancestral state.
+             Statistics requiring ancestral states are not available
+             for :class:`libsequence.PolySites`.
+
+             The characters of the table are counted once, in blocks
+             of sites on several threads, the first time this method
+             is called.  Statistics for a window are then the
+             differences of cumulative sums over sites.
+             )delim");
 }
@@ -183,7 +183,7 @@ setup(
     data_files=[('pylibseq', ['COPYING', 'README.rst'])],
     long_description=long_desc,
     ext_modules=ext_modules,
-    install_requires=['pybind11>=2.2.3'],
+    install_requires=['pybind11>=2.4.0'],
     cmdclass={'build_ext': CMakeBuild},
     packages=PKGS,
     package_data=generated_package_data,
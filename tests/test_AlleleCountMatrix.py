@@ -41,10 +41,114 @@ class testAlleleCountMatrix(unittest.TestCase):
             for j, k in zip(r, rr):
                 self.assertEqual(j, k)
 
+    def testSliceView(self):
+        for s in [slice(3, 20), slice(1, None, 3), slice(None, None, -2)]:
+            v = self.ac.view(s)
+            self.assertTrue(v.is_strided)
+            self.assertEqual(len(v), len(np.array(self.ac)[s]))
+            self.assertTrue(np.array_equal(np.array(v),
+                                           np.array(self.ac)[s]))
+            self.assertTrue(np.array_equal(np.array(v.copy()),
+                                           np.array(self.ac)[s]))
+
+    def testIndexView(self):
+        indexes = [15, 1, 3, 4, 11]
+        v = self.ac.view(indexes)
+        self.assertFalse(v.is_strided)
+        self.assertTrue(np.array_equal(np.array(v),
+                                       np.array(self.ac)[indexes]))
+        vv = v[1:4]
+        self.assertTrue(np.array_equal(np.array(vv),
+                                       np.array(self.ac)[indexes[1:4]]))
+        with self.assertRaises(IndexError):
+            self.ac.view([self.ac.nrow])
+
+    def testViewOutlivesMatrix(self):
+        ac = libsequence.AlleleCountMatrix(self.vm)
+        v = ac.view(slice(0, None, 2))[[0, 1, 2]]
+        del ac
+        self.assertTrue(np.array_equal(np.array(v),
+                                       np.array(self.ac)[[0, 2, 4]]))
+
+    def testViewStatistics(self):
+        for rows in [slice(2, None, 3), [0, 5, 6, 1, self.ac.nrow - 1]]:
+            v = self.ac.view(rows)
+            c = v.copy()
+            self.assertAlmostEqual(libsequence.thetapi(v),
+                                   libsequence.thetapi(c))
+            self.assertAlmostEqual(libsequence.thetaw(v),
+                                   libsequence.thetaw(c))
+            self.assertAlmostEqual(libsequence.tajd(v),
+                                   libsequence.tajd(c))
+            self.assertEqual(libsequence.nvariable_sites(v),
+                             libsequence.nvariable_sites(c))
+            self.assertEqual(libsequence.nbiallelic_sites(v),
+                             libsequence.nbiallelic_sites(c))
+            self.assertEqual(libsequence.total_number_of_mutations(v),
+                             libsequence.total_number_of_mutations(c))
+            self.assertAlmostEqual(libsequence.faywuh(v, 0),
+                                   libsequence.faywuh(c, 0))
+            self.assertAlmostEqual(libsequence.hprime(v, 0),
+                                   libsequence.hprime(c, 0))
+            refstates = [i % 2 for i in range(v.nrow)]
+            self.assertAlmostEqual(libsequence.hprime(v, refstates),
+                                   libsequence.hprime(c, refstates))
+            sv = libsequence.summary_statistics(v, ancestral_states=0)
+            sc = libsequence.summary_statistics(c, ancestral_states=0)
+            for name in sc.dtype.names:
+                self.assertAlmostEqual(sv[name][0], sc[name][0])
+
+    def testPickle(self):
+        import pickle
+        for protocol in range(2, pickle.HIGHEST_PROTOCOL + 1):
+            ac = pickle.loads(pickle.dumps(self.ac, protocol))
+            self.assertEqual(ac.nsam, self.ac.nsam)
+            self.assertTrue(np.array_equal(np.array(ac), np.array(self.ac)))
+        if pickle.HIGHEST_PROTOCOL >= 5:
+            buffers = []
+            p = pickle.dumps(self.ac, 5, buffer_callback=buffers.append)
+            ac = pickle.loads(p, buffers=buffers)
+            self.assertTrue(np.array_equal(np.array(ac), np.array(self.ac)))
+
     def testFromTreeSequence(self):
         ac = libsequence.AlleleCountMatrix.from_tskit(self.ts)
         self.assertTrue(np.array_equal(np.array(ac), np.array(self.ac)))
 
+    def testFromTreeSequenceThreaded(self):
+        ts = msprime.simulate(50, mutation_rate=100, recombination_rate=10,
+                              random_seed=101)
+        vm = libsequence.VariantMatrix.from_TreeSequence(ts)
+        ac = libsequence.AlleleCountMatrix(vm)
+        for nthreads in [1, 3, 8]:
+            acts = libsequence.AlleleCountMatrix.from_tskit(
+                ts, nthreads=nthreads)
+            self.assertTrue(np.array_equal(np.array(acts), np.array(ac)))
+
+    def testFromTreeSequenceSampleSubset(self):
+        samples = [0, 2, 3, 7]
+        ac = libsequence.AlleleCountMatrix.from_tskit(self.ts,
+                                                      samples=samples)
+        self.assertEqual(ac.nsam, len(samples))
+        gm = self.ts.genotype_matrix()[:, samples]
+        counts = np.array(ac)
+        self.assertTrue(np.array_equal(counts[:, 1], gm.sum(axis=1)))
+        self.assertTrue(np.array_equal(counts.sum(axis=1),
+                                       np.repeat(len(samples), ac.nrow)))
+
+
+    def testFromTreeSequenceIsolatedSamples(self):
+        # An extra sample node without edges is isolated in every
+        # tree, and is missing data, as in the chunked decoder.
+        import tskit
+        tables = self.ts.dump_tables()
+        tables.nodes.add_row(flags=tskit.NODE_IS_SAMPLE, time=0)
+        ts = tables.tree_sequence()
+        ac = libsequence.AlleleCountMatrix.from_tskit(ts)
+        self.assertTrue(np.array_equal(np.array(ac), np.array(self.ac)))
+        for vm in libsequence.VariantMatrix.from_TreeSequence_chunks(ts):
+            self.assertTrue(np.all(np.array(vm.data)[:, -1] ==
+                                   libsequence.VariantMatrix.mask))
+
 
 if __name__ == "__main__":
     unittest.main()
@@ -0,0 +1,132 @@
+import os
+import sqlite3
+import tempfile
+import unittest
+import libsequence
+import numpy as np
+
+MS = b"""ms 3 3 -s 2
+1 2 3
+
+//
+segsites: 2
+positions: 0.1 0.5
+01
+10
+11
+
+//
+segsites: 0
+
+//
+segsites: 3
+positions: 0.2 0.3 0.4
+012
+110
+"""
+
+
+class testMsFormatReader(unittest.TestCase):
+    def check(self, reps):
+        self.assertEqual(len(reps), 3)
+        self.assertTrue(np.array_equal(
+            reps[0].data, np.array([[0, 1, 1], [1, 0, 1]])))
+        self.assertTrue(np.array_equal(reps[0].positions, [0.1, 0.5]))
+        self.assertEqual(reps[1].nsites, 0)
+        self.assertTrue(np.array_equal(
+            reps[2].data, np.array([[0, 1], [1, 1], [2, 0]])))
+        self.assertTrue(np.array_equal(reps[2].positions, [0.2, 0.3, 0.4]))
+
+    def testBytes(self):
+        r = libsequence.MsFormatReader(MS)
+        self.assertEqual(len(r), 3)
+        self.check([i for i in r])
+
+    def testFileAndDescriptor(self):
+        with tempfile.NamedTemporaryFile(suffix=".ms", delete=False) as f:
+            f.write(MS * 10)
+        try:
+            reps = [i for i in libsequence.MsFormatReader(
+                f.name, nthreads=4, batch_size=7)]
+            self.assertEqual(len(reps), 30)
+            self.check(reps[-3:])
+            fd = os.open(f.name, os.O_RDONLY)
+            try:
+                self.check([i for i in libsequence.MsFormatReader(fd)][:3])
+            finally:
+                os.close(fd)
+        finally:
+            os.remove(f.name)
+
+    def testMalformed(self):
+        bad = b"//\nsegsites: 2\npositions: 0.1 0.2\n011\n"
+        with self.assertRaises(ValueError):
+            [i for i in libsequence.MsFormatReader(bad)]
+
+    def testStatistics(self):
+        r = libsequence.MsFormatReader(MS * 5, nthreads=2, batch_size=4)
+        batches = []
+        while True:
+            b = r.next_statistics(garud=True)
+            if b is None:
+                break
+            batches.append(b)
+        self.assertEqual([len(b) for b in batches], [4, 4, 4, 3])
+        s = np.concatenate(batches)
+        self.assertTrue(np.array_equal(s['rep'], np.arange(15)))
+        self.assertEqual(s['S'][0], 2)
+        self.assertAlmostEqual(s['thetapi'][0], 4. / 3.)
+        self.assertAlmostEqual(s['thetaw'][0], 2. / 1.5)
+        self.assertEqual(s['singletons'][0], 2)
+        self.assertEqual(s['dsingletons'][0], 0)
+        self.assertAlmostEqual(s['H1'][0], 1. / 3.)
+        self.assertEqual(s['S'][1], 0)
+        self.assertTrue(np.isnan(s['tajd'][1]))
+        ac = libsequence.VariantMatrix(np.array([[0, 1], [1, 1], [2, 0]]),
+                                       [0.2, 0.3, 0.4]).count_alleles()
+        expected = libsequence.summary_statistics(ac, ["thetapi", "thetaw"])
+        self.assertAlmostEqual(s['thetapi'][2], expected['thetapi'][0])
+        self.assertAlmostEqual(s['thetaw'][2], expected['thetaw'][0])
+
+    def testMsstatsCLI(self):
+        from libsequence.msstats_cli import msstats_main
+        d = tempfile.mkdtemp()
+        infile = os.path.join(d, "in.ms")
+        outfile = os.path.join(d, "out.db")
+        with open(infile, 'wb') as f:
+            f.write(MS * 4)
+        msstats_main(["-i", infile, "-o", outfile, "-g", "-t", "2",
+                      "-b", "5"])
+        con = sqlite3.connect(outfile)
+        rows = con.execute("SELECT rep, S, H12 FROM stats").fetchall()
+        con.close()
+        self.assertEqual(len(rows), 12)
+        self.assertEqual(rows[3][:2], (3, 2))
+        os.remove(infile)
+        os.remove(outfile)
+        os.rmdir(d)
+
+    def testMsstatsBlocks(self):
+        import io
+        from libsequence.msstats_cli import read_replicate_blocks
+        from libsequence.msstats_cli import write_statistics
+        data = MS * 4
+        expected = libsequence.MsFormatReader(data).next_statistics(False)
+        for chunk_size in (1, 7, 40, len(data)):
+            blocks = list(read_replicate_blocks(io.BytesIO(data), chunk_size))
+            self.assertEqual(b''.join(blocks), data)
+            for b in blocks[1:]:
+                self.assertTrue(b.startswith(b'//'))
+            readers = (libsequence.MsFormatReader(b) for b in blocks)
+            con = sqlite3.connect(":memory:")
+            self.assertEqual(write_statistics(readers, con, False), 12)
+            rows = con.execute("SELECT rep, S, thetapi FROM stats").fetchall()
+            con.close()
+            self.assertEqual([r[0] for r in rows], list(range(12)))
+            self.assertEqual([r[1] for r in rows], expected['S'].tolist())
+            for r, pi in zip(rows, expected['thetapi']):
+                self.assertAlmostEqual(r[2], pi)
+
+
+if __name__ == "__main__":
+    unittest.main()
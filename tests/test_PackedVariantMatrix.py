@@ -0,0 +1,64 @@
+import unittest
+import libsequence
+import numpy as np
+
+
+class testPackedVariantMatrix(unittest.TestCase):
+    @classmethod
+    def setUpClass(self):
+        np.random.seed(42)
+        # More than 64 samples, so that rows span several words
+        self.data = np.random.choice([0, 1], size=(50, 70)).astype(np.int8)
+        self.pos = np.arange(50, dtype=np.float64)
+        self.vm = libsequence.VariantMatrix(self.data, self.pos)
+        self.p = libsequence.PackedVariantMatrix(self.vm)
+
+    def testRoundTrip(self):
+        self.assertEqual(self.p.nsites, 50)
+        self.assertEqual(self.p.nsam, 70)
+        self.assertFalse(self.p.has_missing_data)
+        self.assertTrue(np.array_equal(self.p.positions, self.pos))
+        self.assertTrue(np.array_equal(
+            self.p.to_VariantMatrix().data, self.data))
+
+    def testCountAlleles(self):
+        self.assertTrue(np.array_equal(np.array(self.p.count_alleles()),
+                                       np.array(self.vm.count_alleles())))
+
+    def testKernelsMatchVariantMatrix(self):
+        self.assertEqual(list(libsequence.difference_matrix(self.p)),
+                         list(libsequence.difference_matrix(self.vm)))
+        self.assertEqual(list(libsequence.label_haplotypes(self.p)),
+                         list(libsequence.label_haplotypes(self.vm)))
+        self.assertEqual(libsequence.rmin(self.p), libsequence.rmin(self.vm))
+
+    def testLD(self):
+        ld = libsequence.ld(self.p, maxd=3)
+        self.assertTrue(np.all(ld['j'] - ld['i'] < 3))
+        x = self.data[int(ld['i'][0])]
+        y = self.data[int(ld['j'][0])]
+        self.assertAlmostEqual(ld['rsq'][0], np.corrcoef(x, y)[0, 1]**2)
+
+    def testMissingData(self):
+        d = self.data.copy()
+        d[0, 0] = -1
+        d[1, 1] = -1
+        p = libsequence.PackedVariantMatrix(d, self.pos)
+        self.assertTrue(p.has_missing_data)
+        ac = np.array(p.count_alleles())
+        self.assertEqual(ac[0].sum(), 69)
+        labels = libsequence.label_haplotypes(p)
+        self.assertEqual(labels[0], -1)
+        self.assertEqual(labels[1], -1)
+        dm = libsequence.difference_matrix(p)
+        self.assertEqual(dm[0], np.count_nonzero(d[2:, 0] != d[2:, 1]))
+
+    def testInvalidStates(self):
+        d = self.data.copy()
+        d[0, 0] = 2
+        with self.assertRaises(ValueError):
+            libsequence.PackedVariantMatrix(d, self.pos)
+
+
+if __name__ == "__main__":
+    unittest.main()
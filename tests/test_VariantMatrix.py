@@ -1,3 +1,5 @@
+import os
+import sys
 import unittest
 import libsequence
 import numpy as np
@@ -61,6 +63,37 @@ class testVariantMatrix(unittest.TestCase):
         self.assertEqual(up.nsam, self.m.nsam)
         self.assertEqual(up.nsites, self.m.nsites)
 
+    def testPickleProtocols(self):
+        import pickle
+        for protocol in range(2, pickle.HIGHEST_PROTOCOL + 1):
+            up = pickle.loads(pickle.dumps(self.m, protocol))
+            self.assertTrue(np.array_equal(up.data, self.m.data))
+            self.assertTrue(np.array_equal(up.positions, self.m.positions))
+
+    def testPickleOutOfBand(self):
+        import pickle
+        if pickle.HIGHEST_PROTOCOL < 5:
+            self.skipTest("pickle protocol 5 not available")
+        buffers = []
+        p = pickle.dumps(self.m, 5, buffer_callback=buffers.append)
+        self.assertTrue(len(buffers) > 0)
+        up = pickle.loads(p, buffers=buffers)
+        self.assertTrue(np.array_equal(up.data, self.m.data))
+        self.assertTrue(np.array_equal(up.positions, self.m.positions))
+        # Within a process, the buffers refer to the data of
+        # self.m, which must be copied rather than shared.
+        self.assertFalse(np.shares_memory(up.data, self.m.data))
+        libsequence.filter_sites(up, lambda x: True)
+        self.assertEqual(up.nsites, 0)
+        self.assertEqual(self.m.nsites, 2)
+        self.assertTrue(np.array_equal(self.m.data, np.array(
+            self.data).reshape(self.m.nsites, self.m.nsam)))
+
+    def testUnpickleOldState(self):
+        m = libsequence.VariantMatrix.__new__(libsequence.VariantMatrix)
+        m.__setstate__((self.data, self.pos))
+        self.assertTrue(np.array_equal(m.data, self.m.data))
+
 
 class testColumnViews(unittest.TestCase):
     @classmethod
@@ -87,6 +120,57 @@ class testColumnViews(unittest.TestCase):
             self.assertTrue(np.array_equal(s, d[:, i]))
 
 
+class testNumpyViews(unittest.TestCase):
+    def setUp(self):
+        self.d = np.arange(24, dtype=np.int8).reshape(4, 6)
+        self.m = libsequence.VariantMatrix(self.d, np.arange(4) / 4.)
+
+    def testRowAndColumnViews(self):
+        for i in range(self.m.nsites):
+            a = self.m.site(i).numpy()
+            self.assertTrue(np.array_equal(a, self.d[i]))
+            self.assertFalse(a.flags.writeable)
+            self.assertTrue(np.array_equal(np.array(self.m.site(i)), self.d[i]))
+        for i in range(self.m.nsam):
+            a = self.m.sample(i).numpy()
+            self.assertTrue(np.array_equal(a, self.d[:, i]))
+            self.assertTrue(np.shares_memory(a, self.m.data))
+            self.assertTrue(np.array_equal(np.array(self.m.sample(i)), self.d[:, i]))
+
+    def testReadOnlyBuffers(self):
+        for v in (self.m.site(1), self.m.sample(2)):
+            b = memoryview(v)
+            self.assertTrue(b.readonly)
+            with self.assertRaises(TypeError):
+                b[0] = 1
+        self.assertTrue(np.array_equal(self.m.data, self.d))
+
+    def testViewKeepsMatrixAlive(self):
+        m = libsequence.VariantMatrix(self.d, np.arange(4) / 4.)
+        a = m.sample(2).numpy()
+        del m
+        self.assertTrue(np.array_equal(a, self.d[:, 2]))
+
+    def testBatchSlices(self):
+        for s in [slice(1, 3), slice(None, None, 2), slice(None, None, -1)]:
+            a = self.m.sites(s)
+            self.assertTrue(np.array_equal(a, self.d[s]))
+            self.assertTrue(np.shares_memory(a, self.m.data))
+            self.assertFalse(a.flags.writeable)
+            a = self.m.samples(s)
+            self.assertTrue(np.array_equal(a, self.d[:, s]))
+            self.assertTrue(np.shares_memory(a, self.m.data))
+
+    def testBatchIndexes(self):
+        for nthreads in [1, 2]:
+            self.assertTrue(np.array_equal(self.m.sites([3, 0], nthreads=nthreads),
+                                           self.d[[3, 0]]))
+            self.assertTrue(np.array_equal(self.m.samples([5, 1, 1], nthreads=nthreads),
+                                           self.d[:, [5, 1, 1]]))
+        with self.assertRaises(IndexError):
+            self.m.samples([6])
+
+
 class testCreationFromNumpy(unittest.TestCase):
     @classmethod
     def setUp(self):
@@ -167,5 +251,273 @@ class testDataFromMsprime(unittest.TestCase):
             pass
 
 
+class testTreeSequenceChunks(unittest.TestCase):
+    @classmethod
+    def setUpClass(self):
+        try:
+            import msprime
+            self.ts = msprime.simulate(
+                20, mutation_rate=50, recombination_rate=20, random_seed=101)
+            self.vm = libsequence.VariantMatrix.from_TreeSequence(self.ts)
+        except ImportError:
+            self.ts = None
+
+    def setUp(self):
+        if self.ts is None:
+            self.skipTest("msprime not available")
+
+    def testChunksBySite(self):
+        chunks = [i for i in
+                  libsequence.VariantMatrix.from_TreeSequence_chunks(
+                      self.ts, nsites=17)]
+        self.assertEqual(len(chunks), (self.vm.nsites + 16) // 17)
+        self.assertTrue(np.array_equal(
+            np.concatenate([i.data for i in chunks]), self.vm.data))
+        self.assertTrue(np.array_equal(
+            np.concatenate([i.positions for i in chunks]), self.vm.positions))
+
+    def testChunksByInterval(self):
+        chunks = [i for i in
+                  libsequence.VariantMatrix.from_TreeSequence_chunks(
+                      self.ts, interval_length=0.1)]
+        self.assertEqual(len(chunks), 10)
+        for i, c in enumerate(chunks):
+            self.assertTrue(np.all(c.positions >= i * 0.1))
+            self.assertTrue(np.all(c.positions < (i + 1) * 0.1))
+        self.assertTrue(np.array_equal(
+            np.concatenate([i.data for i in chunks]), self.vm.data))
+
+    def testSampleSubset(self):
+        samples = [3, 1, 7]
+        chunks = [i for i in
+                  libsequence.VariantMatrix.from_TreeSequence_chunks(
+                      self.ts, nsites=1000, samples=samples)]
+        self.assertTrue(np.array_equal(
+            np.concatenate([i.data for i in chunks]),
+            self.vm.data[:, samples]))
+
+    def testInvalidArguments(self):
+        with self.assertRaises(ValueError):
+            libsequence.VariantMatrix.from_TreeSequence_chunks(
+                self.ts, nsites=10, interval_length=0.1)
+        with self.assertRaises(ValueError):
+            libsequence.VariantMatrix.from_TreeSequence_chunks(
+                self.ts, nsites=0)
+
+
+class testStateCountMatrix(unittest.TestCase):
+    def setUp(self):
+        np.random.seed(202)
+        self.data = np.random.randint(-1, 4, 5000).astype(np.int8).reshape(500, 10)
+        self.m = libsequence.VariantMatrix(self.data, np.arange(500) / 500.)
+
+    def testCounts(self):
+        for nthreads in [1, 4]:
+            counts, refstates = libsequence.state_count_matrix(
+                self.m, nthreads=nthreads)
+            self.assertEqual(counts.shape, (500, self.data.max() + 1))
+            for k in range(counts.shape[1]):
+                self.assertTrue(np.array_equal(counts[:, k],
+                                               (self.data == k).sum(axis=1)))
+            self.assertTrue(np.all(refstates == libsequence.VariantMatrix.mask))
+
+    def testMatchesProcessVariableSites(self):
+        rs = np.random.randint(0, 2, 500).astype(np.int8)
+        counts, refstates = libsequence.state_count_matrix(self.m, rs)
+        self.assertTrue(np.array_equal(refstates, rs))
+        sc = libsequence.process_variable_sites(self.m, rs.tolist())
+        for i, c in enumerate(sc):
+            self.assertEqual(c.refstate, rs[i])
+            k = counts.shape[1]
+            self.assertTrue(np.array_equal(np.array(c.counts)[:k], counts[i]))
+
+    def testSingleRefstate(self):
+        counts, refstates = libsequence.state_count_matrix(self.m, 1)
+        self.assertTrue(np.all(refstates == 1))
+
+
+class testSiteMaskAndSelect(unittest.TestCase):
+    def setUp(self):
+        np.random.seed(101)
+        self.data = np.random.randint(-1, 3, 2000).astype(np.int8).reshape(200, 10)
+        self.pos = np.arange(200) / 200.
+        self.m = libsequence.VariantMatrix(self.data, self.pos)
+
+    def python_mask(self, min_maf, max_missing, biallelic):
+        rv = []
+        for row in self.data:
+            ok = row[row >= 0]
+            counts = np.sort(np.bincount(ok, minlength=3))[::-1] if len(ok) else np.zeros(3)
+            maf = counts[1] / len(ok) if len(ok) else 0.
+            missing = np.count_nonzero(row < 0) / len(row)
+            rv.append(maf >= min_maf and missing <= max_missing and
+                      not (biallelic and np.count_nonzero(counts) > 2))
+        return np.array(rv)
+
+    def testSiteMask(self):
+        for nthreads in [1, 4]:
+            mask = libsequence.site_mask(self.m, min_maf=0.2, max_missing=0.3,
+                                         biallelic=True, nthreads=nthreads)
+            self.assertTrue(np.array_equal(mask,
+                                           self.python_mask(0.2, 0.3, True)))
+
+    def testPositionRange(self):
+        mask = libsequence.site_mask(self.m, start=0.25, stop=0.5)
+        self.assertTrue(np.array_equal(mask, (self.pos >= 0.25) & (self.pos <= 0.5)))
+
+    def testSelectRange(self):
+        mask = libsequence.site_mask(self.m, start=0.25, stop=0.5)
+        m2 = self.m.select(sites=mask)
+        self.assertTrue(np.array_equal(m2.data, self.data[mask]))
+        self.assertTrue(np.array_equal(m2.positions, self.pos[mask]))
+        self.assertFalse(np.shares_memory(m2.data, self.m.data))
+        libsequence.filter_sites(m2, lambda x: True)
+        self.assertTrue(np.array_equal(self.m.data, self.data))
+
+    def testSelectCopy(self):
+        mask = libsequence.site_mask(self.m, min_maf=0.2)
+        samples = [0, 3, 4, 9]
+        for nthreads in [1, 3]:
+            m2 = self.m.select(sites=mask, samples=samples, nthreads=nthreads)
+            self.assertTrue(np.array_equal(m2.data, self.data[mask][:, samples]))
+            self.assertTrue(np.array_equal(m2.positions, self.pos[mask]))
+        m2 = self.m.select(sites=np.where(mask)[0])
+        self.assertTrue(np.array_equal(m2.data, self.data[mask]))
+
+    def testSelectInvalid(self):
+        with self.assertRaises(ValueError):
+            self.m.select(sites=np.ones(3, dtype=bool))
+        with self.assertRaises(ValueError):
+            self.m.select(samples=[3, 1])
+
+
+class testVariantMatrixFile(unittest.TestCase):
+    def setUp(self):
+        import tempfile
+        self.tmpdir = tempfile.mkdtemp()
+        self.fname = os.path.join(self.tmpdir, "vm.bin")
+        np.random.seed(42)
+        self.data = np.random.randint(-1, 3, 300).astype(np.int8).reshape(30, 10)
+        self.pos = np.sort(np.random.uniform(size=30))
+        self.m = libsequence.VariantMatrix(self.data, self.pos)
+
+    def tearDown(self):
+        import shutil
+        shutil.rmtree(self.tmpdir)
+
+    def testRoundTrip(self):
+        self.m.to_file(self.fname)
+        m = libsequence.VariantMatrix.from_file(self.fname)
+        self.assertEqual(m.nsites, self.m.nsites)
+        self.assertEqual(m.nsam, self.m.nsam)
+        self.assertTrue(np.array_equal(m.data, self.data))
+        self.assertTrue(np.array_equal(m.positions, self.pos))
+        self.assertTrue(np.array_equal(np.array(m.count_alleles()),
+                                       np.array(self.m.count_alleles())))
+
+    def testEmpty(self):
+        m = libsequence.VariantMatrix(np.zeros((0, 4), dtype=np.int8), [])
+        m.to_file(self.fname)
+        m = libsequence.VariantMatrix.from_file(self.fname)
+        self.assertEqual(m.nsites, 0)
+        self.assertEqual(m.nsam, 4)
+
+    def testInvalidFile(self):
+        with open(self.fname, 'wb') as f:
+            f.write(b"not a VariantMatrix")
+        with self.assertRaises(ValueError):
+            libsequence.VariantMatrix.from_file(self.fname)
+
+    def testTruncatedFile(self):
+        self.m.to_file(self.fname)
+        size = os.path.getsize(self.fname)
+        with open(self.fname, 'r+b') as f:
+            f.truncate(size - 1)
+        with self.assertRaises(ValueError):
+            libsequence.VariantMatrix.from_file(self.fname)
+
+    @unittest.skipUnless(os.path.exists('/proc/meminfo'),
+                         "requires Linux memory accounting")
+    def testLargerThanMemory(self):
+        # A sparse file larger than RAM plus swap.  A writable
+        # private mapping of it is refused under the default
+        # overcommit policy, but a read-only one is not.
+        import struct
+        meminfo = {}
+        with open('/proc/meminfo') as f:
+            for line in f:
+                name, value = line.split(':')
+                meminfo[name] = int(value.split()[0]) * 1024
+        size = meminfo['MemTotal'] + meminfo['SwapTotal'] + 2**30
+        nsam = 1000
+        nsites = size // nsam
+        offset = (64 + 8 * nsites + 4095) // 4096 * 4096
+        header = struct.pack('=8sIIQQQQb15x', b'LSEQVMF\0', 0x01020304, 1,
+                             nsites, nsam, 64, offset, 1)
+        if sys.maxsize < size:
+            self.skipTest("requires a 64-bit address space")
+        try:
+            with open(self.fname, 'wb') as f:
+                f.write(header)
+                f.truncate(offset + nsites * nsam)
+        except (OSError, IOError):
+            self.skipTest("file system does not allow a file this large")
+        if os.stat(self.fname).st_blocks * 512 >= 2**30:
+            self.skipTest("file system does not support sparse files")
+        try:
+            m = libsequence.VariantMatrix.from_file(self.fname)
+        except RuntimeError:
+            self.skipTest("address space too small to map the file")
+        self.assertEqual(m.nsites, nsites)
+        self.assertEqual(m.data[nsites - 1, nsam - 1], 0)
+        del m
+
+    def testOverwriteMapped(self):
+        self.m.to_file(self.fname)
+        m = libsequence.VariantMatrix.from_file(self.fname)
+        # Writing a mapped matrix to its own file, or other
+        # data to it, leaves the mapping intact.
+        m.to_file(self.fname)
+        d = libsequence.VariantMatrix(self.data[:2].copy(), self.pos[:2])
+        d.to_file(self.fname)
+        self.assertTrue(np.array_equal(m.data, self.data))
+        self.assertTrue(np.array_equal(m.positions, self.pos))
+        self.assertEqual(libsequence.VariantMatrix.from_file(self.fname).nsites,
+                         2)
+        self.assertEqual(os.listdir(self.tmpdir), ["vm.bin"])
+
+    def testSelectShared(self):
+        self.m.to_file(self.fname)
+        m = libsequence.VariantMatrix.from_file(self.fname)
+        mask = libsequence.site_mask(m, start=self.pos[5], stop=self.pos[20])
+        m2 = m.select(sites=mask)
+        self.assertTrue(np.shares_memory(m2.data, m.data))
+        self.assertTrue(np.array_equal(m2.data, self.data[5:21]))
+        # Modifying either matrix copies its data
+        # rather than writing to the file.
+        self.assertEqual(libsequence.filter_sites(m, lambda x: True), 30)
+        self.assertTrue(np.array_equal(m2.data, self.data[5:21]))
+        self.assertTrue(np.array_equal(m2.positions, self.pos[5:21]))
+        removed = [False]
+
+        def remove_first(x):
+            rv, removed[0] = not removed[0], True
+            return rv
+        self.assertEqual(libsequence.filter_sites(m2, remove_first), 1)
+        self.assertTrue(np.array_equal(m2.data, self.data[6:21]))
+        del m, m2
+        m = libsequence.VariantMatrix.from_file(self.fname)
+        self.assertTrue(np.array_equal(m.data, self.data))
+
+    def testModifiedCopy(self):
+        self.m.to_file(self.fname)
+        m = libsequence.VariantMatrix.from_file(self.fname)
+        self.assertEqual(libsequence.filter_sites(m, lambda x: True),
+                         self.m.nsites)
+        self.assertEqual(m.nsites, 0)
+        m = libsequence.VariantMatrix.from_file(self.fname)
+        self.assertTrue(np.array_equal(m.data, self.data))
+
+
 if __name__ == "__main__":
     unittest.main()
@@ -1,5 +1,6 @@
 import unittest
 import libsequence
+import numpy as np
 
 class test_Fst(unittest.TestCase):
     @classmethod
@@ -44,6 +45,98 @@ class test_Fst(unittest.TestCase):
             f = libsequence.Fst(self.d,[2,2])
             #2 is out of range.
             sh = f.priv(2,1)
-        
+
+
+def site_pi(x):
+    n = len(x)
+    c = np.bincount(x)
+    return 1. - (c * (c - 1)).sum() / (n * (n - 1.))
+
+
+def hudson_fst(ga, gb):
+    # 1 - mean within-population diversity / divergence, summed
+    # over the sites where both populations have n >= 2
+    within, between = 0., 0.
+    for x, y in zip(ga, gb):
+        x, y = x[x >= 0], y[y >= 0]
+        if len(x) < 2 or len(y) < 2:
+            continue
+        within += (site_pi(x) + site_pi(y)) / 2.
+        between += (x[:, None] != y[None, :]).mean()
+    return 1. - within / between
+
+
+class testDivergence(unittest.TestCase):
+    @classmethod
+    def setUpClass(self):
+        np.random.seed(42)
+        self.data = np.random.choice([-1, 0, 1, 2], p=[0.05, 0.5, 0.3, 0.15],
+                                     size=(200, 30)).astype(np.int8)
+        self.pos = np.sort(np.random.uniform(0, 10, 200))
+        self.vm = libsequence.VariantMatrix(self.data, self.pos)
+        self.sets = [np.arange(0, 10), np.arange(10, 18), [25, 20, 29]]
+
+    def testMatchesFst(self):
+        g = np.array([[0, 0, 1, 1], [1, 1, 0, 0], [0, 1, 0, 0],
+                      [1, 1, 0, 1], [0, 1, 0, 1]], dtype=np.int8)
+        vm = libsequence.VariantMatrix(g, [0.1, 0.2, 0.3, 0.4, 0.5])
+        d = libsequence.divergence(vm, [[0, 1], [2, 3]])
+        self.assertEqual(d['shared'][0, 1], 1)
+        self.assertEqual(d['fixed'][0, 1], 2)
+        self.assertEqual(d['private'][0, 1], 1)
+        self.assertEqual(d['private'][1, 0], 1)
+        self.assertAlmostEqual(d['fst'][0, 1],
+                               hudson_fst(g[:, [0, 1]], g[:, [2, 3]]))
+
+    def testMatchesPairwiseDifferences(self):
+        d = libsequence.divergence(self.vm, self.sets, nthreads=3)
+        for i, a in enumerate(self.sets):
+            ga = self.data[:, a]
+            vm = libsequence.VariantMatrix(np.ascontiguousarray(ga), self.pos)
+            self.assertAlmostEqual(
+                d['pi'][i], libsequence.thetapi(vm.count_alleles()))
+            for j, b in enumerate(self.sets):
+                if i == j:
+                    continue
+                gb = self.data[:, b]
+                dxy = 0.
+                for x, y in zip(ga, gb):
+                    x, y = x[x >= 0], y[y >= 0]
+                    diff = x[:, None] != y[None, :]
+                    if diff.size:
+                        dxy += diff.mean()
+                self.assertAlmostEqual(d['dxy'][i, j], dxy)
+                self.assertAlmostEqual(d['fst'][i, j], hudson_fst(ga, gb))
+        self.assertTrue(np.array_equal(d['fst'], d['fst'].T))
+
+    def testAlleleCountMatrices(self):
+        d = libsequence.divergence(self.vm, self.sets)
+        acms = [libsequence.VariantMatrix(
+            np.ascontiguousarray(self.data[:, i]), self.pos).count_alleles()
+            for i in self.sets]
+        a = libsequence.divergence(acms, nthreads=2)
+        for k in d:
+            self.assertTrue(np.allclose(d[k], a[k], equal_nan=True))
+
+    def testWindows(self):
+        w = libsequence.windowed_divergence(self.vm, self.sets, 2., 1.,
+                                            nthreads=4)
+        self.assertEqual(w['pi'].shape, (len(w['start']), 3))
+        self.assertEqual(w['dxy'].shape, (len(w['start']), 3, 3))
+        for i, (start, stop) in enumerate(zip(w['start'], w['stop'])):
+            mask = (self.pos >= start) & (self.pos < stop)
+            if not mask.any():
+                continue
+            d = libsequence.divergence(self.vm.select(sites=mask), self.sets)
+            for k in d:
+                self.assertTrue(np.allclose(d[k], w[k][i], equal_nan=True))
+
+    def testExceptions(self):
+        with self.assertRaises(IndexError):
+            libsequence.divergence(self.vm, [[0, 30]])
+        with self.assertRaises(ValueError):
+            libsequence.divergence(self.vm, [[0, 0]])
+
+
 if __name__ == '__main__':
     unittest.main()
@@ -1,5 +1,6 @@
 import unittest
 import pickle
+import numpy as np
 import libsequence
 
 class test_polytable(unittest.TestCase):
@@ -102,6 +103,39 @@ class test_functions_SimData(unittest.TestCase):
         y=libsequence.removeGaps(x,gapchar='-')
         pos = y.pos()
         self.assertEqual(pos,[0.1])
-                
+
+
+class test_variant_matrix_conversion(unittest.TestCase):
+    @classmethod
+    def setUpClass(self):
+        np.random.seed(42)
+        # Larger than one tile in both dimensions
+        self.data = np.random.choice([0, 1], size=(150, 70)).astype(np.int8)
+        self.pos = np.arange(150, dtype=np.float64) / 150.
+        self.vm = libsequence.VariantMatrix(self.data, self.pos)
+
+    def testRoundTrip(self):
+        d = libsequence.SimData.from_variant_matrix(self.vm, nthreads=2)
+        self.assertEqual(d.size(), 70)
+        self.assertEqual(d.numsites(), 150)
+        vm = libsequence.VariantMatrix.from_polytable(d, nthreads=3)
+        self.assertTrue(np.array_equal(np.array(vm.data), self.data))
+        self.assertTrue(np.array_equal(np.array(vm.positions), self.pos))
+
+    def testMatchesStrings(self):
+        d = libsequence.SimData([(0.1, "0011"), (0.2, "1N00")])
+        vm = libsequence.VariantMatrix.from_polytable(d)
+        self.assertEqual(vm.data.tolist(), [[0, 0, 1, 1], [1, -1, 0, 0]])
+        x = libsequence.SimData.from_variant_matrix(vm)
+        self.assertEqual(x.data(), d.data())
+
+    def testNucleotides(self):
+        p = libsequence.PolySites([(0.1, "ACGT"), (0.2, "aa-N")])
+        vm = libsequence.VariantMatrix.from_polytable(p)
+        self.assertEqual(vm.data.tolist(), [[0, 1, 2, 3], [0, 0, -1, -1]])
+        with self.assertRaises(ValueError):
+            libsequence.SimData.from_variant_matrix(vm)
+
+
 if __name__ == '__main__':
     unittest.main()
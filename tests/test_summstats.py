@@ -9,6 +9,8 @@ class test_nSL(unittest.TestCase):
              (0.5,"01010101"),(0.6,"00001111")
              ]
         self.x = libsequence.SimData(d)
+        self.positions = [i[0] for i in d]
+        self.haplotypes = [i[1] for i in d]
         
     #API check
     def test_nSLiHS(self):
@@ -18,6 +20,43 @@ class test_nSL(unittest.TestCase):
         gmap= {0.1:0.1,0.3:0.3,0.5:0.5,0.2:0.2,0.4:0.4,0.6:0.6}
         stats = libsequence.nSLiHS(self.x,gmap=gmap)
         self.assertEqual(len(stats),self.x.numsites())
+    def test_nSLiHS_array_gmap(self):
+        import numpy as np
+        gmap= {0.1:0.1,0.3:0.3,0.5:0.5,0.2:0.2,0.4:0.4,0.6:0.6}
+        a = libsequence.nSLiHS(self.x,gmap=gmap)
+        b = libsequence.nSLiHS(self.x,gmap=(np.array([0.0, 1.0]),
+                                            np.array([0.0, 1.0])),
+                               nthreads=2)
+        self.assertTrue(np.array_equal(a['nsl'], b['nsl'], equal_nan=True))
+        self.assertTrue(np.allclose(a['ihs'], b['ihs'], equal_nan=True))
+        self.assertEqual(list(b['core_count']), [4, 7, 4, 5, 4, 4])
+    def libsequence_nsl(self):
+        # nSL and iHS from libsequence, for all sites
+        import numpy as np
+        g = np.array([[int(c) for c in h] for h in self.haplotypes],
+                     dtype=np.int8).T
+        vm = libsequence.VariantMatrix(np.ascontiguousarray(g),
+                                       np.array(self.positions))
+        return np.array(libsequence.nsl(vm, 0)), g
+    def test_nSLiHS_matches_libsequence(self):
+        import numpy as np
+        e, g = self.libsequence_nsl()
+        for gmap in (None, {p: 2. * p for p in self.positions},
+                     (np.array([0.0, 1.0]), np.array([0.0, 2.0]))):
+            a = libsequence.nSLiHS(self.x, gmap=gmap, nthreads=2)
+            self.assertTrue(np.allclose(a['nsl'], e['nsl'], equal_nan=True))
+            # iHS is a log ratio, so it does not change when
+            # all distances are doubled.
+            self.assertTrue(np.allclose(a['ihs'], e['ihs'], equal_nan=True))
+            self.assertTrue(np.array_equal(a['core_count'], g.sum(axis=1)))
+        a = libsequence.nSLiHS(self.x, core_snps=[1, 3])
+        self.assertTrue(np.allclose(a['nsl'], e['nsl'][[1, 3]],
+                                    equal_nan=True))
+        self.assertEqual(list(a['core_count']), [7, 5])
+    def test_nSLiHS_incomplete_gmap(self):
+        gmap = {p: p for p in self.positions[:-1]}
+        with self.assertRaises(ValueError):
+            libsequence.nSLiHS(self.x, core_snps=[0], gmap=gmap)
     def test_expected_polymorphism_use_case(self):
         p = libsequence.PolySIM(self.x)
     def test_odd_polymorphism_use_case(self):
@@ -25,6 +64,412 @@ class test_nSL(unittest.TestCase):
     def test_classic_stats(self):
         p = libsequence.PolySIM(self.x)
         hp = p.hprime()
+
+
+class test_ThreadedStats(unittest.TestCase):
+    @classmethod
+    def setUpClass(self):
+        import msprime
+        ts = msprime.simulate(20, mutation_rate=25, random_seed=42)
+        vm = libsequence.VariantMatrix.from_TreeSequence(ts)
+        self.windows = [vm.window(i / 8., (i + 1) / 8.) for i in range(8)]
+
+    def test_threads_match_serial(self):
+        from concurrent.futures import ThreadPoolExecutor
+
+        def f(vm):
+            ac = vm.count_alleles()
+            return (libsequence.thetapi(ac), libsequence.tajd(ac),
+                    libsequence.rmin(vm))
+
+        serial = [f(i) for i in self.windows]
+        with ThreadPoolExecutor(4) as e:
+            threaded = list(e.map(f, self.windows))
+        self.assertEqual(serial, threaded)
+
+
+class test_SummaryStatistics(unittest.TestCase):
+    @classmethod
+    def setUpClass(self):
+        import msprime
+        ts = msprime.simulate(20, mutation_rate=25, random_seed=42)
+        vm = libsequence.VariantMatrix.from_TreeSequence(ts)
+        self.ac = vm.count_alleles()
+
+    def test_matches_individual_functions(self):
+        s = libsequence.summary_statistics(self.ac, ancestral_states=0)
+        self.assertEqual(len(s), 1)
+        self.assertAlmostEqual(s['thetapi'][0], libsequence.thetapi(self.ac))
+        self.assertAlmostEqual(s['thetaw'][0], libsequence.thetaw(self.ac))
+        self.assertAlmostEqual(s['tajd'][0], libsequence.tajd(self.ac))
+        self.assertAlmostEqual(s['faywuh'][0],
+                               libsequence.faywuh(self.ac, 0))
+        self.assertAlmostEqual(s['hprime'][0],
+                               libsequence.hprime(self.ac, 0))
+        self.assertEqual(s['nvariable_sites'][0],
+                         libsequence.nvariable_sites(self.ac))
+        self.assertEqual(s['total_number_of_mutations'][0],
+                         libsequence.total_number_of_mutations(self.ac))
+
+    def test_subset_of_stats(self):
+        s = libsequence.summary_statistics(self.ac, ['tajd', 'thetapi'])
+        self.assertEqual(s.dtype.names, ('tajd', 'thetapi'))
+
+    def test_requires_ancestral_states(self):
+        with self.assertRaises(ValueError):
+            libsequence.summary_statistics(self.ac, ['hprime'])
+
+    def test_unknown_statistic(self):
+        with self.assertRaises(ValueError):
+            libsequence.summary_statistics(self.ac, ['not_a_stat'])
+
+    def test_missing_data(self):
+        # A sample that is missing at every site must not
+        # change any statistic.
+        import numpy as np
+        np.random.seed(42)
+        data = np.random.choice([0, 1], size=(50, 12)).astype(np.int8)
+        pos = np.arange(50) / 50.
+        missing = data.copy()
+        missing[:, 5] = -1
+        missing[::3, 7] = -1
+        complete = libsequence.VariantMatrix(np.delete(data, 5, axis=1), pos)
+        partial = libsequence.VariantMatrix(missing, pos)
+        ac = partial.count_alleles()
+        e = libsequence.summary_statistics(
+            libsequence.VariantMatrix(np.delete(missing, 5, axis=1),
+                                      pos).count_alleles(), ancestral_states=0)
+        s = libsequence.summary_statistics(ac, ancestral_states=0)
+        for name in s.dtype.names:
+            self.assertAlmostEqual(s[name][0], e[name][0])
+        c = libsequence.summary_statistics(complete.count_alleles(),
+                                           ['tajd'])
+        self.assertAlmostEqual(c['tajd'][0],
+                               libsequence.tajd(complete.count_alleles()))
+
+    def test_missing_data_matches_numpy(self):
+        # The per-site sample size varies, and some
+        # sites have more than one mutation.
+        import numpy as np
+        np.random.seed(101)
+        data = np.random.choice([-1, 0, 1, 2], p=[0.15, 0.5, 0.25, 0.1],
+                                size=(200, 20)).astype(np.int8)
+        pos = np.arange(200) / 200.
+        ac = libsequence.VariantMatrix(data, pos).count_alleles()
+        counts = np.array(ac)
+        n = counts.sum(axis=1)
+        self.assertTrue(len(np.unique(n)) > 3)
+        D, H = numpy_tajd_hprime(counts, 0)
+        s = libsequence.summary_statistics(ac, ['tajd', 'hprime'],
+                                           ancestral_states=0)
+        self.assertAlmostEqual(s['tajd'][0], D)
+        self.assertAlmostEqual(s['hprime'][0], H)
+        self.assertAlmostEqual(libsequence.tajd(ac.view()), D)
+        self.assertAlmostEqual(libsequence.hprime(ac.view(), 0), H)
+        # The functions of libsequence use the sample size
+        # of the matrix at every site.
+        self.assertNotAlmostEqual(libsequence.tajd(ac), D)
+
+    def test_complete_data_matches_libsequence(self):
+        # Without missing data, the kernel gives the values of
+        # the functions of libsequence.
+        import numpy as np
+        np.random.seed(202)
+        data = np.random.choice([0, 1], p=[0.7, 0.3],
+                                size=(100, 15)).astype(np.int8)
+        ac = libsequence.VariantMatrix(data,
+                                       np.arange(100) / 100.).count_alleles()
+        s = libsequence.summary_statistics(ac, ancestral_states=0)
+        self.assertAlmostEqual(s['thetapi'][0], libsequence.thetapi(ac))
+        self.assertAlmostEqual(s['thetaw'][0], libsequence.thetaw(ac))
+        self.assertAlmostEqual(s['tajd'][0], libsequence.tajd(ac))
+        self.assertAlmostEqual(s['faywuh'][0], libsequence.faywuh(ac, 0))
+        self.assertAlmostEqual(s['hprime'][0], libsequence.hprime(ac, 0))
+        self.assertAlmostEqual(libsequence.tajd(ac.view()),
+                               libsequence.tajd(ac))
+        D, H = numpy_tajd_hprime(np.array(ac), 0)
+        self.assertAlmostEqual(D, libsequence.tajd(ac))
+        self.assertAlmostEqual(H, libsequence.hprime(ac, 0))
+
+
+def numpy_tajd_hprime(counts, refstate):
+    """
+    Tajima's D and H', with theta_W and the variance
+    constants of each site at its own sample size.
+    """
+    import numpy as np
+    n = counts.sum(axis=1).astype(np.float64)
+    m = (counts > 0).sum(axis=1) - 1.
+    keep = m > 0
+    counts, n, m = counts[keep], n[keep], m[keep]
+    i = np.arange(1, int(n.max()) + 1, dtype=np.float64)
+    a1 = np.array([(1. / i[:k - 1]).sum() for k in n.astype(int)])
+    a2 = np.array([(1. / i[:k - 1]**2).sum() for k in n.astype(int)])
+    a2n1 = np.array([(1. / i[:k]**2).sum() for k in n.astype(int)])
+    S = m.sum()
+    pi = (1. - (counts * (counts - 1.)).sum(axis=1) / (n * (n - 1.))).sum()
+    thetaw = (m / a1).sum()
+    derived = n - counts[:, refstate]
+    seg = (derived > 0) & (derived < n)
+    thetal = (derived[seg] / (n[seg] - 1.)).sum()
+
+    b1 = (n + 1.) / (3. * (n - 1.))
+    b2 = 2. * (n**2 + n + 3.) / (9. * n * (n - 1.))
+    c1 = b1 - 1. / a1
+    c2 = b2 - (n + 2.) / (a1 * n) + a2 / a1**2
+    e1 = (m * c1 / a1).sum()
+    e2 = (m * c2 / (a1**2 + a2)).sum()
+    D = (pi - thetaw) / np.sqrt(e1 + (S - 1.) * e2)
+
+    h1 = (m * (n - 2.) / (6. * (n - 1.)) / a1).sum()
+    h2 = (m * (18. * n**2 * (3. * n + 2.) * a2n1
+               - (88. * n**3 + 9. * n**2 - 13. * n + 6.))
+          / (9. * n * (n - 1.)**2) / (a1**2 + a2)).sum()
+    H = (pi - thetal) / np.sqrt(h1 + (S - 1.) * h2)
+    return D, H
+
+
+class test_ReplicateStatistics(unittest.TestCase):
+    @classmethod
+    def setUpClass(self):
+        import msprime
+        self.reps = [libsequence.VariantMatrix.from_TreeSequence(ts)
+                     for ts in msprime.simulate(10, mutation_rate=10,
+                                                random_seed=42,
+                                                num_replicates=20)]
+
+    def test_matches_summary_statistics(self):
+        import numpy as np
+        r = libsequence.replicate_statistics(self.reps, ancestral_state=0,
+                                             nthreads=3)
+        for i, vm in enumerate(self.reps):
+            e = libsequence.summary_statistics(vm.count_alleles(),
+                                               ancestral_states=0)
+            self.assertEqual(r.shape[1], len(e.dtype.names))
+            for j, name in enumerate(e.dtype.names):
+                self.assertTrue(np.isclose(r[i, j], e[name][0],
+                                           equal_nan=True))
+        c = libsequence.replicate_statistics(
+            [vm.count_alleles() for vm in self.reps], ancestral_state=0)
+        self.assertTrue(np.allclose(r, c, equal_nan=True))
+
+    def test_haplotype_statistics(self):
+        r = libsequence.replicate_statistics(
+            self.reps, ['number_of_haplotypes', 'haplotype_diversity', 'H12'])
+        for i, vm in enumerate(self.reps):
+            self.assertEqual(r[i, 0], libsequence.number_of_haplotypes(vm))
+            self.assertAlmostEqual(r[i, 1],
+                                   libsequence.haplotype_diversity(vm))
+            self.assertAlmostEqual(r[i, 2],
+                                   libsequence.garud_statistics(vm).H12)
+        with self.assertRaises(ValueError):
+            libsequence.replicate_statistics(
+                [vm.count_alleles() for vm in self.reps], ['H12'])
+
+    def test_packed(self):
+        import numpy as np
+        stats = ['thetapi', 'tajd', 'H1']
+        r = libsequence.replicate_statistics(self.reps, stats)
+        g = np.concatenate([np.array(vm.data).ravel() for vm in self.reps])
+        offsets = np.cumsum([0] + [vm.nsites * vm.nsam for vm in self.reps])
+        p = libsequence.packed_replicate_statistics(g, offsets, 10, stats,
+                                                    nthreads=2)
+        self.assertTrue(np.allclose(r, p, equal_nan=True))
+        with self.assertRaises(ValueError):
+            libsequence.packed_replicate_statistics(g, offsets, 0, stats)
+
+
+class test_DifferenceMatrix(unittest.TestCase):
+    @classmethod
+    def setUpClass(self):
+        import numpy as np
+        np.random.seed(101)
+        self.data = np.random.choice([0, 1, 2], size=(300, 150)).astype(np.int8)
+        self.data[::7, 3] = -1
+        self.data[:, 10] = self.data[:, 11]
+
+    def brute_force(self, data):
+        import numpy as np
+        n = data.shape[1]
+        rv = []
+        for i in range(n - 1):
+            for j in range(i + 1, n):
+                ok = (data[:, i] >= 0) & (data[:, j] >= 0)
+                rv.append(np.count_nonzero(data[ok, i] != data[ok, j]))
+        return np.array(rv)
+
+    def test_matches_brute_force(self):
+        import numpy as np
+        for data in (self.data, self.data % 2):
+            vm = libsequence.VariantMatrix(data, np.arange(data.shape[0]))
+            expected = self.brute_force(data)
+            for nthreads in (1, 4):
+                dm = libsequence.difference_matrix(vm, nthreads=nthreads)
+                self.assertTrue(np.array_equal(dm, expected))
+                d = libsequence.is_different_matrix(vm, nthreads=nthreads)
+                self.assertEqual(d.dtype, np.bool_)
+                self.assertTrue(np.array_equal(d, expected > 0))
+
+
+class test_OmegaMaxScan(unittest.TestCase):
+    @classmethod
+    def setUpClass(self):
+        import msprime
+        ts = msprime.simulate(20, mutation_rate=50, recombination_rate=10,
+                              random_seed=42)
+        self.vm = libsequence.VariantMatrix.from_TreeSequence(ts)
+
+    def test_single_window_matches_whole_matrix(self):
+        w = libsequence.omega_max_scan(self.vm, self.vm.nsites, 1)
+        self.assertEqual(len(w), 1)
+        o = libsequence.omega_max(self.vm)
+        self.assertEqual(w['omega_max'][0], o[0])
+        self.assertEqual(w['position'][0], o[1])
+
+    def test_windows_match_slices(self):
+        w = libsequence.omega_max_scan(self.vm, 50, 20, nthreads=3)
+        pos = self.vm.positions
+        for i in range(len(w)):
+            first = 20 * i
+            sub = libsequence.VariantMatrix(
+                self.vm.data[first:first + 50].copy(),
+                pos[first:first + 50].copy())
+            o = libsequence.omega_max(sub)
+            self.assertEqual(w['nsites'][i], sub.nsites)
+            self.assertAlmostEqual(w['omega_max'][i], o[0])
+            self.assertEqual(w['position'][i], o[1])
+        self.assertEqual(w['stop'][-1], pos[-1])
+
+
+class test_VariantMatrixLD(unittest.TestCase):
+    @classmethod
+    def setUpClass(self):
+        import msprime
+        ts = msprime.simulate(20, mutation_rate=50, recombination_rate=10,
+                              random_seed=42)
+        self.vm = libsequence.VariantMatrix.from_TreeSequence(ts)
+
+    def test_matches_brute_force(self):
+        import numpy as np
+        ld = libsequence.ld(self.vm, mincount=2, maxd=0.05, nthreads=3)
+        self.assertTrue(len(ld) > 0)
+        pos = np.array(self.vm.positions)
+        data = np.array(self.vm.data)
+        for k in range(0, len(ld), max(1, len(ld) // 50)):
+            i = np.searchsorted(pos, ld['i'][k])
+            j = np.searchsorted(pos, ld['j'][k])
+            self.assertTrue(pos[j] - pos[i] < 0.05)
+            r = np.corrcoef(data[i], data[j])[0, 1]
+            self.assertAlmostEqual(ld['rsq'][k], r * r)
+            p = data[i].mean()
+            q = data[j].mean()
+            D = (data[i] * data[j]).mean() - p * q
+            self.assertAlmostEqual(ld['D'][k], D)
+        p = libsequence.PackedVariantMatrix(self.vm)
+        pld = libsequence.ld(p, mincount=2, maxd=0.05)
+        self.assertTrue(np.array_equal(ld, pld))
+
+    def test_site_subset_and_matrix(self):
+        import numpy as np
+        sites = np.arange(0, self.vm.nsites, 3)
+        ld = libsequence.ld(self.vm, sites=sites)
+        m = libsequence.ld_matrix(self.vm, "rsq", sites=sites, nthreads=2)
+        self.assertEqual(m.shape, (len(sites), len(sites)))
+        self.assertTrue(np.allclose(m, m.T, equal_nan=True))
+        pos = np.array(self.vm.positions)[sites]
+        for k in range(0, len(ld), max(1, len(ld) // 50)):
+            a = np.searchsorted(pos, ld['i'][k])
+            b = np.searchsorted(pos, ld['j'][k])
+            self.assertAlmostEqual(m[a, b], ld['rsq'][k])
+        with self.assertRaises(ValueError):
+            libsequence.ld(self.vm, sites=[2, 1])
+
+    def test_unsorted_positions(self):
+        import numpy as np
+        data = np.array([[0, 1, 0, 1], [1, 1, 0, 0], [0, 1, 1, 0]],
+                        dtype=np.int8)
+        vm = libsequence.VariantMatrix(data, [0.3, 0.1, 0.2])
+        with self.assertRaises(ValueError):
+            libsequence.ld(vm, maxd=0.15)
+
+
+class test_nSLScan(unittest.TestCase):
+    @classmethod
+    def setUpClass(self):
+        import msprime
+        ts = msprime.simulate(30, mutation_rate=20, recombination_rate=20,
+                              random_seed=101)
+        self.vm = libsequence.VariantMatrix.from_TreeSequence(ts)
+
+    def assertResultsEqual(self, a, b):
+        import numpy as np
+        a = np.array(a)
+        b = np.array(b)
+        self.assertTrue(np.array_equal(a['core_count'], b['core_count']))
+        for f in ('nsl', 'ihs'):
+            self.assertTrue(np.allclose(a[f], b[f], equal_nan=True))
+
+    def test_matches_nsl(self):
+        scan = libsequence.nsl_scan(self.vm, 0, nthreads=3)
+        self.assertEqual(len(scan), self.vm.nsites)
+        self.assertResultsEqual(scan, libsequence.nsl(self.vm, 0))
+
+    def test_matches_nslx(self):
+        scan = libsequence.nsl_scan(self.vm, 0, x=3, nthreads=2)
+        self.assertResultsEqual(scan, libsequence.nslx(self.vm, 0, 3))
+
+    def test_matches_nsl_missing_data(self):
+        # Missing data, and states other than 0 and 1, which
+        # use the unpacked comparison of samples.
+        import numpy as np
+        np.random.seed(5)
+        data = np.array(self.vm.data)
+        pos = np.array(self.vm.positions)
+        data[np.random.random_sample(data.shape) < 0.05] = -1
+        vm = libsequence.VariantMatrix(data, pos)
+        self.assertResultsEqual(libsequence.nsl_scan(vm, 0, nthreads=2),
+                                libsequence.nsl(vm, 0))
+        self.assertResultsEqual(libsequence.nsl_scan(vm, 0, x=2),
+                                libsequence.nslx(vm, 0, 2))
+        data[np.random.random_sample(data.shape) < 0.02] = 2
+        vm = libsequence.VariantMatrix(data, pos)
+        self.assertResultsEqual(libsequence.nsl_scan(vm, 0, nthreads=2),
+                                libsequence.nsl(vm, 0))
+        self.assertResultsEqual(libsequence.nsl_scan(vm, 0, x=2),
+                                libsequence.nslx(vm, 0, 2))
+
+    def test_matches_nsl_without_flanking_differences(self):
+        # Samples 0 and 1 never differ, and samples 2 and 3
+        # differ only at the last site, so their haplotypes
+        # reach an end of the data at every core.
+        import numpy as np
+        data = np.array([[0, 0, 1, 1, 0, 1],
+                         [1, 1, 0, 0, 1, 0],
+                         [0, 0, 1, 1, 1, 0],
+                         [1, 1, 0, 0, 0, 1],
+                         [0, 0, 1, 1, 0, 0],
+                         [1, 1, 0, 1, 1, 0]], dtype=np.int8)
+        vm = libsequence.VariantMatrix(data, np.arange(6) / 6.)
+        self.assertResultsEqual(libsequence.nsl_scan(vm, 0),
+                                libsequence.nsl(vm, 0))
+        self.assertResultsEqual(libsequence.nsl_scan(vm, 0, x=1),
+                                libsequence.nslx(vm, 0, 1))
+
+    def test_threads(self):
+        self.assertResultsEqual(libsequence.nsl_scan(self.vm, 0),
+                                libsequence.nsl_scan(self.vm, 0, nthreads=4))
+
+    def test_genetic_map(self):
+        import numpy as np
+        # A uniform map scaling distances by 2 does not change iHS
+        gmap = (np.array([0.0, 1.0]), np.array([0.0, 2.0]))
+        self.assertResultsEqual(libsequence.nsl(self.vm, 0, gmap=gmap),
+                                libsequence.nsl_scan(self.vm, 0))
+        with self.assertRaises(ValueError):
+            libsequence.nsl(self.vm, 0, gmap=(np.array([1.0, 0.0]),
+                                              np.array([0.0, 1.0])))
+
+
 if __name__ == '__main__':
     unittest.main()
         
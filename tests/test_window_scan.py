@@ -0,0 +1,162 @@
+import unittest
+import msprime
+import numpy as np
+import libsequence
+
+
+def numpy_window_statistics(counts):
+    """
+    thetapi, theta_W, Tajima's D, and the number of variable
+    sites for a window, with the sample size of each site
+    being its number of non-missing genotypes.
+    """
+    n = counts.sum(axis=1)
+    m = (counts > 0).sum(axis=1) - 1.
+    keep = m > 0
+    counts, n, m = counts[keep], n[keep], m[keep]
+    if len(n) == 0:
+        return 0., 0., np.nan, 0
+    a1 = np.array([(1. / np.arange(1, k)).sum() for k in n.astype(int)])
+    a2 = np.array([(1. / np.arange(1, k)**2).sum() for k in n.astype(int)])
+    S = m.sum()
+    pi = (1. - (counts * (counts - 1.)).sum(axis=1) / (n * (n - 1.))).sum()
+    thetaw = (m / a1).sum()
+    b1 = (n + 1.) / (3. * (n - 1.))
+    b2 = 2. * (n**2 + n + 3.) / (9. * n * (n - 1.))
+    c1 = b1 - 1. / a1
+    c2 = b2 - (n + 2.) / (a1 * n) + a2 / a1**2
+    e1 = (m * c1 / a1).sum()
+    e2 = (m * c2 / (a1**2 + a2)).sum()
+    D = (pi - thetaw) / np.sqrt(e1 + (S - 1.) * e2)
+    return pi, thetaw, D, int(keep.sum())
+
+
+class testWindowedStatistics(unittest.TestCase):
+    @classmethod
+    def setUpClass(self):
+        self.ts = msprime.simulate(20, mutation_rate=50, random_seed=42)
+        self.vm = libsequence.VariantMatrix.from_TreeSequence(self.ts)
+
+    def testMatchesSlices(self):
+        stats = ['thetapi', 'thetaw', 'tajd', 'nvariable_sites']
+        w = libsequence.windowed_statistics(self.vm, 0.1, 0.05, stats,
+                                            nthreads=2)
+        ac = self.vm.count_alleles()
+        pos = np.array(self.vm.positions)
+        for i in w:
+            idx = np.where((pos >= i['start']) & (pos < i['stop']))[0]
+            self.assertEqual(i['nvariable_sites'], len(idx))
+            if len(idx) == 0:
+                continue
+            s = libsequence.summary_statistics(ac[idx.min():idx.max()+1],
+                                               stats)
+            for j in stats:
+                self.assertTrue(np.isclose(i[j], s[j][0], equal_nan=True))
+
+    def testNumberOfWindows(self):
+        # 0.9375 / 0.0625 == 15 exactly.
+        w = libsequence.windowed_statistics(self.vm, 0.1, 0.0625, start=0.,
+                                            stop=0.9375)
+        self.assertEqual(len(w), 16)
+        self.assertTrue(np.array_equal(w['start'], np.arange(16) * 0.0625))
+        # 19 * 0.05 > 0.95 in floating point.
+        w = libsequence.windowed_statistics(self.vm, 0.1, 0.05, start=0.,
+                                            stop=0.95)
+        self.assertEqual(len(w), 19)
+        self.assertTrue(np.all(w['start'] <= 0.95))
+
+    def testExactSteps(self):
+        data = np.zeros((100, 4), dtype=np.int8)
+        data[::3, 0] = 1
+        vm = libsequence.VariantMatrix(data, np.arange(100.))
+        w = libsequence.windowed_statistics(vm, 10., 5., ['nvariable_sites'],
+                                            start=20., stop=50.)
+        self.assertTrue(np.array_equal(w['start'], np.arange(20., 51., 5.)))
+        self.assertTrue(np.array_equal(w['stop'], w['start'] + 10.))
+        self.assertEqual(w['nvariable_sites'].tolist(),
+                         [sum(j % 3 == 0 for j in range(i, i + 10))
+                          for i in range(20, 51, 5)])
+        w = libsequence.windowed_statistics(vm, 10., 5., start=20.,
+                                            stop=np.nextafter(50., 0.))
+        self.assertEqual(len(w), 6)
+        w = libsequence.windowed_statistics(vm, 10., 5., start=50., stop=50.)
+        self.assertEqual(len(w), 1)
+
+    def testMissingDataMatchesNumpy(self):
+        # Each window is checked against sums over its sites,
+        # with the sample size of each site, rather than against
+        # summary_statistics, which shares the kernel.
+        np.random.seed(303)
+        data = np.random.choice([-1, 0, 1, 2], p=[0.15, 0.5, 0.25, 0.1],
+                                size=(300, 16)).astype(np.int8)
+        pos = np.sort(np.random.uniform(0., 1., 300))
+        vm = libsequence.VariantMatrix(data, pos)
+        stats = ['thetapi', 'thetaw', 'tajd', 'nvariable_sites']
+        w = libsequence.windowed_statistics(vm, 0.1, 0.03, stats,
+                                            nthreads=3)
+        counts = np.stack([(data == i).sum(axis=1) for i in range(3)],
+                          axis=1).astype(np.float64)
+        for i in w:
+            idx = (pos >= i['start']) & (pos < i['stop'])
+            pi, thetaw, D, S = numpy_window_statistics(counts[idx])
+            self.assertEqual(i['nvariable_sites'], S)
+            self.assertAlmostEqual(i['thetapi'], pi)
+            self.assertAlmostEqual(i['thetaw'], thetaw)
+            if np.isnan(D):
+                self.assertTrue(np.isnan(i['tajd']))
+            else:
+                self.assertAlmostEqual(i['tajd'], D)
+
+    def testThreadsAgree(self):
+        w1 = libsequence.windowed_statistics(self.vm, 0.1, 0.01,
+                                             ancestral_states=0)
+        w2 = libsequence.windowed_statistics(self.vm, 0.1, 0.01,
+                                             ancestral_states=0, nthreads=4)
+        for i in w1.dtype.names:
+            self.assertTrue(np.allclose(w1[i], w2[i], equal_nan=True))
+
+    def testInvalidWindows(self):
+        with self.assertRaises(ValueError):
+            libsequence.windowed_statistics(self.vm, 0., 0.05)
+        with self.assertRaises(ValueError):
+            libsequence.windowed_statistics(self.vm, 0.1, -1.)
+
+
+class testWindowedHaplotypeStatistics(unittest.TestCase):
+    @classmethod
+    def setUpClass(self):
+        self.ts = msprime.simulate(20, mutation_rate=50, recombination_rate=5,
+                                   random_seed=42)
+        self.vm = libsequence.VariantMatrix.from_TreeSequence(self.ts)
+
+    def testMatchesSlices(self):
+        w = libsequence.windowed_haplotype_statistics(self.vm, 0.1, 0.03,
+                                                      nthreads=2)
+        pos = np.array(self.vm.positions)
+        data = np.array(self.vm.data)
+        for i in w:
+            idx = np.where((pos >= i['start']) & (pos < i['stop']))[0]
+            if len(idx) == 0:
+                continue
+            sub = libsequence.VariantMatrix(data[idx].copy(), pos[idx].copy())
+            self.assertEqual(i['nsam'], 20)
+            self.assertEqual(i['nhaps'],
+                             libsequence.number_of_haplotypes(sub))
+            self.assertAlmostEqual(i['diversity'],
+                                   libsequence.haplotype_diversity(sub))
+            _, counts = np.unique(data[idx].T, axis=0, return_counts=True)
+            p = np.sort(counts / 20.)[::-1]
+            self.assertAlmostEqual(i['H1'], (p**2).sum())
+            self.assertAlmostEqual(i['H12'], (p**2).sum() + 2 * p[0] *
+                                   (p[1] if len(p) > 1 else 0.))
+
+    def testThreadsAgree(self):
+        w1 = libsequence.windowed_haplotype_statistics(self.vm, 0.2, 0.01)
+        w2 = libsequence.windowed_haplotype_statistics(self.vm, 0.2, 0.01,
+                                                       nthreads=3)
+        for i in w1.dtype.names:
+            self.assertTrue(np.allclose(w1[i], w2[i], equal_nan=True))
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -1,4 +1,5 @@
 import unittest
+import numpy as np
 import libsequence
 
 class test_SimData(unittest.TestCase):
@@ -61,6 +62,32 @@ class test_SimData(unittest.TestCase):
             i+=1
             self.assertEqual(ppwi,pp)
 
+    def testRanges(self):
+        w = libsequence.Windows(self.x,0.1,0.05,0,1)
+        pos = self.x.pos()
+        for i, r in enumerate(w.ranges):
+            self.assertEqual(w[i].pos(), pos[r.first:r.last])
+            self.assertEqual(r.nsites, len(w[i].pos()))
+        self.assertEqual(w[-1].pos(), w[len(w)-1].pos())
+        with self.assertRaises(IndexError):
+            w[len(w)]
+
+    def testSummaryStatistics(self):
+        stats = ['thetapi', 'thetaw', 'tajd', 'nvariable_sites', 'thetah']
+        w = libsequence.Windows(self.x,0.1,0.05,0,1)
+        s = w.summary_statistics(stats, nthreads=2)
+        self.assertEqual(len(s), len(w))
+        for i, r in enumerate(w.ranges):
+            self.assertEqual(s['nvariable_sites'][i], r.nsites)
+            if r.nsites == 0:
+                continue
+            vm = libsequence.VariantMatrix.from_polytable(w[i])
+            e = libsequence.summary_statistics(vm.count_alleles(), stats, 0)
+            for j in stats:
+                self.assertTrue(np.isclose(s[j][i], e[j][0], equal_nan=True))
+        sub = w.summary_statistics(stats, windows=[1, 3])
+        self.assertTrue(np.array_equal(sub['thetapi'], s['thetapi'][[1, 3]]))
+
     def testException1(self):
         ##Fail with window size of 0
         with self.assertRaises(RuntimeError):